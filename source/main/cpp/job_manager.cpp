@@ -86,6 +86,7 @@ namespace ncore
             channel   = m_buf[m_head].m_channel;
             job_fn    = m_buf[m_head].m_job_fn;
             job_data0 = m_buf[m_head].m_job_data0;
+            job_data1 = m_buf[m_head].m_job_data1;
             m_head    = (m_head + 1) % m_capacity;
             m_count -= 1;
             return 0;
@@ -113,6 +114,10 @@ namespace ncore
         uv_cond_t* m_has_completed;   // signaled when completed has jobs (per channel)
         uv_cond_t* m_room_completed;  // signaled when producer pops from completed (per channel)
 
+        // Completion hooks (per channel), called on the worker thread outside of the mutex
+        job_notify_fn_t* m_notify_fn;
+        void**           m_notify_user;
+
         volatile i32 m_stopping;    // 0->running, 1->stopping (drain or drop)
         i32          m_drain_mode;  // 1->drain pending; 0->drop pending immediately
 
@@ -144,6 +149,8 @@ namespace ncore
             m_completed      = g_allocate_array<ring_t>(allocator, max_channels);
             m_has_completed  = g_allocate_array<uv_cond_t>(allocator, max_channels);
             m_room_completed = g_allocate_array<uv_cond_t>(allocator, max_channels);
+            m_notify_fn      = g_allocate_array_and_clear<job_notify_fn_t>(allocator, max_channels);
+            m_notify_user    = g_allocate_array_and_clear<void*>(allocator, max_channels);
 
             uv_mutex_init(&m_mutex);
             uv_cond_init(&m_has_jobs);
@@ -184,6 +191,14 @@ namespace ncore
             return channel;
         }
 
+        void set_notify(job_channel_t channel, job_notify_fn_t notify_fn, void* user)
+        {
+            uv_mutex_lock(&m_mutex);
+            m_notify_fn[channel]   = notify_fn;
+            m_notify_user[channel] = user;
+            uv_mutex_unlock(&m_mutex);
+        }
+
         // Destructor
         void shutdown()
         {
@@ -209,6 +224,8 @@ namespace ncore
             }
             g_deallocate_array(m_allocator, m_has_completed);
             g_deallocate_array(m_allocator, m_room_completed);
+            g_deallocate_array(m_allocator, m_notify_fn);
+            g_deallocate_array(m_allocator, m_notify_user);
             g_deallocate_array(m_allocator, m_completed);
         }
 
@@ -386,6 +403,16 @@ namespace ncore
                 {
                     m_completed[channel].push(channel, job_fn, job_data0, job_data1);
                     uv_cond_signal(&m_has_completed[channel]);  // notify producer
+
+                    // Let an event loop know right away instead of it polling pop_job
+                    job_notify_fn_t notify_fn = m_notify_fn[channel];
+                    if (notify_fn)
+                    {
+                        void* notify_user = m_notify_user[channel];
+                        uv_mutex_unlock(&m_mutex);
+                        notify_fn(channel, notify_user);
+                        uv_mutex_lock(&m_mutex);
+                    }
                 }
                 // Loop back for next job
             }
@@ -522,5 +549,6 @@ namespace ncore
     i32           push_job(job_manager_t* jm, job_channel_t channel, job_fn_t job_fn, void* job_data0, void* job_data1) { return jm->submit(channel, job_fn, job_data0, job_data1); }
     i32           pop_job(job_manager_t* jm, job_channel_t channel, void*& job_data0, void*& job_data1) { return jm->pop_completed(channel, job_data0, job_data1); }
     i32           pop_job_wait(job_manager_t* jm, job_channel_t channel, void*& job_data0, void*& job_data1) { return jm->pop_completed_wait(channel, job_data0, job_data1); }
+    void          set_channel_notify(job_manager_t* jm, job_channel_t channel, job_notify_fn_t notify_fn, void* user) { jm->set_notify(channel, notify_fn, user); }
 
 }  // namespace ncore
@@ -39,8 +39,16 @@ namespace ncore
 
     packet_t *packet_acquire(packet_pool_t *pool)
     {
-        packet_t *pkt        = (packet_t *)nbin::alloc(pool->m_packet_bin);
-        pkt->m_data          = (u8 *)nbin::alloc(pool->m_packet_data_bin);
+        packet_t *pkt = (packet_t *)nbin::alloc(pool->m_packet_bin);
+        if (pkt == nullptr)
+            return nullptr;  // Pool is exhausted (max_pool_size)
+        pkt->m_data = (u8 *)nbin::alloc(pool->m_packet_data_bin);
+        if (pkt->m_data == nullptr)
+        {
+            nbin::free(pool->m_packet_bin, pkt);
+            return nullptr;
+        }
+        pkt->m_conn          = nullptr;
         pkt->m_data_size     = 0;
         pkt->m_data_capacity = pool->m_packet_data_size;
         return pkt;
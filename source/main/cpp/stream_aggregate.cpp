@@ -0,0 +1,647 @@
+#include "cconartist/stream_aggregate.h"
+#include "cconartist/user_types.h"
+
+#include <string.h>
+
+// The x86 kernels are compiled with a target attribute and picked at runtime from the cpu features, so a
+// build without -mavx2 or -msse4.1 still uses them. AArch64 always has NEON.
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#    define STREAM_AGGREGATE_X86
+#    define STREAM_AGGREGATE_AVX2 __attribute__((target("avx2")))
+#    define STREAM_AGGREGATE_SSE4 __attribute__((target("sse4.1")))
+#    include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#    define STREAM_AGGREGATE_NEON
+#    include <arm_neon.h>
+#endif
+
+namespace ncore
+{
+    void stream_stats_init(stream_stats_t &stats)
+    {
+        stats.m_count = 0;
+        stats.m_min   = 0.0;
+        stats.m_max   = 0.0;
+        stats.m_sum   = 0.0;
+        stats.m_mean  = 0.0;
+    }
+
+    void stream_stats_finish(stream_stats_t &stats) { stats.m_mean = (stats.m_count > 0) ? stats.m_sum / (f64)stats.m_count : 0.0; }
+
+    static void stats_merge(stream_stats_t &stats, u32 count, f64 lo, f64 hi, f64 sum)
+    {
+        if (count == 0)
+            return;
+        if (stats.m_count == 0 || lo < stats.m_min)
+            stats.m_min = lo;
+        if (stats.m_count == 0 || hi > stats.m_max)
+            stats.m_max = hi;
+        stats.m_count += count;
+        stats.m_sum += sum;
+    }
+
+    // Every kernel runs a vector loop over the largest multiple of the vector width and finishes the
+    // remaining values with the scalar loop, starting from the partial result of the vector loop.
+    // A vector loop returns the number of values it consumed, 0 when there is less than one vector.
+
+    template <typename T, typename S>
+    static void scalar_tail(const T *v, u32 i, u32 n, T &lo, T &hi, S &sum)
+    {
+        for (; i < n; ++i)
+        {
+            const T x = v[i];
+            lo        = x < lo ? x : lo;
+            hi        = x > hi ? x : hi;
+            sum += (S)x;
+        }
+    }
+
+    template <typename T>
+    static void lanes_reduce(const T *lanes, u32 count, T &lo, T &hi)
+    {
+        for (u32 i = 0; i < count; ++i)
+        {
+            lo = lanes[i] < lo ? lanes[i] : lo;
+            hi = lanes[i] > hi ? lanes[i] : hi;
+        }
+    }
+
+    template <typename T, typename S>
+    static void aggregate(const T *v, u32 n, u32 (*vector_fn)(const T *, u32, T &, T &, S &), stream_stats_t &stats)
+    {
+        if (n == 0)
+            return;
+        T   lo  = v[0];
+        T   hi  = v[0];
+        S   sum = 0;
+        u32 i   = 0;
+        if (vector_fn != nullptr)
+            i = vector_fn(v, n, lo, hi, sum);
+        scalar_tail<T, S>(v, i, n, lo, hi, sum);
+        stats_merge(stats, n, (f64)lo, (f64)hi, (f64)sum);
+    }
+
+    // The vector loops of the u8, u16, s16, u32, f32 and f64 kernels, one set per instruction set
+    struct stream_kernels_t
+    {
+        u32 (*m_u8)(const u8 *, u32, u8 &, u8 &, u64 &);
+        u32 (*m_u16)(const u16 *, u32, u16 &, u16 &, u64 &);
+        u32 (*m_s16)(const s16 *, u32, s16 &, s16 &, s64 &);
+        u32 (*m_u32)(const u32 *, u32, u32 &, u32 &, u64 &);
+        u32 (*m_f32)(const f32 *, u32, f32 &, f32 &, f64 &);
+        u32 (*m_f64)(const f64 *, u32, f64 &, f64 &, f64 &);
+    };
+
+#if defined(STREAM_AGGREGATE_X86)
+    STREAM_AGGREGATE_AVX2 static u32 u8_avx2(const u8 *v, u32 n, u8 &lo, u8 &hi, u64 &sum)
+    {
+        if (n < 32)
+            return 0;
+        const __m256i zero = _mm256_setzero_si256();
+        __m256i       vlo  = _mm256_set1_epi8((char)lo);
+        __m256i       vhi  = vlo;
+        __m256i       vsum = zero;
+        u32           i    = 0;
+        for (; i + 32 <= n; i += 32)
+        {
+            const __m256i x = _mm256_loadu_si256((const __m256i *)(v + i));
+            vlo             = _mm256_min_epu8(vlo, x);
+            vhi             = _mm256_max_epu8(vhi, x);
+            vsum            = _mm256_add_epi64(vsum, _mm256_sad_epu8(x, zero));
+        }
+        u8  lanes_lo[32], lanes_hi[32];
+        u64 sums[4];
+        _mm256_storeu_si256((__m256i *)lanes_lo, vlo);
+        _mm256_storeu_si256((__m256i *)lanes_hi, vhi);
+        _mm256_storeu_si256((__m256i *)sums, vsum);
+        lanes_reduce(lanes_lo, 32, lo, hi);
+        lanes_reduce(lanes_hi, 32, lo, hi);
+        sum = sums[0] + sums[1] + sums[2] + sums[3];
+        return i;
+    }
+
+    STREAM_AGGREGATE_SSE4 static u32 u8_sse4(const u8 *v, u32 n, u8 &lo, u8 &hi, u64 &sum)
+    {
+        if (n < 16)
+            return 0;
+        const __m128i zero = _mm_setzero_si128();
+        __m128i       vlo  = _mm_set1_epi8((char)lo);
+        __m128i       vhi  = vlo;
+        __m128i       vsum = zero;
+        u32           i    = 0;
+        for (; i + 16 <= n; i += 16)
+        {
+            const __m128i x = _mm_loadu_si128((const __m128i *)(v + i));
+            vlo             = _mm_min_epu8(vlo, x);
+            vhi             = _mm_max_epu8(vhi, x);
+            vsum            = _mm_add_epi64(vsum, _mm_sad_epu8(x, zero));
+        }
+        u8  lanes_lo[16], lanes_hi[16];
+        u64 sums[2];
+        _mm_storeu_si128((__m128i *)lanes_lo, vlo);
+        _mm_storeu_si128((__m128i *)lanes_hi, vhi);
+        _mm_storeu_si128((__m128i *)sums, vsum);
+        lanes_reduce(lanes_lo, 16, lo, hi);
+        lanes_reduce(lanes_hi, 16, lo, hi);
+        sum = sums[0] + sums[1];
+        return i;
+    }
+
+    STREAM_AGGREGATE_AVX2 static u32 u16_avx2(const u16 *v, u32 n, u16 &lo, u16 &hi, u64 &sum)
+    {
+        if (n < 16)
+            return 0;
+        // The sum of the low bytes plus 256 times the sum of the high bytes, sad does not overflow
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i mask = _mm256_set1_epi16(0x00FF);
+        __m256i       vlo  = _mm256_set1_epi16((short)lo);
+        __m256i       vhi  = vlo;
+        __m256i       vsl  = zero;
+        __m256i       vsh  = zero;
+        u32           i    = 0;
+        for (; i + 16 <= n; i += 16)
+        {
+            const __m256i x = _mm256_loadu_si256((const __m256i *)(v + i));
+            vlo             = _mm256_min_epu16(vlo, x);
+            vhi             = _mm256_max_epu16(vhi, x);
+            vsl             = _mm256_add_epi64(vsl, _mm256_sad_epu8(_mm256_and_si256(x, mask), zero));
+            vsh             = _mm256_add_epi64(vsh, _mm256_sad_epu8(_mm256_srli_epi16(x, 8), zero));
+        }
+        u16 lanes_lo[16], lanes_hi[16];
+        u64 sl[4], sh[4];
+        _mm256_storeu_si256((__m256i *)lanes_lo, vlo);
+        _mm256_storeu_si256((__m256i *)lanes_hi, vhi);
+        _mm256_storeu_si256((__m256i *)sl, vsl);
+        _mm256_storeu_si256((__m256i *)sh, vsh);
+        lanes_reduce(lanes_lo, 16, lo, hi);
+        lanes_reduce(lanes_hi, 16, lo, hi);
+        sum = (sl[0] + sl[1] + sl[2] + sl[3]) + ((sh[0] + sh[1] + sh[2] + sh[3]) << 8);
+        return i;
+    }
+
+    STREAM_AGGREGATE_SSE4 static u32 u16_sse4(const u16 *v, u32 n, u16 &lo, u16 &hi, u64 &sum)
+    {
+        if (n < 8)
+            return 0;
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i mask = _mm_set1_epi16(0x00FF);
+        __m128i       vlo  = _mm_set1_epi16((short)lo);
+        __m128i       vhi  = vlo;
+        __m128i       vsl  = zero;
+        __m128i       vsh  = zero;
+        u32           i    = 0;
+        for (; i + 8 <= n; i += 8)
+        {
+            const __m128i x = _mm_loadu_si128((const __m128i *)(v + i));
+            vlo             = _mm_min_epu16(vlo, x);
+            vhi             = _mm_max_epu16(vhi, x);
+            vsl             = _mm_add_epi64(vsl, _mm_sad_epu8(_mm_and_si128(x, mask), zero));
+            vsh             = _mm_add_epi64(vsh, _mm_sad_epu8(_mm_srli_epi16(x, 8), zero));
+        }
+        u16 lanes_lo[8], lanes_hi[8];
+        u64 sl[2], sh[2];
+        _mm_storeu_si128((__m128i *)lanes_lo, vlo);
+        _mm_storeu_si128((__m128i *)lanes_hi, vhi);
+        _mm_storeu_si128((__m128i *)sl, vsl);
+        _mm_storeu_si128((__m128i *)sh, vsh);
+        lanes_reduce(lanes_lo, 8, lo, hi);
+        lanes_reduce(lanes_hi, 8, lo, hi);
+        sum = (sl[0] + sl[1]) + ((sh[0] + sh[1]) << 8);
+        return i;
+    }
+
+    // madd gives the sum of pairs as s32, a lane gains at most 2^16 per step so the s32 lanes are added to
+    // the s64 total every 2^14 steps
+    static const u32 c_s16_flush_steps = 1 << 14;
+
+    STREAM_AGGREGATE_AVX2 static u32 s16_avx2(const s16 *v, u32 n, s16 &lo, s16 &hi, s64 &sum)
+    {
+        if (n < 16)
+            return 0;
+        const __m256i ones = _mm256_set1_epi16(1);
+        __m256i       vlo  = _mm256_set1_epi16(lo);
+        __m256i       vhi  = vlo;
+        u32           i    = 0;
+        while (i + 16 <= n)
+        {
+            __m256i   vsum = _mm256_setzero_si256();
+            const u32 end  = (n - i) / 16 > c_s16_flush_steps ? i + c_s16_flush_steps * 16 : n - ((n - i) % 16);
+            for (; i < end; i += 16)
+            {
+                const __m256i x = _mm256_loadu_si256((const __m256i *)(v + i));
+                vlo             = _mm256_min_epi16(vlo, x);
+                vhi             = _mm256_max_epi16(vhi, x);
+                vsum            = _mm256_add_epi32(vsum, _mm256_madd_epi16(x, ones));
+            }
+            s32 sums[8];
+            _mm256_storeu_si256((__m256i *)sums, vsum);
+            for (u32 l = 0; l < 8; ++l)
+                sum += sums[l];
+        }
+        s16 lanes_lo[16], lanes_hi[16];
+        _mm256_storeu_si256((__m256i *)lanes_lo, vlo);
+        _mm256_storeu_si256((__m256i *)lanes_hi, vhi);
+        lanes_reduce(lanes_lo, 16, lo, hi);
+        lanes_reduce(lanes_hi, 16, lo, hi);
+        return i;
+    }
+
+    STREAM_AGGREGATE_SSE4 static u32 s16_sse4(const s16 *v, u32 n, s16 &lo, s16 &hi, s64 &sum)
+    {
+        if (n < 8)
+            return 0;
+        const __m128i ones = _mm_set1_epi16(1);
+        __m128i       vlo  = _mm_set1_epi16(lo);
+        __m128i       vhi  = vlo;
+        u32           i    = 0;
+        while (i + 8 <= n)
+        {
+            __m128i   vsum = _mm_setzero_si128();
+            const u32 end  = (n - i) / 8 > c_s16_flush_steps ? i + c_s16_flush_steps * 8 : n - ((n - i) % 8);
+            for (; i < end; i += 8)
+            {
+                const __m128i x = _mm_loadu_si128((const __m128i *)(v + i));
+                vlo             = _mm_min_epi16(vlo, x);
+                vhi             = _mm_max_epi16(vhi, x);
+                vsum            = _mm_add_epi32(vsum, _mm_madd_epi16(x, ones));
+            }
+            s32 sums[4];
+            _mm_storeu_si128((__m128i *)sums, vsum);
+            sum += (s64)sums[0] + sums[1] + sums[2] + sums[3];
+        }
+        s16 lanes_lo[8], lanes_hi[8];
+        _mm_storeu_si128((__m128i *)lanes_lo, vlo);
+        _mm_storeu_si128((__m128i *)lanes_hi, vhi);
+        lanes_reduce(lanes_lo, 8, lo, hi);
+        lanes_reduce(lanes_hi, 8, lo, hi);
+        return i;
+    }
+
+    STREAM_AGGREGATE_AVX2 static u32 u32_avx2(const u32 *v, u32 n, u32 &lo, u32 &hi, u64 &sum)
+    {
+        if (n < 8)
+            return 0;
+        const __m256i zero = _mm256_setzero_si256();
+        __m256i       vlo  = _mm256_set1_epi32((int)lo);
+        __m256i       vhi  = vlo;
+        __m256i       vsum = zero;
+        u32           i    = 0;
+        for (; i + 8 <= n; i += 8)
+        {
+            const __m256i x = _mm256_loadu_si256((const __m256i *)(v + i));
+            vlo             = _mm256_min_epu32(vlo, x);
+            vhi             = _mm256_max_epu32(vhi, x);
+            vsum            = _mm256_add_epi64(vsum, _mm256_add_epi64(_mm256_unpacklo_epi32(x, zero), _mm256_unpackhi_epi32(x, zero)));
+        }
+        u32 lanes_lo[8], lanes_hi[8];
+        u64 sums[4];
+        _mm256_storeu_si256((__m256i *)lanes_lo, vlo);
+        _mm256_storeu_si256((__m256i *)lanes_hi, vhi);
+        _mm256_storeu_si256((__m256i *)sums, vsum);
+        lanes_reduce(lanes_lo, 8, lo, hi);
+        lanes_reduce(lanes_hi, 8, lo, hi);
+        sum = sums[0] + sums[1] + sums[2] + sums[3];
+        return i;
+    }
+
+    STREAM_AGGREGATE_SSE4 static u32 u32_sse4(const u32 *v, u32 n, u32 &lo, u32 &hi, u64 &sum)
+    {
+        if (n < 4)
+            return 0;
+        const __m128i zero = _mm_setzero_si128();
+        __m128i       vlo  = _mm_set1_epi32((int)lo);
+        __m128i       vhi  = vlo;
+        __m128i       vsum = zero;
+        u32           i    = 0;
+        for (; i + 4 <= n; i += 4)
+        {
+            const __m128i x = _mm_loadu_si128((const __m128i *)(v + i));
+            vlo             = _mm_min_epu32(vlo, x);
+            vhi             = _mm_max_epu32(vhi, x);
+            vsum            = _mm_add_epi64(vsum, _mm_add_epi64(_mm_unpacklo_epi32(x, zero), _mm_unpackhi_epi32(x, zero)));
+        }
+        u32 lanes_lo[4], lanes_hi[4];
+        u64 sums[2];
+        _mm_storeu_si128((__m128i *)lanes_lo, vlo);
+        _mm_storeu_si128((__m128i *)lanes_hi, vhi);
+        _mm_storeu_si128((__m128i *)sums, vsum);
+        lanes_reduce(lanes_lo, 4, lo, hi);
+        lanes_reduce(lanes_hi, 4, lo, hi);
+        sum = sums[0] + sums[1];
+        return i;
+    }
+
+    STREAM_AGGREGATE_AVX2 static u32 f32_avx2(const f32 *v, u32 n, f32 &lo, f32 &hi, f64 &sum)
+    {
+        if (n < 8)
+            return 0;
+        __m256  vlo  = _mm256_set1_ps(lo);
+        __m256  vhi  = vlo;
+        __m256d vsum = _mm256_setzero_pd();
+        u32     i    = 0;
+        for (; i + 8 <= n; i += 8)
+        {
+            const __m256 x = _mm256_loadu_ps(v + i);
+            vlo            = _mm256_min_ps(vlo, x);
+            vhi            = _mm256_max_ps(vhi, x);
+            vsum           = _mm256_add_pd(vsum, _mm256_add_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(x)), _mm256_cvtps_pd(_mm256_extractf128_ps(x, 1))));
+        }
+        f32 lanes_lo[8], lanes_hi[8];
+        f64 sums[4];
+        _mm256_storeu_ps(lanes_lo, vlo);
+        _mm256_storeu_ps(lanes_hi, vhi);
+        _mm256_storeu_pd(sums, vsum);
+        lanes_reduce(lanes_lo, 8, lo, hi);
+        lanes_reduce(lanes_hi, 8, lo, hi);
+        sum = (sums[0] + sums[1]) + (sums[2] + sums[3]);
+        return i;
+    }
+
+    STREAM_AGGREGATE_SSE4 static u32 f32_sse4(const f32 *v, u32 n, f32 &lo, f32 &hi, f64 &sum)
+    {
+        if (n < 4)
+            return 0;
+        __m128  vlo  = _mm_set1_ps(lo);
+        __m128  vhi  = vlo;
+        __m128d vsum = _mm_setzero_pd();
+        u32     i    = 0;
+        for (; i + 4 <= n; i += 4)
+        {
+            const __m128 x = _mm_loadu_ps(v + i);
+            vlo            = _mm_min_ps(vlo, x);
+            vhi            = _mm_max_ps(vhi, x);
+            vsum           = _mm_add_pd(vsum, _mm_add_pd(_mm_cvtps_pd(x), _mm_cvtps_pd(_mm_movehl_ps(x, x))));
+        }
+        f32 lanes_lo[4], lanes_hi[4];
+        f64 sums[2];
+        _mm_storeu_ps(lanes_lo, vlo);
+        _mm_storeu_ps(lanes_hi, vhi);
+        _mm_storeu_pd(sums, vsum);
+        lanes_reduce(lanes_lo, 4, lo, hi);
+        lanes_reduce(lanes_hi, 4, lo, hi);
+        sum = sums[0] + sums[1];
+        return i;
+    }
+
+    STREAM_AGGREGATE_AVX2 static u32 f64_avx2(const f64 *v, u32 n, f64 &lo, f64 &hi, f64 &sum)
+    {
+        if (n < 4)
+            return 0;
+        __m256d vlo  = _mm256_set1_pd(lo);
+        __m256d vhi  = vlo;
+        __m256d vsum = _mm256_setzero_pd();
+        u32     i    = 0;
+        for (; i + 4 <= n; i += 4)
+        {
+            const __m256d x = _mm256_loadu_pd(v + i);
+            vlo             = _mm256_min_pd(vlo, x);
+            vhi             = _mm256_max_pd(vhi, x);
+            vsum            = _mm256_add_pd(vsum, x);
+        }
+        f64 lanes_lo[4], lanes_hi[4], sums[4];
+        _mm256_storeu_pd(lanes_lo, vlo);
+        _mm256_storeu_pd(lanes_hi, vhi);
+        _mm256_storeu_pd(sums, vsum);
+        lanes_reduce(lanes_lo, 4, lo, hi);
+        lanes_reduce(lanes_hi, 4, lo, hi);
+        sum = (sums[0] + sums[1]) + (sums[2] + sums[3]);
+        return i;
+    }
+
+    STREAM_AGGREGATE_SSE4 static u32 f64_sse4(const f64 *v, u32 n, f64 &lo, f64 &hi, f64 &sum)
+    {
+        if (n < 2)
+            return 0;
+        __m128d vlo  = _mm_set1_pd(lo);
+        __m128d vhi  = vlo;
+        __m128d vsum = _mm_setzero_pd();
+        u32     i    = 0;
+        for (; i + 2 <= n; i += 2)
+        {
+            const __m128d x = _mm_loadu_pd(v + i);
+            vlo             = _mm_min_pd(vlo, x);
+            vhi             = _mm_max_pd(vhi, x);
+            vsum            = _mm_add_pd(vsum, x);
+        }
+        f64 lanes_lo[2], lanes_hi[2], sums[2];
+        _mm_storeu_pd(lanes_lo, vlo);
+        _mm_storeu_pd(lanes_hi, vhi);
+        _mm_storeu_pd(sums, vsum);
+        lanes_reduce(lanes_lo, 2, lo, hi);
+        lanes_reduce(lanes_hi, 2, lo, hi);
+        sum = sums[0] + sums[1];
+        return i;
+    }
+
+    static const stream_kernels_t s_kernels_avx2 = {u8_avx2, u16_avx2, s16_avx2, u32_avx2, f32_avx2, f64_avx2};
+    static const stream_kernels_t s_kernels_sse4 = {u8_sse4, u16_sse4, s16_sse4, u32_sse4, f32_sse4, f64_sse4};
+    static const stream_kernels_t s_kernels_none = {nullptr, nullptr, nullptr, nullptr, nullptr, nullptr};
+
+    static const stream_kernels_t *s_kernels_select()
+    {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            return &s_kernels_avx2;
+        if (__builtin_cpu_supports("sse4.1"))
+            return &s_kernels_sse4;
+        return &s_kernels_none;
+    }
+
+#elif defined(STREAM_AGGREGATE_NEON)
+    static u32 u8_neon(const u8 *v, u32 n, u8 &lo, u8 &hi, u64 &sum)
+    {
+        if (n < 16)
+            return 0;
+        uint8x16_t vlo  = vdupq_n_u8(lo);
+        uint8x16_t vhi  = vlo;
+        uint64x2_t vsum = vdupq_n_u64(0);
+        u32        i    = 0;
+        for (; i + 16 <= n; i += 16)
+        {
+            const uint8x16_t x = vld1q_u8(v + i);
+            vlo                = vminq_u8(vlo, x);
+            vhi                = vmaxq_u8(vhi, x);
+            vsum               = vpadalq_u32(vsum, vpaddlq_u16(vpaddlq_u8(x)));
+        }
+        lo  = vminvq_u8(vlo) < lo ? vminvq_u8(vlo) : lo;
+        hi  = vmaxvq_u8(vhi) > hi ? vmaxvq_u8(vhi) : hi;
+        sum = vgetq_lane_u64(vsum, 0) + vgetq_lane_u64(vsum, 1);
+        return i;
+    }
+
+    static u32 u16_neon(const u16 *v, u32 n, u16 &lo, u16 &hi, u64 &sum)
+    {
+        if (n < 8)
+            return 0;
+        uint16x8_t vlo  = vdupq_n_u16(lo);
+        uint16x8_t vhi  = vlo;
+        uint64x2_t vsum = vdupq_n_u64(0);
+        u32        i    = 0;
+        for (; i + 8 <= n; i += 8)
+        {
+            const uint16x8_t x = vld1q_u16(v + i);
+            vlo                = vminq_u16(vlo, x);
+            vhi                = vmaxq_u16(vhi, x);
+            vsum               = vpadalq_u32(vsum, vpaddlq_u16(x));
+        }
+        lo  = vminvq_u16(vlo) < lo ? vminvq_u16(vlo) : lo;
+        hi  = vmaxvq_u16(vhi) > hi ? vmaxvq_u16(vhi) : hi;
+        sum = vgetq_lane_u64(vsum, 0) + vgetq_lane_u64(vsum, 1);
+        return i;
+    }
+
+    static u32 s16_neon(const s16 *v, u32 n, s16 &lo, s16 &hi, s64 &sum)
+    {
+        if (n < 8)
+            return 0;
+        int16x8_t vlo  = vdupq_n_s16(lo);
+        int16x8_t vhi  = vlo;
+        int64x2_t vsum = vdupq_n_s64(0);
+        u32       i    = 0;
+        for (; i + 8 <= n; i += 8)
+        {
+            const int16x8_t x = vld1q_s16(v + i);
+            vlo               = vminq_s16(vlo, x);
+            vhi               = vmaxq_s16(vhi, x);
+            vsum              = vpadalq_s32(vsum, vpaddlq_s16(x));
+        }
+        lo  = vminvq_s16(vlo) < lo ? vminvq_s16(vlo) : lo;
+        hi  = vmaxvq_s16(vhi) > hi ? vmaxvq_s16(vhi) : hi;
+        sum = vgetq_lane_s64(vsum, 0) + vgetq_lane_s64(vsum, 1);
+        return i;
+    }
+
+    static u32 u32_neon(const u32 *v, u32 n, u32 &lo, u32 &hi, u64 &sum)
+    {
+        if (n < 4)
+            return 0;
+        uint32x4_t vlo  = vdupq_n_u32(lo);
+        uint32x4_t vhi  = vlo;
+        uint64x2_t vsum = vdupq_n_u64(0);
+        u32        i    = 0;
+        for (; i + 4 <= n; i += 4)
+        {
+            const uint32x4_t x = vld1q_u32(v + i);
+            vlo                = vminq_u32(vlo, x);
+            vhi                = vmaxq_u32(vhi, x);
+            vsum               = vpadalq_u32(vsum, x);
+        }
+        lo  = vminvq_u32(vlo) < lo ? vminvq_u32(vlo) : lo;
+        hi  = vmaxvq_u32(vhi) > hi ? vmaxvq_u32(vhi) : hi;
+        sum = vgetq_lane_u64(vsum, 0) + vgetq_lane_u64(vsum, 1);
+        return i;
+    }
+
+    static u32 f32_neon(const f32 *v, u32 n, f32 &lo, f32 &hi, f64 &sum)
+    {
+        if (n < 4)
+            return 0;
+        float32x4_t vlo  = vdupq_n_f32(lo);
+        float32x4_t vhi  = vlo;
+        float64x2_t vsum = vdupq_n_f64(0.0);
+        u32         i    = 0;
+        for (; i + 4 <= n; i += 4)
+        {
+            const float32x4_t x = vld1q_f32(v + i);
+            vlo                 = vminq_f32(vlo, x);
+            vhi                 = vmaxq_f32(vhi, x);
+            vsum                = vaddq_f64(vsum, vaddq_f64(vcvt_f64_f32(vget_low_f32(x)), vcvt_high_f64_f32(x)));
+        }
+        lo  = vminvq_f32(vlo) < lo ? vminvq_f32(vlo) : lo;
+        hi  = vmaxvq_f32(vhi) > hi ? vmaxvq_f32(vhi) : hi;
+        sum = vgetq_lane_f64(vsum, 0) + vgetq_lane_f64(vsum, 1);
+        return i;
+    }
+
+    static u32 f64_neon(const f64 *v, u32 n, f64 &lo, f64 &hi, f64 &sum)
+    {
+        if (n < 2)
+            return 0;
+        float64x2_t vlo  = vdupq_n_f64(lo);
+        float64x2_t vhi  = vlo;
+        float64x2_t vsum = vdupq_n_f64(0.0);
+        u32         i    = 0;
+        for (; i + 2 <= n; i += 2)
+        {
+            const float64x2_t x = vld1q_f64(v + i);
+            vlo                 = vminq_f64(vlo, x);
+            vhi                 = vmaxq_f64(vhi, x);
+            vsum                = vaddq_f64(vsum, x);
+        }
+        lo  = vminvq_f64(vlo) < lo ? vminvq_f64(vlo) : lo;
+        hi  = vmaxvq_f64(vhi) > hi ? vmaxvq_f64(vhi) : hi;
+        sum = vgetq_lane_f64(vsum, 0) + vgetq_lane_f64(vsum, 1);
+        return i;
+    }
+
+    static const stream_kernels_t  s_kernels_neon = {u8_neon, u16_neon, s16_neon, u32_neon, f32_neon, f64_neon};
+    static const stream_kernels_t *s_kernels_select() { return &s_kernels_neon; }
+
+#else
+    static const stream_kernels_t  s_kernels_none = {nullptr, nullptr, nullptr, nullptr, nullptr, nullptr};
+    static const stream_kernels_t *s_kernels_select() { return &s_kernels_none; }
+#endif
+
+    // Selected on first use, the cpu does not change while the process runs
+    static const stream_kernels_t &s_kernels()
+    {
+        static const stream_kernels_t *s_selected = s_kernels_select();
+        return *s_selected;
+    }
+
+    bool stream_aggregate_values(u8 value_type, const void *values, u32 count, stream_stats_t &stats)
+    {
+        const stream_kernels_t &k = s_kernels();
+        switch (value_type)
+        {
+            case nvalue::TypeU8: aggregate<u8, u64>((const u8 *)values, count, k.m_u8, stats); return true;
+            case nvalue::TypeU16: aggregate<u16, u64>((const u16 *)values, count, k.m_u16, stats); return true;
+            case nvalue::TypeU32: aggregate<u32, u64>((const u32 *)values, count, k.m_u32, stats); return true;
+            case nvalue::TypeU64: aggregate<u64, u64>((const u64 *)values, count, nullptr, stats); return true;
+            case nvalue::TypeS8: aggregate<s8, s64>((const s8 *)values, count, nullptr, stats); return true;
+            case nvalue::TypeS16: aggregate<s16, s64>((const s16 *)values, count, k.m_s16, stats); return true;
+            case nvalue::TypeS32: aggregate<s32, s64>((const s32 *)values, count, nullptr, stats); return true;
+            case nvalue::TypeS64: aggregate<s64, s64>((const s64 *)values, count, nullptr, stats); return true;
+            case nvalue::TypeF32: aggregate<f32, f64>((const f32 *)values, count, k.m_f32, stats); return true;
+            case nvalue::TypeF64: aggregate<f64, f64>((const f64 *)values, count, k.m_f64, stats); return true;
+        }
+        return false;
+    }
+
+    // The row layout interleaves the values with the item times, so the values are copied out a block at a
+    // time into a packed buffer on the stack and handed to the same kernels as a column page.
+    static const u32 c_strided_block = 512;
+
+    template <typename T>
+    static void aggregate_strided(u8 value_type, const u8 *values, u32 stride, u32 n, stream_stats_t &stats)
+    {
+        T block[c_strided_block];
+        while (n > 0)
+        {
+            const u32 count = n < c_strided_block ? n : c_strided_block;
+            for (u32 i = 0; i < count; ++i, values += stride)
+                memcpy(&block[i], values, sizeof(T));
+            stream_aggregate_values(value_type, block, count, stats);
+            n -= count;
+        }
+    }
+
+    bool stream_aggregate_strided(u8 value_type, const u8 *values, u32 stride, u32 count, stream_stats_t &stats)
+    {
+        switch (value_type)
+        {
+            case nvalue::TypeU8: aggregate_strided<u8>(value_type, values, stride, count, stats); return true;
+            case nvalue::TypeU16: aggregate_strided<u16>(value_type, values, stride, count, stats); return true;
+            case nvalue::TypeU32: aggregate_strided<u32>(value_type, values, stride, count, stats); return true;
+            case nvalue::TypeU64: aggregate_strided<u64>(value_type, values, stride, count, stats); return true;
+            case nvalue::TypeS8: aggregate_strided<s8>(value_type, values, stride, count, stats); return true;
+            case nvalue::TypeS16: aggregate_strided<s16>(value_type, values, stride, count, stats); return true;
+            case nvalue::TypeS32: aggregate_strided<s32>(value_type, values, stride, count, stats); return true;
+            case nvalue::TypeS64: aggregate_strided<s64>(value_type, values, stride, count, stats); return true;
+            case nvalue::TypeF32: aggregate_strided<f32>(value_type, values, stride, count, stats); return true;
+            case nvalue::TypeF64: aggregate_strided<f64>(value_type, values, stride, count, stats); return true;
+        }
+        return false;
+    }
+
+}  // namespace ncore
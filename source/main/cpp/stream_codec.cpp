@@ -0,0 +1,289 @@
+#include "cconartist/stream_codec.h"
+
+#include <string.h>
+
+namespace ncore
+{
+    // Bits are written most significant first, a value of more than 32 bits is written as two parts
+    // so that the accumulator never holds more than 39 bits.
+    struct bit_writer_t
+    {
+        u8 *m_dst;
+        u32 m_pos;
+        u32 m_bits;
+        u64 m_acc;
+    };
+
+    static inline u64 low_bits(u64 value, u32 count) { return count >= 64 ? value : (value & (((u64)1 << count) - 1)); }
+
+    static void bits_write(bit_writer_t &w, u64 value, u32 count)
+    {
+        if (count > 32)
+        {
+            bits_write(w, value >> 32, count - 32);
+            count = 32;
+        }
+        w.m_acc = (w.m_acc << count) | low_bits(value, count);
+        w.m_bits += count;
+        while (w.m_bits >= 8)
+        {
+            w.m_bits -= 8;
+            w.m_dst[w.m_pos++] = (u8)(w.m_acc >> w.m_bits);
+        }
+    }
+
+    static u32 bits_flush(bit_writer_t &w)
+    {
+        if (w.m_bits > 0)
+            w.m_dst[w.m_pos++] = (u8)(w.m_acc << (8 - w.m_bits));
+        w.m_bits = 0;
+        return w.m_pos;
+    }
+
+    struct bit_reader_t
+    {
+        const u8 *m_src;
+        u32       m_size;
+        u32       m_pos;
+        u32       m_bits;
+        u64       m_acc;
+        bool      m_overrun;
+    };
+
+    static u64 bits_read(bit_reader_t &r, u32 count)
+    {
+        if (count > 32)
+        {
+            const u64 high = bits_read(r, count - 32);
+            return (high << 32) | bits_read(r, 32);
+        }
+        while (r.m_bits < count)
+        {
+            if (r.m_pos < r.m_size)
+                r.m_acc = (r.m_acc << 8) | r.m_src[r.m_pos++];
+            else
+            {
+                r.m_acc <<= 8;
+                r.m_overrun = true;
+            }
+            r.m_bits += 8;
+        }
+        r.m_bits -= count;
+        return low_bits(r.m_acc >> r.m_bits, count);
+    }
+
+    // Number of leading 1 bits before a 0, at most 'max'
+    static inline u32 bits_read_prefix(bit_reader_t &r, u32 max)
+    {
+        u32 ones = 0;
+        while (ones < max && bits_read(r, 1) == 1)
+            ones += 1;
+        return ones;
+    }
+
+    static inline u64 zigzag_encode(i64 value) { return ((u64)value << 1) ^ (u64)(value >> 63); }
+    static inline i64 zigzag_decode(u64 value) { return (i64)(value >> 1) ^ -(i64)(value & 1); }
+
+    static inline u64 load_value(const u8 *values, u32 index, u32 value_size)
+    {
+        switch (value_size)
+        {
+            case 1: return values[index];
+            case 2:
+            {
+                u16 v;
+                memcpy(&v, values + index * 2, 2);
+                return v;
+            }
+            case 4:
+            {
+                u32 v;
+                memcpy(&v, values + index * 4, 4);
+                return v;
+            }
+        }
+        u64 v;
+        memcpy(&v, values + index * 8, 8);
+        return v;
+    }
+
+    static inline void store_value(u8 *values, u32 index, u32 value_size, u64 value)
+    {
+        switch (value_size)
+        {
+            case 1: values[index] = (u8)value; return;
+            case 2:
+            {
+                const u16 v = (u16)value;
+                memcpy(values + index * 2, &v, 2);
+                return;
+            }
+            case 4:
+            {
+                const u32 v = (u32)value;
+                memcpy(values + index * 4, &v, 4);
+                return;
+            }
+        }
+        memcpy(values + index * 8, &value, 8);
+    }
+
+    // Codes of the time delta-of-delta and the integer value delta (zigzag), by number of leading 1 bits:
+    //   time  : 0 : zero,  1 : 4 bits,  2 : 8 bits,  3 : 12 bits,  4 : 64 bits
+    //   value : 0 : zero,  1 : 6 bits,  2 : 13 bits, 3 : 20 bits,  4 : the full value width
+    // The short time code covers a jitter of a few ms on a regular interval.
+    static const u32 c_time_code_bits[4]  = {0, 4, 8, 12};
+    static const u32 c_value_code_bits[4] = {0, 6, 13, 20};
+
+    static void write_code(bit_writer_t &w, u64 zigzag, const u32 *code_bits, u64 raw, u32 raw_bits)
+    {
+        if (zigzag == 0)
+        {
+            bits_write(w, 0, 1);
+            return;
+        }
+        for (u32 code = 1; code < 4; ++code)
+        {
+            if (zigzag < ((u64)1 << code_bits[code]))
+            {
+                bits_write(w, ((u64)1 << (code + 1)) - 2, code + 1);  // 'code' ones and a zero
+                bits_write(w, zigzag, code_bits[code]);
+                return;
+            }
+        }
+        bits_write(w, 0xF, 4);
+        bits_write(w, raw, raw_bits);
+    }
+
+    // Returns the zigzag value, or sets 'out_raw' when the full width code was used
+    static u64 read_code(bit_reader_t &r, const u32 *code_bits, u32 raw_bits, bool &out_raw)
+    {
+        const u32 code = bits_read_prefix(r, 4);
+        out_raw        = (code == 4);
+        if (code == 0)
+            return 0;
+        return bits_read(r, out_raw ? raw_bits : code_bits[code]);
+    }
+
+    u32 stream_codec_bound(u32 count, u32 value_size)
+    {
+        // Per item at most 4 + 64 bits of time and 2 + 6 + 6 + 64 bits of value, and the raw first item
+        const u64 bits = (u64)count * (68 + 78) + 64 + value_size * 8;
+        return (u32)((bits + 7) / 8) + 8;
+    }
+
+    u32 stream_codec_encode(u8 *dst, const u64 *times, const u8 *values, u32 count, u32 value_size, bool is_float)
+    {
+        bit_writer_t w = {dst, 0, 0, 0};
+        if (count == 0)
+            return 0;
+
+        const u32 width      = value_size * 8;
+        u64       prev_time  = times[0];
+        u64       prev_delta = 0;
+        u64       prev_value = load_value(values, 0, value_size);
+        bits_write(w, prev_time, 64);
+        bits_write(w, prev_value, width);
+
+        u32 window_lead  = 0xFF;  // No window yet
+        u32 window_trail = 0;
+        for (u32 i = 1; i < count; ++i)
+        {
+            const u64 delta = times[i] - prev_time;
+            const u64 dod   = delta - prev_delta;
+            write_code(w, zigzag_encode((i64)dod), c_time_code_bits, dod, 64);
+            prev_time  = times[i];
+            prev_delta = delta;
+
+            const u64 value = load_value(values, i, value_size);
+            if (is_float)
+            {
+                const u64 x = value ^ prev_value;
+                if (x == 0)
+                    bits_write(w, 0, 1);
+                else
+                {
+                    u32 lead  = (u32)__builtin_clzll(x) - (64 - width);
+                    u32 trail = (u32)__builtin_ctzll(x);
+                    if (lead > 63)
+                        lead = 63;
+                    if (window_lead != 0xFF && lead >= window_lead && trail >= window_trail)
+                    {
+                        // Fits in the meaningful bits of the previous value
+                        bits_write(w, 2, 2);
+                        bits_write(w, x >> window_trail, width - window_lead - window_trail);
+                    }
+                    else
+                    {
+                        const u32 length = width - lead - trail;
+                        bits_write(w, 3, 2);
+                        bits_write(w, lead, 6);
+                        bits_write(w, length - 1, 6);
+                        bits_write(w, x >> trail, length);
+                        window_lead  = lead;
+                        window_trail = trail;
+                    }
+                }
+            }
+            else
+            {
+                // The delta is taken in the width of the value, a sign extended delta keeps small steps down small
+                const u64 delta_value  = low_bits(value - prev_value, width);
+                const i64 signed_delta = (width < 64 && (delta_value >> (width - 1)) != 0) ? (i64)(delta_value | ~(((u64)1 << width) - 1)) : (i64)delta_value;
+                write_code(w, zigzag_encode(signed_delta), c_value_code_bits, delta_value, width);
+            }
+            prev_value = value;
+        }
+        return bits_flush(w);
+    }
+
+    bool stream_codec_decode(const u8 *src, u32 src_size, u64 *times, u8 *values, u32 count, u32 value_size, bool is_float)
+    {
+        bit_reader_t r = {src, src_size, 0, 0, 0, false};
+        if (count == 0)
+            return true;
+
+        const u32 width      = value_size * 8;
+        u64       prev_time  = bits_read(r, 64);
+        u64       prev_delta = 0;
+        u64       prev_value = bits_read(r, width);
+        times[0]             = prev_time;
+        store_value(values, 0, value_size, prev_value);
+
+        u32 window_lead  = 0;
+        u32 window_trail = 0;
+        for (u32 i = 1; i < count && !r.m_overrun; ++i)
+        {
+            bool      raw;
+            const u64 code = read_code(r, c_time_code_bits, 64, raw);
+            const u64 dod  = raw ? code : (u64)zigzag_decode(code);
+            prev_delta += dod;
+            prev_time += prev_delta;
+            times[i] = prev_time;
+
+            if (is_float)
+            {
+                if (bits_read(r, 1) != 0)
+                {
+                    if (bits_read(r, 1) != 0)
+                    {
+                        window_lead      = (u32)bits_read(r, 6);
+                        const u32 length = (u32)bits_read(r, 6) + 1;
+                        if (window_lead + length > width)
+                            return false;
+                        window_trail = width - window_lead - length;
+                    }
+                    prev_value ^= bits_read(r, width - window_lead - window_trail) << window_trail;
+                }
+            }
+            else
+            {
+                const u64 delta_value = read_code(r, c_value_code_bits, width, raw);
+                prev_value            = low_bits(prev_value + (raw ? delta_value : (u64)zigzag_decode(delta_value)), width);
+            }
+            store_value(values, i, value_size, prev_value);
+        }
+        return !r.m_overrun;
+    }
+
+}  // namespace ncore
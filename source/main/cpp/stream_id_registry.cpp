@@ -40,7 +40,7 @@ namespace ncore
                     pos++;
                 for (i16 i = m_count; i > pos; i--)
                     m_sorted[i] = m_sorted[i - 1];
-                m_sorted[pos] = (i16)m_count;
+                m_sorted[pos] = index;
                 m_count++;
             }
 
@@ -67,7 +67,7 @@ namespace ncore
         shard_t     *m_shards;
     };
 
-    stream_id_registry_t *stream_id_register_create(alloc_t *allocator, i32 capacity, u8 n_sharding_bits)
+    stream_id_registry_t *stream_id_registry_create(alloc_t *allocator, i32 capacity, u8 n_sharding_bits)
     {
         const i32             n_shards = 1 << n_sharding_bits;
         stream_id_registry_t *r        = (stream_id_registry_t *)allocator->allocate(sizeof(stream_id_registry_t));
@@ -78,10 +78,16 @@ namespace ncore
         r->m_size                      = 0;
         r->m_n_shards                  = n_shards;
         r->m_shards                    = (stream_id_registry_t::shard_t *)allocator->allocate(sizeof(stream_id_registry_t::shard_t) * n_shards);
+        for (i32 i = 0; i < n_shards; i++)
+        {
+            r->m_shards[i].m_count    = 0;
+            r->m_shards[i].m_capacity = 0;
+            r->m_shards[i].m_sorted   = nullptr;
+        }
         return r;
     }
 
-    void stream_id_register_destroy(stream_id_registry_t *&r)
+    void stream_id_registry_destroy(stream_id_registry_t *&r)
     {
         if (r != nullptr)
         {
@@ -92,25 +98,31 @@ namespace ncore
                     r->m_allocator->deallocate(shard.m_sorted);
             }
             r->m_allocator->deallocate(r->m_user_ids);
+            r->m_allocator->deallocate(r->m_stream_ids);
             r->m_allocator->deallocate(r->m_shards);
             r->m_allocator->deallocate(r);
             r = nullptr;
         }
     }
 
-    stream_id_t stream_id_register(stream_id_registry_t *r, u64 user_id)
+    bool stream_id_register(stream_id_registry_t *r, u64 user_id, stream_id_t stream_id)
     {
-        stream_id_t out_stream_id;
-        if (stream_id_find(r, user_id, out_stream_id))
-            return out_stream_id;
         const u32                      shard_index = (u32)((user_id >> 32) & (r->m_n_shards - 1));
         stream_id_registry_t::shard_t &shard       = r->m_shards[shard_index];
-        const i32                      index       = r->m_size;
-        r->m_user_ids[r->m_size]                   = user_id;
-        r->m_stream_ids[r->m_size]                 = index;
+        const i16                      found_index = shard.find(r->m_user_ids, user_id);
+        if (found_index >= 0)
+        {
+            r->m_stream_ids[found_index] = stream_id;
+            return true;
+        }
+        if (r->m_size >= r->m_capacity)
+            return false;
+        const i16 index          = (i16)r->m_size;
+        r->m_user_ids[index]     = user_id;
+        r->m_stream_ids[index]   = stream_id;
         shard.add(r->m_allocator, r->m_user_ids, index);
         r->m_size++;
-        return index;
+        return true;
     }
 
     bool stream_id_find(stream_id_registry_t *r, u64 user_id, stream_id_t &out_stream_id)
@@ -2,11 +2,17 @@
 #include "ccore/c_math.h"
 #include "ccore/c_memory.h"
 #include "ccore/c_arena.h"
+#include "ccore/c_qsort.h"
 #include "cbase/c_runes.h"
 
 #include "cconartist/stream_manager.h"
 #include "cconartist/stream_id_registry.h"
+#include "cconartist/stream_request.h"
+#include "cconartist/stream_codec.h"
+#include "cconartist/stream_rollup.h"
+#include "cconartist/stream_notify.h"
 #include "cconartist/channel.h"
+#include "cconartist/job_manager.h"
 
 #include "cmmio/c_mmio.h"
 
@@ -16,15 +22,30 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <sys/param.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <fcntl.h>
 #include <ctype.h>
+#include <errno.h>
 
 namespace ncore
 {
     // Notes:
     // - Stream Files are not to be used accross different platforms with different endianness
-    // - All is not thread safe, the user must ensure proper locking if multiple threads access this
-    // - stream_manager_t::update ?, where every night it analyzes the streams and finalize/rotates them if needed.
-    // - file naming convention: {name}_XXXX.stream, where XXXX is a 4 digit incrementing number.
+    // - All is not thread safe, the user must ensure proper locking if multiple threads access this. The exception are
+    //   readers of the stream files in other threads or processes (e.g. the GUI mapping them read-only), the writer
+    //   publishes every item with a seqlock on the header, see s_stream_publish and stream_file_snapshot.
+    //   Such readers can block until a stream advances, update publishes the item counts in streams.notify and
+    //   wakes them once per call, see stream_notify.h.
+    // - stream_manager_update estimates the fill rate of every read-write stream and prepares a larger successor file
+    //   ahead of time, a writer that finds its stream full swaps to the successor and update archives the full stream.
+    // - Update also schedules the flush of what was written since the previous flush on the job manager, the retired
+    //   stream of a rotation is not archived (unmapped) while a flush is in flight.
+    // - Archived streams are registered from a copy of their header (stream_ro_entry_t) and mapped on first access,
+    //   the least recently used mappings are closed again to stay within the budget of open mappings and bytes.
+    // - file naming convention: {name}.rwstream for the live stream, {YYYYMM}/{name}_XXXX.rostream for the archived
+    //   streams, where XXXX is the 4 digit user_index and YYYYMM the month the archived stream started in.
 
     namespace estream_mode
     {
@@ -45,9 +66,13 @@ namespace ncore
         u16 m_user_index;    // Index of the stream (in case multiple (historical) streams exist with the same user_id)
         u16 m_stream_type;   // (stream_type_t) Type of stream
         u16 m_reserved0;     // Type of the stream (sensor type, audio, video, etc)
-        u16 m_reserved1;     // Reserved for future use
+        u16 m_layout;        // Layout of the items, c_stream_layout_row or c_stream_layout_column
         u32 m_sizeof_item;   // Size of each item (bytes) in the stream (for fixed size streams)
-        u32 m_reserved2;     // Reserved for future use
+        union
+        {
+            u32 m_block_count;  // Number of blocks of a compressed stream (read-only, never changes)
+            u32 m_sequence;     // Publication sequence of a live stream, odd while the writer updates the header
+        };
         u64 m_time_begin;    // Time of the first item in the stream
         u64 m_stream_size;   // Size of the stream file in bytes
         u64 m_item_count;    // Number of items in the stream
@@ -55,23 +80,182 @@ namespace ncore
         u64 m_write_cursor;  // Cursor of where the next data will be written in the stream
     };
 
+    // A column layout stream file is a sequence of pages after the header. A page holds the u64 times of
+    // its items (relative to m_time_begin) followed by their values in a 64 byte aligned block, so that
+    // both can be read as plain arrays. Pages start at 64 byte aligned offsets since the header is 64 bytes.
+    // The write cursor is the offset of the time slot of the next item.
+    static const u64 c_column_page_size = 16 * cKB;
+
+    // Archived files of numeric streams are compressed (see stream_codec.h). After the header follows a
+    // directory with an entry per block of c_stream_codec_block_items items and then the encoded blocks,
+    // the write cursor is the end of the last block. Readers decode one block at a time into the block
+    // cache of the manager.
+    static const u16 c_stream_layout_compressed = 2;
+
+    struct stream_block_entry_t
+    {
+        u64 m_offset;      // Offset of the encoded block in the file
+        u64 m_time_first;  // Time of the first item in the block, relative to m_time_begin
+    };
+
+    // The decoded block, in the column layout and on request also in the row layout (for stream_read)
+    struct stream_block_cache_t
+    {
+        const stream_header_t* m_header;  // Compressed file the block is from, nullptr when empty
+        u32                    m_block;
+        u32                    m_count;
+        bool                   m_has_rows;
+        u64*                   m_times;
+        u8*                    m_values;
+        u8*                    m_rows;
+    };
+
+    // Sparse index from time to item, an entry every c_time_index_item_step items or every
+    // c_time_index_byte_step bytes (variable size items), whichever comes first. A lookup does a
+    // binary search on the entries and then reads at most one step of items sequentially.
+    // The index lives in memory, a stream is indexed by one sequential pass on the first lookup and
+    // from then on the writers keep it up to date.
+    static const u64 c_time_index_item_step = 1024;
+    static const u64 c_time_index_byte_step = 256 * cKB;
+
+    struct stream_time_entry_t
+    {
+        u64 m_time;    // Absolute time of the item, never less than the time of the previous entry
+        u64 m_offset;  // Offset of the item in the stream file
+        u64 m_item;    // Index of the item in the stream file
+    };
+
+    struct stream_time_index_t
+    {
+        stream_time_entry_t* m_entries;
+        u32                  m_count;
+        u32                  m_capacity;
+        u64                  m_indexed_items;   // Number of items that have been looked at
+        u64                  m_indexed_offset;  // Offset of the first item that has not been looked at
+    };
+
+    // Streams that wait for their file are written to a staging buffer, a stream header followed by the
+    // items exactly like a stream file, so the writers do not know the difference and the file gets the
+    // buffer with a single copy. The buffers are carved from one block that is allocated up front, which
+    // caps the memory used by streams without a file.
+    static const u32 c_staging_buffer_size  = 64 * cKB;
+    static const u32 c_staging_buffer_count = 64;
+    static const u64 c_stream_initial_size  = 4 * cMB;  // Size of the file created for a new stream
+    static const u32 c_ro_max_mappings      = 1024;     // Default budget of the mapped archived files
+    static const u64 c_ro_max_mapped_bytes  = (u64)8 * 1024 * cMB;  //
+
+    // An archived (read-only) stream file, registered with a copy of its header and only mapped when its items are
+    // needed, see s_ro_map. The mappings are closed again least recently used first when they exceed the budget.
+    struct stream_ro_entry_t
+    {
+        stream_header_t m_header;  // Copy of the header of the file
+        char*           m_filepath;
+        u64             m_file_size;
+        i32             m_lru_prev;   // Mapped streams, most recently used first, see s_ro_touch
+        i32             m_lru_next;   //
+        bool            m_pinned;     // A retired stream stays mapped (and out of the LRU list) until it has been archived
+    };
+
+    // A range of a mapped file that is written to disk by a flush job, a data range of a stream moves the flushed
+    // offset of the stream to 'm_cursor' once it is done (unless the stream swapped to its successor meanwhile)
+    struct stream_flush_range_t
+    {
+        u8*                    m_address;
+        u64                    m_size;
+        const stream_header_t* m_header;  // nullptr for a rollup or a header range
+        u64                    m_cursor;
+        u32                    m_stream_index;
+    };
+
+    // Filled on the main thread, msync'ed on a worker of the job manager
+    struct stream_flush_job_t
+    {
+        stream_flush_range_t* m_ranges;
+        u32                   m_count;
+        u32                   m_capacity;
+        u64                   m_bytes;
+        u64                   m_errors;
+        u64                   m_duration_us;
+    };
+
+    struct stream_catalog_file_t;
+
+    // Archiving a retired stream (sync, move to its archive directory, compress and write the catalog) is done by a job
+    // on the job manager, update fills it in and picks up the result, see s_archive_schedule and s_archive_done
+    struct stream_archive_job_t
+    {
+        const stream_header_t* m_retired;        // Mapped (pinned) header of the retired stream
+        nmmio::mappedfile_t*   m_retired_file;   //
+        nmmio::mappedfile_t*   m_output;         // The compressed file, mapped read-only once it replaced the archived file
+        nmmio::mappedfile_t*   m_catalog_file;   //
+        u64*                   m_times;          // A block of items to compress
+        u8*                    m_values;         //
+        u8*                    m_catalog;        // Catalog built by update, see s_catalog_build
+        u64                    m_catalog_size;   //
+        stream_catalog_file_t* m_catalog_entry;  // Entry of the retired stream in m_catalog
+        const char*            m_base_path;
+        char                   m_rw_path[MAXPATHLEN];
+        char                   m_dir_path[MAXPATHLEN];
+        char                   m_archive_path[MAXPATHLEN];
+        u32                    m_stream_index;
+        i32                    m_ro_index;
+        bool                   m_archived;       // Moved to the archive directory
+        u64                    m_compressed;     // Size of the compressed file, 0 when the file stayed as it is
+    };
+
     struct stream_manager_t
     {
         char*                   m_base_path;
-        time_t                  m_last_update_time;
+        f64                     m_last_update_time;
         alloc_t*                m_allocator;
         stream_id_registry_t*   m_stream_id_registry;
         i32                     m_num_ro_streams;
         i32                     m_max_ro_streams;
         nmmio::mappedfile_t**   m_ro_stream_files;
-        const stream_header_t** m_ro_streams;
-        const stream_header_t** m_ro_streams_sorted;  // For quick lookup by user_id
+        const stream_header_t** m_ro_streams;       // Header in the mapped file, nullptr while the file is not mapped
+        stream_ro_entry_t*      m_ro_entries;       //
+        stream_time_index_t*    m_ro_time_indices;  // Offsets, stays valid while the file is not mapped
+        i32*                    m_ro_sorted;        // Read-only streams ordered by (user_id, user_index), see s_ro_lower_bound
+        i32                     m_ro_lru_head;      // Mapped read-only streams that are not pinned, most recently used first
+        i32                     m_ro_lru_tail;      //
+        i32                     m_ro_mapped_count;  // Read-only streams that are mapped
+        u64                     m_ro_mapped_bytes;  //
+        u32                     m_ro_max_mappings;  // Budget, see stream_manager_set_ro_budget
+        u64                     m_ro_max_mapped_bytes;
         u32                     m_num_rw_streams;
         u32                     m_max_rw_streams;
         char**                  m_rw_stream_filepaths;
         void**                  m_rw_stream_memory;
         nmmio::mappedfile_t**   m_rw_stream_files;
         stream_header_t**       m_rw_streams;
+        stream_time_index_t*    m_rw_time_indices;
+        nmmio::mappedfile_t**   m_rw_rollup_files;  // Rollup of each numeric read-write stream ({name}.rollup), see stream_rollup.h
+        void**                  m_rw_rollups;       // nullptr while the stream is staged
+        u64*                    m_rw_archived_items;  // Items in the archived files of each read-write stream
+        u64*                    m_rw_flushed;         // Offset up to which each read-write stream has been flushed
+        nmmio::mappedfile_t**   m_rw_next_files;    // Successor of each read-write stream, prepared by update
+        stream_header_t**       m_rw_next_streams;  //
+        i32*                    m_rw_retired;       // Read-only slot of a stream that was swapped out and still has to be archived, or -1
+        i32                     m_num_successors;   // Read-only slots are reserved for the prepared successors
+        u8*                     m_rw_requested;     // A file has been requested for the staged stream
+        stream_request_manager_t* m_requests;       // Creates the files of new streams
+        u8*                     m_staging;          // c_staging_buffer_count buffers of c_staging_buffer_size bytes
+        u32*                    m_staging_free;     //
+        u32                     m_staging_free_count;
+        stream_manager_stats_t  m_stats;
+        stream_block_cache_t    m_block_cache;
+        stream_notify_t*        m_notify;  // Doorbell of the readers, nullptr when streams.notify could not be created
+        job_manager_t*          m_jobs;    // Runs the flushes, nullptr until stream_manager_set_job_manager
+        job_channel_t           m_flush_channel;
+        stream_flush_config_t   m_flush_config;
+        stream_flush_job_t      m_flush_job;
+        bool                    m_flush_in_flight;
+        f64                     m_last_flush_time;
+        job_channel_t           m_archive_channel;
+        stream_archive_job_t    m_archive_job;
+        bool                    m_archive_in_flight;
+        u32                     m_archive_next;  // Retired streams are archived round robin
+        u64                     m_page_size;
 
         DCORE_CLASS_PLACEMENT_NEW_DELETE
     };
@@ -88,18 +272,68 @@ namespace ncore
         return (ext && strcmp(ext, ".rwstream") == 0);
     }
 
+    static inline u32 s_column_page_items(const stream_header_t* header) { return (u32)((c_column_page_size - 64) / (sizeof(u64) + header->m_sizeof_item)); }
+    static inline u64 s_column_values_offset(u32 page_items) { return ((u64)page_items * sizeof(u64) + 63) & ~(u64)63; }
+    static inline u64 s_column_page_base(u64 offset) { return sizeof(stream_header_t) + ((offset - sizeof(stream_header_t)) / c_column_page_size) * c_column_page_size; }
+
+    // Offset of the item after the one at 'offset'
+    static inline u64 s_next_offset(const stream_header_t* header, u64 offset, u64 item_bytes)
+    {
+        if (header->m_layout != c_stream_layout_column)
+            return offset + item_bytes;
+        const u64 base = s_column_page_base(offset);
+        const u64 slot = (offset - base) / sizeof(u64);
+        return (slot + 1 < s_column_page_items(header)) ? offset + sizeof(u64) : base + c_column_page_size;
+    }
+
+    // An item of 'item_bytes' can be written at the write cursor
+    static inline bool s_stream_fits(const stream_header_t* header, u64 item_bytes)
+    {
+        if (header->m_layout != c_stream_layout_column)
+            return header->m_write_cursor + item_bytes <= header->m_stream_size;
+        return s_column_page_base(header->m_write_cursor) + c_column_page_size <= header->m_stream_size;
+    }
+
+    // Bytes of the stream file in use, including the header and the (partially filled) page of a column stream
+    static inline u64 s_stream_used_bytes(const stream_header_t* header)
+    {
+        if (header->m_layout != c_stream_layout_column)
+            return math::min(header->m_write_cursor, header->m_stream_size);
+        return math::min(s_column_page_base(header->m_write_cursor) + c_column_page_size, header->m_stream_size);
+    }
+
+    static void s_time_index_init(stream_time_index_t& index)
+    {
+        index.m_entries        = nullptr;
+        index.m_count          = 0;
+        index.m_capacity       = 0;
+        index.m_indexed_items  = 0;
+        index.m_indexed_offset = sizeof(stream_header_t);
+    }
+
+    static void s_time_index_release(alloc_t* allocator, stream_time_index_t& index)
+    {
+        if (index.m_entries != nullptr)
+            g_deallocate_array<stream_time_entry_t>(allocator, index.m_entries);
+        s_time_index_init(index);
+    }
+
     void stream_manager_resize_ro(stream_manager_t* m)
     {
-        if (m->m_num_ro_streams >= m->m_max_ro_streams)
+        if (m->m_num_ro_streams + m->m_num_successors >= m->m_max_ro_streams)
         {
             // Resize the read-only arrays
             i32                     new_max_ro_streams    = m->m_max_ro_streams * 2;
             nmmio::mappedfile_t**   new_ro_stream_files   = g_reallocate_array<nmmio::mappedfile_t*>(m->m_allocator, m->m_ro_stream_files, m->m_max_ro_streams, new_max_ro_streams);
             const stream_header_t** new_ro_streams        = g_reallocate_array<const stream_header_t*>(m->m_allocator, m->m_ro_streams, m->m_max_ro_streams, new_max_ro_streams);
-            const stream_header_t** new_ro_streams_sorted = g_reallocate_array<const stream_header_t*>(m->m_allocator, m->m_ro_streams_sorted, m->m_max_ro_streams, new_max_ro_streams);
+            stream_ro_entry_t*      new_ro_entries        = g_reallocate_array<stream_ro_entry_t>(m->m_allocator, m->m_ro_entries, m->m_max_ro_streams, new_max_ro_streams);
+            stream_time_index_t*    new_ro_time_indices   = g_reallocate_array<stream_time_index_t>(m->m_allocator, m->m_ro_time_indices, m->m_max_ro_streams, new_max_ro_streams);
+            i32*                    new_ro_sorted         = g_reallocate_array<i32>(m->m_allocator, m->m_ro_sorted, m->m_max_ro_streams, new_max_ro_streams);
             m->m_ro_stream_files                          = new_ro_stream_files;
             m->m_ro_streams                               = new_ro_streams;
-            m->m_ro_streams_sorted                        = new_ro_streams_sorted;
+            m->m_ro_entries                               = new_ro_entries;
+            m->m_ro_time_indices                          = new_ro_time_indices;
+            m->m_ro_sorted                                = new_ro_sorted;
             m->m_max_ro_streams                           = new_max_ro_streams;
         }
     }
@@ -113,57 +347,238 @@ namespace ncore
             char**                new_rw_stream_filepaths = g_reallocate_array<char*>(m->m_allocator, m->m_rw_stream_filepaths, m->m_max_rw_streams, new_max_rw_streams);
             nmmio::mappedfile_t** new_rw_stream_files     = g_reallocate_array<nmmio::mappedfile_t*>(m->m_allocator, m->m_rw_stream_files, m->m_max_rw_streams, new_max_rw_streams);
             stream_header_t**     new_rw_streams          = g_reallocate_array<stream_header_t*>(m->m_allocator, m->m_rw_streams, m->m_max_rw_streams, new_max_rw_streams);
+            stream_time_index_t*  new_rw_time_indices     = g_reallocate_array<stream_time_index_t>(m->m_allocator, m->m_rw_time_indices, m->m_max_rw_streams, new_max_rw_streams);
+            nmmio::mappedfile_t** new_rw_rollup_files     = g_reallocate_array<nmmio::mappedfile_t*>(m->m_allocator, m->m_rw_rollup_files, m->m_max_rw_streams, new_max_rw_streams);
+            void**                new_rw_rollups          = g_reallocate_array<void*>(m->m_allocator, m->m_rw_rollups, m->m_max_rw_streams, new_max_rw_streams);
+            u64*                  new_rw_archived_items   = g_reallocate_array<u64>(m->m_allocator, m->m_rw_archived_items, m->m_max_rw_streams, new_max_rw_streams);
+            u64*                  new_rw_flushed          = g_reallocate_array<u64>(m->m_allocator, m->m_rw_flushed, m->m_max_rw_streams, new_max_rw_streams);
+            nmmio::mappedfile_t** new_rw_next_files       = g_reallocate_array<nmmio::mappedfile_t*>(m->m_allocator, m->m_rw_next_files, m->m_max_rw_streams, new_max_rw_streams);
+            stream_header_t**     new_rw_next_streams     = g_reallocate_array<stream_header_t*>(m->m_allocator, m->m_rw_next_streams, m->m_max_rw_streams, new_max_rw_streams);
+            i32*                  new_rw_retired          = g_reallocate_array<i32>(m->m_allocator, m->m_rw_retired, m->m_max_rw_streams, new_max_rw_streams);
+            u8*                   new_rw_requested        = g_reallocate_array<u8>(m->m_allocator, m->m_rw_requested, m->m_max_rw_streams, new_max_rw_streams);
             m->m_rw_stream_filepaths                      = new_rw_stream_filepaths;
             m->m_rw_stream_files                          = new_rw_stream_files;
             m->m_rw_streams                               = new_rw_streams;
+            m->m_rw_time_indices                          = new_rw_time_indices;
+            m->m_rw_rollup_files                          = new_rw_rollup_files;
+            m->m_rw_rollups                               = new_rw_rollups;
+            m->m_rw_archived_items                        = new_rw_archived_items;
+            m->m_rw_flushed                               = new_rw_flushed;
+            m->m_rw_next_files                            = new_rw_next_files;
+            m->m_rw_next_streams                          = new_rw_next_streams;
+            m->m_rw_retired                               = new_rw_retired;
+            m->m_rw_requested                             = new_rw_requested;
             m->m_max_rw_streams                           = new_max_rw_streams;
         }
     }
 
-    void stream_manager_add_ro_stream(stream_manager_t* m, const char* filepath)
+    static void s_ro_lru_unlink(stream_manager_t* m, i32 ro_index)
     {
-        stream_manager_resize_ro(m);
+        stream_ro_entry_t& entry = m->m_ro_entries[ro_index];
+        if (entry.m_lru_prev >= 0)
+            m->m_ro_entries[entry.m_lru_prev].m_lru_next = entry.m_lru_next;
+        else
+            m->m_ro_lru_head = entry.m_lru_next;
+        if (entry.m_lru_next >= 0)
+            m->m_ro_entries[entry.m_lru_next].m_lru_prev = entry.m_lru_prev;
+        else
+            m->m_ro_lru_tail = entry.m_lru_prev;
+        entry.m_lru_prev = -1;
+        entry.m_lru_next = -1;
+    }
 
-        // Open the mapped file
-        nmmio::mappedfile_t* mmfile_ro = nullptr;
-        nmmio::allocate(m->m_allocator, mmfile_ro);
-        if (nmmio::open_ro(mmfile_ro, filepath))
+    static void s_ro_lru_push(stream_manager_t* m, i32 ro_index)
+    {
+        stream_ro_entry_t& entry = m->m_ro_entries[ro_index];
+        entry.m_lru_prev         = -1;
+        entry.m_lru_next         = m->m_ro_lru_head;
+        if (m->m_ro_lru_head >= 0)
+            m->m_ro_entries[m->m_ro_lru_head].m_lru_prev = ro_index;
+        else
+            m->m_ro_lru_tail = ro_index;
+        m->m_ro_lru_head = ro_index;
+    }
+
+    // A mapped stream that is not pinned moves to the head of the LRU list
+    static inline void s_ro_touch(stream_manager_t* m, i32 ro_index)
+    {
+        if (m->m_ro_lru_head == ro_index || m->m_ro_entries[ro_index].m_pinned)
+            return;
+        s_ro_lru_unlink(m, ro_index);
+        s_ro_lru_push(m, ro_index);
+    }
+
+    static void s_ro_unmap(stream_manager_t* m, i32 ro_index)
+    {
+        if (m->m_block_cache.m_header == m->m_ro_streams[ro_index])
+            m->m_block_cache.m_header = nullptr;  // Decoded from the file that is closed
+        s_ro_lru_unlink(m, ro_index);
+        nmmio::close(m->m_ro_stream_files[ro_index]);
+        nmmio::deallocate(m->m_allocator, m->m_ro_stream_files[ro_index]);
+        m->m_ro_stream_files[ro_index] = nullptr;
+        m->m_ro_streams[ro_index]      = nullptr;
+        m->m_ro_mapped_bytes -= m->m_ro_entries[ro_index].m_file_size;
+        m->m_ro_mapped_count -= 1;
+        m->m_stats.m_ro_unmaps += 1;
+    }
+
+    // Close the least recently used mappings until the budget is met, except for 'keep' (which is at the head of
+    // the LRU list) and pinned streams (which are not in it)
+    static void s_ro_evict(stream_manager_t* m, i32 keep)
+    {
+        while (m->m_ro_mapped_count > (i32)m->m_ro_max_mappings || m->m_ro_mapped_bytes > m->m_ro_max_mapped_bytes)
         {
-            // Get the stream header
-            const stream_header_t* header = (stream_header_t*)nmmio::address_ro(mmfile_ro);
-            if (header != nullptr)
-            {
-                // Register the read-only stream
-                m->m_ro_streams[m->m_num_ro_streams]        = header;
-                m->m_ro_streams_sorted[m->m_num_ro_streams] = header;
-                m->m_ro_stream_files[m->m_num_ro_streams]   = mmfile_ro;
-                m->m_num_ro_streams += 1;
+            const i32 victim = m->m_ro_lru_tail;
+            if (victim < 0 || victim == keep)
                 return;
-            }
-            nmmio::close(mmfile_ro);
+            s_ro_unmap(m, victim);
         }
-        nmmio::deallocate(m->m_allocator, mmfile_ro);
     }
 
-    // Find the largest user_index for the given user_id in the read-write streams
-    // This means that if there are multiple streams for the same user_id, and they can
-    // exist as read-only stream in sub folders, we need to find the largest user_index to assign
-    // to a new read-write stream.
-    static u16 stream_manager_largest_user_index_for(stream_manager_t* m, u64 user_id)
+    static void s_ro_add_mapping(stream_manager_t* m, i32 ro_index, nmmio::mappedfile_t* mmfile, const stream_header_t* header)
     {
-        u16 largest_index = 0;
-        for (i32 i = 0; i < m->m_num_ro_streams; i++)
+        m->m_ro_stream_files[ro_index] = mmfile;
+        m->m_ro_streams[ro_index]      = header;
+        m->m_ro_mapped_count += 1;
+        m->m_ro_mapped_bytes += m->m_ro_entries[ro_index].m_file_size;
+        if (!m->m_ro_entries[ro_index].m_pinned)
+            s_ro_lru_push(m, ro_index);
+    }
+
+    // The header of an archived stream, its file is mapped when it is not, nullptr when that fails
+    static const stream_header_t* s_ro_map(stream_manager_t* m, i32 ro_index)
+    {
+        stream_ro_entry_t& entry = m->m_ro_entries[ro_index];
+        if (m->m_ro_streams[ro_index] != nullptr)
         {
-            const stream_header_t* header = m->m_ro_streams[i];
-            if (header->m_user_id == user_id)
+            s_ro_touch(m, ro_index);
+            return m->m_ro_streams[ro_index];
+        }
+
+        nmmio::mappedfile_t* mmfile = nullptr;
+        nmmio::allocate(m->m_allocator, mmfile);
+        if (entry.m_filepath != nullptr && nmmio::open_ro(mmfile, entry.m_filepath))
+        {
+            // The file must still be the one that was registered
+            const stream_header_t* header = (const stream_header_t*)nmmio::address_ro(mmfile);
+            if (header != nullptr && header->m_user_id == entry.m_header.m_user_id && header->m_user_index == entry.m_header.m_user_index && header->m_layout == entry.m_header.m_layout)
             {
-                if (header->m_user_index > largest_index)
-                {
-                    largest_index = header->m_user_index;
-                }
+                s_ro_add_mapping(m, ro_index, mmfile, header);
+                m->m_stats.m_ro_maps += 1;
+                s_ro_evict(m, ro_index);
+                return header;
             }
+            nmmio::close(mmfile);
+        }
+        nmmio::deallocate(m->m_allocator, mmfile);
+        return nullptr;
+    }
+
+    // Order of the read-only streams in m_ro_sorted, streams with the same user_id and user_index stay in the order
+    // they were registered in
+    static inline bool s_ro_less(const stream_manager_t* m, i32 ro_index, u64 user_id, u32 user_index)
+    {
+        const stream_header_t& header = m->m_ro_entries[ro_index].m_header;
+        return header.m_user_id < user_id || (header.m_user_id == user_id && header.m_user_index < user_index);
+    }
+
+    static s8 s_ro_sorted_cmp_fn(const void* lhs, const void* rhs, const void* manager)
+    {
+        const stream_manager_t* m         = (const stream_manager_t*)manager;
+        const i32               lhs_index = *(i32 const*)lhs;
+        const i32               rhs_index = *(i32 const*)rhs;
+        const stream_header_t&  lhs_info  = m->m_ro_entries[lhs_index].m_header;
+        if (s_ro_less(m, lhs_index, m->m_ro_entries[rhs_index].m_header.m_user_id, m->m_ro_entries[rhs_index].m_header.m_user_index))
+            return -1;
+        if (s_ro_less(m, rhs_index, lhs_info.m_user_id, lhs_info.m_user_index))
+            return 1;
+        return (lhs_index < rhs_index) ? -1 : ((lhs_index > rhs_index) ? 1 : 0);
+    }
+
+    // Position in the first 'count' entries of m_ro_sorted of the first read-only stream at or after (user_id, user_index),
+    // a user_index above 0xFFFF gives the position after the last stream of the user
+    static i32 s_ro_lower_bound(const stream_manager_t* m, i32 count, u64 user_id, u32 user_index)
+    {
+        i32 lo = 0;
+        i32 hi = count;
+        while (lo < hi)
+        {
+            const i32 mid = lo + ((hi - lo) >> 1);
+            if (s_ro_less(m, m->m_ro_sorted[mid], user_id, user_index))
+                lo = mid + 1;
+            else
+                hi = mid;
         }
-        return largest_index;
+        return lo;
+    }
+
+    // The scan registers all archived streams first and sorts them once, afterwards a stream is inserted
+    static void s_ro_sort(stream_manager_t* m)
+    {
+        for (i32 i = 0; i < m->m_num_ro_streams; i++)
+            m->m_ro_sorted[i] = i;
+        nsort::sort<i32>(m->m_ro_sorted, (u32)m->m_num_ro_streams, s_ro_sorted_cmp_fn, m);
+    }
+
+    // 'ro_index' is the stream that was registered last, the ones before it are in m_ro_sorted
+    static void s_ro_insert_sorted(stream_manager_t* m, i32 ro_index)
+    {
+        const stream_header_t& header = m->m_ro_entries[ro_index].m_header;
+        const i32              pos    = s_ro_lower_bound(m, ro_index, header.m_user_id, (u32)header.m_user_index + 1);
+        memmove(&m->m_ro_sorted[pos + 1], &m->m_ro_sorted[pos], (ro_index - pos) * sizeof(i32));
+        m->m_ro_sorted[pos] = ro_index;
+    }
+
+    // Not in m_ro_sorted yet, see s_ro_sort and s_ro_insert_sorted
+    static i32 s_ro_register(stream_manager_t* m, const stream_header_t& header, const char* filepath, u64 file_size)
+    {
+        const i32          ro_index = m->m_num_ro_streams++;
+        stream_ro_entry_t& entry    = m->m_ro_entries[ro_index];
+        entry.m_header              = header;
+        entry.m_filepath            = (filepath != nullptr) ? g_duplicate_string(m->m_allocator, filepath) : nullptr;
+        entry.m_file_size           = file_size;
+        entry.m_lru_prev            = -1;
+        entry.m_lru_next            = -1;
+        entry.m_pinned              = false;
+        m->m_ro_streams[ro_index]      = nullptr;
+        m->m_ro_stream_files[ro_index] = nullptr;
+        s_time_index_init(m->m_ro_time_indices[ro_index]);
+        return ro_index;
+    }
+
+    // An archived stream is registered from its header, its file is mapped when it is read
+    void stream_manager_add_ro_stream(stream_manager_t* m, const char* filepath)
+    {
+        stream_manager_resize_ro(m);
+
+        const int fd = open(filepath, O_RDONLY);
+        if (fd < 0)
+            return;
+        struct stat     st;
+        stream_header_t header;
+        const bool      valid = fstat(fd, &st) == 0 && (u64)st.st_size >= sizeof(stream_header_t) && pread(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header);
+        ::close(fd);
+        if (valid)
+            s_ro_register(m, header, filepath, (u64)st.st_size);
+    }
+
+    void stream_manager_set_ro_budget(stream_manager_t* m, u32 max_mappings, u64 max_bytes)
+    {
+        m->m_ro_max_mappings     = max_mappings;
+        m->m_ro_max_mapped_bytes = max_bytes;
+        s_ro_evict(m, -1);
+    }
+
+    // Find the largest user_index for the given user_id in the read-only streams, or -1 if there are none
+    // This means that if there are multiple streams for the same user_id, and they can
+    // exist as read-only stream in sub folders, we need to find the largest user_index to assign
+    // to a new read-write stream.
+    static i32 stream_manager_largest_user_index_for(stream_manager_t* m, u64 user_id)
+    {
+        const i32 pos = s_ro_lower_bound(m, m->m_num_ro_streams, user_id, 0x10000);
+        if (pos > 0 && m->m_ro_entries[m->m_ro_sorted[pos - 1]].m_header.m_user_id == user_id)
+            return m->m_ro_entries[m->m_ro_sorted[pos - 1]].m_header.m_user_index;
+        return -1;
     }
 
     void stream_manager_add_rw_stream(stream_manager_t* m, const char* filepath)
@@ -179,11 +594,24 @@ namespace ncore
             stream_header_t* header = (stream_header_t*)nmmio::address_rw(mmfile_rw);
             if (header != nullptr)
             {
+                // A writer that stopped in the middle of s_stream_publish leaves an odd sequence
+                if ((header->m_sequence & 1) != 0)
+                    header->m_sequence += 1;
+
                 // Register the read-write stream
                 m->m_rw_stream_filepaths[m->m_num_rw_streams] = g_allocate_array<char>(m->m_allocator, strlen(filepath) + 1);
                 strlcpy((char*)m->m_rw_stream_filepaths[m->m_num_rw_streams], filepath, strlen(filepath) + 1);
                 m->m_rw_stream_files[m->m_num_rw_streams] = mmfile_rw;
                 m->m_rw_streams[m->m_num_rw_streams]      = header;
+                m->m_rw_next_files[m->m_num_rw_streams]   = nullptr;
+                m->m_rw_next_streams[m->m_num_rw_streams] = nullptr;
+                m->m_rw_retired[m->m_num_rw_streams]      = -1;
+                m->m_rw_requested[m->m_num_rw_streams]    = 0;
+                m->m_rw_rollup_files[m->m_num_rw_streams] = nullptr;
+                m->m_rw_rollups[m->m_num_rw_streams]      = nullptr;
+                m->m_rw_archived_items[m->m_num_rw_streams] = 0;  // Known after the scan
+                m->m_rw_flushed[m->m_num_rw_streams]        = 0;
+                s_time_index_init(m->m_rw_time_indices[m->m_num_rw_streams]);
                 m->m_num_rw_streams += 1;
                 return;
             }
@@ -192,18 +620,276 @@ namespace ncore
         nmmio::deallocate(m->m_allocator, mmfile_rw);
     }
 
+    // The catalog (streams.catalog in the base path) lists the archived files per directory together with a copy of
+    // their header, a restart registers them from the catalog without opening them. A directory that was modified
+    // after the catalog was written, or is not in it, is scanned again and the catalog is rewritten.
+    static const u32 c_catalog_magic   = 0x4C544143;  // 'CATL'
+    static const u32 c_catalog_version = 1;
+
+    struct stream_catalog_header_t
+    {
+        u32 m_magic;
+        u32 m_version;
+        u32 m_dir_count;
+        u32 m_file_count;
+        u32 m_names_size;
+        u32 m_reserved0;
+        s64 m_written;  // Time the catalog was written (seconds)
+        u8  m_reserved[32];
+    };
+
+    struct stream_catalog_dir_t
+    {
+        s64 m_mtime;  // Modification time of the directory when the catalog was written
+        u32 m_name;   // Offset of the name (relative to the base path) in the names
+        u32 m_first_file;
+        u32 m_file_count;
+        u32 m_reserved;
+    };
+
+    struct stream_catalog_file_t
+    {
+        stream_header_t m_header;
+        u64             m_file_size;
+        u32             m_name;  // Offset of the file name in the names
+        u32             m_reserved;
+    };
+
+    static inline const stream_catalog_dir_t*  s_catalog_dirs(const stream_catalog_header_t* catalog) { return (const stream_catalog_dir_t*)(catalog + 1); }
+    static inline const stream_catalog_file_t* s_catalog_files(const stream_catalog_header_t* catalog) { return (const stream_catalog_file_t*)(s_catalog_dirs(catalog) + catalog->m_dir_count); }
+    static inline const char*                  s_catalog_names(const stream_catalog_header_t* catalog) { return (const char*)(s_catalog_files(catalog) + catalog->m_file_count); }
+
+    static const stream_catalog_header_t* s_catalog_open(stream_manager_t* m, nmmio::mappedfile_t*& out_file)
+    {
+        char filepath[MAXPATHLEN];
+        snprintf(filepath, sizeof(filepath), "%s/streams.catalog", m->m_base_path);
+        out_file = nullptr;
+
+        struct stat st;
+        if (stat(filepath, &st) != 0 || (u64)st.st_size < sizeof(stream_catalog_header_t))
+            return nullptr;
+        nmmio::allocate(m->m_allocator, out_file);
+        if (nmmio::open_ro(out_file, filepath))
+        {
+            const stream_catalog_header_t* catalog = (const stream_catalog_header_t*)nmmio::address_ro(out_file);
+            if (catalog != nullptr && catalog->m_magic == c_catalog_magic && catalog->m_version == c_catalog_version &&
+                sizeof(stream_catalog_header_t) + (u64)catalog->m_dir_count * sizeof(stream_catalog_dir_t) + (u64)catalog->m_file_count * sizeof(stream_catalog_file_t) + catalog->m_names_size <= (u64)st.st_size)
+                return catalog;
+            nmmio::close(out_file);
+        }
+        nmmio::deallocate(m->m_allocator, out_file);
+        return nullptr;
+    }
+
+    static void s_catalog_close(stream_manager_t* m, nmmio::mappedfile_t*& file)
+    {
+        if (file == nullptr)
+            return;
+        nmmio::close(file);
+        nmmio::deallocate(m->m_allocator, file);
+    }
+
+    // The directory when it has not been modified since the catalog was written (a modification in the same second
+    // can not be told apart, so it counts as modified)
+    static const stream_catalog_dir_t* s_catalog_find_dir(const stream_catalog_header_t* catalog, const char* name, s64 mtime)
+    {
+        const stream_catalog_dir_t* dirs = s_catalog_dirs(catalog);
+        for (u32 i = 0; i < catalog->m_dir_count; i++)
+        {
+            if (strcmp(s_catalog_names(catalog) + dirs[i].m_name, name) == 0)
+                return (dirs[i].m_mtime == mtime && mtime < catalog->m_written) ? &dirs[i] : nullptr;
+        }
+        return nullptr;
+    }
+
+    static void s_catalog_register_dir(stream_manager_t* m, const stream_catalog_header_t* catalog, const stream_catalog_dir_t* dir, const char* dir_path)
+    {
+        const stream_catalog_file_t* files = s_catalog_files(catalog) + dir->m_first_file;
+        char                         filepath[MAXPATHLEN];
+        for (u32 i = 0; i < dir->m_file_count; i++)
+        {
+            stream_manager_resize_ro(m);
+            snprintf(filepath, sizeof(filepath), "%s/%s", dir_path, s_catalog_names(catalog) + files[i].m_name);
+            s_ro_register(m, files[i].m_header, filepath, files[i].m_file_size);
+        }
+    }
+
+    // Directory of an archived file relative to the base path, 0 when the file is not in a directory of the base path
+    static u32 s_catalog_dir_name(const stream_manager_t* m, const char* filepath, const char*& out_name)
+    {
+        const u32 base_len = (u32)strlen(m->m_base_path);
+        if (filepath == nullptr || strncmp(filepath, m->m_base_path, base_len) != 0 || filepath[base_len] != '/')
+            return 0;
+        out_name          = filepath + base_len + 1;
+        const char* slash = strrchr(out_name, '/');
+        return (slash != nullptr && slash > out_name) ? (u32)(slash - out_name) : 0;
+    }
+
+    // Path of a read-only stream in the catalog, 'filepath' for 'ro_index' (a stream that is being archived)
+    static inline const char* s_catalog_path(const stream_manager_t* m, i32 i, i32 ro_index, const char* filepath) { return (i == ro_index) ? filepath : m->m_ro_entries[i].m_filepath; }
+
+    // The catalog of the archived files in memory, the modification times of the directories and the time it was
+    // written are filled in by s_catalog_store. The entry of 'ro_index' is listed at 'filepath' and returned in
+    // 'out_file' (nullptr when there is no such entry).
+    static u8* s_catalog_build(stream_manager_t* m, i32 ro_index, const char* filepath, u64& out_size, stream_catalog_file_t*& out_file)
+    {
+        // The directory of every archived file (-1 for a file that is not archived yet), files of the same
+        // directory are mostly next to each other
+        i32* file_dir   = g_allocate_array<i32>(m->m_allocator, m->m_num_ro_streams + 1);
+        i32* dir_sample = g_allocate_array<i32>(m->m_allocator, m->m_num_ro_streams + 1);  // A file of each directory
+        u32* dir_files  = g_allocate_array_and_clear<u32>(m->m_allocator, m->m_num_ro_streams + 1);
+        u32  dir_count  = 0;
+        u32  file_count = 0;
+        u32  names_size = 0;
+        for (i32 i = 0; i < m->m_num_ro_streams; i++)
+        {
+            file_dir[i] = -1;
+            const char* name;
+            const u32   len = s_catalog_dir_name(m, s_catalog_path(m, i, ro_index, filepath), name);
+            if (len == 0)
+                continue;
+            // Same directory as the previous file, otherwise look it up
+            i32         dir = (i > 0) ? file_dir[i - 1] : -1;
+            const char* dir_name;
+            if (dir < 0 || s_catalog_dir_name(m, s_catalog_path(m, dir_sample[dir], ro_index, filepath), dir_name) != len || strncmp(dir_name, name, len) != 0)
+            {
+                for (dir = 0; dir < (i32)dir_count; dir++)
+                {
+                    if (s_catalog_dir_name(m, s_catalog_path(m, dir_sample[dir], ro_index, filepath), dir_name) == len && strncmp(dir_name, name, len) == 0)
+                        break;
+                }
+                if (dir == (i32)dir_count)
+                {
+                    dir_sample[dir_count++] = i;
+                    names_size += len + 1;
+                }
+            }
+            file_dir[i] = dir;
+            dir_files[dir] += 1;
+            file_count += 1;
+            names_size += (u32)strlen(name + len + 1) + 1;
+        }
+
+        out_size = sizeof(stream_catalog_header_t) + (u64)dir_count * sizeof(stream_catalog_dir_t) + (u64)file_count * sizeof(stream_catalog_file_t) + names_size;
+        out_file = nullptr;
+        u8* data = g_allocate_array<u8>(m->m_allocator, (uint_t)out_size);
+
+        stream_catalog_header_t* catalog = (stream_catalog_header_t*)data;
+        memset(catalog, 0, sizeof(stream_catalog_header_t));
+        catalog->m_magic      = c_catalog_magic;
+        catalog->m_version    = c_catalog_version;
+        catalog->m_dir_count  = dir_count;
+        catalog->m_file_count = file_count;
+        catalog->m_names_size = names_size;
+
+        stream_catalog_dir_t*  dirs  = (stream_catalog_dir_t*)s_catalog_dirs(catalog);
+        stream_catalog_file_t* files = (stream_catalog_file_t*)s_catalog_files(catalog);
+        char*                  names = (char*)s_catalog_names(catalog);
+        u32                    first = 0;
+        u32                    used  = 0;
+        for (u32 d = 0; d < dir_count; d++)
+        {
+            const char* dir_name;
+            const u32   len      = s_catalog_dir_name(m, s_catalog_path(m, dir_sample[d], ro_index, filepath), dir_name);
+            dirs[d].m_mtime      = 0;
+            dirs[d].m_name       = used;
+            dirs[d].m_first_file = first;
+            dirs[d].m_file_count = 0;
+            dirs[d].m_reserved   = 0;
+            memcpy(names + used, dir_name, len);
+            names[used + len] = 0;
+            used += len + 1;
+            first += dir_files[d];
+        }
+        for (i32 i = 0; i < m->m_num_ro_streams; i++)
+        {
+            if (file_dir[i] < 0)
+                continue;
+            const char*            name;
+            const u32              len  = s_catalog_dir_name(m, s_catalog_path(m, i, ro_index, filepath), name);
+            stream_catalog_dir_t&  dir  = dirs[file_dir[i]];
+            stream_catalog_file_t& file = files[dir.m_first_file + dir.m_file_count++];
+            const u32              leaf = (u32)strlen(name + len + 1) + 1;
+            file.m_header               = m->m_ro_entries[i].m_header;
+            file.m_file_size            = m->m_ro_entries[i].m_file_size;
+            file.m_name                 = used;
+            file.m_reserved             = 0;
+            memcpy(names + used, name + len + 1, leaf);
+            used += leaf;
+            if (i == ro_index)
+                out_file = &file;
+        }
+
+        g_deallocate_array<i32>(m->m_allocator, file_dir);
+        g_deallocate_array<i32>(m->m_allocator, dir_sample);
+        g_deallocate_array<u32>(m->m_allocator, dir_files);
+        return data;
+    }
+
+    // Write a catalog built by s_catalog_build, next to it first and then renamed over it. Does not allocate, so that
+    // it can run on a worker of the job manager.
+    static void s_catalog_store(const char* base_path, nmmio::mappedfile_t* mmfile, u8* data, u64 size)
+    {
+        stream_catalog_header_t* catalog = (stream_catalog_header_t*)data;
+        stream_catalog_dir_t*    dirs    = (stream_catalog_dir_t*)s_catalog_dirs(catalog);
+        char                     path[MAXPATHLEN];
+        for (u32 d = 0; d < catalog->m_dir_count; d++)
+        {
+            struct stat st;
+            snprintf(path, sizeof(path), "%s/%s", base_path, s_catalog_names(catalog) + dirs[d].m_name);
+            dirs[d].m_mtime = (stat(path, &st) == 0) ? (s64)st.st_mtime : 0;
+        }
+        catalog->m_written = (s64)time(nullptr);
+
+        char filepath[MAXPATHLEN];
+        snprintf(filepath, sizeof(filepath), "%s/streams.catalog", base_path);
+        snprintf(path, sizeof(path), "%s.tmp", filepath);
+        bool written = false;
+        if (nmmio::create_rw(mmfile, path, size))
+        {
+            void* dst = nmmio::address_rw(mmfile);
+            if (dst != nullptr)
+            {
+                memcpy(dst, data, size);
+                nmmio::sync(mmfile);
+                written = true;
+            }
+            nmmio::close(mmfile);
+        }
+        if (!written || rename(path, filepath) != 0)
+            remove(path);
+    }
+
+    static void s_catalog_write(stream_manager_t* m)
+    {
+        u64                    size;
+        stream_catalog_file_t* file;
+        u8*                    data   = s_catalog_build(m, -1, nullptr, size, file);
+        nmmio::mappedfile_t*   mmfile = nullptr;
+        nmmio::allocate(m->m_allocator, mmfile);
+        s_catalog_store(m->m_base_path, mmfile, data, size);
+        nmmio::deallocate(m->m_allocator, mmfile);
+        g_deallocate_array<u8>(m->m_allocator, data);
+    }
+
     // Scan the base path and register any read-only or read-write stream files found.
     // This will collect *.rwstream files in the root of `m->m_base_path` and also
     // scan one directory level deep for numeric directories containing *.rostream files.
     static bool s_dir_is_current_or_parent(const char* name) { return (strcmp(name, ".") == 0 || strcmp(name, "..") == 0); }
 
-    static void stream_manager_scan_basepath(stream_manager_t* m)
+    // Returns false when the catalog is missing or out of date.
+    static bool stream_manager_scan_basepath(stream_manager_t* m)
     {
         char full_path[MAXPATHLEN];
 
         DIR* dir = opendir(m->m_base_path);
         if (!dir)
-            return;
+            return true;
+
+        nmmio::mappedfile_t*           catalog_file = nullptr;
+        const stream_catalog_header_t* catalog      = s_catalog_open(m, catalog_file);
+        u32                            catalog_dirs = 0;  // Directories taken from the catalog
+        bool                           rescanned    = false;
 
         struct dirent* entry;
         while ((entry = readdir(dir)) != nullptr)
@@ -226,9 +912,19 @@ namespace ncore
             }
 
             snprintf(full_path, sizeof(full_path), "%s/%s", m->m_base_path, entry->d_name);
+            struct stat                 st;
+            const stream_catalog_dir_t* catalog_dir = (catalog != nullptr && stat(full_path, &st) == 0) ? s_catalog_find_dir(catalog, entry->d_name, (s64)st.st_mtime) : nullptr;
+            if (catalog_dir != nullptr)
+            {
+                s_catalog_register_dir(m, catalog, catalog_dir, full_path);
+                catalog_dirs += 1;
+                continue;
+            }
+
             DIR* subdir = opendir(full_path);
             if (!subdir)
                 continue;
+            rescanned = true;
 
             struct dirent* subentry;
             char           sub_full[MAXPATHLEN];
@@ -245,6 +941,27 @@ namespace ncore
             closedir(subdir);
         }
         closedir(dir);
+
+        // A directory of the catalog that no longer exists also makes it out of date
+        const bool up_to_date = catalog != nullptr && !rescanned && catalog_dirs == catalog->m_dir_count;
+        s_catalog_close(m, catalog_file);
+        return up_to_date;
+    }
+
+    static void s_rollup_open(stream_manager_t* m, u32 stream_index);
+
+    // Sum of the items in the archived files of a stream, kept up to date by s_stream_swap
+    static u64 s_stream_archived_items(const stream_manager_t* m, const stream_header_t* rw_header)
+    {
+        u64 items = 0;
+        for (i32 i = s_ro_lower_bound(m, m->m_num_ro_streams, rw_header->m_user_id, 0); i < m->m_num_ro_streams; i++)
+        {
+            const stream_header_t* header = &m->m_ro_entries[m->m_ro_sorted[i]].m_header;
+            if (header->m_user_id != rw_header->m_user_id || header->m_user_index >= rw_header->m_user_index)
+                break;
+            items += header->m_item_count;
+        }
+        return items;
     }
 
     stream_manager_t* stream_manager_create(alloc_t* allocator, i32 max_streams, const char* base_path)
@@ -259,104 +976,1139 @@ namespace ncore
         stream_manager_t* m = g_construct<stream_manager_t>(allocator);
         m->m_base_path      = g_allocate_array<char>(allocator, strlen(base_path) + 1);
         strcpy((char*)m->m_base_path, base_path);
-        m->m_last_update_time    = time(nullptr);  // Current time
+        m->m_last_update_time    = 0.0;
         m->m_allocator           = allocator;
         m->m_stream_id_registry  = stream_id_registry_create(allocator, max_streams);
         m->m_num_ro_streams      = 0;
         m->m_max_ro_streams      = max_streams;
+        m->m_ro_stream_files     = g_allocate_array_and_clear<nmmio::mappedfile_t*>(allocator, max_streams);
         m->m_ro_streams          = g_allocate_array_and_clear<const stream_header_t*>(allocator, max_streams);
-        m->m_ro_streams_sorted   = g_allocate_array_and_clear<const stream_header_t*>(allocator, max_streams);
+        m->m_ro_entries          = g_allocate_array_and_clear<stream_ro_entry_t>(allocator, max_streams);
+        m->m_ro_time_indices     = g_allocate_array_and_clear<stream_time_index_t>(allocator, max_streams);
+        m->m_ro_sorted           = g_allocate_array<i32>(allocator, max_streams);
+        m->m_ro_lru_head         = -1;
+        m->m_ro_lru_tail         = -1;
+        m->m_ro_mapped_count     = 0;
+        m->m_ro_mapped_bytes     = 0;
+        m->m_ro_max_mappings     = c_ro_max_mappings;
+        m->m_ro_max_mapped_bytes = c_ro_max_mapped_bytes;
         m->m_num_rw_streams      = 0;
         m->m_max_rw_streams      = max_streams;
         m->m_rw_stream_filepaths = g_allocate_array_and_clear<char*>(allocator, max_streams);
         m->m_rw_stream_files     = g_allocate_array_and_clear<nmmio::mappedfile_t*>(allocator, max_streams);
         m->m_rw_streams          = g_allocate_array_and_clear<stream_header_t*>(allocator, max_streams);
-
-        // Scan base path and register streams
-        stream_manager_scan_basepath(m);
+        m->m_rw_time_indices     = g_allocate_array_and_clear<stream_time_index_t>(allocator, max_streams);
+        m->m_rw_rollup_files     = g_allocate_array_and_clear<nmmio::mappedfile_t*>(allocator, max_streams);
+        m->m_rw_rollups          = g_allocate_array_and_clear<void*>(allocator, max_streams);
+        m->m_rw_archived_items   = g_allocate_array_and_clear<u64>(allocator, max_streams);
+        m->m_rw_flushed          = g_allocate_array_and_clear<u64>(allocator, max_streams);
+        m->m_rw_next_files       = g_allocate_array_and_clear<nmmio::mappedfile_t*>(allocator, max_streams);
+        m->m_rw_next_streams     = g_allocate_array_and_clear<stream_header_t*>(allocator, max_streams);
+        m->m_rw_retired          = g_allocate_array<i32>(allocator, max_streams);
+        m->m_num_successors      = 0;
+        m->m_rw_requested        = g_allocate_array_and_clear<u8>(allocator, max_streams);
+        m->m_requests            = nullptr;
+        m->m_staging             = g_allocate_array<u8>(allocator, (uint_t)c_staging_buffer_count * c_staging_buffer_size);
+        m->m_staging_free        = g_allocate_array<u32>(allocator, c_staging_buffer_count);
+        m->m_staging_free_count  = 0;
+        for (u32 i = 0; i < c_staging_buffer_count; i++)
+            m->m_staging_free[m->m_staging_free_count++] = c_staging_buffer_count - 1 - i;
+        memset(&m->m_stats, 0, sizeof(m->m_stats));
+        m->m_block_cache.m_header   = nullptr;
+        m->m_block_cache.m_has_rows = false;
+        m->m_block_cache.m_times    = g_allocate_array<u64>(allocator, c_stream_codec_block_items);
+        m->m_block_cache.m_values   = g_allocate_array<u8>(allocator, c_stream_codec_block_items * sizeof(u64));
+        m->m_block_cache.m_rows     = g_allocate_array<u8>(allocator, c_stream_codec_block_items * (c_relative_time_byte_count + sizeof(u64)));
+        m->m_notify                 = stream_notify_create(allocator, base_path);
+
+        // Flushes are synchronous (stream_manager_flush) until a job manager is set
+        m->m_jobs                       = nullptr;
+        m->m_flush_channel              = -1;
+        m->m_flush_config.m_interval    = 5.0;
+        m->m_flush_config.m_dirty_bytes = 0;
+        m->m_flush_in_flight            = false;
+        m->m_last_flush_time            = 0.0;
+        m->m_page_size                  = (u64)sysconf(_SC_PAGESIZE);
+        memset(&m->m_flush_job, 0, sizeof(m->m_flush_job));
+        memset(&m->m_archive_job, 0, sizeof(m->m_archive_job));
+        m->m_archive_channel      = -1;
+        m->m_archive_in_flight    = false;
+        m->m_archive_next         = 0;
+        m->m_archive_job.m_times  = g_allocate_array<u64>(allocator, c_stream_codec_block_items);
+        m->m_archive_job.m_values = g_allocate_array<u8>(allocator, c_stream_codec_block_items * sizeof(u64));
+
+        // Scan base path and register streams, the archived streams mostly from the catalog
+        if (!stream_manager_scan_basepath(m))
+            s_catalog_write(m);
+        s_ro_sort(m);
+        for (u32 i = 0; i < m->m_num_rw_streams; i++)
+        {
+            stream_id_register(m->m_stream_id_registry, m->m_rw_streams[i]->m_user_id, i);
+            m->m_rw_archived_items[i] = s_stream_archived_items(m, m->m_rw_streams[i]);
+            s_rollup_open(m, i);  // After the scan, catching up reads the archived files as well
+        }
 
         return m;
     }
 
-    void stream_manager_flush(stream_manager_t* manager)
+    static void s_flush_add_range(stream_manager_t* m, u8* address, u64 size, const stream_header_t* header, u64 cursor, u32 stream_index)
     {
-        // Flush all read-write streams to disk
-        for (u32 i = 0; i < manager->m_num_rw_streams; i++)
+        stream_flush_job_t& job = m->m_flush_job;
+        if (job.m_count == job.m_capacity)
         {
-            nmmio::mappedfile_t* rw_file = manager->m_rw_stream_files[i];
-            if (rw_file != nullptr)
-            {
-                nmmio::sync(rw_file);
-            }
+            const u32 capacity = job.m_capacity == 0 ? 64 : job.m_capacity * 2;
+            job.m_ranges       = g_reallocate_array<stream_flush_range_t>(m->m_allocator, job.m_ranges, job.m_capacity, capacity);
+            job.m_capacity     = capacity;
         }
+        stream_flush_range_t& range = job.m_ranges[job.m_count++];
+        range.m_address             = address;
+        range.m_size                = size;
+        range.m_header              = header;
+        range.m_cursor              = cursor;
+        range.m_stream_index        = stream_index;
     }
 
-    void stream_manager_update(stream_manager_t* manager, f64 now)
+    // Bytes written to a stream since its last flush
+    static inline u64 s_flush_dirty_bytes(const stream_manager_t* m, u32 stream_index)
     {
-        // Check time since last update and skip if too soon
-        //  - We only want to do this once in a while, e.g. once every day
-        // Update the stream manager
-        //  - Check if any streams need to 'grow'
-        //    We can do this by 'closing' the stream, and opening it again with a larger size.
-        // Using m_time_begin and m_time_end together with m_item_count we can determine the throughput
-        // and determine how many days a stream still has to go before it should be extended in size.
+        const stream_header_t* header = m->m_rw_streams[stream_index];
+        if (header == nullptr || m->m_rw_stream_files[stream_index] == nullptr)
+            return 0;
+        const u64 used = s_stream_used_bytes(header);
+        return used > m->m_rw_flushed[stream_index] ? used - m->m_rw_flushed[stream_index] : 0;
+    }
 
-        // Check the stream request channel for any completed stream requests and process them.
-        // A completed stream request provides us with an opened mmapped file that we can use
-        // to back the read-write stream instead of the memory stream we have been using so far.
-        // - Copy the memory stream contents to the mmapped file
-        // - Update the stream header in the stream manager
-        // - Update the filename of the read-write stream in the stream manager
-        // - Deallocate the memory stream and set its pointer to nullptr
-        // - Set the mapped file pointer in the stream manager
+    // Collect the dirty ranges of all streams, msync wants page aligned addresses. The header is part of the first
+    // page, a stream that was flushed before needs that page as a range of its own.
+    // A rollup is updated all over (three tiers), the whole rollup of a stream with dirty items is flushed with it.
+    static void s_flush_collect(stream_manager_t* m)
+    {
+        stream_flush_job_t& job = m->m_flush_job;
+        job.m_count             = 0;
+        job.m_bytes             = 0;
+        job.m_errors            = 0;
+        job.m_duration_us       = 0;
+        const u64 page_mask     = ~(m->m_page_size - 1);
+        for (u32 i = 0; i < m->m_num_rw_streams; i++)
+        {
+            if (s_flush_dirty_bytes(m, i) == 0)
+                continue;
+            stream_header_t* header = m->m_rw_streams[i];
+            const u64        used   = s_stream_used_bytes(header);
+            const u64        begin  = m->m_rw_flushed[i] & page_mask;
+            if (begin > 0)
+                s_flush_add_range(m, (u8*)header, math::min(m->m_page_size, header->m_stream_size), nullptr, 0, i);
+            s_flush_add_range(m, (u8*)header + begin, used - begin, header, used, i);
+            if (m->m_rw_rollups[i] != nullptr)
+                s_flush_add_range(m, (u8*)m->m_rw_rollups[i], stream_rollup_size(), nullptr, 0, i);
+        }
     }
 
-    void stream_manager_destroy(alloc_t* allocator, stream_manager_t*& manager)
+    static u64 s_flush_now_us()
     {
-        // Destroy the stream manager
-        //  - Flush and close all open streams
-        //  - Deallocate all memory used by the stream manager
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (u64)ts.tv_sec * 1000000 + (u64)ts.tv_nsec / 1000;
+    }
 
-        // Close all read-write streams
-        for (u32 i = 0; i < manager->m_num_rw_streams; i++)
+    // Runs on a worker of the job manager (or on the caller for stream_manager_flush). MS_SYNC blocks only the worker,
+    // and a range only counts as flushed once it is on disk. MS_ASYNC does not write anything on Linux, and
+    // sync_file_range needs the descriptor of the file (nmmio does not expose it) and does not write the metadata.
+    static void s_flush_job_fn(void* job_data0, void* job_data1)
+    {
+        CC_UNUSED(job_data1);
+        stream_flush_job_t* job   = (stream_flush_job_t*)job_data0;
+        const u64           start = s_flush_now_us();
+        for (u32 i = 0; i < job->m_count; i++)
         {
-            nmmio::mappedfile_t* rw_file = manager->m_rw_stream_files[i];
-            if (rw_file != nullptr)
-            {
-                nmmio::sync(rw_file);
-                nmmio::close(rw_file);
-                nmmio::deallocate(manager->m_allocator, rw_file);
-                manager->m_rw_stream_files[i] = nullptr;
-            }
+            const stream_flush_range_t& range = job->m_ranges[i];
+            if (msync(range.m_address, range.m_size, MS_SYNC) != 0)
+                job->m_errors += 1;
+            job->m_bytes += range.m_size;
         }
-        g_deallocate_array<char*>(allocator, manager->m_rw_stream_filepaths);
-        g_deallocate_array<nmmio::mappedfile_t*>(allocator, manager->m_rw_stream_files);
-        g_deallocate_array<stream_header_t*>(allocator, manager->m_rw_streams);
+        job->m_duration_us = s_flush_now_us() - start;
+    }
 
-        // Close all read-only streams
-        for (i32 i = 0; i < manager->m_num_ro_streams; i++)
+    static void s_flush_done(stream_manager_t* m)
+    {
+        const stream_flush_job_t& job = m->m_flush_job;
+        for (u32 i = 0; i < job.m_count; i++)
         {
-            nmmio::mappedfile_t* ro_file = manager->m_ro_stream_files[i];
-            if (ro_file != nullptr)
-            {
-                nmmio::close(ro_file);
-                nmmio::deallocate(manager->m_allocator, ro_file);
-                manager->m_ro_stream_files[i] = nullptr;
-            }
+            const stream_flush_range_t& range = job.m_ranges[i];
+            if (range.m_header != nullptr && m->m_rw_streams[range.m_stream_index] == range.m_header)
+                m->m_rw_flushed[range.m_stream_index] = range.m_cursor;
         }
-
-        g_deallocate_array<nmmio::mappedfile_t*>(allocator, manager->m_ro_stream_files);
-        g_deallocate_array<const stream_header_t*>(allocator, manager->m_ro_streams);
-        g_deallocate_array<const stream_header_t*>(allocator, manager->m_ro_streams_sorted);
-
-        g_deallocate_array<char>(allocator, manager->m_base_path);
-
-        g_destruct(allocator, manager);
+        m->m_stats.m_flushes += 1;
+        m->m_stats.m_flushed_bytes += job.m_bytes;
+        m->m_stats.m_flush_errors += job.m_errors;
+        m->m_stats.m_flush_last_us = job.m_duration_us;
+        m->m_stats.m_flush_max_us  = math::max(m->m_stats.m_flush_max_us, job.m_duration_us);
+        m->m_stats.m_flush_total_us += job.m_duration_us;
+        m->m_flush_in_flight = false;
     }
 
-    static u8* stream_write_u64_le(u8* dest, u64 value, u8 byte_count)
+    // Pick up the flush that completed, or wait for it
+    static void s_flush_poll(stream_manager_t* m, bool wait)
     {
-        for (u8 i = 0; i < byte_count; i++)
+        if (!m->m_flush_in_flight)
+            return;
+        void* job_data0;
+        void* job_data1;
+        const i32 result = wait ? pop_job_wait(m->m_jobs, m->m_flush_channel, job_data0, job_data1) : pop_job(m->m_jobs, m->m_flush_channel, job_data0, job_data1);
+        if (result == 0)
+            s_flush_done(m);
+    }
+
+    static void s_flush_schedule(stream_manager_t* m, f64 now)
+    {
+        if (m->m_jobs == nullptr || m->m_flush_in_flight)
+            return;
+        if (now - m->m_last_flush_time < m->m_flush_config.m_interval)
+        {
+            if (m->m_flush_config.m_dirty_bytes == 0)
+                return;
+            u64 dirty = 0;
+            for (u32 i = 0; i < m->m_num_rw_streams && dirty < m->m_flush_config.m_dirty_bytes; i++)
+                dirty += s_flush_dirty_bytes(m, i);
+            if (dirty < m->m_flush_config.m_dirty_bytes)
+                return;
+        }
+        m->m_last_flush_time = now;
+        s_flush_collect(m);
+        if (m->m_flush_job.m_count > 0 && push_job(m->m_jobs, m->m_flush_channel, s_flush_job_fn, &m->m_flush_job, nullptr) == 0)
+            m->m_flush_in_flight = true;
+    }
+
+    static void s_archive_poll(stream_manager_t* m, bool wait);
+
+    void stream_manager_set_job_manager(stream_manager_t* manager, job_manager_t* jobs, const stream_flush_config_t& config)
+    {
+        s_flush_poll(manager, true);
+        s_archive_poll(manager, true);
+        if (jobs != manager->m_jobs)
+        {
+            manager->m_jobs            = jobs;
+            manager->m_flush_channel   = (jobs != nullptr) ? init_channel(jobs, 2) : -1;
+            manager->m_archive_channel = (jobs != nullptr) ? init_channel(jobs, 2) : -1;
+        }
+        manager->m_flush_config = config;
+    }
+
+    void stream_manager_flush(stream_manager_t* manager)
+    {
+        // Write the dirty ranges of all read-write streams to disk on this thread
+        s_flush_poll(manager, true);
+        s_flush_collect(manager);
+        s_flush_job_fn(&manager->m_flush_job, nullptr);
+        s_flush_done(manager);
+    }
+
+    static const f64 c_stream_update_interval = 10.0;                      // Seconds between two fill rate estimates
+    static const f64 c_stream_rotation_lead   = 24.0 * 3600.0 * 1000.0;       // A successor is prepared when a stream has less than this (ms) to go
+    static const f64 c_stream_target_span     = 30.0 * 24.0 * 3600.0 * 1000.0;  // A successor is sized to last this long (ms)
+
+    // Name of the stream, the file name of the read-write stream without the extension
+    static void s_stream_name(const char* rw_filepath, char* out_name, u32 out_name_size)
+    {
+        const char* name = strrchr(rw_filepath, '/');
+        name             = (name != nullptr) ? name + 1 : rw_filepath;
+        const char* ext  = strrchr(name, '.');
+        const u32   len  = math::min((u32)((ext != nullptr) ? (ext - name) : strlen(name)), out_name_size - 1);
+        memcpy(out_name, name, len);
+        out_name[len] = 0;
+    }
+
+    static bool s_stream_needs_successor(const stream_header_t* header)
+    {
+        if (header->m_write_cursor >= header->m_stream_size)
+            return true;
+        const u64 remaining = header->m_stream_size - header->m_write_cursor;
+        if (remaining < (header->m_stream_size >> 3))
+            return true;
+        const u64 used = header->m_write_cursor - sizeof(stream_header_t);
+        const u64 span = header->m_time_end - header->m_time_begin;
+        if (used == 0 || span == 0)
+            return false;
+        // Time left at the current fill rate (bytes per ms)
+        return ((f64)remaining * (f64)span / (f64)used) < c_stream_rotation_lead;
+    }
+
+    static u64 s_stream_successor_size(const stream_header_t* header)
+    {
+        const u64 used = (header->m_write_cursor > sizeof(stream_header_t)) ? header->m_write_cursor - sizeof(stream_header_t) : 0;
+        const u64 span = header->m_time_end - header->m_time_begin;
+        u64       size = header->m_stream_size;
+        if (used > 0 && span > 0)
+        {
+            const u64 estimate = sizeof(stream_header_t) + (u64)((f64)used / (f64)span * c_stream_target_span);
+            size               = math::min(math::max(estimate, header->m_stream_size), header->m_stream_size * 4);
+        }
+        return (size + cMB - 1) & ~((u64)cMB - 1);
+    }
+
+    // Create the successor of a read-write stream next to it ({name}.rwstream.next), a writer swaps
+    // to it once the stream is full
+    static bool s_stream_prepare_successor(stream_manager_t* m, u32 stream_index)
+    {
+        const stream_header_t* stream = m->m_rw_streams[stream_index];
+        const u64              size   = s_stream_successor_size(stream);
+
+        char filepath[MAXPATHLEN];
+        snprintf(filepath, sizeof(filepath), "%s.next", m->m_rw_stream_filepaths[stream_index]);
+
+        nmmio::mappedfile_t* mmfile_rw = nullptr;
+        nmmio::allocate(m->m_allocator, mmfile_rw);
+        if (nmmio::create_rw(mmfile_rw, filepath, size))
+        {
+            stream_header_t* header = (stream_header_t*)nmmio::address_rw(mmfile_rw);
+            if (header != nullptr)
+            {
+                memset(header, 0, sizeof(stream_header_t));
+                header->m_user_id      = stream->m_user_id;
+                header->m_user_index   = stream->m_user_index + 1;
+                header->m_stream_type  = stream->m_stream_type;
+                header->m_reserved0    = stream->m_reserved0;
+                header->m_sizeof_item  = stream->m_sizeof_item;
+                header->m_layout       = stream->m_layout;
+                header->m_stream_size  = size;
+                header->m_write_cursor = sizeof(stream_header_t);
+
+                // The swap moves the full stream to the read-only streams, reserve its slot now
+                m->m_num_successors += 1;
+                stream_manager_resize_ro(m);
+                m->m_rw_next_files[stream_index]   = mmfile_rw;
+                m->m_rw_next_streams[stream_index] = header;
+                return true;
+            }
+            nmmio::close(mmfile_rw);
+            remove(filepath);
+        }
+        nmmio::deallocate(m->m_allocator, mmfile_rw);
+        return false;
+    }
+
+    static void s_stream_discard_successor(stream_manager_t* m, u32 stream_index)
+    {
+        if (m->m_rw_next_files[stream_index] == nullptr)
+            return;
+        char filepath[MAXPATHLEN];
+        snprintf(filepath, sizeof(filepath), "%s.next", m->m_rw_stream_filepaths[stream_index]);
+        nmmio::close(m->m_rw_next_files[stream_index]);
+        nmmio::deallocate(m->m_allocator, m->m_rw_next_files[stream_index]);
+        remove(filepath);
+        m->m_rw_next_files[stream_index]   = nullptr;
+        m->m_rw_next_streams[stream_index] = nullptr;
+        m->m_num_successors -= 1;
+    }
+
+    static u64 s_item_at(const stream_header_t* header, u64 offset, u64& out_time, const u8*& out_data, u32& out_size);
+    static u64 s_readable_items(const stream_header_t* header);
+
+    static inline bool s_stream_is_float(const stream_header_t* header) { return header->m_stream_type == nvalue::TypeF32 || header->m_stream_type == nvalue::TypeF64; }
+
+    // Rewrite an archived stream file in the compressed layout, the file stays as it is when it cannot be
+    // compressed or would not get smaller. On success the compressed file is mapped read-only in 'mmfile' and its
+    // size is returned, otherwise 0. The items are gathered block by block in 'times' and 'values'.
+    static u64 s_stream_compress(const stream_header_t* header, u64* times, u8* values, nmmio::mappedfile_t* mmfile, const char* filepath)
+    {
+        const u32 value_size = header->m_sizeof_item;
+        const u64 item_count = s_readable_items(header);
+        if (header->m_layout == c_stream_layout_compressed || item_count == 0 || (value_size != 1 && value_size != 2 && value_size != 4 && value_size != 8))
+            return 0;
+
+        const u64 raw_size    = s_stream_used_bytes(header);
+        const u32 block_count = (u32)((item_count + c_stream_codec_block_items - 1) / c_stream_codec_block_items);
+        const u32 block_bound = stream_codec_bound(c_stream_codec_block_items, value_size);
+        u64       size        = sizeof(stream_header_t) + (u64)block_count * sizeof(stream_block_entry_t);
+        if (size >= raw_size)
+            return 0;
+
+        // Encoded straight into a file next to the archived file, with room for one block beyond the raw size since the
+        // result is only kept when it is smaller. It is then cut to size and renamed over the archived file, a crash
+        // leaves either of the two.
+        char tmp_path[MAXPATHLEN];
+        snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", filepath);
+        if (!nmmio::create_rw(mmfile, tmp_path, raw_size + block_bound))
+        {
+            remove(tmp_path);
+            return 0;
+        }
+        u8*  data     = (u8*)nmmio::address_rw(mmfile);
+        bool complete = data != nullptr;
+        u64  offset   = sizeof(stream_header_t);
+        u64  item     = 0;
+        for (u32 b = 0; complete && b < block_count; b++)
+        {
+            u32 n = 0;
+            for (; n < c_stream_codec_block_items && item < item_count; n++, item++)
+            {
+                u64       time;
+                const u8* value;
+                u32       value_bytes;
+                offset = s_item_at(header, offset, time, value, value_bytes);
+                if (offset == 0)
+                    break;  // Truncated
+                times[n] = time - header->m_time_begin;
+                memcpy(values + n * value_size, value, value_size);
+            }
+            if (offset == 0 || size >= raw_size)
+            {
+                complete = false;  // Truncated, or would not get smaller
+                break;
+            }
+            stream_block_entry_t* entry = (stream_block_entry_t*)(data + sizeof(stream_header_t)) + b;
+            entry->m_offset             = size;
+            entry->m_time_first         = times[0];
+            size += stream_codec_encode(data + size, times, values, n, value_size, s_stream_is_float(header));
+        }
+        if (complete && size < raw_size)
+        {
+            stream_header_t* compressed = (stream_header_t*)data;
+            memcpy(compressed, header, sizeof(stream_header_t));
+            compressed->m_layout       = c_stream_layout_compressed;
+            compressed->m_block_count  = block_count;
+            compressed->m_item_count   = item_count;
+            compressed->m_stream_size  = size;
+            compressed->m_write_cursor = size;
+            complete                   = msync(data, size, MS_SYNC) == 0;
+        }
+        else
+        {
+            complete = false;
+        }
+        nmmio::close(mmfile);
+
+        if (!complete || truncate(tmp_path, (off_t)size) != 0 || rename(tmp_path, filepath) != 0)
+        {
+            remove(tmp_path);
+            return 0;
+        }
+        if (!nmmio::open_ro(mmfile, filepath) || nmmio::address_ro(mmfile) == nullptr)
+            return 0;
+        return size;
+    }
+
+    // Runs on a worker of the job manager (or on the caller without a job manager), only touches the job
+    static void s_archive_job_fn(void* job_data0, void* job_data1)
+    {
+        CC_UNUSED(job_data1);
+        stream_archive_job_t* job = (stream_archive_job_t*)job_data0;
+        job->m_archived           = false;
+        job->m_compressed         = 0;
+        nmmio::sync(job->m_retired_file);
+
+        // A retry after the second rename failed finds the retired file archived already
+        char        next_path[MAXPATHLEN];
+        struct stat st;
+        snprintf(next_path, sizeof(next_path), "%s.next", job->m_rw_path);
+        if (mkdir(job->m_dir_path, 0755) != 0 && errno != EEXIST)
+            return;
+        const bool archived = stat(job->m_rw_path, &st) != 0 && stat(job->m_archive_path, &st) == 0;
+        if ((!archived && rename(job->m_rw_path, job->m_archive_path) != 0) || rename(next_path, job->m_rw_path) != 0)
+            return;
+        job->m_archived = true;
+
+        job->m_compressed = s_stream_compress(job->m_retired, job->m_times, job->m_values, job->m_output, job->m_archive_path);
+        if (job->m_catalog_entry != nullptr && job->m_compressed > 0)
+        {
+            job->m_catalog_entry->m_header    = *(const stream_header_t*)nmmio::address_ro(job->m_output);
+            job->m_catalog_entry->m_file_size = job->m_compressed;
+        }
+        s_catalog_store(job->m_base_path, job->m_catalog_file, job->m_catalog, job->m_catalog_size);
+    }
+
+    // The archive job is done, when it failed the stream stays retired (pinned, at its current path) and is tried again
+    static void s_archive_done(stream_manager_t* m)
+    {
+        stream_archive_job_t& job = m->m_archive_job;
+        m->m_archive_in_flight    = false;
+        g_deallocate_array<u8>(m->m_allocator, job.m_catalog);
+        job.m_catalog       = nullptr;
+        job.m_catalog_entry = nullptr;
+        if (!job.m_archived)
+        {
+            m->m_stats.m_archive_errors += 1;
+            return;
+        }
+
+        const i32          ro_index = job.m_ro_index;
+        stream_ro_entry_t& entry    = m->m_ro_entries[ro_index];
+        m->m_rw_retired[job.m_stream_index] = -1;
+        if (job.m_compressed > 0)
+        {
+            // Switch to the compressed file, the old mapping still refers to the replaced file
+            if (m->m_block_cache.m_header == m->m_ro_streams[ro_index])
+                m->m_block_cache.m_header = nullptr;
+            nmmio::close(m->m_ro_stream_files[ro_index]);
+            nmmio::deallocate(m->m_allocator, m->m_ro_stream_files[ro_index]);
+            const stream_header_t* compressed = (const stream_header_t*)nmmio::address_ro(job.m_output);
+            m->m_ro_stream_files[ro_index]    = job.m_output;
+            m->m_ro_streams[ro_index]         = compressed;
+            m->m_ro_mapped_bytes              = m->m_ro_mapped_bytes - entry.m_file_size + job.m_compressed;
+            entry.m_header                    = *compressed;
+            entry.m_file_size                 = job.m_compressed;
+            s_time_index_release(m->m_allocator, m->m_ro_time_indices[ro_index]);
+            s_time_index_init(m->m_ro_time_indices[ro_index]);
+            job.m_output = nullptr;
+        }
+
+        // From here on the archived stream is like any other, its mapping can be closed and opened again
+        entry.m_filepath = g_duplicate_string(m->m_allocator, job.m_archive_path);
+        entry.m_pinned   = false;
+        s_ro_lru_push(m, ro_index);
+        s_ro_evict(m, -1);
+    }
+
+    // Fill in the archive job for a stream that was swapped out
+    static void s_archive_prepare(stream_manager_t* m, u32 stream_index)
+    {
+        stream_archive_job_t&  job      = m->m_archive_job;
+        const i32              ro_index = m->m_rw_retired[stream_index];
+        const stream_header_t* retired  = m->m_ro_streams[ro_index];
+        job.m_retired                   = retired;
+        job.m_retired_file              = m->m_ro_stream_files[ro_index];
+        job.m_base_path                 = m->m_base_path;
+        job.m_stream_index              = stream_index;
+        job.m_ro_index                  = ro_index;
+        if (job.m_output == nullptr)
+            nmmio::allocate(m->m_allocator, job.m_output);
+        if (job.m_catalog_file == nullptr)
+            nmmio::allocate(m->m_allocator, job.m_catalog_file);
+
+        char name[MAXPATHLEN];
+        s_stream_name(m->m_rw_stream_filepaths[stream_index], name, sizeof(name));
+        const time_t begin = (time_t)(retired->m_time_begin / 1000);
+        struct tm    date;
+        gmtime_r(&begin, &date);
+        snprintf(job.m_rw_path, sizeof(job.m_rw_path), "%s", m->m_rw_stream_filepaths[stream_index]);
+        snprintf(job.m_dir_path, sizeof(job.m_dir_path), "%s/%04d%02d", m->m_base_path, date.tm_year + 1900, date.tm_mon + 1);
+        snprintf(job.m_archive_path, sizeof(job.m_archive_path), "%s/%s_%04u.rostream", job.m_dir_path, name, (u32)retired->m_user_index);
+        job.m_catalog = s_catalog_build(m, ro_index, job.m_archive_path, job.m_catalog_size, job.m_catalog_entry);
+    }
+
+    // Pick up the archive job that completed, or wait for it
+    static void s_archive_poll(stream_manager_t* m, bool wait)
+    {
+        if (!m->m_archive_in_flight)
+            return;
+        void* job_data0;
+        void* job_data1;
+        const i32 result = wait ? pop_job_wait(m->m_jobs, m->m_archive_channel, job_data0, job_data1) : pop_job(m->m_jobs, m->m_archive_channel, job_data0, job_data1);
+        if (result == 0)
+            s_archive_done(m);
+    }
+
+    // Start archiving the next retired stream, one at a time. Without a job manager it is archived right away.
+    static void s_archive_schedule(stream_manager_t* m)
+    {
+        if (m->m_archive_in_flight)
+            return;
+        for (u32 n = 0; n < m->m_num_rw_streams; n++)
+        {
+            const u32 stream_index = (m->m_archive_next + n) % m->m_num_rw_streams;
+            if (m->m_rw_retired[stream_index] < 0)
+                continue;
+            m->m_archive_next = stream_index + 1;
+            s_archive_prepare(m, stream_index);
+            if (m->m_jobs == nullptr)
+            {
+                s_archive_job_fn(&m->m_archive_job, nullptr);
+                s_archive_done(m);
+            }
+            else if (push_job(m->m_jobs, m->m_archive_channel, s_archive_job_fn, &m->m_archive_job, nullptr) == 0)
+            {
+                m->m_archive_in_flight = true;
+            }
+            else
+            {
+                g_deallocate_array<u8>(m->m_allocator, m->m_archive_job.m_catalog);
+                m->m_archive_job.m_catalog = nullptr;
+            }
+            return;
+        }
+    }
+
+    static inline bool s_stream_is_staged(const stream_manager_t* m, const stream_header_t* header)
+    {
+        const u8* address = (const u8*)header;
+        return address >= m->m_staging && address < m->m_staging + (u64)c_staging_buffer_count * c_staging_buffer_size;
+    }
+
+    // The file of a staged stream was created, the staged items are copied over and the stream switches to the file
+    static void s_stream_attach_file(stream_manager_t* m, u64 user_id, nmmio::mappedfile_t* mmfile, const char* filepath)
+    {
+        stream_id_t stream_index;
+        if (!stream_id_find(m->m_stream_id_registry, user_id, stream_index) || stream_index >= m->m_num_rw_streams || !s_stream_is_staged(m, m->m_rw_streams[stream_index]))
+        {
+            if (mmfile != nullptr)
+            {
+                nmmio::close(mmfile);
+                nmmio::deallocate(m->m_allocator, mmfile);
+            }
+            return;
+        }
+
+        stream_header_t* header = (mmfile != nullptr) ? (stream_header_t*)nmmio::address_rw(mmfile) : nullptr;
+        if (header == nullptr)
+        {
+            // Requested again on the next update
+            if (mmfile != nullptr)
+            {
+                nmmio::close(mmfile);
+                nmmio::deallocate(m->m_allocator, mmfile);
+            }
+            m->m_rw_requested[stream_index] = 0;
+            return;
+        }
+
+        stream_header_t* staged = m->m_rw_streams[stream_index];
+        memcpy(header, staged, s_stream_used_bytes(staged));
+        header->m_stream_size = c_stream_initial_size;
+
+        const u32 filepath_len                 = (u32)strlen(filepath) + 1;
+        m->m_rw_stream_filepaths[stream_index] = g_allocate_array<char>(m->m_allocator, filepath_len);
+        memcpy(m->m_rw_stream_filepaths[stream_index], filepath, filepath_len);
+        m->m_rw_stream_files[stream_index] = mmfile;
+        m->m_rw_streams[stream_index]      = header;
+        m->m_rw_flushed[stream_index]      = 0;
+
+        m->m_staging_free[m->m_staging_free_count++] = (u32)(((u8*)staged - m->m_staging) / c_staging_buffer_size);
+
+        // The rollup catches up with the items that were staged
+        s_rollup_open(m, stream_index);
+    }
+
+    // Publish the item count of every stream that advanced and wake the readers, once per update so that a
+    // busy stream does not cost a wakeup per item. Staged streams are published once their file exists.
+    static void s_stream_notify(stream_manager_t* m)
+    {
+        if (m->m_notify == nullptr)
+            return;
+        for (u32 i = 0; i < m->m_num_rw_streams; i++)
+        {
+            const stream_header_t* header = m->m_rw_streams[i];
+            if (header == nullptr || m->m_rw_stream_files[i] == nullptr)
+                continue;
+            stream_notify_publish(m->m_notify, i, header->m_user_id, m->m_rw_archived_items[i] + header->m_item_count, header->m_time_end);
+        }
+        stream_notify_ring(m->m_notify);
+    }
+
+    void stream_manager_update(stream_manager_t* manager, f64 now)
+    {
+        // Rotations done by the writers are completed by an archive job, but not while a flush job may still be
+        // syncing the retired file
+        s_flush_poll(manager, false);
+        s_archive_poll(manager, false);
+        if (!manager->m_flush_in_flight)
+            s_archive_schedule(manager);
+
+        // New streams are staged in memory until the request manager delivers their file
+        if (manager->m_requests != nullptr)
+        {
+            update_stream_requests(manager->m_requests, now);
+            for (u32 i = 0; i < manager->m_num_rw_streams; i++)
+            {
+                const stream_header_t* header = manager->m_rw_streams[i];
+                if (manager->m_rw_requested[i] == 0 && s_stream_is_staged(manager, header))
+                {
+                    if (push_stream_request(manager->m_requests, header->m_user_id, i, c_stream_initial_size, nullptr))
+                        manager->m_rw_requested[i] = 1;
+                }
+            }
+
+            u64                  user_id;
+            nmmio::mappedfile_t* mmfile;
+            char                 filepath[MAXPATHLEN];
+            while (pop_stream_request(manager->m_requests, user_id, mmfile, filepath, sizeof(filepath)))
+                s_stream_attach_file(manager, user_id, mmfile, filepath);
+        }
+
+        s_stream_notify(manager);
+        s_flush_schedule(manager, now);
+
+        // Using m_time_begin and m_time_end together with the write cursor we can determine the throughput
+        // and prepare a successor well before a stream runs out of space.
+        if (now - manager->m_last_update_time < c_stream_update_interval)
+            return;
+        manager->m_last_update_time = now;
+        for (u32 i = 0; i < manager->m_num_rw_streams; i++)
+        {
+            const stream_header_t* header = manager->m_rw_streams[i];
+            // A retired stream that is not archived yet still has its successor at the '.next' path
+            if (header != nullptr && manager->m_rw_stream_files[i] != nullptr && manager->m_rw_next_streams[i] == nullptr && manager->m_rw_retired[i] < 0 && s_stream_needs_successor(header))
+                s_stream_prepare_successor(manager, i);
+        }
+    }
+
+    void stream_manager_set_request_manager(stream_manager_t* manager, stream_request_manager_t* requests) { manager->m_requests = requests; }
+
+    void stream_manager_stats(stream_manager_t* manager, stream_manager_stats_t& out_stats)
+    {
+        out_stats                   = manager->m_stats;
+        out_stats.m_staged_streams  = 0;
+        out_stats.m_staged_bytes    = 0;
+        out_stats.m_ro_mappings     = (u32)manager->m_ro_mapped_count;
+        out_stats.m_ro_mapped_bytes = manager->m_ro_mapped_bytes;
+        for (u32 i = 0; i < manager->m_num_rw_streams; i++)
+        {
+            const stream_header_t* header = manager->m_rw_streams[i];
+            if (s_stream_is_staged(manager, header))
+            {
+                out_stats.m_staged_streams += 1;
+                out_stats.m_staged_bytes += header->m_write_cursor - sizeof(stream_header_t);
+            }
+        }
+    }
+
+    // Size of the value of an item, 0 for a variable size stream
+    static u32 s_sizeof_value(u8 stream_type)
+    {
+        switch (stream_type)
+        {
+            case nvalue::TypeU8:
+            case nvalue::TypeS8: return 1;
+            case nvalue::TypeU16:
+            case nvalue::TypeS16: return 2;
+            case nvalue::TypeU32:
+            case nvalue::TypeS32:
+            case nvalue::TypeF32: return 4;
+            case nvalue::TypeU64:
+            case nvalue::TypeS64:
+            case nvalue::TypeF64: return 8;
+        }
+        return 0;
+    }
+
+    stream_id_t stream_manager_register_stream(stream_manager_t* m, u32 hid, u16 lid, u8 stream_type, u8 user_type) { return stream_manager_register_stream(m, hid, lid, stream_type, user_type, c_stream_layout_row); }
+
+    stream_id_t stream_manager_register_stream(stream_manager_t* m, u32 hid, u16 lid, u8 stream_type, u8 user_type, u16 layout)
+    {
+        // ID format: [byte[6] Mac, byte stream-type, byte user-type]
+        const u64 user_id = (((((u64)hid << 16) | lid) << 16) | ((u64)stream_type << 8) | user_type);
+
+        stream_id_t stream_id;
+        if (stream_id_find(m->m_stream_id_registry, user_id, stream_id))
+            return stream_id;
+
+        // A new stream is written to a staging buffer until its file exists
+        stream_manager_resize_rw(m);
+        const u32 stream_index = m->m_num_rw_streams;
+        if (m->m_staging_free_count == 0 || !stream_id_register(m->m_stream_id_registry, user_id, stream_index))
+        {
+            m->m_stats.m_dropped_streams += 1;
+            return c_invalid_stream_id;
+        }
+
+        const u32        buffer = m->m_staging_free[--m->m_staging_free_count];
+        stream_header_t* header = (stream_header_t*)(m->m_staging + (u64)buffer * c_staging_buffer_size);
+        memset(header, 0, sizeof(stream_header_t));
+        header->m_user_id      = user_id;
+        header->m_user_index   = (u16)(stream_manager_largest_user_index_for(m, user_id) + 1);
+        header->m_stream_type  = stream_type;
+        header->m_reserved0    = user_type;
+        header->m_sizeof_item  = s_sizeof_value(stream_type);
+        header->m_layout       = (layout == c_stream_layout_column && header->m_sizeof_item != 0) ? c_stream_layout_column : c_stream_layout_row;
+        header->m_stream_size  = c_staging_buffer_size;
+        header->m_write_cursor = sizeof(stream_header_t);
+
+        m->m_rw_stream_filepaths[stream_index] = nullptr;
+        m->m_rw_stream_files[stream_index]     = nullptr;
+        m->m_rw_streams[stream_index]          = header;
+        m->m_rw_next_files[stream_index]       = nullptr;
+        m->m_rw_next_streams[stream_index]     = nullptr;
+        m->m_rw_retired[stream_index]          = -1;
+        m->m_rw_requested[stream_index]        = 0;
+        m->m_rw_rollup_files[stream_index]     = nullptr;
+        m->m_rw_rollups[stream_index]          = nullptr;
+        m->m_rw_archived_items[stream_index]   = s_stream_archived_items(m, header);
+        m->m_rw_flushed[stream_index]          = 0;
+        s_time_index_init(m->m_rw_time_indices[stream_index]);
+        m->m_num_rw_streams += 1;
+        return stream_index;
+    }
+
+    void stream_manager_destroy(alloc_t* allocator, stream_manager_t*& manager)
+    {
+        // Destroy the stream manager
+        //  - Flush and close all open streams
+        //  - Deallocate all memory used by the stream manager
+
+        // Finish pending rotations, successors that were never used are removed
+        s_flush_poll(manager, true);
+        s_archive_poll(manager, true);
+        for (u32 i = 0; i < manager->m_num_rw_streams; i++)
+        {
+            if (manager->m_rw_retired[i] >= 0)
+            {
+                s_archive_prepare(manager, i);
+                s_archive_job_fn(&manager->m_archive_job, nullptr);
+                s_archive_done(manager);
+            }
+            s_stream_discard_successor(manager, i);
+        }
+
+        // Readers see the final item counts
+        s_stream_notify(manager);
+        stream_notify_close(allocator, manager->m_notify);
+
+        // Close all read-write streams
+        for (u32 i = 0; i < manager->m_num_rw_streams; i++)
+        {
+            nmmio::mappedfile_t* rw_file = manager->m_rw_stream_files[i];
+            if (rw_file != nullptr)
+            {
+                nmmio::sync(rw_file);
+                nmmio::close(rw_file);
+                nmmio::deallocate(manager->m_allocator, rw_file);
+                manager->m_rw_stream_files[i] = nullptr;
+            }
+            nmmio::mappedfile_t* rollup_file = manager->m_rw_rollup_files[i];
+            if (rollup_file != nullptr)
+            {
+                nmmio::sync(rollup_file);
+                nmmio::close(rollup_file);
+                nmmio::deallocate(manager->m_allocator, rollup_file);
+                manager->m_rw_rollup_files[i] = nullptr;
+            }
+            if (manager->m_rw_stream_filepaths[i] != nullptr)
+                g_deallocate_array<char>(manager->m_allocator, manager->m_rw_stream_filepaths[i]);
+            s_time_index_release(manager->m_allocator, manager->m_rw_time_indices[i]);
+        }
+        g_deallocate_array<char*>(allocator, manager->m_rw_stream_filepaths);
+        g_deallocate_array<nmmio::mappedfile_t*>(allocator, manager->m_rw_stream_files);
+        g_deallocate_array<stream_header_t*>(allocator, manager->m_rw_streams);
+        g_deallocate_array<stream_time_index_t>(allocator, manager->m_rw_time_indices);
+        g_deallocate_array<nmmio::mappedfile_t*>(allocator, manager->m_rw_rollup_files);
+        g_deallocate_array<void*>(allocator, manager->m_rw_rollups);
+        g_deallocate_array<u64>(allocator, manager->m_rw_archived_items);
+        g_deallocate_array<u64>(allocator, manager->m_rw_flushed);
+        g_deallocate_array<stream_flush_range_t>(allocator, manager->m_flush_job.m_ranges);
+        g_deallocate_array<nmmio::mappedfile_t*>(allocator, manager->m_rw_next_files);
+        g_deallocate_array<stream_header_t*>(allocator, manager->m_rw_next_streams);
+        g_deallocate_array<i32>(allocator, manager->m_rw_retired);
+        g_deallocate_array<u8>(allocator, manager->m_rw_requested);
+
+        // Streams that are still staged never got their file, their items are lost
+        g_deallocate_array<u8>(allocator, manager->m_staging);
+        g_deallocate_array<u32>(allocator, manager->m_staging_free);
+        g_deallocate_array<u64>(allocator, manager->m_block_cache.m_times);
+        g_deallocate_array<u8>(allocator, manager->m_block_cache.m_values);
+        g_deallocate_array<u8>(allocator, manager->m_block_cache.m_rows);
+        g_deallocate_array<u64>(allocator, manager->m_archive_job.m_times);
+        g_deallocate_array<u8>(allocator, manager->m_archive_job.m_values);
+        if (manager->m_archive_job.m_output != nullptr)
+            nmmio::deallocate(allocator, manager->m_archive_job.m_output);
+        if (manager->m_archive_job.m_catalog_file != nullptr)
+            nmmio::deallocate(allocator, manager->m_archive_job.m_catalog_file);
+        stream_id_registry_destroy(manager->m_stream_id_registry);
+
+        // Close all read-only streams
+        for (i32 i = 0; i < manager->m_num_ro_streams; i++)
+        {
+            nmmio::mappedfile_t* ro_file = manager->m_ro_stream_files[i];
+            if (ro_file != nullptr)
+            {
+                nmmio::close(ro_file);
+                nmmio::deallocate(manager->m_allocator, ro_file);
+                manager->m_ro_stream_files[i] = nullptr;
+            }
+            if (manager->m_ro_entries[i].m_filepath != nullptr)
+                g_deallocate_string(manager->m_allocator, manager->m_ro_entries[i].m_filepath);
+            s_time_index_release(manager->m_allocator, manager->m_ro_time_indices[i]);
+        }
+
+        g_deallocate_array<nmmio::mappedfile_t*>(allocator, manager->m_ro_stream_files);
+        g_deallocate_array<const stream_header_t*>(allocator, manager->m_ro_streams);
+        g_deallocate_array<stream_ro_entry_t>(allocator, manager->m_ro_entries);
+        g_deallocate_array<i32>(allocator, manager->m_ro_sorted);
+        g_deallocate_array<stream_time_index_t>(allocator, manager->m_ro_time_indices);
+
+        g_deallocate_array<char>(allocator, manager->m_base_path);
+
+        g_destruct(allocator, manager);
+    }
+
+    static u64 s_read_u64_le(const u8* src, u8 byte_count)
+    {
+        u64 value = 0;
+        for (u8 i = 0; i < byte_count; i++)
+            value |= (u64)src[i] << (i * 8);
+        return value;
+    }
+
+    // End of the item data, a header that claims more than the mapping holds is clipped
+    static inline u64 s_data_end(const stream_header_t* header) { return math::min(header->m_write_cursor, header->m_stream_size); }
+
+    // Decode the item at 'offset', returns the offset of the next item or 0 when there is no complete item
+    static u64 s_item_at(const stream_header_t* header, u64 offset, u64& out_time, const u8*& out_data, u32& out_size)
+    {
+        if (header->m_layout == c_stream_layout_column)
+        {
+            // The item exists when it is before the write cursor and its page is in the mapping
+            const u64 base = s_column_page_base(offset);
+            if (offset >= header->m_write_cursor || base + c_column_page_size > header->m_stream_size)
+                return 0;
+            const u32 page_items = s_column_page_items(header);
+            const u64 slot       = (offset - base) / sizeof(u64);
+            out_time             = header->m_time_begin + *(const u64*)((const u8*)header + offset);
+            out_data             = (const u8*)header + base + s_column_values_offset(page_items) + slot * header->m_sizeof_item;
+            out_size             = header->m_sizeof_item;
+            return (slot + 1 < page_items) ? offset + sizeof(u64) : base + c_column_page_size;
+        }
+
+        const u64 end         = s_data_end(header);
+        const u8* item        = (const u8*)header + offset;
+        u64       data_offset = offset + c_relative_time_byte_count;
+        u32       size        = header->m_sizeof_item;
+        if (size == 0)
+        {
+            // Variable size item, the size follows the time
+            if (data_offset + 4 > end)
+                return 0;
+            size = (u32)s_read_u64_le(item + c_relative_time_byte_count, 4);
+            data_offset += 4;
+        }
+        if (data_offset > end || size > end - data_offset)
+            return 0;
+        out_time = header->m_time_begin + s_read_u64_le(item, c_relative_time_byte_count);
+        out_data = (const u8*)header + data_offset;
+        out_size = size;
+        return data_offset + size;
+    }
+
+    static void s_time_index_push(alloc_t* allocator, stream_time_index_t& index, u64 time, u64 offset, u64 item)
+    {
+        if (index.m_count == index.m_capacity)
+        {
+            const u32 new_capacity = index.m_capacity == 0 ? 64 : index.m_capacity * 2;
+            if (index.m_entries == nullptr)
+                index.m_entries = g_allocate_array<stream_time_entry_t>(allocator, new_capacity);
+            else
+                index.m_entries = g_reallocate_array<stream_time_entry_t>(allocator, index.m_entries, index.m_capacity, new_capacity);
+            index.m_capacity = new_capacity;
+        }
+        stream_time_entry_t& entry = index.m_entries[index.m_count];
+        entry.m_time               = (index.m_count > 0) ? math::max(time, index.m_entries[index.m_count - 1].m_time) : time;
+        entry.m_offset             = offset;
+        entry.m_item               = item;
+        index.m_count += 1;
+    }
+
+    static inline bool s_time_index_due(const stream_time_index_t& index, u64 item, u64 offset)
+    {
+        if (index.m_count == 0)
+            return true;
+        const stream_time_entry_t& last = index.m_entries[index.m_count - 1];
+        return (item - last.m_item) >= c_time_index_item_step || (offset - last.m_offset) >= c_time_index_byte_step;
+    }
+
+    // Called by the writers before an item is counted, once the index has caught up with the stream
+    // the writers keep it up to date
+    static inline void s_time_index_note(alloc_t* allocator, stream_time_index_t& index, const stream_header_t* header, u64 time, u64 item_bytes)
+    {
+        if (index.m_indexed_items != header->m_item_count)
+            return;  // Behind, the next lookup catches up
+        if (s_time_index_due(index, header->m_item_count, header->m_write_cursor))
+            s_time_index_push(allocator, index, time, header->m_write_cursor, header->m_item_count);
+        index.m_indexed_items += 1;
+        index.m_indexed_offset = s_next_offset(header, header->m_write_cursor, item_bytes);
+    }
+
+    // Index the items that were not looked at yet, the first lookup on a stream file reads it once
+    static void s_time_index_update(alloc_t* allocator, stream_time_index_t& index, const stream_header_t* header)
+    {
+        u64 offset = index.m_indexed_offset;
+        while (index.m_indexed_items < header->m_item_count)
+        {
+            u64       time;
+            const u8* data;
+            u32       size;
+            const u64 next = s_item_at(header, offset, time, data, size);
+            if (next == 0)
+                break;  // Truncated
+            if (s_time_index_due(index, index.m_indexed_items, offset))
+                s_time_index_push(allocator, index, time, offset, index.m_indexed_items);
+            index.m_indexed_items += 1;
+            offset = next;
+        }
+        index.m_indexed_offset = offset;
+    }
+
+    // First item at or after 'time' in a stream file, false when all items are before 'time'.
+    // Items are expected to be written in time order.
+    static bool s_time_index_seek(alloc_t* allocator, stream_time_index_t& index, const stream_header_t* header, u64 time, u64& out_item, u64& out_offset)
+    {
+        s_time_index_update(allocator, index, header);
+
+        // The last entry before 'time' starts the step that holds the item
+        u32 lo = 0;
+        u32 hi = index.m_count;
+        while (lo < hi)
+        {
+            const u32 mid = (lo + hi) >> 1;
+            if (index.m_entries[mid].m_time < time)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        u64 item   = (lo > 0) ? index.m_entries[lo - 1].m_item : 0;
+        u64 offset = (lo > 0) ? index.m_entries[lo - 1].m_offset : sizeof(stream_header_t);
+        while (item < index.m_indexed_items)
+        {
+            u64       item_time;
+            const u8* data;
+            u32       size;
+            const u64 next = s_item_at(header, offset, item_time, data, size);
+            if (next == 0)
+                break;
+            if (item_time >= time)
+            {
+                out_item   = item;
+                out_offset = offset;
+                return true;
+            }
+            item += 1;
+            offset = next;
+        }
+        return false;
+    }
+
+    // A full stream swaps to its successor, the full stream becomes a read-only stream right away and
+    // update moves its file to the archive. Returns nullptr when there is no (large enough) successor.
+    static stream_header_t* s_stream_swap(stream_manager_t* m, u32 stream_index, u64 time, u64 item_bytes)
+    {
+        stream_header_t* next = m->m_rw_next_streams[stream_index];
+        if (next == nullptr || m->m_rw_retired[stream_index] >= 0 || !s_stream_fits(next, item_bytes))
+            return nullptr;
+
+        // The full stream stays mapped (pinned) until update has archived it, its path is known from then on
+        const stream_header_t* full        = m->m_rw_streams[stream_index];
+        const i32              ro_index    = s_ro_register(m, *full, nullptr, full->m_stream_size);
+        m->m_ro_entries[ro_index].m_pinned = true;
+        s_ro_insert_sorted(m, ro_index);
+        s_ro_add_mapping(m, ro_index, m->m_rw_stream_files[stream_index], full);
+        m->m_ro_time_indices[ro_index]     = m->m_rw_time_indices[stream_index];
+        m->m_rw_retired[stream_index]      = ro_index;
+        m->m_num_successors               -= 1;
+        m->m_rw_archived_items[stream_index] += full->m_item_count;
+
+        next->m_time_begin                 = time;
+        next->m_time_end                   = time;
+        m->m_rw_streams[stream_index]      = next;
+        m->m_rw_stream_files[stream_index] = m->m_rw_next_files[stream_index];
+        m->m_rw_next_files[stream_index]   = nullptr;
+        m->m_rw_next_streams[stream_index] = nullptr;
+        m->m_rw_flushed[stream_index]      = 0;
+        s_time_index_init(m->m_rw_time_indices[stream_index]);
+        return next;
+    }
+
+    // Bounds check of the writers
+    static inline stream_header_t* s_stream_reserve(stream_manager_t* m, u32 stream_index, u64 time, u64 item_bytes)
+    {
+        stream_header_t* stream = m->m_rw_streams[stream_index];
+        if (!s_stream_fits(stream, item_bytes))
+        {
+            stream = s_stream_swap(m, stream_index, time, item_bytes);
+            if (stream == nullptr)
+            {
+                m->m_stats.m_dropped_items += 1;
+                return nullptr;
+            }
+        }
+        if (stream->m_item_count == 0)
+        {
+            // Item times are relative to the first item, readers ignore the times until the item is published
+            stream->m_time_begin = time;
+            stream->m_time_end   = time;
+        }
+        return stream;
+    }
+
+    // Value of a numeric item, in native byte order
+    static f64 s_value_as_f64(u8 stream_type, const u8* value)
+    {
+        switch (stream_type)
+        {
+            case nvalue::TypeU8: return value[0];
+            case nvalue::TypeS8: return (s8)value[0];
+        }
+        u64 bits = 0;
+        memcpy(&bits, value, s_sizeof_value(stream_type));
+        switch (stream_type)
+        {
+            case nvalue::TypeU16: return (u16)bits;
+            case nvalue::TypeS16: return (s16)bits;
+            case nvalue::TypeU32: return (u32)bits;
+            case nvalue::TypeS32: return (s32)bits;
+            case nvalue::TypeU64: return (f64)bits;
+            case nvalue::TypeS64: return (f64)(s64)bits;
+            case nvalue::TypeF32:
+            {
+                f32 f;
+                memcpy(&f, value, sizeof(f32));
+                return f;
+            }
+            case nvalue::TypeF64:
+            {
+                f64 f;
+                memcpy(&f, value, sizeof(f64));
+                return f;
+            }
+        }
+        return 0.0;
+    }
+
+    // Called by the writers for every item, the rollup is only open for a numeric stream with a file
+    static inline void s_rollup_note(stream_manager_t* m, u32 stream_index, u64 time, const void* value)
+    {
+        void* rollup = m->m_rw_rollups[stream_index];
+        if (rollup != nullptr)
+            stream_rollup_add(rollup, time, s_value_as_f64((u8)m->m_rw_streams[stream_index]->m_stream_type, (const u8*)value));
+    }
+
+    static void s_rollup_note_run(stream_manager_t* m, u32 stream_index, const u64* times, const u8* values, u32 value_size, u32 count)
+    {
+        if (m->m_rw_rollups[stream_index] == nullptr)
+            return;
+        for (u32 i = 0; i < count; i++)
+            s_rollup_note(m, stream_index, times[i], values + (u64)i * value_size);
+    }
+
+    // Publication of new items, the single writer of a stream first writes the item bytes beyond the write cursor and
+    // then updates the header with an odd sequence. The item bytes are stored before the sequence is made even again
+    // (release), so a reader that finds the same even sequence before and after reading the header (acquire) has a
+    // consistent header and every item before the write cursor is complete. Items are never changed once published.
+    static inline void s_stream_publish(stream_header_t* stream, u64 write_cursor, u64 item_count, u64 time_end)
+    {
+        const u32 sequence = stream->m_sequence;
+        __atomic_store_n(&stream->m_sequence, sequence + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        __atomic_store_n(&stream->m_write_cursor, write_cursor, __ATOMIC_RELAXED);
+        __atomic_store_n(&stream->m_item_count, item_count, __ATOMIC_RELAXED);
+        __atomic_store_n(&stream->m_time_end, time_end, __ATOMIC_RELAXED);
+        __atomic_store_n(&stream->m_sequence, sequence + 2, __ATOMIC_RELEASE);
+    }
+
+    // Writer of a column layout stream, values are stored in native byte order
+    static bool s_column_write(stream_manager_t* m, u32 stream_index, stream_header_t* stream, u64 time, const void* value, u32 size)
+    {
+        s_time_index_note(m->m_allocator, m->m_rw_time_indices[stream_index], stream, time, sizeof(u64));
+        const u64 offset     = stream->m_write_cursor;
+        const u64 base       = s_column_page_base(offset);
+        const u32 page_items = s_column_page_items(stream);
+        const u64 slot       = (offset - base) / sizeof(u64);
+        *(u64*)((u8*)stream + offset) = time - stream->m_time_begin;
+        memcpy((u8*)stream + base + s_column_values_offset(page_items) + slot * size, value, size);
+        s_stream_publish(stream, s_next_offset(stream, offset, sizeof(u64)), stream->m_item_count + 1, math::max(time, stream->m_time_end));
+        s_rollup_note(m, stream_index, time, value);
+        return true;
+    }
+
+    static u8* stream_write_u64_le(u8* dest, u64 value, u8 byte_count)
+    {
+        for (u8 i = 0; i < byte_count; i++)
         {
             dest[i] = (u8)(value & 0xFF);
             value >>= 8;
@@ -398,16 +2150,26 @@ namespace ncore
         const u32 stream_index = stream_id;
 
         // Write data to the stream identified by stream_id at the given time
-        stream_header_t* stream = m->m_rw_streams[stream_index];
-        if (stream->m_write_cursor + (c_relative_time_byte_count + size) <= stream->m_stream_size)
+        // A variable size stream (m_sizeof_item == 0) stores the size of each item after the time
+        stream_header_t* stream     = m->m_rw_streams[stream_index];
+        const u32        size_bytes = (stream->m_sizeof_item == 0) ? 4 : 0;
+        if (size_bytes == 0 && size != stream->m_sizeof_item)
+            return false;
+        const u64 item_bytes = c_relative_time_byte_count + size_bytes + size;
+        stream               = s_stream_reserve(m, stream_index, time, item_bytes);
+        if (stream != nullptr)
         {
+            if (stream->m_layout == c_stream_layout_column)
+                return s_column_write(m, stream_index, stream, time, data, size);
+            s_time_index_note(m->m_allocator, m->m_rw_time_indices[stream_index], stream, time, item_bytes);
             u8* write_cursor = (u8*)stream + stream->m_write_cursor;
             u64 rtime        = (u64)(time - stream->m_time_begin);
             write_cursor     = stream_write_u64_le(write_cursor, rtime, c_relative_time_byte_count);
-            write_cursor     = stream_write_data(write_cursor, data, size);
-            stream->m_write_cursor += (c_relative_time_byte_count + size);
-            stream->m_item_count += 1;
-            stream->m_time_end = math::max(time, stream->m_time_end);
+            if (size_bytes != 0)
+                write_cursor = stream_write_u32_le(write_cursor, size);
+            write_cursor = stream_write_data(write_cursor, data, size);
+            s_stream_publish(stream, stream->m_write_cursor + item_bytes, stream->m_item_count + 1, math::max(time, stream->m_time_end));
+            s_rollup_note(m, stream_index, time, data);
             return true;
         }
         return false;  // Not enough space
@@ -418,14 +2180,18 @@ namespace ncore
         const u32 stream_index = stream_id;
 
         // Write a u8 value to the stream identified by stream_id at the given time
-        stream_header_t* stream       = m->m_rw_streams[stream_index];
-        u8*              write_cursor = (u8*)stream + stream->m_write_cursor;
-        u64              rtime        = (u64)(time - stream->m_time_begin);
-        write_cursor                  = stream_write_u64_le(write_cursor, rtime, c_relative_time_byte_count);
-        write_cursor[0]               = value;
-        stream->m_write_cursor += (c_relative_time_byte_count + sizeof(u8));
-        stream->m_item_count += 1;
-        stream->m_time_end = math::max(time, stream->m_time_end);
+        stream_header_t* stream = s_stream_reserve(m, stream_index, time, c_relative_time_byte_count + sizeof(u8));
+        if (stream == nullptr)
+            return false;  // Full, and no successor yet
+        if (stream->m_layout == c_stream_layout_column)
+            return s_column_write(m, stream_index, stream, time, &value, sizeof(u8));
+        s_time_index_note(m->m_allocator, m->m_rw_time_indices[stream_index], stream, time, c_relative_time_byte_count + sizeof(u8));
+        u8* write_cursor = (u8*)stream + stream->m_write_cursor;
+        u64 rtime        = (u64)(time - stream->m_time_begin);
+        write_cursor     = stream_write_u64_le(write_cursor, rtime, c_relative_time_byte_count);
+        write_cursor[0]  = value;
+        s_stream_publish(stream, stream->m_write_cursor + c_relative_time_byte_count + sizeof(u8), stream->m_item_count + 1, math::max(time, stream->m_time_end));
+        s_rollup_note(m, stream_index, time, &value);
         return true;
     }
 
@@ -434,14 +2200,18 @@ namespace ncore
         const u32 stream_index = stream_id;
 
         // Write a u16 value to the stream identified by stream_id at the given time
-        stream_header_t* stream       = m->m_rw_streams[stream_index];
-        u8*              write_cursor = (u8*)stream + stream->m_write_cursor;
-        u64              rtime        = (u64)(time - stream->m_time_begin);
-        write_cursor                  = stream_write_u64_le(write_cursor, rtime, c_relative_time_byte_count);
-        write_cursor                  = stream_write_u16_le(write_cursor, value);
-        stream->m_write_cursor += (c_relative_time_byte_count + sizeof(u16));
-        stream->m_item_count += 1;
-        stream->m_time_end = math::max(time, stream->m_time_end);
+        stream_header_t* stream = s_stream_reserve(m, stream_index, time, c_relative_time_byte_count + sizeof(u16));
+        if (stream == nullptr)
+            return false;  // Full, and no successor yet
+        if (stream->m_layout == c_stream_layout_column)
+            return s_column_write(m, stream_index, stream, time, &value, sizeof(u16));
+        s_time_index_note(m->m_allocator, m->m_rw_time_indices[stream_index], stream, time, c_relative_time_byte_count + sizeof(u16));
+        u8* write_cursor = (u8*)stream + stream->m_write_cursor;
+        u64 rtime        = (u64)(time - stream->m_time_begin);
+        write_cursor     = stream_write_u64_le(write_cursor, rtime, c_relative_time_byte_count);
+        write_cursor     = stream_write_u16_le(write_cursor, value);
+        s_stream_publish(stream, stream->m_write_cursor + c_relative_time_byte_count + sizeof(u16), stream->m_item_count + 1, math::max(time, stream->m_time_end));
+        s_rollup_note(m, stream_index, time, &value);
         return true;
     }
 
@@ -450,14 +2220,18 @@ namespace ncore
         const u32 stream_index = stream_id;
 
         // Write a u32 value to the stream identified by stream_id at the given time
-        stream_header_t* stream       = m->m_rw_streams[stream_index];
-        u8*              write_cursor = (u8*)stream + stream->m_write_cursor;
-        u64              rtime        = (u64)(time - stream->m_time_begin);
-        write_cursor                  = stream_write_u64_le(write_cursor, rtime, c_relative_time_byte_count);
-        write_cursor                  = stream_write_u32_le(write_cursor, value);
-        stream->m_write_cursor += (c_relative_time_byte_count + sizeof(u32));
-        stream->m_item_count += 1;
-        stream->m_time_end = math::max(time, stream->m_time_end);
+        stream_header_t* stream = s_stream_reserve(m, stream_index, time, c_relative_time_byte_count + sizeof(u32));
+        if (stream == nullptr)
+            return false;  // Full, and no successor yet
+        if (stream->m_layout == c_stream_layout_column)
+            return s_column_write(m, stream_index, stream, time, &value, sizeof(u32));
+        s_time_index_note(m->m_allocator, m->m_rw_time_indices[stream_index], stream, time, c_relative_time_byte_count + sizeof(u32));
+        u8* write_cursor = (u8*)stream + stream->m_write_cursor;
+        u64 rtime        = (u64)(time - stream->m_time_begin);
+        write_cursor     = stream_write_u64_le(write_cursor, rtime, c_relative_time_byte_count);
+        write_cursor     = stream_write_u32_le(write_cursor, value);
+        s_stream_publish(stream, stream->m_write_cursor + c_relative_time_byte_count + sizeof(u32), stream->m_item_count + 1, math::max(time, stream->m_time_end));
+        s_rollup_note(m, stream_index, time, &value);
         return true;
     }
 
@@ -466,17 +2240,156 @@ namespace ncore
         const u32 stream_index = stream_id;
 
         // Write a f32 value to the stream identified by stream_id at the given time
-        stream_header_t* stream       = m->m_rw_streams[stream_index];
-        u8*              write_cursor = (u8*)stream + stream->m_write_cursor;
-        u64              rtime        = (u64)(time - stream->m_time_begin);
-        write_cursor                  = stream_write_u64_le(write_cursor, rtime, c_relative_time_byte_count);
-        write_cursor                  = stream_write_f32_le(write_cursor, value);
-        stream->m_write_cursor += (c_relative_time_byte_count + sizeof(f32));
-        stream->m_item_count += 1;
-        stream->m_time_end = math::max(time, stream->m_time_end);
+        stream_header_t* stream = s_stream_reserve(m, stream_index, time, c_relative_time_byte_count + sizeof(f32));
+        if (stream == nullptr)
+            return false;  // Full, and no successor yet
+        if (stream->m_layout == c_stream_layout_column)
+            return s_column_write(m, stream_index, stream, time, &value, sizeof(f32));
+        s_time_index_note(m->m_allocator, m->m_rw_time_indices[stream_index], stream, time, c_relative_time_byte_count + sizeof(f32));
+        u8* write_cursor = (u8*)stream + stream->m_write_cursor;
+        u64 rtime        = (u64)(time - stream->m_time_begin);
+        write_cursor     = stream_write_u64_le(write_cursor, rtime, c_relative_time_byte_count);
+        write_cursor     = stream_write_f32_le(write_cursor, value);
+        s_stream_publish(stream, stream->m_write_cursor + c_relative_time_byte_count + sizeof(f32), stream->m_item_count + 1, math::max(time, stream->m_time_end));
+        s_rollup_note(m, stream_index, time, &value);
         return true;
     }
 
+    // The batch writer notes a run of fixed size items at once
+    static void s_time_index_note_run(alloc_t* allocator, stream_time_index_t& index, const stream_header_t* header, const u64* times, u32 count, u64 stride, u64 end_offset)
+    {
+        if (index.m_indexed_items != header->m_item_count)
+            return;  // Behind, the next lookup catches up
+        u64 item   = header->m_item_count;
+        u64 offset = header->m_write_cursor;
+        for (u32 i = 0; i < count; i++, item++, offset += stride)
+        {
+            if (s_time_index_due(index, item, offset))
+                s_time_index_push(allocator, index, times[i], offset, item);
+        }
+        index.m_indexed_items  = item;
+        index.m_indexed_offset = end_offset;
+    }
+
+    // Encode 'count' items of N value bytes, returns the largest time. On a little endian target the
+    // relative time is stored with a single 8 byte store, the 3 bytes it writes too many are overwritten
+    // by the value and the next item. The last item is written exactly so nothing beyond the batch is touched.
+    template <u32 N>
+    static u64 s_encode_items(u8* dst, u64 time_begin, u64 time_end, const u64* times, const u8* values, u32 count)
+    {
+        const u32 stride = c_relative_time_byte_count + N;
+        u32       i      = 0;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        for (; i + 1 < count; i++, dst += stride, values += N)
+        {
+            const u64 rtime = times[i] - time_begin;
+            memcpy(dst, &rtime, sizeof(u64));
+            memcpy(dst + c_relative_time_byte_count, values, N);
+            time_end = math::max(times[i], time_end);
+        }
+#endif
+        for (; i < count; i++, dst += stride, values += N)
+        {
+            stream_write_u64_le(dst, times[i] - time_begin, c_relative_time_byte_count);
+            memcpy(dst + c_relative_time_byte_count, values, N);
+            time_end = math::max(times[i], time_end);
+        }
+        return time_end;
+    }
+
+    static u64 s_encode_items(u8* dst, u64 time_begin, u64 time_end, const u64* times, const u8* values, u32 value_size, u32 count)
+    {
+        const u32 stride = c_relative_time_byte_count + value_size;
+        for (u32 i = 0; i < count; i++, dst += stride, values += value_size)
+        {
+            stream_write_u64_le(dst, times[i] - time_begin, c_relative_time_byte_count);
+            memcpy(dst + c_relative_time_byte_count, values, value_size);
+            time_end = math::max(times[i], time_end);
+        }
+        return time_end;
+    }
+
+    u32 stream_write_batch(stream_manager_t* m, stream_id_t stream_id, const u64* times, const void* values, u32 count, u32 value_size)
+    {
+        const u32 stream_index = stream_id;
+
+        // Only fixed size streams, the items of a variable size stream are written one by one with stream_write_data
+        const stream_header_t* rw_header = m->m_rw_streams[stream_index];
+        if (rw_header->m_sizeof_item == 0 || rw_header->m_sizeof_item != value_size)
+            return 0;
+
+        const u64 stride  = c_relative_time_byte_count + value_size;
+        const u8* src     = (const u8*)values;
+        u32       written = 0;
+        while (written < count)
+        {
+            // A batch that does not fit continues in the successor of the stream
+            stream_header_t* stream = s_stream_reserve(m, stream_index, times[written], stride);
+            if (stream == nullptr)
+            {
+                m->m_stats.m_dropped_items += count - written - 1;
+                break;  // Full, and no successor yet
+            }
+            if (stream->m_layout == c_stream_layout_column)
+            {
+                // Up to the end of the page, times and values are copied as plain arrays
+                const u64 offset     = stream->m_write_cursor;
+                const u64 base       = s_column_page_base(offset);
+                const u32 page_items = s_column_page_items(stream);
+                const u64 slot       = (offset - base) / sizeof(u64);
+                const u32 n          = (u32)math::min((u64)(count - written), page_items - slot);
+                const u64 end_offset = (slot + n < page_items) ? offset + n * sizeof(u64) : base + c_column_page_size;
+                s_time_index_note_run(m->m_allocator, m->m_rw_time_indices[stream_index], stream, times + written, n, sizeof(u64), end_offset);
+
+                u64*      dst_times  = (u64*)((u8*)stream + offset);
+                const u64 time_begin = stream->m_time_begin;
+                u64       time_end   = stream->m_time_end;
+                for (u32 i = 0; i < n; i++)
+                {
+                    dst_times[i] = times[written + i] - time_begin;
+                    time_end     = math::max(times[written + i], time_end);
+                }
+                memcpy((u8*)stream + base + s_column_values_offset(page_items) + slot * value_size, src, (u64)n * value_size);
+
+                s_stream_publish(stream, end_offset, stream->m_item_count + n, time_end);
+                s_rollup_note_run(m, stream_index, times + written, src, value_size, n);
+
+                src += (u64)n * value_size;
+                written += n;
+                continue;
+            }
+
+            const u64 fit = (stream->m_stream_size - stream->m_write_cursor) / stride;
+            const u32 n   = (u32)math::min((u64)(count - written), fit);
+
+            s_time_index_note_run(m->m_allocator, m->m_rw_time_indices[stream_index], stream, times + written, n, stride, stream->m_write_cursor + n * stride);
+            u8* dst      = (u8*)stream + stream->m_write_cursor;
+            u64 time_end = stream->m_time_end;
+            switch (value_size)
+            {
+                case 1: time_end = s_encode_items<1>(dst, stream->m_time_begin, time_end, times + written, src, n); break;
+                case 2: time_end = s_encode_items<2>(dst, stream->m_time_begin, time_end, times + written, src, n); break;
+                case 4: time_end = s_encode_items<4>(dst, stream->m_time_begin, time_end, times + written, src, n); break;
+                case 8: time_end = s_encode_items<8>(dst, stream->m_time_begin, time_end, times + written, src, n); break;
+                default: time_end = s_encode_items(dst, stream->m_time_begin, time_end, times + written, src, value_size, n); break;
+            }
+
+            // Publish once for the whole run
+            s_stream_publish(stream, stream->m_write_cursor + n * stride, stream->m_item_count + n, time_end);
+            s_rollup_note_run(m, stream_index, times + written, src, value_size, n);
+
+            src += (u64)n * value_size;
+            written += n;
+        }
+        return written;
+    }
+
+    u32 stream_write_batch(stream_manager_t* m, stream_id_t stream_id, const u64* times, const void* values, u32 count)
+    {
+        const u32 stream_index = stream_id;
+        return stream_write_batch(m, stream_id, times, values, count, m->m_rw_streams[stream_index]->m_sizeof_item);
+    }
+
     bool stream_time(stream_manager_t* m, stream_id_t stream_id, u64& out_time_begin, u64& out_time_end)
     {
         const u32 stream_index = stream_id;
@@ -508,18 +2421,647 @@ namespace ncore
         return false;
     }
 
+    bool stream_file_snapshot(const void* file_data, u64 file_size, stream_snapshot_t& out_snapshot)
+    {
+        const stream_header_t* header = (const stream_header_t*)file_data;
+        if (header == nullptr || file_size < sizeof(stream_header_t))
+            return false;
+
+        // A compressed file is never written to, its sequence field is the block count
+        const bool live = header->m_layout != c_stream_layout_compressed;
+        for (u32 attempt = 0; attempt < 1024; attempt++)
+        {
+            const u32 sequence = live ? __atomic_load_n(&header->m_sequence, __ATOMIC_ACQUIRE) : 0;
+            if ((sequence & 1) != 0)
+                continue;  // The writer is updating the header
+            out_snapshot.m_user_id      = header->m_user_id;
+            out_snapshot.m_stream_type  = header->m_stream_type;
+            out_snapshot.m_layout       = header->m_layout;
+            out_snapshot.m_sizeof_item  = header->m_sizeof_item;
+            out_snapshot.m_time_begin   = __atomic_load_n(&header->m_time_begin, __ATOMIC_RELAXED);
+            out_snapshot.m_time_end     = __atomic_load_n(&header->m_time_end, __ATOMIC_RELAXED);
+            out_snapshot.m_item_count   = __atomic_load_n(&header->m_item_count, __ATOMIC_RELAXED);
+            out_snapshot.m_write_cursor = __atomic_load_n(&header->m_write_cursor, __ATOMIC_RELAXED);
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (!live || __atomic_load_n(&header->m_sequence, __ATOMIC_RELAXED) == sequence)
+            {
+                out_snapshot.m_write_cursor = math::min(out_snapshot.m_write_cursor, file_size);
+                return true;
+            }
+        }
+        return false;  // Try again later
+    }
+
+    // Items of a fixed size stream follow the header back to back, each item is the relative time
+    // followed by m_sizeof_item bytes of value.
+    static inline u64 s_item_stride(const stream_header_t* header) { return (u64)c_relative_time_byte_count + header->m_sizeof_item; }
+
+    // Number of complete items in the mapping, a header that claims more than fits is clipped
+    static u64 s_readable_items(const stream_header_t* header)
+    {
+        if (header->m_layout == c_stream_layout_compressed)
+            return header->m_item_count;
+        const u64 stride = s_item_stride(header);
+        if (header->m_stream_size <= sizeof(stream_header_t))
+            return 0;
+        if (header->m_layout == c_stream_layout_column)
+            return math::min(header->m_item_count, ((header->m_stream_size - sizeof(stream_header_t)) / c_column_page_size) * s_column_page_items(header));
+        return math::min(header->m_item_count, (header->m_stream_size - sizeof(stream_header_t)) / stride);
+    }
+
+    // The header fields of an archived file are read from its catalog entry (m_info), the file itself is only
+    // mapped by s_segment_map when its items are needed. A mapping may be closed by the next map, so a segment
+    // is used up before the next one is mapped.
+    struct stream_segment_t
+    {
+        const stream_header_t* m_info;
+        stream_time_index_t*   m_time_index;
+        i32                    m_ro_index;  // -1 for the read-write file
+    };
+
+    // The files of a stream are its archived (read-only) files of the same user, oldest first, followed
+    // by the read-write file. Gives the file with the lowest user_index above 'after_user_index'.
+    static bool s_segment_next(stream_manager_t* m, u32 stream_index, i32 after_user_index, stream_segment_t& out_segment)
+    {
+        const stream_header_t* rw_header = m->m_rw_streams[stream_index];
+        const i32              pos       = s_ro_lower_bound(m, m->m_num_ro_streams, rw_header->m_user_id, (u32)(after_user_index + 1));
+        const i32              next      = (pos < m->m_num_ro_streams) ? m->m_ro_sorted[pos] : -1;
+        if (next >= 0 && m->m_ro_entries[next].m_header.m_user_id == rw_header->m_user_id && m->m_ro_entries[next].m_header.m_user_index < rw_header->m_user_index)
+        {
+            out_segment.m_info       = &m->m_ro_entries[next].m_header;
+            out_segment.m_time_index = &m->m_ro_time_indices[next];
+            out_segment.m_ro_index   = next;
+            return true;
+        }
+        if ((i32)rw_header->m_user_index > after_user_index)
+        {
+            out_segment.m_info       = rw_header;
+            out_segment.m_time_index = &m->m_rw_time_indices[stream_index];
+            out_segment.m_ro_index   = -1;
+            return true;
+        }
+        return false;
+    }
+
+    // The header in the mapped file of the segment, nullptr when the file can not be mapped
+    static inline const stream_header_t* s_segment_map(stream_manager_t* m, const stream_segment_t& segment) { return (segment.m_ro_index < 0) ? segment.m_info : s_ro_map(m, segment.m_ro_index); }
+
+    // Decode a block of a compressed file into the block cache, unless it is already there
+    static bool s_block_load(stream_manager_t* m, const stream_header_t* header, u32 block)
+    {
+        stream_block_cache_t& cache = m->m_block_cache;
+        if (cache.m_header == header && cache.m_block == block)
+            return true;
+        if (block >= header->m_block_count || sizeof(stream_header_t) + (u64)header->m_block_count * sizeof(stream_block_entry_t) > header->m_stream_size)
+            return false;
+
+        const stream_block_entry_t* blocks = (const stream_block_entry_t*)(header + 1);
+        const u64                   begin  = blocks[block].m_offset;
+        const u64                   end    = (block + 1 < header->m_block_count) ? blocks[block + 1].m_offset : math::min(header->m_write_cursor, header->m_stream_size);
+        const u64                   first  = (u64)block * c_stream_codec_block_items;
+        if (begin > end || end > header->m_stream_size || first >= header->m_item_count)
+            return false;
+
+        const u32 count = (u32)math::min((u64)c_stream_codec_block_items, header->m_item_count - first);
+        cache.m_header  = nullptr;
+        if (!stream_codec_decode((const u8*)header + begin, (u32)(end - begin), cache.m_times, cache.m_values, count, header->m_sizeof_item, s_stream_is_float(header)))
+            return false;
+        cache.m_header   = header;
+        cache.m_block    = block;
+        cache.m_count    = count;
+        cache.m_has_rows = false;
+        return true;
+    }
+
+    // The loaded block in the row layout
+    static const u8* s_block_rows(stream_manager_t* m)
+    {
+        stream_block_cache_t& cache = m->m_block_cache;
+        if (!cache.m_has_rows)
+        {
+            const u32 value_size = cache.m_header->m_sizeof_item;
+            u8*       row        = cache.m_rows;
+            for (u32 i = 0; i < cache.m_count; i++)
+            {
+                row = stream_write_u64_le(row, cache.m_times[i], c_relative_time_byte_count);
+                memcpy(row, cache.m_values + i * value_size, value_size);
+                row += value_size;
+            }
+            cache.m_has_rows = true;
+        }
+        return cache.m_rows;
+    }
+
+    // Item of a compressed file, the offset of an item is the size of the header plus its index
+    static u64 s_compressed_item_at(stream_manager_t* m, const stream_header_t* header, u64 offset, u64& out_time, const u8*& out_data, u32& out_size)
+    {
+        const u64 item = offset - sizeof(stream_header_t);
+        if (item >= header->m_item_count || !s_block_load(m, header, (u32)(item / c_stream_codec_block_items)))
+            return 0;
+        const u32 slot = (u32)(item % c_stream_codec_block_items);
+        out_time       = header->m_time_begin + m->m_block_cache.m_times[slot];
+        out_data       = m->m_block_cache.m_values + slot * header->m_sizeof_item;
+        out_size       = header->m_sizeof_item;
+        return offset + 1;
+    }
+
+    // First item at or after 'time' in a compressed file, the block directory has the time of the first item of each block
+    static bool s_compressed_seek(stream_manager_t* m, const stream_header_t* header, u64 time, u64& out_item, u64& out_offset)
+    {
+        if (sizeof(stream_header_t) + (u64)header->m_block_count * sizeof(stream_block_entry_t) > header->m_stream_size)
+            return false;
+        const stream_block_entry_t* blocks   = (const stream_block_entry_t*)(header + 1);
+        const u64                   relative = (time > header->m_time_begin) ? time - header->m_time_begin : 0;
+        u32                         lo       = 0;
+        u32                         hi       = header->m_block_count;
+        while (lo < hi)
+        {
+            const u32 mid = (lo + hi) >> 1;
+            if (blocks[mid].m_time_first < relative)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        for (u32 block = (lo > 0) ? lo - 1 : 0; block < header->m_block_count; block++)
+        {
+            if (!s_block_load(m, header, block))
+                return false;
+            for (u32 slot = 0; slot < m->m_block_cache.m_count; slot++)
+            {
+                if (m->m_block_cache.m_times[slot] >= relative)
+                {
+                    out_item   = (u64)block * c_stream_codec_block_items + slot;
+                    out_offset = sizeof(stream_header_t) + out_item;
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    i32 stream_read(stream_manager_t* m, stream_id_t stream_id, u64 item_index, u32 item_count, void const*& item_array, u32& item_size, u64& out_time_begin)
+    {
+        const u32 stream_index = stream_id;
+        if (stream_index >= m->m_num_rw_streams)
+            return -1;
+
+        const stream_header_t* rw_header = m->m_rw_streams[stream_index];
+        if (rw_header == nullptr || rw_header->m_sizeof_item == 0 || rw_header->m_layout != c_stream_layout_row)
+            return -1;  // Variable size streams can only be read with the iterator, column streams with stream_read_columns
+
+        // Item indices run over the archived files of this user (oldest first) and then over the
+        // read-write file, a request is clipped at the end of the file that contains item_index.
+        stream_segment_t segment;
+        i32              after_user_index = -1;
+        while (s_segment_next(m, stream_index, after_user_index, segment))
+        {
+            const stream_header_t* info = segment.m_info;
+            if (info->m_sizeof_item != rw_header->m_sizeof_item || (info->m_layout != rw_header->m_layout && info->m_layout != c_stream_layout_compressed))
+                return -1;
+            const u64 segment_items = s_readable_items(info);
+            if (item_index >= segment_items)
+            {
+                item_index -= segment_items;
+                after_user_index = info->m_user_index;
+                continue;
+            }
+            const stream_header_t* header = s_segment_map(m, segment);
+            if (header == nullptr)
+                return -1;
+            if (header->m_layout == c_stream_layout_compressed)
+            {
+                // Decoded, a request is also clipped at the end of the block
+                if (!s_block_load(m, header, (u32)(item_index / c_stream_codec_block_items)))
+                    return -1;
+                const u32 slot   = (u32)(item_index % c_stream_codec_block_items);
+                const u64 stride = s_item_stride(header);
+                item_array       = s_block_rows(m) + slot * stride;
+                item_size        = (u32)stride;
+                out_time_begin   = header->m_time_begin;
+                return (i32)math::min(item_count, m->m_block_cache.m_count - slot);
+            }
+            const u64 stride = s_item_stride(header);
+            item_array       = (const u8*)header + sizeof(stream_header_t) + item_index * stride;
+            item_size        = (u32)stride;
+            out_time_begin   = header->m_time_begin;
+            return (i32)math::min((u64)item_count, segment_items - item_index);
+        }
+        return 0;  // Past the end of the stream
+    }
+
     i32 stream_read(stream_manager_t* m, stream_id_t stream_id, u64 item_index, u32 item_count, void const*& item_array, u32& item_size)
     {
-        // Make sure the stream identified by stream_id is of type c_stream_type_fixed_data or c_stream_type_fixed_u8 or c_stream_type_fixed_u16
+        u64 time_begin;
+        return stream_read(m, stream_id, item_index, item_count, item_array, item_size, time_begin);
+    }
+
+    i32 stream_read_columns(stream_manager_t* m, stream_id_t stream_id, u64 item_index, u32 item_count, u64 const*& out_times, void const*& out_values, u64& out_time_begin)
+    {
         const u32 stream_index = stream_id;
+        if (stream_index >= m->m_num_rw_streams)
+            return -1;
 
-        const stream_header_t* header = nullptr;
-        ASSERT(stream_index < (u16)m->m_num_rw_streams);
-        header = m->m_rw_streams[stream_index];
+        const stream_header_t* rw_header = m->m_rw_streams[stream_index];
+        if (rw_header == nullptr || rw_header->m_layout != c_stream_layout_column)
+            return -1;
 
-        // TODO : implement reading from the stream
+        // As stream_read, and a request is also clipped at the end of the page that contains item_index
+        stream_segment_t segment;
+        i32              after_user_index = -1;
+        while (s_segment_next(m, stream_index, after_user_index, segment))
+        {
+            const stream_header_t* info = segment.m_info;
+            if (info->m_sizeof_item != rw_header->m_sizeof_item || (info->m_layout != rw_header->m_layout && info->m_layout != c_stream_layout_compressed))
+                return -1;
+            const u64 segment_items = s_readable_items(info);
+            if (item_index >= segment_items)
+            {
+                item_index -= segment_items;
+                after_user_index = info->m_user_index;
+                continue;
+            }
+            const stream_header_t* header = s_segment_map(m, segment);
+            if (header == nullptr)
+                return -1;
+            if (header->m_layout == c_stream_layout_compressed)
+            {
+                if (!s_block_load(m, header, (u32)(item_index / c_stream_codec_block_items)))
+                    return -1;
+                const u32 slot = (u32)(item_index % c_stream_codec_block_items);
+                out_times      = m->m_block_cache.m_times + slot;
+                out_values     = m->m_block_cache.m_values + slot * header->m_sizeof_item;
+                out_time_begin = header->m_time_begin;
+                return (i32)math::min(item_count, m->m_block_cache.m_count - slot);
+            }
+            const u32 page_items = s_column_page_items(header);
+            const u64 slot       = item_index % page_items;
+            const u8* page       = (const u8*)header + sizeof(stream_header_t) + (item_index / page_items) * c_column_page_size;
+            out_times            = (const u64*)page + slot;
+            out_values           = page + s_column_values_offset(page_items) + slot * header->m_sizeof_item;
+            out_time_begin       = header->m_time_begin;
+            return (i32)math::min(math::min((u64)item_count, segment_items - item_index), page_items - slot);
+        }
+        return 0;  // Past the end of the stream
+    }
 
-        return 0;
+    bool stream_iterator_begin(stream_manager_t* m, stream_id_t stream_id, stream_iterator_t& out_iterator)
+    {
+        const u32 stream_index    = stream_id;
+        out_iterator.m_stream_id = c_invalid_stream_id;
+        if (stream_index >= m->m_num_rw_streams || m->m_rw_streams[stream_index] == nullptr)
+            return false;
+
+        stream_segment_t segment;
+        i32              after_user_index = -1;
+        u64              total_items      = 0;
+        while (s_segment_next(m, stream_index, after_user_index, segment))
+        {
+            if (after_user_index < 0)
+                out_iterator.m_segment = segment.m_info->m_user_index;
+            total_items += segment.m_info->m_item_count;
+            after_user_index = segment.m_info->m_user_index;
+        }
+        out_iterator.m_stream_id      = stream_id;
+        out_iterator.m_current_offset = sizeof(stream_header_t);
+        out_iterator.m_current_item   = 0;
+        out_iterator.m_total_items    = total_items;
+        return true;
+    }
+
+    bool stream_iterator_next(stream_manager_t* m, stream_iterator_t& iterator, u64& time_begin, u8 const*& out_data_ptr, u32& out_data_size)
+    {
+        if (iterator.m_stream_id == c_invalid_stream_id)
+            return false;
+
+        // Stay on the current file until it runs out of items, then move on to the next one
+        stream_segment_t segment;
+        i32              after_user_index = iterator.m_segment - 1;
+        while (s_segment_next(m, iterator.m_stream_id, after_user_index, segment))
+        {
+            if ((i32)segment.m_info->m_user_index != iterator.m_segment)
+            {
+                iterator.m_segment        = segment.m_info->m_user_index;
+                iterator.m_current_offset = sizeof(stream_header_t);
+            }
+            const stream_header_t* header = (segment.m_info->m_item_count > 0) ? s_segment_map(m, segment) : nullptr;
+            u64                    next   = 0;
+            if (header != nullptr)
+                next = (header->m_layout == c_stream_layout_compressed) ? s_compressed_item_at(m, header, iterator.m_current_offset, time_begin, out_data_ptr, out_data_size) : s_item_at(header, iterator.m_current_offset, time_begin, out_data_ptr, out_data_size);
+            if (next != 0)
+            {
+                iterator.m_current_offset = next;
+                iterator.m_current_item += 1;
+                return true;
+            }
+            after_user_index = iterator.m_segment;
+        }
+        return false;
+    }
+
+    bool stream_iterator_seek(stream_manager_t* m, stream_iterator_t& iterator, u64 time)
+    {
+        if (iterator.m_stream_id == c_invalid_stream_id)
+            return false;
+
+        stream_segment_t segment;
+        i32              after_user_index = -1;
+        u64              first_item       = 0;
+        while (s_segment_next(m, iterator.m_stream_id, after_user_index, segment))
+        {
+            const stream_header_t* info = segment.m_info;
+            const stream_header_t* header = (info->m_item_count > 0 && info->m_time_end >= time) ? s_segment_map(m, segment) : nullptr;
+            u64                    item, offset;
+            bool                   found = false;
+            if (header != nullptr)
+                found = (header->m_layout == c_stream_layout_compressed) ? s_compressed_seek(m, header, time, item, offset) : s_time_index_seek(m->m_allocator, *segment.m_time_index, header, time, item, offset);
+            if (found)
+            {
+                iterator.m_segment        = info->m_user_index;
+                iterator.m_current_offset = offset;
+                iterator.m_current_item   = first_item + item;
+                return true;
+            }
+            first_item += info->m_item_count;
+            after_user_index = info->m_user_index;
+        }
+        return false;
+    }
+
+    void stream_iterator_end(stream_manager_t* m, stream_iterator_t& iterator)
+    {
+        CC_UNUSED(m);
+        iterator.m_stream_id = c_invalid_stream_id;
+    }
+
+    bool stream_find_time(stream_manager_t* m, stream_id_t stream_id, u64 time, u64& out_item_index)
+    {
+        stream_iterator_t iterator;
+        if (!stream_iterator_begin(m, stream_id, iterator) || !stream_iterator_seek(m, iterator, time))
+            return false;
+        out_item_index = iterator.m_current_item;
+        return true;
+    }
+
+    // Index of the first of the 'count' times that is after 'time' (items are in time order)
+    static u32 s_times_upper_bound(const u64* times, u32 count, u64 time)
+    {
+        u32 lo = 0;
+        u32 hi = count;
+        while (lo < hi)
+        {
+            const u32 mid = (lo + hi) >> 1;
+            if (times[mid] <= time)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        return lo;
+    }
+
+    // As s_times_upper_bound for the items of a row layout file, 'first' to 'end'
+    static u64 s_rows_upper_bound(const stream_header_t* header, u64 first, u64 end, u64 time)
+    {
+        const u64 stride = s_item_stride(header);
+        const u8* items  = (const u8*)header + sizeof(stream_header_t);
+        u64       lo     = first;
+        u64       hi     = end;
+        while (lo < hi)
+        {
+            const u64 mid = (lo + hi) >> 1;
+            if (s_read_u64_le(items + mid * stride, c_relative_time_byte_count) <= time)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        return lo;
+    }
+
+    // Aggregate the items of a stream file from 'item' up to the last item at or before 'time_end' (relative),
+    // returns false when the file holds items after 'time_end', so that the following files can be skipped.
+    static bool s_segment_aggregate(stream_manager_t* m, const stream_header_t* header, u8 value_type, u64 item, u64 time_end, stream_stats_t& stats)
+    {
+        const u64 items = s_readable_items(header);
+        if (header->m_layout == c_stream_layout_compressed)
+        {
+            for (u32 block = (u32)(item / c_stream_codec_block_items); (u64)block * c_stream_codec_block_items < items; block++)
+            {
+                if (!s_block_load(m, header, block))
+                    return false;
+                const stream_block_cache_t& cache = m->m_block_cache;
+                const u32                   slot  = (u32)math::max(item, (u64)block * c_stream_codec_block_items) % c_stream_codec_block_items;
+                const u32                   end   = slot + s_times_upper_bound(cache.m_times + slot, cache.m_count - slot, time_end);
+                stream_aggregate_values(value_type, cache.m_values + slot * header->m_sizeof_item, end - slot, stats);
+                if (end < cache.m_count)
+                    return false;
+            }
+            return true;
+        }
+
+        if (header->m_layout == c_stream_layout_column)
+        {
+            const u32 page_items = s_column_page_items(header);
+            for (u64 page = item / page_items; page * page_items < items; page++)
+            {
+                const u8* base  = (const u8*)header + sizeof(stream_header_t) + page * c_column_page_size;
+                const u32 slot  = (u32)(math::max(item, page * page_items) - page * page_items);
+                const u32 count = (u32)math::min((u64)page_items, items - page * page_items);
+                const u32 end   = slot + s_times_upper_bound((const u64*)base + slot, count - slot, time_end);
+                stream_aggregate_values(value_type, base + s_column_values_offset(page_items) + slot * header->m_sizeof_item, end - slot, stats);
+                if (end < count)
+                    return false;
+            }
+            return true;
+        }
+
+        const u64 stride = s_item_stride(header);
+        const u64 end    = s_rows_upper_bound(header, item, items, time_end);
+        for (u64 i = item; i < end;)
+        {
+            const u32 count = (u32)math::min(end - i, (u64)0x40000000);
+            stream_aggregate_strided(value_type, (const u8*)header + sizeof(stream_header_t) + i * stride + c_relative_time_byte_count, (u32)stride, count, stats);
+            i += count;
+        }
+        return end == items;
+    }
+
+    bool stream_aggregate(stream_manager_t* m, stream_id_t stream_id, u64 time_begin, u64 time_end, stream_stats_t& out_stats)
+    {
+        stream_stats_init(out_stats);
+
+        const u32 stream_index = stream_id;
+        if (stream_index >= m->m_num_rw_streams || m->m_rw_streams[stream_index] == nullptr)
+            return false;
+        const stream_header_t* rw_header  = m->m_rw_streams[stream_index];
+        const u8               value_type = (u8)rw_header->m_stream_type;
+        if (s_sizeof_value(value_type) == 0 || s_sizeof_value(value_type) != rw_header->m_sizeof_item)
+            return false;  // Not a numeric stream
+
+        // Only the files that overlap the range are visited, the sparse time index (or the block directory)
+        // gives the first item, from there the values are aggregated a page or block at a time.
+        stream_segment_t segment;
+        i32              after_user_index = -1;
+        while (time_begin <= time_end && s_segment_next(m, stream_index, after_user_index, segment))
+        {
+            const stream_header_t* info = segment.m_info;
+            after_user_index            = info->m_user_index;
+            if (info->m_sizeof_item != rw_header->m_sizeof_item || info->m_item_count == 0 || info->m_time_end < time_begin)
+                continue;
+            if (info->m_time_begin > time_end)
+                break;
+            const stream_header_t* header = s_segment_map(m, segment);
+            if (header == nullptr)
+                continue;
+
+            u64  item, offset;
+            bool found = (header->m_layout == c_stream_layout_compressed) ? s_compressed_seek(m, header, time_begin, item, offset) : s_time_index_seek(m->m_allocator, *segment.m_time_index, header, time_begin, item, offset);
+            if (found && !s_segment_aggregate(m, header, value_type, item, time_end - header->m_time_begin, out_stats))
+                break;
+        }
+
+        stream_stats_finish(out_stats);
+        return true;
+    }
+
+    // Fold the items that the rollup has not seen yet, all of them for a new rollup. Items older than the span of the
+    // rollup would only be overwritten, they are counted but not read, so the archives before the span are not decoded.
+    static void s_rollup_catch_up(stream_manager_t* m, u32 stream_index, void* rollup)
+    {
+        const stream_header_t* rw_header  = m->m_rw_streams[stream_index];
+        const u8               value_type = (u8)rw_header->m_stream_type;
+        u64                    item       = stream_rollup_items(rollup);
+        u64                    first      = 0;
+        if (rw_header->m_time_end > stream_rollup_span() && stream_find_time(m, stream_index, rw_header->m_time_end - stream_rollup_span(), first) && first > item)
+        {
+            stream_rollup_skip(rollup, first - item);
+            item = first;
+        }
+        while (true)
+        {
+            u64 time_begin;
+            i32 count;
+            if (rw_header->m_layout == c_stream_layout_column)
+            {
+                u64 const*  times;
+                void const* values;
+                count = stream_read_columns(m, stream_index, item, 0x10000, times, values, time_begin);
+                for (i32 i = 0; i < count; i++)
+                    stream_rollup_add(rollup, time_begin + times[i], s_value_as_f64(value_type, (const u8*)values + (u64)i * rw_header->m_sizeof_item));
+            }
+            else
+            {
+                void const* items;
+                u32         stride;
+                count = stream_read(m, stream_index, item, 0x10000, items, stride, time_begin);
+                for (i32 i = 0; i < count; i++)
+                {
+                    const u8* at = (const u8*)items + (u64)i * stride;
+                    stream_rollup_add(rollup, time_begin + s_read_u64_le(at, c_relative_time_byte_count), s_value_as_f64(value_type, at + c_relative_time_byte_count));
+                }
+            }
+            if (count <= 0)
+                break;
+            item += count;
+        }
+    }
+
+    // Map the rollup of a numeric stream that has a file, it is created next to the stream file ({name}.rollup)
+    static void s_rollup_open(stream_manager_t* m, u32 stream_index)
+    {
+        const stream_header_t* header = m->m_rw_streams[stream_index];
+        if (m->m_rw_rollups[stream_index] != nullptr || m->m_rw_stream_filepaths[stream_index] == nullptr || s_sizeof_value((u8)header->m_stream_type) == 0 ||
+            s_sizeof_value((u8)header->m_stream_type) != header->m_sizeof_item)
+            return;
+
+        char        filepath[MAXPATHLEN];
+        const char* rw_filepath = m->m_rw_stream_filepaths[stream_index];
+        const char* ext         = strrchr(rw_filepath, '.');
+        snprintf(filepath, sizeof(filepath), "%.*s.rollup", (int)((ext != nullptr) ? ext - rw_filepath : strlen(rw_filepath)), rw_filepath);
+
+        // An existing rollup is used when it is complete and of this version, otherwise it is rebuilt
+        struct stat          st;
+        nmmio::mappedfile_t* mmfile = nullptr;
+        void*                rollup = nullptr;
+        nmmio::allocate(m->m_allocator, mmfile);
+        if (stat(filepath, &st) == 0 && (u64)st.st_size >= stream_rollup_size() && nmmio::open_rw(mmfile, filepath))
+        {
+            rollup = nmmio::address_rw(mmfile);
+            if (rollup == nullptr || !stream_rollup_valid(rollup, (u64)st.st_size))
+            {
+                nmmio::close(mmfile);
+                rollup = nullptr;
+            }
+        }
+        if (rollup == nullptr && nmmio::create_rw(mmfile, filepath, stream_rollup_size()))
+        {
+            rollup = nmmio::address_rw(mmfile);
+            if (rollup != nullptr)
+                stream_rollup_init(rollup);
+            else
+                nmmio::close(mmfile);
+        }
+        if (rollup == nullptr)
+        {
+            nmmio::deallocate(m->m_allocator, mmfile);
+            return;
+        }
+
+        s_rollup_catch_up(m, stream_index, rollup);
+        m->m_rw_rollup_files[stream_index] = mmfile;
+        m->m_rw_rollups[stream_index]      = rollup;
+    }
+
+    i32 stream_read_buckets(stream_manager_t* m, stream_id_t stream_id, u64 time_begin, u64 time_end, u64 resolution, stream_bucket_t* out_buckets, u32 max_buckets, u64& out_width)
+    {
+        const u32 stream_index = stream_id;
+        if (stream_index >= m->m_num_rw_streams || m->m_rw_streams[stream_index] == nullptr)
+            return -1;
+        const stream_header_t* rw_header  = m->m_rw_streams[stream_index];
+        const u8               value_type = (u8)rw_header->m_stream_type;
+        if (s_sizeof_value(value_type) == 0 || s_sizeof_value(value_type) != rw_header->m_sizeof_item)
+            return -1;
+
+        // The coarsest tier of the rollup that is fine enough and still holds the range
+        const void* rollup = m->m_rw_rollups[stream_index];
+        if (rollup != nullptr)
+        {
+            const i32 tier = stream_rollup_tier(rollup, time_begin, resolution, out_width);
+            if (tier >= 0)
+                return (i32)stream_rollup_read(rollup, tier, time_begin, time_end, out_buckets, max_buckets);
+        }
+
+        // Finer than a minute, older than the rollup holds, or a stream without a file, the buckets come from the items
+        out_width             = math::max(resolution, (u64)1);
+        const u64 bucket_last = (time_end / out_width) * out_width;
+        stream_iterator_t iterator;
+        if (!stream_iterator_begin(m, stream_id, iterator) || !stream_iterator_seek(m, iterator, (time_begin / out_width) * out_width))
+            return 0;
+        u32       count = 0;
+        u64       time;
+        const u8* data;
+        u32       size;
+        while (stream_iterator_next(m, iterator, time, data, size) && time - time % out_width <= bucket_last)
+        {
+            const u64 bucket_time = (time / out_width) * out_width;
+            if (count == 0 || out_buckets[count - 1].m_time != bucket_time)
+            {
+                if (count == max_buckets)
+                    break;
+                stream_bucket_t& bucket = out_buckets[count++];
+                bucket.m_time           = bucket_time;
+                bucket.m_count          = 0;
+                bucket.m_mean           = 0.0;  // The sum until all items are in
+            }
+            stream_bucket_t& bucket = out_buckets[count - 1];
+            const f64        value  = s_value_as_f64(value_type, data);
+            bucket.m_min            = (bucket.m_count == 0 || value < bucket.m_min) ? value : bucket.m_min;
+            bucket.m_max            = (bucket.m_count == 0 || value > bucket.m_max) ? value : bucket.m_max;
+            bucket.m_mean += value;
+            bucket.m_count += 1;
+        }
+        stream_iterator_end(m, iterator);
+        for (u32 i = 0; i < count; i++)
+            out_buckets[i].m_mean /= (f64)out_buckets[i].m_count;
+        return (i32)count;
     }
 
     // We want a thread that can create new streams on disk, and we want this to be on a separate
@@ -0,0 +1,349 @@
+#include "ccore/c_allocator.h"
+#include "cmmio/c_mmio.h"
+
+#include "cconartist/stream_notify.h"
+
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(TARGET_LINUX)
+#    include <limits.h>
+#    include <linux/futex.h>
+#    include <sys/syscall.h>
+#endif
+
+namespace ncore
+{
+    static const u32 c_notify_magic   = 0x5946544E;  // 'NTFY'
+    static const u32 c_notify_version = 1;
+    static const u32 c_notify_slots   = 4096;  // Streams with a higher index only ring the doorbell
+    static const u32 c_notify_index   = 8192;  // Buckets of the writer's user id index, twice the slots
+
+    struct notify_header_t
+    {
+        u32 m_magic;
+        u32 m_version;
+        u32 m_slot_count;
+        u32 m_generation;  // The doorbell (futex word)
+        u8  m_pad[48];
+    };
+
+    // Written by the stream manager only, under a seqlock like the stream header (see s_stream_publish), so a reader
+    // never sees the item count of one publish with the time of another.
+    struct notify_slot_t
+    {
+        u64 m_user_id;
+        u64 m_time_end;
+        u64 m_item_count;
+        u64 m_sequence;  // Odd while the writer updates the slot
+    };
+
+    struct stream_notify_t
+    {
+        nmmio::mappedfile_t* m_file;
+        notify_header_t*     m_header;
+        notify_slot_t*       m_slots;
+        u16*                 m_index;  // Writer: slot + 1 of every user id (open addressing), 0 for an empty bucket
+        bool                 m_dirty;  // Writer: something was published since the last ring
+    };
+
+    static inline u64 s_notify_file_size() { return sizeof(notify_header_t) + (u64)c_notify_slots * sizeof(notify_slot_t); }
+
+    static stream_notify_t* s_notify_new(alloc_t* allocator, nmmio::mappedfile_t* file, void* address)
+    {
+        stream_notify_t* notify = g_allocate<stream_notify_t>(allocator);
+        notify->m_file          = file;
+        notify->m_header        = (notify_header_t*)address;
+        notify->m_slots         = (notify_slot_t*)(notify->m_header + 1);
+        notify->m_index         = nullptr;
+        notify->m_dirty         = false;
+        return notify;
+    }
+
+    static void s_slot_store(notify_slot_t& s, u64 user_id, u64 item_count, u64 time_end)
+    {
+        const u64 sequence = s.m_sequence;
+        __atomic_store_n(&s.m_sequence, sequence + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        __atomic_store_n(&s.m_user_id, user_id, __ATOMIC_RELAXED);
+        __atomic_store_n(&s.m_item_count, item_count, __ATOMIC_RELAXED);
+        __atomic_store_n(&s.m_time_end, time_end, __ATOMIC_RELAXED);
+        __atomic_store_n(&s.m_sequence, sequence + 2, __ATOMIC_RELEASE);
+    }
+
+    // False when the writer kept updating the slot during the attempts
+    static bool s_slot_load(const notify_slot_t& s, u64& out_user_id, u64& out_item_count, u64& out_time_end)
+    {
+        for (u32 attempt = 0; attempt < 1024; attempt++)
+        {
+            const u64 sequence = __atomic_load_n(&s.m_sequence, __ATOMIC_ACQUIRE);
+            if ((sequence & 1) != 0)
+                continue;
+            out_user_id    = __atomic_load_n(&s.m_user_id, __ATOMIC_RELAXED);
+            out_item_count = __atomic_load_n(&s.m_item_count, __ATOMIC_RELAXED);
+            out_time_end   = __atomic_load_n(&s.m_time_end, __ATOMIC_RELAXED);
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&s.m_sequence, __ATOMIC_RELAXED) == sequence)
+                return true;
+        }
+        return false;
+    }
+
+    // The writer finds the slot a user id is in through an index, the slot only changes hands after a restart (another
+    // scan order of the stream manager) and the user id must then be removed from the slot it had before.
+    static inline u32 s_index_bucket(u64 user_id) { return (u32)((user_id * 0x9E3779B97F4A7C15ull) >> 51); }
+
+    static i32 s_index_find(const stream_notify_t* notify, u64 user_id)
+    {
+        for (u32 b = s_index_bucket(user_id);; b = (b + 1) & (c_notify_index - 1))
+        {
+            const u16 entry = notify->m_index[b];
+            if (entry == 0)
+                return -1;
+            if (notify->m_slots[entry - 1].m_user_id == user_id)
+                return (i32)b;
+        }
+    }
+
+    static void s_index_insert(stream_notify_t* notify, u64 user_id, u32 slot)
+    {
+        u32 b = s_index_bucket(user_id);
+        while (notify->m_index[b] != 0)
+            b = (b + 1) & (c_notify_index - 1);
+        notify->m_index[b] = (u16)(slot + 1);
+    }
+
+    // Shifts the entries after the bucket back, every entry stays reachable from its own bucket
+    static void s_index_remove(stream_notify_t* notify, u32 bucket)
+    {
+        const u32 mask = c_notify_index - 1;
+        u32       hole = bucket;
+        for (u32 b = (hole + 1) & mask; notify->m_index[b] != 0; b = (b + 1) & mask)
+        {
+            const u32 home = s_index_bucket(notify->m_slots[notify->m_index[b] - 1].m_user_id);
+            if (((b - home) & mask) >= ((b - hole) & mask))
+            {
+                notify->m_index[hole] = notify->m_index[b];
+                hole                  = b;
+            }
+        }
+        notify->m_index[hole] = 0;
+    }
+
+    static bool s_notify_valid(const notify_header_t* header) { return header != nullptr && header->m_magic == c_notify_magic && header->m_version == c_notify_version && header->m_slot_count == c_notify_slots; }
+
+    stream_notify_t* stream_notify_create(alloc_t* allocator, const char* base_path)
+    {
+        char filepath[MAXPATHLEN];
+        snprintf(filepath, sizeof(filepath), "%s/streams.notify", base_path);
+
+        // An existing file is kept, readers that have it mapped stay connected when the server restarts
+        struct stat          st;
+        nmmio::mappedfile_t* file   = nullptr;
+        void*                memory = nullptr;
+        nmmio::allocate(allocator, file);
+        if (stat(filepath, &st) == 0 && (u64)st.st_size == s_notify_file_size() && nmmio::open_rw(file, filepath))
+        {
+            memory = nmmio::address_rw(file);
+            if (!s_notify_valid((const notify_header_t*)memory))
+            {
+                nmmio::close(file);
+                memory = nullptr;
+            }
+        }
+        if (memory == nullptr && nmmio::create_rw(file, filepath, s_notify_file_size()))
+        {
+            memory = nmmio::address_rw(file);
+            if (memory != nullptr)
+            {
+                memset(memory, 0, s_notify_file_size());
+                notify_header_t* header = (notify_header_t*)memory;
+                header->m_version       = c_notify_version;
+                header->m_slot_count    = c_notify_slots;
+                __atomic_store_n(&header->m_magic, c_notify_magic, __ATOMIC_RELEASE);
+            }
+            else
+            {
+                nmmio::close(file);
+            }
+        }
+        if (memory == nullptr)
+        {
+            nmmio::deallocate(allocator, file);
+            return nullptr;
+        }
+
+        stream_notify_t* notify = s_notify_new(allocator, file, memory);
+        notify->m_index         = g_allocate_array_and_clear<u16>(allocator, c_notify_index);
+        for (u32 i = 0; i < c_notify_slots; i++)
+        {
+            // A writer that stopped in the middle of s_slot_store leaves an odd sequence
+            notify_slot_t& s = notify->m_slots[i];
+            if ((s.m_sequence & 1) != 0)
+                __atomic_store_n(&s.m_sequence, s.m_sequence + 1, __ATOMIC_RELEASE);
+            if (s.m_user_id == 0)
+                continue;
+            if (s_index_find(notify, s.m_user_id) >= 0)
+                s_slot_store(s, 0, 0, 0);  // Already in an earlier slot
+            else
+                s_index_insert(notify, s.m_user_id, i);
+        }
+        return notify;
+    }
+
+    void stream_notify_publish(stream_notify_t* notify, u32 slot, u64 user_id, u64 item_count, u64 time_end)
+    {
+        if (slot >= c_notify_slots)
+        {
+            notify->m_dirty = true;
+            return;
+        }
+        notify_slot_t& s = notify->m_slots[slot];
+        if (s.m_user_id == user_id && s.m_item_count == item_count)
+            return;
+        if (s.m_user_id != user_id)
+        {
+            // The slot changes hands, readers look the user id up again and must not find it in the slot it had before
+            const i32 current = s.m_user_id != 0 ? s_index_find(notify, s.m_user_id) : -1;
+            if (current >= 0)
+                s_index_remove(notify, (u32)current);
+            const i32 previous = s_index_find(notify, user_id);
+            if (previous >= 0)
+            {
+                notify_slot_t& p = notify->m_slots[notify->m_index[previous] - 1];
+                s_index_remove(notify, (u32)previous);
+                s_slot_store(p, 0, 0, 0);
+            }
+            s_slot_store(s, user_id, item_count, time_end);
+            s_index_insert(notify, user_id, slot);
+        }
+        else
+        {
+            s_slot_store(s, user_id, item_count, time_end);
+        }
+        notify->m_dirty = true;
+    }
+
+    void stream_notify_ring(stream_notify_t* notify)
+    {
+        if (!notify->m_dirty)
+            return;
+        notify->m_dirty = false;
+        __atomic_add_fetch(&notify->m_header->m_generation, 1, __ATOMIC_RELEASE);
+#if defined(TARGET_LINUX)
+        syscall(SYS_futex, &notify->m_header->m_generation, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+#endif
+    }
+
+    stream_notify_t* stream_notify_open(alloc_t* allocator, const char* base_path)
+    {
+        char filepath[MAXPATHLEN];
+        snprintf(filepath, sizeof(filepath), "%s/streams.notify", base_path);
+
+        struct stat st;
+        if (stat(filepath, &st) != 0 || (u64)st.st_size < s_notify_file_size())
+            return nullptr;
+        nmmio::mappedfile_t* file = nullptr;
+        nmmio::allocate(allocator, file);
+        if (nmmio::open_ro(file, filepath))
+        {
+            const void* memory = nmmio::address_ro(file);
+            if (memory != nullptr && s_notify_valid((const notify_header_t*)memory))
+                return s_notify_new(allocator, file, (void*)memory);
+            nmmio::close(file);
+        }
+        nmmio::deallocate(allocator, file);
+        return nullptr;
+    }
+
+    bool stream_notify_state(stream_notify_t* notify, u64 user_id, u64& out_item_count, u64& out_time_end)
+    {
+        for (u32 i = 0; i < c_notify_slots; i++)
+        {
+            const notify_slot_t& s = notify->m_slots[i];
+            if (__atomic_load_n(&s.m_user_id, __ATOMIC_RELAXED) != user_id)
+                continue;
+            u64 slot_user_id;
+            if (s_slot_load(s, slot_user_id, out_item_count, out_time_end) && slot_user_id == user_id)
+                return true;
+        }
+        return false;
+    }
+
+    u32 stream_notify_generation(stream_notify_t* notify) { return __atomic_load_n(&notify->m_header->m_generation, __ATOMIC_ACQUIRE); }
+
+    static u64 s_now_ms()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (u64)ts.tv_sec * 1000 + (u64)ts.tv_nsec / 1000000;
+    }
+
+    bool stream_notify_wait(stream_notify_t* notify, u32 generation, i32 timeout_ms)
+    {
+        const u64 deadline = s_now_ms() + (u64)(timeout_ms < 0 ? 0 : timeout_ms);
+        while (stream_notify_generation(notify) == generation)
+        {
+            const u64 now = s_now_ms();
+            if (timeout_ms >= 0 && now >= deadline)
+                return false;
+#if defined(TARGET_LINUX)
+            // Returns right away when the generation already moved on, a wakeup can not get lost
+            struct timespec  ts;
+            struct timespec* timeout = nullptr;
+            if (timeout_ms >= 0)
+            {
+                ts.tv_sec  = (time_t)((deadline - now) / 1000);
+                ts.tv_nsec = (long)((deadline - now) % 1000) * 1000000;
+                timeout    = &ts;
+            }
+            syscall(SYS_futex, &notify->m_header->m_generation, FUTEX_WAIT, generation, timeout, nullptr, 0);
+#else
+            usleep(1000);
+#endif
+        }
+        return true;
+    }
+
+    i32 stream_notify_wait_any(stream_notify_t* notify, const u64* user_ids, const u64* cursors, u32 count, i32 timeout_ms)
+    {
+        const u64 deadline = s_now_ms() + (u64)(timeout_ms < 0 ? 0 : timeout_ms);
+        while (true)
+        {
+            // The generation is read before the streams are checked, a publish in between is not missed
+            const u32 generation = stream_notify_generation(notify);
+            for (u32 i = 0; i < count; i++)
+            {
+                u64 item_count, time_end;
+                if (stream_notify_state(notify, user_ids[i], item_count, time_end) && item_count > cursors[i])
+                    return (i32)i;
+            }
+            i32 remaining = timeout_ms;
+            if (timeout_ms >= 0)
+            {
+                const u64 now = s_now_ms();
+                if (now >= deadline)
+                    return -1;
+                remaining = (i32)(deadline - now);
+            }
+            stream_notify_wait(notify, generation, remaining);
+        }
+    }
+
+    void stream_notify_close(alloc_t* allocator, stream_notify_t*& notify)
+    {
+        if (notify == nullptr)
+            return;
+        nmmio::close(notify->m_file);
+        nmmio::deallocate(allocator, notify->m_file);
+        if (notify->m_index != nullptr)
+            g_deallocate_array(allocator, notify->m_index);
+        g_deallocate(allocator, notify);
+        notify = nullptr;
+    }
+
+}  // namespace ncore
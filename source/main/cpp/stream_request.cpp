@@ -16,6 +16,8 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <sys/param.h>
+#include <sys/stat.h>
 
 namespace ncore
 {
@@ -37,7 +39,8 @@ namespace ncore
         stream_id_t          m_stream_id;
         u64                  m_user_id;
         u64                  m_mmfile_size;
-        nmmio::mappedfile_t* m_mmfile;
+        nmmio::mappedfile_t* m_mmfile;                // Set by the job, nullptr when the file could not be created
+        char                 m_filepath[MAXPATHLEN];  //
     };
 
 #define DMAPPING_NAME_MAXLEN 64
@@ -86,7 +89,8 @@ namespace ncore
     {
         char* name_dest = &mappings->m_mapping_names[mappings->m_mappings_size * DMAPPING_NAME_MAXLEN];
         nmem::memcpy(name_dest, name, DMAPPING_NAME_MAXLEN);
-        mappings->m_mapping_ids[mappings->m_mappings_size] = user_id;
+        mappings->m_mapping_ids[mappings->m_mappings_size]     = user_id;
+        mappings->m_mappings_sorted[mappings->m_mappings_size] = mappings->m_mappings_size;
         mappings->m_mappings_size++;
     }
 
@@ -144,7 +148,10 @@ namespace ncore
         manager->m_requests                 = g_allocate_array<stream_request_t>(allocator, manager->m_requests_capacity);
         manager->m_free_requests            = g_allocate_array<i16>(allocator, manager->m_requests_capacity);
         manager->m_active_requests          = g_allocate_array<i16>(allocator, manager->m_requests_capacity);
+        manager->m_done_requests            = g_allocate_array<i16>(allocator, manager->m_requests_capacity);
         manager->m_last_mappings_check_time = now;
+        for (i32 i = 0; i < manager->m_requests_capacity; ++i)
+            manager->m_free_requests[manager->m_free_requests_size++] = (i16)(manager->m_requests_capacity - 1 - i);
 
         for (i32 i = 0; i < 2; ++i)
         {
@@ -174,29 +181,47 @@ namespace ncore
 
     void destroy_stream_request_manager(stream_request_manager_t*& manager)
     {
+        // The loaded mappings are owned by the job that reloads them until that job is done
+        if (manager->m_loaded_mappings == nullptr)
+        {
+            void* job_data0;
+            void* job_data1;
+            if (pop_job_wait(manager->m_job_manager, manager->m_mappings_channel, job_data0, job_data1) == 0)
+                manager->m_loaded_mappings = (stream_mappings_t*)job_data0;
+        }
+
         // Deallocate mappings
+        g_deallocate_array<char>(manager->m_allocator, manager->m_mappings->m_file_content);
         g_deallocate_string(manager->m_allocator, manager->m_mappings->m_mappings_filepath);
         g_deallocate_array<u64>(manager->m_allocator, manager->m_mappings->m_mapping_ids);
         g_deallocate_array<char>(manager->m_allocator, manager->m_mappings->m_mapping_names);
+        g_deallocate_array<i32>(manager->m_allocator, manager->m_mappings->m_mappings_sorted);
         g_deallocate<stream_mappings_t>(manager->m_allocator, manager->m_mappings);
 
         // Deallocate loaded mappings
-        g_deallocate_string(manager->m_allocator, manager->m_loaded_mappings->m_mappings_filepath);
-        g_deallocate_array<u64>(manager->m_allocator, manager->m_loaded_mappings->m_mapping_ids);
-        g_deallocate_array<char>(manager->m_allocator, manager->m_loaded_mappings->m_mapping_names);
-        g_deallocate<stream_mappings_t>(manager->m_allocator, manager->m_loaded_mappings);
+        if (manager->m_loaded_mappings != nullptr)
+        {
+            g_deallocate_array<char>(manager->m_allocator, manager->m_loaded_mappings->m_file_content);
+            g_deallocate_string(manager->m_allocator, manager->m_loaded_mappings->m_mappings_filepath);
+            g_deallocate_array<u64>(manager->m_allocator, manager->m_loaded_mappings->m_mapping_ids);
+            g_deallocate_array<char>(manager->m_allocator, manager->m_loaded_mappings->m_mapping_names);
+            g_deallocate_array<i32>(manager->m_allocator, manager->m_loaded_mappings->m_mappings_sorted);
+            g_deallocate<stream_mappings_t>(manager->m_allocator, manager->m_loaded_mappings);
+        }
 
         // Deallocate members of manager
         g_deallocate_string(manager->m_allocator, manager->m_streams_basepath);
         g_deallocate_array<stream_request_t>(manager->m_allocator, manager->m_requests);
         g_deallocate_array<i16>(manager->m_allocator, manager->m_active_requests);
+        g_deallocate_array<i16>(manager->m_allocator, manager->m_free_requests);
+        g_deallocate_array<i16>(manager->m_allocator, manager->m_done_requests);
         g_deallocate<stream_request_manager_t>(manager->m_allocator, manager);
 
         // Nullify pointer
         manager = nullptr;
     }
 
-    void push_stream_request(stream_request_manager_t* srm, u64 user_id, stream_id_t stream_id, u64 mmfile_size, nmmio::mappedfile_t* mmfile)
+    bool push_stream_request(stream_request_manager_t* srm, u64 user_id, stream_id_t stream_id, u64 mmfile_size, nmmio::mappedfile_t* mmfile)
     {
         if (srm->m_free_requests_size > 0)
         {
@@ -208,13 +233,16 @@ namespace ncore
             req->m_version                  = srm->m_mappings->m_version - 1;
             req->m_stream_id                = stream_id;
             req->m_mmfile                   = mmfile;
+            req->m_filepath[0]              = 0;
 
             // Move to active requests
             srm->m_active_requests[srm->m_active_requests_size++] = request_index;
+            return true;
         }
+        return false;
     }
 
-    bool pop_stream_request(stream_request_manager_t* srm, u64& user_id, nmmio::mappedfile_t*& out_mmfile)
+    bool pop_stream_request(stream_request_manager_t* srm, u64& user_id, nmmio::mappedfile_t*& out_mmfile, char* out_filepath, u32 out_filepath_size)
     {
         if (srm->m_done_requests_size > 0)
         {
@@ -222,6 +250,7 @@ namespace ncore
             stream_request_t* req           = &srm->m_requests[request_index];
             user_id                         = req->m_user_id;
             out_mmfile                      = req->m_mmfile;
+            snprintf(out_filepath, out_filepath_size, "%s", req->m_filepath);
 
             // Reclaim request slot
             srm->m_free_requests[srm->m_free_requests_size++] = request_index;
@@ -258,7 +287,7 @@ namespace ncore
         while (pop_job(srm->m_job_manager, srm->m_mappings_channel, job_data0, job_data1) == 0)
         {
             // Stream mapping job finished
-            stream_mappings_t* loaded_mappings = (stream_mappings_t*)job_data1;
+            stream_mappings_t* loaded_mappings = (stream_mappings_t*)job_data0;
             srm->m_loaded_mappings             = loaded_mappings;
 
             // For each user-id / name, we add them to srm->m_mappings
@@ -281,17 +310,18 @@ namespace ncore
         while (pop_job(srm->m_job_manager, srm->m_stream_request_channel, job_data0, job_data1) == 0)
         {
             // Stream request job finished
-            stream_request_t* request = (stream_request_t*)job_data0;
+            stream_request_t* request = (stream_request_t*)job_data1;
 
             // Push it in the done requests array
             srm->m_done_requests[srm->m_done_requests_size++] = (i16)(request - srm->m_requests);
         }
 
-        // Check stream requests against the mappings
-        for (i32 i = 0; i < srm->m_active_requests_size; ++i)
+        // Check stream requests against the mappings, a request that is handed to the job manager is
+        // no longer active until it comes back as done
+        for (i32 i = 0; i < srm->m_active_requests_size;)
         {
             const i16 request_index = srm->m_active_requests[i];
-            if (srm->m_mappings != nullptr && srm->m_requests[request_index].m_mmfile == nullptr)
+            if (srm->m_mappings != nullptr)
             {
                 // Check if the mapping exists
                 const i32 mapping_index = find_mapping(srm->m_mappings, srm->m_requests[request_index].m_user_id);
@@ -302,9 +332,14 @@ namespace ncore
                     req_to_process->m_mapping_index = mapping_index;
                     req_to_process->m_version       = srm->m_mappings->m_version;
 
-                    push_job(srm->m_job_manager, srm->m_stream_request_channel, stream_request_fn, srm, req_to_process);
+                    if (push_job(srm->m_job_manager, srm->m_stream_request_channel, stream_request_fn, srm, req_to_process) == 0)
+                    {
+                        srm->m_active_requests[i] = srm->m_active_requests[--srm->m_active_requests_size];
+                        continue;
+                    }
                 }
             }
+            ++i;
         }
     }
 
@@ -370,15 +405,20 @@ namespace ncore
         const char* streams_basepath = srm->m_streams_basepath;
 
         // Create the stream file on disk
-        char filepath[MAXPATHLEN];
-        snprintf(filepath, sizeof(filepath), "%s/%s.rwstream", streams_basepath, name);
+        snprintf(known_request->m_filepath, sizeof(known_request->m_filepath), "%s/%s.rwstream", streams_basepath, name);
 
         // Create the mapped file
-        nmmio::mappedfile_t* mmfile_rw = known_request->m_mmfile;
-        if (nmmio::create_rw(mmfile_rw, filepath, known_request->m_mmfile_size))
+        nmmio::mappedfile_t* mmfile_rw = nullptr;
+        nmmio::allocate(srm->m_allocator, mmfile_rw);
+        if (nmmio::create_rw(mmfile_rw, known_request->m_filepath, known_request->m_mmfile_size))
         {
             known_request->m_mmfile = mmfile_rw;
         }
+        else
+        {
+            nmmio::deallocate(srm->m_allocator, mmfile_rw);
+            known_request->m_mmfile = nullptr;
+        }
     }
 
 }  // namespace ncore
@@ -0,0 +1,147 @@
+#include "cconartist/stream_rollup.h"
+
+#include <string.h>
+
+namespace ncore
+{
+    static const u32 c_rollup_magic   = 0x4C4C4F52;  // 'ROLL'
+    static const u32 c_rollup_version = 1;
+
+    static const u64 c_tier_width[c_stream_rollup_tiers]    = {60 * 1000, 3600 * 1000, 24 * 3600 * 1000};
+    static const u32 c_tier_capacity[c_stream_rollup_tiers] = {32768, 32768, 16384};
+
+    struct rollup_header_t
+    {
+        u32 m_magic;
+        u32 m_version;
+        u64 m_items;                           // Number of values added
+        u32 m_newest[c_stream_rollup_tiers];  // Key of the newest bucket of each tier, 0 when the tier is empty
+        u32 m_reserved[9];
+    };
+
+    // A bucket belongs to the key stored in it (the bucket index plus one), a slot that is reused by a
+    // newer bucket starts over
+    struct rollup_bucket_t
+    {
+        u32 m_key;
+        u32 m_count;
+        f64 m_min;
+        f64 m_max;
+        f64 m_sum;
+    };
+
+    static inline rollup_bucket_t *tier_buckets(void *rollup, u32 tier)
+    {
+        rollup_bucket_t *buckets = (rollup_bucket_t *)((rollup_header_t *)rollup + 1);
+        for (u32 i = 0; i < tier; ++i)
+            buckets += c_tier_capacity[i];
+        return buckets;
+    }
+
+    static inline const rollup_bucket_t *tier_buckets(const void *rollup, u32 tier) { return tier_buckets((void *)rollup, tier); }
+
+    u64 stream_rollup_size()
+    {
+        u64 size = sizeof(rollup_header_t);
+        for (u32 i = 0; i < c_stream_rollup_tiers; ++i)
+            size += (u64)c_tier_capacity[i] * sizeof(rollup_bucket_t);
+        return size;
+    }
+
+    void stream_rollup_init(void *rollup)
+    {
+        memset(rollup, 0, stream_rollup_size());
+        rollup_header_t *header = (rollup_header_t *)rollup;
+        header->m_magic         = c_rollup_magic;
+        header->m_version       = c_rollup_version;
+    }
+
+    bool stream_rollup_valid(const void *rollup, u64 size)
+    {
+        const rollup_header_t *header = (const rollup_header_t *)rollup;
+        return rollup != nullptr && size >= stream_rollup_size() && header->m_magic == c_rollup_magic && header->m_version == c_rollup_version;
+    }
+
+    u64 stream_rollup_items(const void *rollup) { return ((const rollup_header_t *)rollup)->m_items; }
+
+    void stream_rollup_add(void *rollup, u64 time, f64 value)
+    {
+        rollup_header_t *header = (rollup_header_t *)rollup;
+        header->m_items += 1;
+        for (u32 tier = 0; tier < c_stream_rollup_tiers; ++tier)
+        {
+            const u32        key    = (u32)(time / c_tier_width[tier]) + 1;
+            rollup_bucket_t &bucket = tier_buckets(rollup, tier)[key % c_tier_capacity[tier]];
+            if (bucket.m_key != key)
+            {
+                if (bucket.m_key > key)
+                    continue;  // Too old, the slot holds a newer bucket
+                bucket.m_key   = key;
+                bucket.m_count = 0;
+                bucket.m_min   = value;
+                bucket.m_max   = value;
+                bucket.m_sum   = 0.0;
+            }
+            bucket.m_count += 1;
+            bucket.m_min = value < bucket.m_min ? value : bucket.m_min;
+            bucket.m_max = value > bucket.m_max ? value : bucket.m_max;
+            bucket.m_sum += value;
+            if (key > header->m_newest[tier])
+                header->m_newest[tier] = key;
+        }
+    }
+
+    void stream_rollup_skip(void *rollup, u64 count) { ((rollup_header_t *)rollup)->m_items += count; }
+
+    u64 stream_rollup_span() { return c_tier_width[c_stream_rollup_tiers - 1] * c_tier_capacity[c_stream_rollup_tiers - 1]; }
+
+    // Key of the oldest bucket a tier can still hold
+    static inline u32 tier_oldest(const rollup_header_t *header, u32 tier) { return header->m_newest[tier] > c_tier_capacity[tier] ? header->m_newest[tier] - c_tier_capacity[tier] + 1 : 1; }
+
+    i32 stream_rollup_tier(const void *rollup, u64 time, u64 resolution, u64 &out_width)
+    {
+        const rollup_header_t *header = (const rollup_header_t *)rollup;
+        for (i32 tier = c_stream_rollup_tiers - 1; tier >= 0; --tier)
+        {
+            if (c_tier_width[tier] > resolution)
+                continue;
+            if ((u32)(time / c_tier_width[tier]) + 1 < tier_oldest(header, tier))
+                continue;  // Overwritten, the finer tiers have even less history
+            out_width = c_tier_width[tier];
+            return tier;
+        }
+        return -1;
+    }
+
+    u32 stream_rollup_read(const void *rollup, i32 tier, u64 time_begin, u64 time_end, stream_bucket_t *out_buckets, u32 max_buckets)
+    {
+        const rollup_header_t *header = (const rollup_header_t *)rollup;
+        if (tier < 0 || tier >= (i32)c_stream_rollup_tiers || time_begin > time_end || header->m_newest[tier] == 0)
+            return 0;
+
+        const rollup_bucket_t *buckets = tier_buckets(rollup, tier);
+        const u64              width   = c_tier_width[tier];
+        u64                    first   = time_begin / width + 1;
+        u64                    last    = time_end / width + 1;
+        if (first < tier_oldest(header, tier))
+            first = tier_oldest(header, tier);
+        if (last > header->m_newest[tier])
+            last = header->m_newest[tier];
+
+        u32 count = 0;
+        for (u64 key = first; key <= last && count < max_buckets; ++key)
+        {
+            const rollup_bucket_t &bucket = buckets[key % c_tier_capacity[tier]];
+            if (bucket.m_key != (u32)key || bucket.m_count == 0)
+                continue;
+            stream_bucket_t &out = out_buckets[count++];
+            out.m_time           = (key - 1) * width;
+            out.m_count          = bucket.m_count;
+            out.m_min            = bucket.m_min;
+            out.m_max            = bucket.m_max;
+            out.m_mean           = bucket.m_sum / (f64)bucket.m_count;
+        }
+        return count;
+    }
+
+}  // namespace ncore
@@ -0,0 +1,284 @@
+#include "cconartist/timer_wheel.h"
+
+#include "ccore/c_allocator.h"
+
+namespace ncore
+{
+#define TIMER_LEVELS        4
+#define TIMER_SLOT_BITS     6
+#define TIMER_SLOTS         (1 << TIMER_SLOT_BITS)
+#define TIMER_SLOT_MASK     (TIMER_SLOTS - 1)
+#define TIMER_SLOT_OVERFLOW (TIMER_LEVELS * TIMER_SLOTS)
+#define TIMER_SLOT_FIRING   (TIMER_SLOT_OVERFLOW + 1)
+#define TIMER_SLOT_NONE     0xFFFFFFFF
+
+    // Every slot is a circular list with a sentinel, so a timer can unlink itself without knowing
+    // which list it is on (a slot, the overflow list or the list that is being fired).
+    struct timer_wheel_t
+    {
+        alloc_t     *m_allocator;
+        u64          m_current;                 // First tick that has not been processed yet
+        u64          m_occupied[TIMER_LEVELS];  // Bit per non-empty slot
+        u32          m_count;                   // Number of scheduled timers
+        timer_node_t m_slots[TIMER_LEVELS * TIMER_SLOTS];
+        timer_node_t m_overflow;
+    };
+
+    static inline void list_init(timer_node_t *head)
+    {
+        head->m_prev = head;
+        head->m_next = head;
+    }
+
+    static inline bool list_empty(timer_node_t const *head) { return head->m_next == head; }
+
+    static inline void list_push(timer_node_t *head, timer_node_t *node)
+    {
+        node->m_prev         = head->m_prev;
+        node->m_next         = head;
+        head->m_prev->m_next = node;
+        head->m_prev         = node;
+    }
+
+    // Move all nodes of 'from' to the (empty) list 'to'
+    static inline void list_take(timer_node_t *from, timer_node_t *to)
+    {
+        if (list_empty(from))
+        {
+            list_init(to);
+            return;
+        }
+        to->m_next         = from->m_next;
+        to->m_prev         = from->m_prev;
+        to->m_next->m_prev = to;
+        to->m_prev->m_next = to;
+        list_init(from);
+    }
+
+    static inline u32 lowest_bit(u64 bits) { return (u32)__builtin_ctzll(bits); }
+
+    static void wheel_insert(timer_wheel_t *w, timer_node_t *timer)
+    {
+        u64 const c = w->m_current;
+        u64       e = timer->m_expires;
+        if (e < c)
+            e = c;  // Already due, fires on the next tick that is processed
+
+        // A timer goes to the lowest level whose current block it shares with 'current', when
+        // 'current' enters that block the slot is cascaded down one level.
+        u32 level;
+        if ((e >> TIMER_SLOT_BITS) == (c >> TIMER_SLOT_BITS))
+            level = 0;
+        else if ((e >> (2 * TIMER_SLOT_BITS)) == (c >> (2 * TIMER_SLOT_BITS)))
+            level = 1;
+        else if ((e >> (3 * TIMER_SLOT_BITS)) == (c >> (3 * TIMER_SLOT_BITS)))
+            level = 2;
+        else if ((e >> (4 * TIMER_SLOT_BITS)) == (c >> (4 * TIMER_SLOT_BITS)))
+            level = 3;
+        else
+        {
+            timer->m_slot = TIMER_SLOT_OVERFLOW;
+            list_push(&w->m_overflow, timer);
+            return;
+        }
+        u32 const slot = (u32)(e >> (level * TIMER_SLOT_BITS)) & TIMER_SLOT_MASK;
+        timer->m_slot  = level * TIMER_SLOTS + slot;
+        list_push(&w->m_slots[timer->m_slot], timer);
+        w->m_occupied[level] |= (u64)1 << slot;
+    }
+
+    static void wheel_unlink(timer_wheel_t *w, timer_node_t *timer)
+    {
+        timer->m_prev->m_next = timer->m_next;
+        timer->m_next->m_prev = timer->m_prev;
+        if (timer->m_slot < TIMER_SLOT_OVERFLOW)
+        {
+            timer_node_t *head = &w->m_slots[timer->m_slot];
+            if (list_empty(head))
+                w->m_occupied[timer->m_slot / TIMER_SLOTS] &= ~((u64)1 << (timer->m_slot & TIMER_SLOT_MASK));
+        }
+        timer->m_prev = nullptr;
+        timer->m_next = nullptr;
+        timer->m_slot = TIMER_SLOT_NONE;
+    }
+
+    // Re-insert every timer of a list, they land on a lower level now that 'current' moved on
+    static void wheel_reinsert(timer_wheel_t *w, timer_node_t *head)
+    {
+        timer_node_t list;
+        list_take(head, &list);
+        while (!list_empty(&list))
+        {
+            timer_node_t *timer   = list.m_next;
+            list.m_next           = timer->m_next;
+            timer->m_next->m_prev = &list;
+            wheel_insert(w, timer);
+        }
+    }
+
+    static void wheel_cascade(timer_wheel_t *w, u64 tick)
+    {
+        // From the top down, a timer cascaded from level 3 can end up in the level 2 slot that is
+        // cascaded next
+        if ((tick & (((u64)1 << (4 * TIMER_SLOT_BITS)) - 1)) == 0)
+            wheel_reinsert(w, &w->m_overflow);
+        for (u32 level = TIMER_LEVELS - 1; level > 0; --level)
+        {
+            if ((tick & (((u64)1 << (level * TIMER_SLOT_BITS)) - 1)) != 0)
+                continue;
+            u32 const slot = (u32)(tick >> (level * TIMER_SLOT_BITS)) & TIMER_SLOT_MASK;
+            if ((w->m_occupied[level] & ((u64)1 << slot)) == 0)
+                continue;
+            w->m_occupied[level] &= ~((u64)1 << slot);
+            wheel_reinsert(w, &w->m_slots[level * TIMER_SLOTS + slot]);
+        }
+    }
+
+    timer_wheel_t *timer_wheel_create(alloc_t *allocator, u64 now)
+    {
+        timer_wheel_t *wheel = g_allocate_and_clear<timer_wheel_t>(allocator);
+        if (wheel == nullptr)
+            return nullptr;
+        wheel->m_allocator = allocator;
+        wheel->m_current   = now;
+        for (u32 i = 0; i < TIMER_LEVELS * TIMER_SLOTS; ++i)
+            list_init(&wheel->m_slots[i]);
+        list_init(&wheel->m_overflow);
+        return wheel;
+    }
+
+    void timer_wheel_destroy(timer_wheel_t *&wheel)
+    {
+        if (wheel == nullptr)
+            return;
+        // Timers are owned by the caller, they are only detached
+        for (u32 i = 0; i <= TIMER_LEVELS * TIMER_SLOTS; ++i)
+        {
+            timer_node_t *head = (i < TIMER_LEVELS * TIMER_SLOTS) ? &wheel->m_slots[i] : &wheel->m_overflow;
+            while (!list_empty(head))
+                wheel_unlink(wheel, head->m_next);
+        }
+        g_deallocate(wheel->m_allocator, wheel);
+        wheel = nullptr;
+    }
+
+    u32 timer_wheel_advance(timer_wheel_t *w, u64 now)
+    {
+        u32 fired = 0;
+        while (w->m_current <= now && w->m_count > 0)
+        {
+            u64 const tick = w->m_current;
+            if ((tick & TIMER_SLOT_MASK) == 0)
+                wheel_cascade(w, tick);
+
+            // Jump to the next occupied slot of this block, or to the start of the next block
+            u64 const pending = w->m_occupied[0] >> (tick & TIMER_SLOT_MASK);
+            if (pending == 0)
+            {
+                u64 const next_block = (tick | TIMER_SLOT_MASK) + 1;
+                w->m_current         = next_block <= now ? next_block : now + 1;
+                continue;
+            }
+            u64 const due = tick + lowest_bit(pending);
+            if (due > now)
+            {
+                w->m_current = now + 1;
+                break;
+            }
+
+            // Timers (re)scheduled by a callback for this tick or earlier go to the next tick
+            w->m_current   = due + 1;
+            u32 const slot = (u32)due & TIMER_SLOT_MASK;
+            w->m_occupied[0] &= ~((u64)1 << slot);
+
+            timer_node_t firing;
+            list_take(&w->m_slots[slot], &firing);
+            for (timer_node_t *t = firing.m_next; t != &firing; t = t->m_next)
+                t->m_slot = TIMER_SLOT_FIRING;
+            while (!list_empty(&firing))
+            {
+                timer_node_t *timer = firing.m_next;
+                wheel_unlink(w, timer);
+                w->m_count -= 1;
+                fired += 1;
+                timer->m_fn(timer, timer->m_user);
+            }
+        }
+        if (w->m_count == 0 && w->m_current <= now)
+            w->m_current = now + 1;
+        return fired;
+    }
+
+    u64 timer_wheel_next(timer_wheel_t const *w)
+    {
+        if (w->m_count == 0)
+            return 0xFFFFFFFFFFFFFFFFull;
+        u64 const tick = w->m_current;
+
+        // At the start of a block a slot that 'current' entered may still have to be cascaded, its
+        // timers can be due right away
+        for (u32 level = 1; level < TIMER_LEVELS; ++level)
+        {
+            if ((tick & (((u64)1 << (level * TIMER_SLOT_BITS)) - 1)) != 0)
+                break;
+            u32 const slot = (u32)(tick >> (level * TIMER_SLOT_BITS)) & TIMER_SLOT_MASK;
+            if ((w->m_occupied[level] & ((u64)1 << slot)) != 0)
+                return tick;
+            if (level == TIMER_LEVELS - 1 && (tick & (((u64)1 << (4 * TIMER_SLOT_BITS)) - 1)) == 0 && !list_empty(&w->m_overflow))
+                return tick;
+        }
+
+        // Level 0 holds exactly the timers of the current block
+        u64 const pending = w->m_occupied[0] >> (tick & TIMER_SLOT_MASK);
+        if (pending != 0)
+            return tick + lowest_bit(pending);
+
+        // Otherwise the first timer is in the lowest occupied slot after 'current' on the lowest level, every
+        // timer of a level expires before those of the level above. The first tick of that slot is where it is
+        // cascaded down, so a timer costs at most one wakeup per level instead of one per block.
+        for (u32 level = 1; level < TIMER_LEVELS; ++level)
+        {
+            u32 const slot  = (u32)(tick >> (level * TIMER_SLOT_BITS)) & TIMER_SLOT_MASK;
+            u64 const later = w->m_occupied[level] & ~(((u64)2 << slot) - 1);
+            if (later != 0)
+            {
+                u32 const block_shift = (level + 1) * TIMER_SLOT_BITS;
+                return ((tick >> block_shift) << block_shift) + ((u64)lowest_bit(later) << (level * TIMER_SLOT_BITS));
+            }
+        }
+
+        // Only timers in the overflow list, they are re-inserted at the next level 3 rotation
+        return ((tick >> (4 * TIMER_SLOT_BITS)) + 1) << (4 * TIMER_SLOT_BITS);
+    }
+
+    void timer_init(timer_node_t *timer, timer_fn fn, void *user)
+    {
+        timer->m_prev    = nullptr;
+        timer->m_next    = nullptr;
+        timer->m_expires = 0;
+        timer->m_fn      = fn;
+        timer->m_user    = user;
+        timer->m_slot    = TIMER_SLOT_NONE;
+    }
+
+    void timer_schedule(timer_wheel_t *wheel, timer_node_t *timer, u64 expires)
+    {
+        if (timer->m_slot != TIMER_SLOT_NONE)
+            wheel_unlink(wheel, timer);
+        else
+            wheel->m_count += 1;
+        timer->m_expires = expires;
+        wheel_insert(wheel, timer);
+    }
+
+    void timer_cancel(timer_wheel_t *wheel, timer_node_t *timer)
+    {
+        if (timer->m_slot == TIMER_SLOT_NONE)
+            return;
+        wheel_unlink(wheel, timer);
+        wheel->m_count -= 1;
+    }
+
+    bool timer_pending(timer_node_t const *timer) { return timer->m_slot != TIMER_SLOT_NONE; }
+
+}  // namespace ncore
@@ -4,6 +4,8 @@
 #include "cconartist/user_types.h"
 #include "cconartist/value_unit.h"
 
+#include <time.h>
+
 struct connection_context_t;
 
 // The format of an image packet received over the wire
@@ -85,8 +87,20 @@ struct decoder_context_t
     void                *m_user_context1;
     int                  m_user_data0;
     int                  m_user_data1;
+    uint64_t             m_time_ms;  // Wall clock time in ms, set by the server before every call (us_loop_time), 0 if not set
 };
 
+// Time for the items a plugin writes, in ms. Uses the time cached by the server and falls back to the wall
+// clock for a host that does not fill in m_time_ms.
+inline uint64_t decoder_time_ms(decoder_context_t const *ctx)
+{
+    if (ctx->m_time_ms != 0)
+        return ctx->m_time_ms;
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
 // This is for a decoder plugin to initialize its internal state
 typedef void (*decoder_initialize_fn)(decoder_context_t *ctx);
 
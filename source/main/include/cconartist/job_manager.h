@@ -29,6 +29,11 @@ namespace ncore
     i32            pop_job(job_manager_t* jm, job_channel_t channel, void*& job_data0, void*& job_data1);
     i32            pop_job_wait(job_manager_t* jm, job_channel_t channel, void*& job_data, void*& job_data1);
 
+    // Completion hook, called on the worker thread every time a job of the channel completed (after it
+    // can be popped). Use it to wake the thread that pops the channel, e.g. with us_loop_post.
+    typedef void (*job_notify_fn_t)(job_channel_t channel, void* user);
+    void set_channel_notify(job_manager_t* jm, job_channel_t channel, job_notify_fn_t notify_fn, void* user);
+
 }  // namespace ncore
 
 #endif
@@ -5,12 +5,10 @@
 #    pragma once
 #endif
 
-#include "clibuv/uv.h"
-#include "cconartist/conman.h"
-
 namespace ncore
 {
     class alloc_t;
+    struct tcp_con_t;
 
     struct packet_pool_t;
 
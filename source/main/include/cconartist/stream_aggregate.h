@@ -0,0 +1,39 @@
+#ifndef __CCONARTIST_STREAM_AGGREGATE_H__
+#define __CCONARTIST_STREAM_AGGREGATE_H__
+#include "ccore/c_target.h"
+#ifdef USE_PRAGMA_ONCE
+#    pragma once
+#endif
+
+namespace ncore
+{
+    // Min, max, sum and count of the values of a numeric stream.
+    // The kernels accumulate into a stream_stats_t, so a range can be aggregated in pieces (per page, per
+    // block, per file). The mean is only filled in by stream_stats_finish.
+    //
+    // The u8, u16, s16, u32, f32 and f64 kernels use AVX2 or SSE4.1, picked at runtime from the cpu, or NEON
+    // (AArch64), the other types are scalar. Integer sums are exact up to 2^53, f32 values are summed as f64.
+    // The result for values that are NaN is unspecified.
+
+    struct stream_stats_t
+    {
+        u64 m_count;
+        f64 m_min;
+        f64 m_max;
+        f64 m_sum;
+        f64 m_mean;
+    };
+
+    void stream_stats_init(stream_stats_t &stats);
+    void stream_stats_finish(stream_stats_t &stats);  // Computes the mean
+
+    // 'value_type' is an nvalue::enum_t, 'values' are packed in native byte order, false for a non numeric type
+    bool stream_aggregate_values(u8 value_type, const void *values, u32 count, stream_stats_t &stats);
+
+    // Values 'stride' bytes apart, as in the row layout of a stream. The values are copied out in blocks of 512 and
+    // aggregated with the same kernels as stream_aggregate_values.
+    bool stream_aggregate_strided(u8 value_type, const u8 *values, u32 stride, u32 count, stream_stats_t &stats);
+
+}  // namespace ncore
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef __CCONARTIST_STREAM_CODEC_H__
+#define __CCONARTIST_STREAM_CODEC_H__
+#include "ccore/c_target.h"
+#ifdef USE_PRAGMA_ONCE
+#    pragma once
+#endif
+
+namespace ncore
+{
+    // Compression of a block of fixed size stream items, used for archived (read-only) stream files.
+    // Times are encoded as delta-of-delta, float values as the XOR with the previous value (Gorilla)
+    // and integer values as a zigzag delta, all in a bit stream with short codes for the common
+    // cases (a constant interval, an unchanged value). A block is decoded on its own, it does not
+    // depend on any other block.
+    //
+    // Times are u64 (relative to the begin of the stream file), values are packed back to back in
+    // native byte order with a size of 1, 2, 4 or 8 bytes.
+
+    const u32 c_stream_codec_block_items = 1024;  // Maximum number of items in a block
+
+    // Largest number of bytes that encoding 'count' items can produce
+    u32 stream_codec_bound(u32 count, u32 value_size);
+
+    // Encode 'count' items into 'dst' (at least stream_codec_bound bytes), returns the number of bytes written
+    u32 stream_codec_encode(u8 *dst, const u64 *times, const u8 *values, u32 count, u32 value_size, bool is_float);
+
+    // Decode 'count' items from the 'src_size' bytes of 'src', false when the data is truncated
+    bool stream_codec_decode(const u8 *src, u32 src_size, u64 *times, u8 *values, u32 count, u32 value_size, bool is_float);
+
+}  // namespace ncore
+
+#endif
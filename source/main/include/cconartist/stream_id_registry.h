@@ -1,11 +1,10 @@
-#ifndef __CCONARTIST_UDP_SEND_POOL_H__
-#define __CCONARTIST_UDP_SEND_POOL_H__
+#ifndef __CCONARTIST_STREAM_ID_REGISTRY_H__
+#define __CCONARTIST_STREAM_ID_REGISTRY_H__
 #include "ccore/c_target.h"
 #ifdef USE_PRAGMA_ONCE
 #    pragma once
 #endif
 
-#include "clibuv/uv.h"
 #include "cconartist/types.h"
 
 namespace ncore
@@ -19,7 +18,7 @@ namespace ncore
     // 8 items per shard.
     stream_id_registry_t *stream_id_registry_create(alloc_t *allocator, i32 capacity, u8 n_sharding_bits = 8);
     void                  stream_id_registry_destroy(stream_id_registry_t *&r);
-    void                  stream_id_register(stream_id_registry_t *r, u64 user_id, stream_id_t stream_id);
+    bool                  stream_id_register(stream_id_registry_t *r, u64 user_id, stream_id_t stream_id);  // false when the registry is full
     bool                  stream_id_find(stream_id_registry_t *r, u64 user_id, stream_id_t &out_stream_id);
 
 }  // namespace ncore
@@ -7,6 +7,8 @@
 
 #include "cconartist/types.h"
 #include "cconartist/user_types.h"
+#include "cconartist/stream_aggregate.h"
+#include "cconartist/stream_rollup.h"
 
 namespace ncore
 {
@@ -20,11 +22,65 @@ namespace ncore
     struct stream_manager_t;
     stream_manager_t* stream_manager_create(alloc_t* allocator, i32 max_streams, const char* base_path);
     void              stream_manager_destroy(alloc_t* allocator, stream_manager_t*& manager);
-    void              stream_manager_flush(stream_manager_t* manager);
-    void              stream_manager_update(stream_manager_t* manager, f64 now); // main event loop call
+    void              stream_manager_flush(stream_manager_t* manager);  // Synchronous, writes the dirty ranges of all streams to disk
+    void              stream_manager_update(stream_manager_t* manager, f64 now); // main event loop call, also wakes the readers (see stream_notify.h)
+
+    // New streams are written to an in-memory staging buffer until their file exists, update hands them to the
+    // request manager (and updates it) and copies the staged items into the file once it has been created.
+    void stream_manager_set_request_manager(stream_manager_t* manager, stream_request_manager_t* requests);
+
+    // The part of every stream (and its rollup) that was written since the previous flush is written to disk by a job on
+    // the job manager, so that the write path never waits for the disk. Update schedules a flush every 'm_interval'
+    // seconds, or earlier once 'm_dirty_bytes' are waiting (0 to only use the interval). At most one flush is in flight.
+    // The job uses msync(MS_SYNC) on the dirty ranges, it waits on its worker until they are on disk, which is what
+    // bounds the loss to 'm_interval' (MS_ASYNC writes nothing on Linux).
+    // A stream that swapped to its successor is archived (moved to its month directory, compressed and added to the
+    // catalog) by a job as well, one at a time and only started while no flush is in flight. Without a job manager update
+    // archives it on its own thread. Calling it again with the same job manager waits for both jobs and only changes
+    // the config.
+    struct stream_flush_config_t
+    {
+        f64 m_interval;     // Seconds between two flushes, the data lost on a power failure is at most this old
+        u64 m_dirty_bytes;  // Flush early when this many bytes have been written
+    };
+    void stream_manager_set_job_manager(stream_manager_t* manager, job_manager_t* jobs, const stream_flush_config_t& config);
+
+    struct stream_manager_stats_t
+    {
+        u32 m_staged_streams;   // Streams that are waiting for their file
+        u64 m_staged_bytes;     // Item bytes held in staging buffers
+        u64 m_dropped_items;    // Items that did not fit (full staging buffer, or a full stream without a successor)
+        u64 m_dropped_streams;  // Streams that could not be registered (no staging buffer left)
+        u64 m_flushes;          // Flushes done, see stream_flush_config_t
+        u64 m_flushed_bytes;    // Bytes handed to msync (the kernel only writes the dirty pages among them)
+        u64 m_flush_errors;     // Ranges that msync failed on
+        u64 m_flush_last_us;    // Duration of the last flush
+        u64 m_flush_max_us;     // Longest flush
+        u64 m_flush_total_us;   // Total duration of all flushes
+        u32 m_ro_mappings;      // Archived files that are mapped, see stream_manager_set_ro_budget
+        u64 m_ro_mapped_bytes;  //
+        u64 m_ro_maps;          // Archived files that were mapped on access
+        u64 m_ro_unmaps;        // Mappings that were closed to stay within the budget
+        u64 m_archive_errors;   // Failed attempts to move a full stream to its archive directory (retried by update)
+    };
+    void stream_manager_stats(stream_manager_t* manager, stream_manager_stats_t& out_stats);
+
+    // Archived (.rostream) files are registered from their header at startup and only mapped when they are read.
+    // The least recently used mappings are closed when there are more than 'max_mappings' or they map more than
+    // 'max_bytes', which also means that a pointer into an archived file is only valid until the next read.
+    // The headers are kept in a catalog in the base path (streams.catalog) that is rewritten when a stream is archived,
+    // at startup only the month directories that changed since it was written are scanned again.
+    void stream_manager_set_ro_budget(stream_manager_t* manager, u32 max_mappings, u64 max_bytes);
+
+    // Layout of the items in a stream file, chosen when the stream is registered.
+    // The row layout stores the items back to back, see stream_read. The column layout (numeric streams only) stores
+    // pages that hold the item times followed by the item values, both as aligned arrays, see stream_read_columns.
+    const u16 c_stream_layout_row    = 0;
+    const u16 c_stream_layout_column = 1;
 
     // When you have an ID for a stream, you can register it to get a stream_id to use for further operations
     stream_id_t stream_manager_register_stream(stream_manager_t* m, u32 hid, u16 lid, u8 stream_type, u8 user_type);
+    stream_id_t stream_manager_register_stream(stream_manager_t* m, u32 hid, u16 lid, u8 stream_type, u8 user_type, u16 layout);
 
     // Write to the stream, returns false if failed, check by calling stream_is_full() to see if stream is full
     bool stream_write_data(stream_manager_t* m, stream_id_t stream_id, u64 time, const u8* data, u32 size);
@@ -33,10 +89,28 @@ namespace ncore
     bool stream_write_u32(stream_manager_t* m, stream_id_t stream_id, u64 time, u32 value);
     bool stream_write_f32(stream_manager_t* m, stream_id_t stream_id, u64 time, f32 value);
 
+    // Write 'count' items to a fixed size stream, 'values' holds the values back to back (the item size of the stream each).
+    // The header of the stream is updated once per batch instead of once per item, times are expected in order.
+    // Returns the number of items written, less than 'count' when the stream is full and has no successor yet, 0 for a
+    // variable size stream or when the value size does not match the stream.
+    u32 stream_write_batch(stream_manager_t* m, stream_id_t stream_id, const u64* times, const void* values, u32 count);
+    u32 stream_write_batch(stream_manager_t* m, stream_id_t stream_id, const u64* times, const void* values, u32 count, u32 value_size);
+
+    template <typename T>
+    inline u32 stream_write_batch(stream_manager_t* m, stream_id_t stream_id, const u64* times, const T* values, u32 count)
+    {
+        return stream_write_batch(m, stream_id, times, (const void*)values, count, (u32)sizeof(T));
+    }
+
     // Functions to obtain data from the stream, returns number of items read, or -1 if error
     // Requests may be crossing stream file boundaries, so the function will return less items than requested if the end of the stream is reached.
     // User should call multiple times until all requested items are gotten.
-    // Item time is relative to time_begin of the stream (5 bytes can cover up to 34 years of time range with millisecond precision)
+    // Item indices cover the archived (.rostream) files of the stream, oldest first, followed by the read-write stream.
+    // The returned array points directly into the mapped file, item_size is the distance between items. For an archived file
+    // that is only until the next read, as its mapping may then be closed (see stream_manager_set_ro_budget).
+    // Archived files of numeric streams are compressed, for those the items are decoded into a buffer of the manager that
+    // stays valid until the next read (any read, iterator or seek), and a request is also clipped at the end of a block.
+    // Item time is relative to time_begin of the file the items are in (5 bytes can cover up to 34 years of time range with millisecond precision)
     // Item layout depends on stream type:
     //    In a u8 data stream the item layout : [u8[5] time_offset, u8 value]
     //    In a u16 data stream the item layout : [u8[5] time_offset, u16 value]
@@ -47,6 +121,29 @@ namespace ncore
     bool stream_time(stream_manager_t* m, stream_id_t stream_id, u64& out_time_begin, u64& out_time_end);
     bool stream_info(stream_manager_t* m, stream_id_t stream_id, u64& out_user_id);
     i32  stream_read(stream_manager_t* m, stream_id_t stream_id, u64 item_index, u32 item_count, void const*& item_array, u32& item_size);
+    i32  stream_read(stream_manager_t* m, stream_id_t stream_id, u64 item_index, u32 item_count, void const*& item_array, u32& item_size, u64& out_time_begin);
+
+    // Consistent view of the header of a stream file that is mapped (read-only) by another thread or process than the one
+    // that writes it, the reader can tail the stream without locks. Every item before the write cursor is complete, the
+    // items start after the 64 byte header in the layout described above (or in pages, see stream_read_columns).
+    // Returns false when the writer kept updating the header during the attempts, the caller tries again later.
+    struct stream_snapshot_t
+    {
+        u64 m_user_id;
+        u16 m_stream_type;
+        u16 m_layout;
+        u32 m_sizeof_item;
+        u64 m_time_begin;
+        u64 m_time_end;
+        u64 m_item_count;
+        u64 m_write_cursor;
+    };
+    bool stream_file_snapshot(const void* file_data, u64 file_size, stream_snapshot_t& out_snapshot);
+
+    // Read a column layout stream (stream_read returns -1 for it), a request is also clipped at the end of a page.
+    // 'out_times' are u64 times relative to 'out_time_begin', 'out_values' are the values in native byte order with the
+    // size of the stream value type, both arrays are 8 byte aligned and the values of a page start 64 byte aligned.
+    i32 stream_read_columns(stream_manager_t* m, stream_id_t stream_id, u64 item_index, u32 item_count, u64 const*& out_times, void const*& out_values, u64& out_time_begin);
 
     // We also provide a general way to iterate over items in any stream, but this is the only way for variable size data streams.
     struct stream_iterator_t
@@ -55,13 +152,32 @@ namespace ncore
         u64         m_current_offset;
         u64         m_current_item;
         u64         m_total_items;
+        i32         m_segment;  // User index of the stream file the iterator is in
     };
 
-    //
+    // The iterator visits the archived files of the stream and then the read-write stream, next gives the absolute time of each item.
+    // Seek moves the iterator to the first item at or after 'time', using a sparse time index instead of reading every item.
     bool stream_iterator_begin(stream_manager_t* m, stream_id_t stream_id, stream_iterator_t& out_iterator);
     bool stream_iterator_next(stream_manager_t* m, stream_iterator_t& iterator, u64& time_begin, u8 const*& out_data_ptr, u32& out_data_size);
+    bool stream_iterator_seek(stream_manager_t* m, stream_iterator_t& iterator, u64 time);
     void stream_iterator_end(stream_manager_t* m, stream_iterator_t& iterator);
 
+    // Index of the first item at or after 'time' (for stream_read), false if there is no such item
+    bool stream_find_time(stream_manager_t* m, stream_id_t stream_id, u64 time, u64& out_item_index);
+
+    // Count, min, max, sum and mean of the values of the items with a time in [time_begin, time_end], over all files
+    // of the stream and all layouts, see stream_aggregate.h. False for an unknown or a non numeric stream.
+    // Column pages and compressed (archived) blocks go to the vector kernels directly. A file in the row layout, the
+    // default of stream_manager_register_stream, goes through stream_aggregate_strided, which copies the values out.
+    bool stream_aggregate(stream_manager_t* m, stream_id_t stream_id, u64 time_begin, u64 time_end, stream_stats_t& out_stats);
+
+    // Min, max, mean and count per bucket of time, for charts, the buckets that overlap [time_begin, time_end] as a whole. Numeric streams keep a rollup of
+    // their values per minute, hour and day next to the stream file (updated by the writers). The buckets come from the
+    // coarsest of those that is not wider than 'resolution' (ms) and still holds 'time_begin', otherwise they are computed
+    // from the items with a width of 'resolution'. 'out_width' is the width of the buckets, only buckets with items are
+    // returned, oldest first. Returns the number of buckets, at most 'max_buckets', or -1 for a non numeric stream.
+    i32 stream_read_buckets(stream_manager_t* m, stream_id_t stream_id, u64 time_begin, u64 time_end, u64 resolution, stream_bucket_t* out_buckets, u32 max_buckets, u64& out_width);
+
 }  // namespace ncore
 
 #endif
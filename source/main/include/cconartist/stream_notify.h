@@ -0,0 +1,41 @@
+#ifndef __CCONARTIST_STREAM_NOTIFY_H__
+#define __CCONARTIST_STREAM_NOTIFY_H__
+#include "ccore/c_target.h"
+#ifdef USE_PRAGMA_ONCE
+#    pragma once
+#endif
+
+namespace ncore
+{
+    class alloc_t;
+
+    // Change notification for readers of the stream files (e.g. the GUI), so that they do not have to poll
+    // the stream headers. The stream manager keeps a small shared file in its base path (streams.notify)
+    // with a slot per stream, holding the user id, the number of items of the stream (over all its files,
+    // as the item index of stream_read) and the time of the last item.
+    // stream_manager_update publishes the streams that advanced since the previous update and then rings a
+    // single doorbell, a futex word in the same file, so a busy stream costs at most one wakeup per update
+    // (loop tick) and not one per item. Readers map the file read-only and block on the doorbell.
+    // Futexes are Linux only, elsewhere a waiting reader checks the doorbell every millisecond.
+
+    struct stream_notify_t;
+
+    // Writer side, used by the stream manager
+    stream_notify_t* stream_notify_create(alloc_t* allocator, const char* base_path);
+    void             stream_notify_publish(stream_notify_t* notify, u32 slot, u64 user_id, u64 item_count, u64 time_end);
+    void             stream_notify_ring(stream_notify_t* notify);  // Wake the readers when anything was published
+
+    // Reader side, false / -1 when the file does not exist (yet) or the stream is unknown
+    stream_notify_t* stream_notify_open(alloc_t* allocator, const char* base_path);
+    bool             stream_notify_state(stream_notify_t* notify, u64 user_id, u64& out_item_count, u64& out_time_end);
+    u32              stream_notify_generation(stream_notify_t* notify);                           // Changes every time the doorbell rings
+    bool             stream_notify_wait(stream_notify_t* notify, u32 generation, i32 timeout_ms);  // True when the generation moved on
+
+    // Block until one of the streams has more items than its cursor, returns its index or -1 on a timeout
+    i32 stream_notify_wait_any(stream_notify_t* notify, const u64* user_ids, const u64* cursors, u32 count, i32 timeout_ms);
+
+    void stream_notify_close(alloc_t* allocator, stream_notify_t*& notify);
+
+}  // namespace ncore
+
+#endif
@@ -14,8 +14,10 @@ namespace ncore
     stream_request_manager_t* create_stream_request_manager(alloc_t* allocator, job_manager_t* jm, f64 now, const char* streams_basepath, const char* mappings_filepath);
     void                      destroy_stream_request_manager(stream_request_manager_t*& manager);
     void                      update_stream_requests(stream_request_manager_t* srm, f64 now);
-    void                      push_stream_request(stream_request_manager_t* srm, u64 user_id, stream_id_t stream_id, u64 mmfile_size, nmmio::mappedfile_t* mmfile);
-    bool                      pop_stream_request(stream_request_manager_t* srm, u64& user_id, nmmio::mappedfile_t*& out_mmfile);
+    bool                      push_stream_request(stream_request_manager_t* srm, u64 user_id, stream_id_t stream_id, u64 mmfile_size, nmmio::mappedfile_t* mmfile);
+
+    // A request that is done gives the created file (nullptr when creating it failed) and its path
+    bool pop_stream_request(stream_request_manager_t* srm, u64& user_id, nmmio::mappedfile_t*& out_mmfile, char* out_filepath, u32 out_filepath_size);
 
 }  // namespace ncore
 
@@ -0,0 +1,45 @@
+#ifndef __CCONARTIST_STREAM_ROLLUP_H__
+#define __CCONARTIST_STREAM_ROLLUP_H__
+#include "ccore/c_target.h"
+#ifdef USE_PRAGMA_ONCE
+#    pragma once
+#endif
+
+namespace ncore
+{
+    // Rollup of a numeric stream, the min, max, sum and count of its values per minute, hour and day.
+    // Each tier is a ring of buckets aligned to multiples of the tier width (ms since the epoch), a value
+    // updates one bucket per tier so adding is O(1). A ring holds the most recent buckets, the minute tier
+    // covers about 22 days, the hour tier about 3.7 years and the day tier about 44 years.
+    // The rollup is a single block of stream_rollup_size() bytes without pointers, so it can live in a
+    // mapped file. It counts the items it has been given, the owner uses that to catch up after a restart.
+
+    const u32 c_stream_rollup_tiers = 3;
+
+    struct stream_bucket_t
+    {
+        u64 m_time;   // Begin of the bucket
+        u64 m_count;  // Number of values
+        f64 m_min;
+        f64 m_max;
+        f64 m_mean;
+    };
+
+    u64  stream_rollup_size();
+    void stream_rollup_init(void *rollup);
+    bool stream_rollup_valid(const void *rollup, u64 size);  // A block that was initialized by stream_rollup_init
+    u64  stream_rollup_items(const void *rollup);            // Number of values added so far
+    void stream_rollup_add(void *rollup, u64 time, f64 value);
+    void stream_rollup_skip(void *rollup, u64 count);  // Count values without adding them (older than the span)
+    u64  stream_rollup_span();                         // Time covered by the day tier, the most any tier holds
+
+    // Coarsest tier with a width of at most 'resolution' that still holds the bucket of 'time', -1 when none.
+    i32 stream_rollup_tier(const void *rollup, u64 time, u64 resolution, u64 &out_width);
+
+    // The buckets of a tier in [time_begin, time_end] that have values, oldest first, at most 'max_buckets'.
+    // Returns the number of buckets written, continue with the time of the last one plus the width of the tier.
+    u32 stream_rollup_read(const void *rollup, i32 tier, u64 time_begin, u64 time_end, stream_bucket_t *out_buckets, u32 max_buckets);
+
+}  // namespace ncore
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef __CCONARTIST_TIMER_WHEEL_H__
+#define __CCONARTIST_TIMER_WHEEL_H__
+#include "ccore/c_target.h"
+#ifdef USE_PRAGMA_ONCE
+#    pragma once
+#endif
+
+namespace ncore
+{
+    class alloc_t;
+
+    // Hierarchical timer wheel, 4 levels of 64 slots with a tick of 1 ms.
+    // Scheduling and cancelling are O(1), a timer is moved down a level at most 3 times before it
+    // fires. Level 3 reaches about 4.6 hours ahead, timers further out wait in an overflow list
+    // that is re-inserted once per level 3 rotation.
+    //
+    // Timers are intrusive, embed a timer_node_t in the object that owns the timeout (e.g. a
+    // connection) and initialize it with timer_init. Callbacks may schedule or cancel any timer,
+    // including the one that is firing.
+
+    struct timer_wheel_t;
+    struct timer_node_t;
+
+    typedef void (*timer_fn)(timer_node_t *timer, void *user);
+
+    struct timer_node_t
+    {
+        timer_node_t *m_prev;
+        timer_node_t *m_next;
+        u64           m_expires;  // Tick (ms) at which the timer fires
+        timer_fn      m_fn;
+        void         *m_user;
+        u32           m_slot;  // Level * 64 + slot, or one of the internal TIMER_SLOT_ values
+    };
+
+    timer_wheel_t *timer_wheel_create(alloc_t *allocator, u64 now);
+    void           timer_wheel_destroy(timer_wheel_t *&wheel);
+
+    // Fire every timer that expired at or before 'now', returns the number of timers fired
+    u32 timer_wheel_advance(timer_wheel_t *wheel, u64 now);
+
+    // Earliest tick at which a timer may fire (a lower bound, never later than the real expiry),
+    // 0xFFFFFFFFFFFFFFFF when no timer is scheduled. Exact for a timer within the current 64 ticks,
+    // otherwise the tick at which its slot is cascaded down a level, so a caller that sleeps until
+    // then wakes at most once per level before the timer fires.
+    u64 timer_wheel_next(timer_wheel_t const *wheel);
+
+    void timer_init(timer_node_t *timer, timer_fn fn, void *user);
+    void timer_schedule(timer_wheel_t *wheel, timer_node_t *timer, u64 expires);  // (Re)schedule, an expiry that was already processed fires on the next tick
+    void timer_cancel(timer_wheel_t *wheel, timer_node_t *timer);
+    bool timer_pending(timer_node_t const *timer);
+
+}  // namespace ncore
+
+#endif
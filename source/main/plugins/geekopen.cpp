@@ -2,7 +2,6 @@
 #include "../cpp/user_types.cpp"
 
 #include <string>
-#include <time.h>
 
 #include "decoder_interface.h"
 
@@ -230,7 +229,7 @@ extern "C"
         {
             // For GeekOpen we write the raw JSON data as is to the stream that is coupled with the GeekOpen TCP server.
             uint64_t user_id   = (uint64_t)(ctx->m_user_context0);
-            uint64_t data_time = (uint64_t)time(nullptr) * 1000;  // Current time in milliseconds
+            uint64_t data_time = decoder_time_ms(ctx);  // Current time in milliseconds
             ctx->m_stream->write_fix_data((user_id << 16) | ID_JSON, data_time, stream_data, stream_data_size);
 
             // Here we also parse properties that we are interested in as sensor data.
@@ -3,7 +3,6 @@
 #include "../cpp/user_types.cpp"
 
 #include <string>
-#include <ctime>
 
 #include "decoder_interface.h"
 
@@ -44,7 +43,7 @@ extern "C"
                 return;
 
             const uint64_t user_id      = ((uint64_t)mac[0] << 40) | ((uint64_t)mac[1] << 32) | ((uint64_t)mac[2] << 24) | ((uint64_t)mac[3] << 16) | ((uint64_t)mac[4] << 8) | (uint64_t)mac[5];
-            const uint64_t current_time = static_cast<uint64_t>(std::time(nullptr));
+            const uint64_t current_time = decoder_time_ms(ctx);  // Item times are in ms, see stream_manager.h
 
             image->m_image_type        = packet_hdr->m_image_type;
             image->m_total_size        = packet_hdr->m_image_total_size;
@@ -2,7 +2,6 @@
 #include "../cpp/user_types.cpp"
 
 #include <string>
-#include <ctime>
 
 #include "decoder_interface.h"
 
@@ -123,7 +122,7 @@ extern "C"
 
     void decoder_write_to_stream(decoder_context_t* ctx, const unsigned char* packet_data, unsigned int packet_size)
     {
-        const uint64_t current_time = static_cast<uint64_t>(std::time(nullptr));
+        const uint64_t current_time = decoder_time_ms(ctx);  // Item times are in ms, see stream_manager.h
 
         sensor_packet_t const* packet = (sensor_packet_t const*)packet_data;
         const unsigned char*   end    = packet_data + packet_size;
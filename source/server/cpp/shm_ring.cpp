@@ -0,0 +1,285 @@
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+#include "ccore/c_allocator.h"
+#include "cconartist/shm_ring.h"
+
+namespace ncore
+{
+    static inline u32 shm_record_size(u32 size) { return (4 + size + 7) & ~(u32)7; }
+
+    void shm_ring_init(void* memory, u32 capacity)
+    {
+        shm_ring_header_t* header = (shm_ring_header_t*)memory;
+        memset(header, 0, sizeof(shm_ring_header_t));
+        header->m_magic            = US_SHM_MAGIC;
+        header->m_version          = US_SHM_VERSION;
+        header->m_capacity         = capacity;
+        header->m_consumer_waiting = 1;  // Empty, the first record rings the doorbell
+    }
+
+    bool shm_ring_attach(shm_ring_t& ring, void* memory, u32 capacity)
+    {
+        shm_ring_header_t* header = (shm_ring_header_t*)memory;
+        if (header->m_magic != US_SHM_MAGIC || header->m_version != US_SHM_VERSION || header->m_capacity != capacity)
+            return false;
+        if (capacity < 64 || (capacity & (capacity - 1)) != 0)
+            return false;
+        ring.m_header   = header;
+        ring.m_data     = (byte*)memory + US_SHM_DATA_OFFSET;
+        ring.m_capacity = capacity;
+        ring.m_size     = 0;
+        ring.m_pos      = 0;
+        return true;
+    }
+
+    i32 shm_ring_peek(shm_ring_t& ring, const byte*& out_data, u32& out_size)
+    {
+        const u64 tail = __atomic_load_n(&ring.m_header->m_tail, __ATOMIC_ACQUIRE);
+        if (tail - ring.m_pos > ring.m_capacity)
+            return -1;  // The producer published a position that is impossible
+        while (ring.m_pos != tail)
+        {
+            const u32 offset = (u32)ring.m_pos & (ring.m_capacity - 1);
+            u32       size;
+            memcpy(&size, ring.m_data + offset, sizeof(u32));
+            if (size == US_SHM_WRAP)
+            {
+                ring.m_pos += ring.m_capacity - offset;
+                if (tail - ring.m_pos > ring.m_capacity)
+                    return -1;  // Wrapped past the tail
+                continue;
+            }
+            if (size > ring.m_capacity - offset - 4 || shm_record_size(size) > tail - ring.m_pos)
+                return -1;
+            ring.m_size = size;
+            out_data    = ring.m_data + offset + 4;
+            out_size    = size;
+            return 1;
+        }
+        return 0;
+    }
+
+    void shm_ring_pop(shm_ring_t& ring)
+    {
+        ring.m_pos += shm_record_size(ring.m_size);
+        ring.m_size = 0;
+        __atomic_store_n(&ring.m_header->m_head, ring.m_pos, __ATOMIC_RELEASE);
+    }
+
+    // The consumer flags that it is going to sleep and then looks at the tail again, the producer
+    // publishes the tail and then looks at the flag. With sequentially consistent ordering at least
+    // one of the two sees the other, so a record is never left behind without a doorbell.
+    bool shm_ring_wait(shm_ring_t& ring)
+    {
+        // The wrap markers have been consumed as well, release them to the producer
+        __atomic_store_n(&ring.m_header->m_head, ring.m_pos, __ATOMIC_RELEASE);
+        __atomic_store_n(&ring.m_header->m_consumer_waiting, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&ring.m_header->m_tail, __ATOMIC_SEQ_CST) != ring.m_pos)
+        {
+            __atomic_store_n(&ring.m_header->m_consumer_waiting, 0, __ATOMIC_RELAXED);
+            return false;
+        }
+        return true;
+    }
+
+    // ----------------------------------------------------------------------------------------------
+    // Producer
+    // ----------------------------------------------------------------------------------------------
+
+    struct us_shm_producer
+    {
+        alloc_t*   m_allocator;
+        i32        m_sock_fd;  // Kept open, the server sees the producer leave when it is closed
+        i32        m_bell_fd;
+        void*      m_map;
+        size_t     m_map_size;
+        shm_ring_t m_ring;
+    };
+
+#if defined(TARGET_LINUX)
+
+    us_shm_producer* us_shm_connect(alloc_t* allocator, const char* socket_path)
+    {
+        if (!allocator || !socket_path || strlen(socket_path) >= sizeof(((sockaddr_un*)0)->sun_path))
+        {
+            errno = EINVAL;
+            return NULL;
+        }
+        i32 fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0)
+            return NULL;
+        sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strcpy(addr.sun_path, socket_path);
+        if (connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0)
+        {
+            i32 e = errno;
+            close(fd);
+            errno = e;
+            return NULL;
+        }
+
+        // The server answers with the ring size and two descriptors, the ring memfd and the doorbell
+        u32   map_size = 0;
+        iovec iov;
+        iov.iov_base = &map_size;
+        iov.iov_len  = sizeof(map_size);
+        union
+        {
+            cmsghdr m_align;
+            byte    m_buf[CMSG_SPACE(2 * sizeof(i32))];
+        } control;
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov        = &iov;
+        msg.msg_iovlen     = 1;
+        msg.msg_control    = control.m_buf;
+        msg.msg_controllen = sizeof(control.m_buf);
+        ssize_t n;
+        do
+        {
+            n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+        } while (n < 0 && errno == EINTR);
+
+        i32      fds[2] = {-1, -1};
+        cmsghdr* cmsg   = n > 0 ? CMSG_FIRSTHDR(&msg) : NULL;
+        if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS && cmsg->cmsg_len == CMSG_LEN(2 * sizeof(i32)))
+            memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+        if (n != (ssize_t)sizeof(map_size) || fds[0] < 0 || fds[1] < 0 || map_size <= US_SHM_DATA_OFFSET)
+        {
+            if (fds[0] >= 0)
+                close(fds[0]);
+            if (fds[1] >= 0)
+                close(fds[1]);
+            close(fd);
+            errno = EPROTO;
+            return NULL;
+        }
+
+        void* map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+        close(fds[0]);
+        us_shm_producer* producer = (map != MAP_FAILED) ? g_allocate_and_clear<us_shm_producer>(allocator) : NULL;
+        if (!producer || !shm_ring_attach(producer->m_ring, map, map_size - US_SHM_DATA_OFFSET))
+        {
+            if (producer)
+                g_deallocate(allocator, producer);
+            if (map != MAP_FAILED)
+                munmap(map, map_size);
+            close(fds[1]);
+            close(fd);
+            errno = EPROTO;
+            return NULL;
+        }
+        producer->m_allocator = allocator;
+        producer->m_sock_fd   = fd;
+        producer->m_bell_fd   = fds[1];
+        producer->m_map       = map;
+        producer->m_map_size  = map_size;
+        return producer;
+    }
+
+    void us_shm_disconnect(us_shm_producer* producer)
+    {
+        if (!producer)
+            return;
+        munmap(producer->m_map, producer->m_map_size);
+        close(producer->m_bell_fd);
+        close(producer->m_sock_fd);
+        g_deallocate(producer->m_allocator, producer);
+    }
+
+    u8* us_shm_reserve(us_shm_producer* producer, u32 size)
+    {
+        shm_ring_t& ring  = producer->m_ring;
+        const u32   total = shm_record_size(size);
+        if (total > (ring.m_capacity >> 1))
+        {
+            errno = EMSGSIZE;
+            return NULL;
+        }
+        const u64 head   = __atomic_load_n(&ring.m_header->m_head, __ATOMIC_ACQUIRE);
+        const u32 offset = (u32)ring.m_pos & (ring.m_capacity - 1);
+        const u32 skip   = (ring.m_capacity - offset < total) ? (ring.m_capacity - offset) : 0;
+        if (ring.m_capacity - (u32)(ring.m_pos - head) < skip + total)
+        {
+            errno = EAGAIN;
+            return NULL;
+        }
+        if (skip > 0)
+        {
+            const u32 wrap = US_SHM_WRAP;
+            memcpy(ring.m_data + offset, &wrap, sizeof(u32));
+            ring.m_pos += skip;
+        }
+        byte* record = ring.m_data + ((u32)ring.m_pos & (ring.m_capacity - 1));
+        memcpy(record, &size, sizeof(u32));
+        ring.m_size = size;
+        return record + 4;
+    }
+
+    void us_shm_commit(us_shm_producer* producer)
+    {
+        shm_ring_t& ring = producer->m_ring;
+        ring.m_pos += shm_record_size(ring.m_size);
+        ring.m_size = 0;
+        __atomic_store_n(&ring.m_header->m_tail, ring.m_pos, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&ring.m_header->m_consumer_waiting, __ATOMIC_SEQ_CST) != 0 && __atomic_exchange_n(&ring.m_header->m_consumer_waiting, 0, __ATOMIC_SEQ_CST) != 0)
+        {
+            const u64 one = 1;
+            ssize_t   n;
+            do
+            {
+                n = write(producer->m_bell_fd, &one, sizeof(one));
+            } while (n < 0 && errno == EINTR);
+        }
+    }
+
+    bool us_shm_write(us_shm_producer* producer, const u8* data, u32 size)
+    {
+        u8* dst = us_shm_reserve(producer, size);
+        if (!dst)
+            return false;
+        memcpy(dst, data, size);
+        us_shm_commit(producer);
+        return true;
+    }
+
+#else
+
+    // memfd and eventfd are Linux only
+    us_shm_producer* us_shm_connect(alloc_t* allocator, const char* socket_path)
+    {
+        CC_UNUSED(allocator);
+        CC_UNUSED(socket_path);
+        errno = ENOSYS;
+        return NULL;
+    }
+
+    void us_shm_disconnect(us_shm_producer* producer) { CC_UNUSED(producer); }
+    u8*  us_shm_reserve(us_shm_producer* producer, u32 size)
+    {
+        CC_UNUSED(producer);
+        CC_UNUSED(size);
+        errno = ENOSYS;
+        return NULL;
+    }
+    void us_shm_commit(us_shm_producer* producer) { CC_UNUSED(producer); }
+    bool us_shm_write(us_shm_producer* producer, const u8* data, u32 size)
+    {
+        CC_UNUSED(producer);
+        CC_UNUSED(data);
+        CC_UNUSED(size);
+        errno = ENOSYS;
+        return false;
+    }
+
+#endif
+
+}  // namespace ncore
@@ -1,7 +1,6 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/un.h>
-#include <sys/event.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <fcntl.h>
@@ -11,23 +10,97 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <signal.h>
+#include <pthread.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 
 #include "ccore/c_allocator.h"
+#include "cconartist/packet_pool.h"
+#include "cconartist/shm_ring.h"
+#include "cconartist/timer_wheel.h"
 #include "cconartist/unix_socket_server.h"
 
+#if defined(TARGET_LINUX)
+#    include <sys/epoll.h>
+#    include <sys/eventfd.h>
+#    include <poll.h>
+#    include <sys/mman.h>
+#    include <sys/syscall.h>
+#    include <linux/io_uring.h>
+#else
+#    include <sys/event.h>
+#endif
+
 namespace ncore
 {
     struct us_loop;
     struct us_server;
+    struct us_dgram_batch;
 
 #define US_KIND_SERVER   0x53525652  // "SRVR"
 #define US_KIND_CONN     0x434F4E4E  // "CONN"
+
+// us_server::m_type
+#define US_SERVER_UDP 0
+#define US_SERVER_TCP 1
+#define US_SERVER_SHM 2  // Unix socket handshake, messages arrive through a shared memory ring
 #define US_MESSAGE_MAGIC 0x55434F4E  // "UCON"
 
-#define US_MAX_KEVENT_BATCH 128
-#define US_SERVER_CONN_CAP  64
-#define US_LOOP_SERVER_CAP  32
+#define US_MAX_EVENT_BATCH 128
+#define US_LOOP_SERVER_CAP 32
+#define US_GROUP_LOOP_CAP  64
+
+#define US_LOOP_FLAG_REUSEPORT 0x1  // Listeners are opened with SO_REUSEPORT (loop is part of a group)
+
+// Connection slab, connections live in fixed size pages that never move once allocated
+#define US_CONN_PAGE_SHIFT 8
+#define US_CONN_PAGE_SIZE  (1 << US_CONN_PAGE_SHIFT)
+#define US_CONN_PAGE_MASK  (US_CONN_PAGE_SIZE - 1)
+#define US_CONN_SLOT_LIMIT 0x1000000  // Slots must fit the 24 bit id of the io_uring user_data
+#define US_CONN_SLOT_NONE  0xFFFFFFFF
+
+// Outbound queue, pending data of a connection is kept in a list of pooled chunks
+#define US_OUT_CHUNK_SIZE      4096
+#define US_OUT_CHUNK_DATA      (US_OUT_CHUNK_SIZE - 16)  // Chunk size minus the chunk header
+#define US_OUT_CHUNK_POOL_MAX  1024                      // Free chunks a loop keeps around
+#define US_OUT_WRITEV_MAX      64                        // Chunks handed to one sendmsg() call
+#define US_OUT_LOW_WATERMARK   (64 * 1024)
+#define US_OUT_HIGH_WATERMARK  (256 * 1024)
+
+// UDP servers drain their socket in batches of datagrams (one recvmmsg() call on Linux)
+#define US_UDP_BATCH        64
+#define US_UDP_MAX_DATAGRAM 65535       // Packet pool buffers are at most this large (u16)
+#define US_UDP_RCVBUF       (1 << 20)  // Socket receive buffer, absorbs bursts of sensor datagrams
+
+// Cross-thread posts (us_loop_post), a bounded queue so posting never allocates
+#define US_POST_CAPACITY 4096
+#define US_WAKE_TOKEN    0  // Poll token of the wakeup, 0 is never a server id or a connection token
+#define US_WAKE_IDENT    1  // EVFILT_USER identifier (kqueue)
+
+// Shared memory servers (type 2), a ring per producer process
+#define US_SHM_MIN_CAPACITY  (64 * 1024)
+#define US_SHM_MAX_CAPACITY  (1u << 30)
+#define US_SHM_DRAIN_BUDGET  4096  // Records per wakeup before other connections get their turn
+
+// A UDP peer handle is (ip << 32 | US_PEER_TAG | server id << 24 | port << 8 | server slot), the tag puts the slot part
+// out of the range of connection slots so a peer handle never resolves as a connection. The low bits of the server id
+// tag the slot as the generation does for a connection, a handle of a closed server does not resolve to the server
+// that reuses its slot.
+#define US_PEER_TAG      0x80000000
+#define US_PEER_ID_SHIFT 24
+#define US_PEER_ID_MASK  0x7F
+
+// Readiness flags reported by the poll backend (epoll on Linux, kqueue on macOS/BSD)
+#define US_EV_READ  0x1
+#define US_EV_WRITE 0x2
+#define US_EV_EOF   0x4
+#define US_EV_ERROR 0x8
+
+#if defined(TARGET_LINUX)
+#    define US_SEND_FLAGS MSG_NOSIGNAL
+#else
+#    define US_SEND_FLAGS 0
+#endif
 
 // Fixed 32 byte message header
 #define US_MESSAGE_HEADER_SIZE  32
@@ -36,46 +109,193 @@ namespace ncore
 #define US_MESSAGE_OFFSET_TYPE  8
 #define US_MESSAGE_OFFSET_FLAGS 12
 
+    // Outbound data of a connection is queued in a list of these, see us_conn::m_out_head
+    struct us_out_chunk
+    {
+        us_out_chunk* m_next;
+        u32           m_head;  // First byte not yet sent
+        u32           m_tail;  // End of the queued bytes
+        byte          m_data[US_OUT_CHUNK_DATA];
+    };
+
+    // Shared memory link of a producer process, the connection fd is the Unix socket that it
+    // connected with, it is only watched to see the producer go away.
+    struct us_shm_link
+    {
+        shm_ring_t m_ring;
+        void*      m_map;
+        size_t     m_map_size;
+        i32        m_bell_fd;  // eventfd, rung by the producer when the consumer waits
+    };
+
+    // Receive buffer of a connection, [m_head, m_tail) holds bytes that are received but not yet
+    // dispatched, this is always the (partial) start of the next message. The framing state survives
+    // EAGAIN, a message may arrive over any number of reads.
     struct us_conn
     {
-        i32        m_kind;
-        i32        m_fd;
-        us_server* m_server;
-        byte*      m_buf;
-        u32        m_cap;
-        u32        m_used;
+        i32           m_kind;  // US_KIND_CONN while the slot is in use, 0 when it is on the free list
+        i32           m_fd;
+        u32           m_slot;       // Index in the connection slab, never changes
+        u32           m_gen;        // Generation of the slot, bumped on every close, never 0
+        u32           m_next_free;  // Next slot on the free list
+        us_server*    m_server;
+        byte*         m_buf;
+        u32           m_cap;
+        u32           m_head;  // Start of the message that is currently being received
+        u32           m_tail;  // End of the received bytes
+        u32           m_need;  // Size of the message in progress, header size until its header is complete
+        us_out_chunk* m_out_head;     // Outbound queue, sent in order
+        us_out_chunk* m_out_tail;     // Small sends are appended to this chunk while it has room
+        u32           m_out_bytes;    // Bytes queued and not yet sent
+        u8            m_out_armed;      // Waiting for write readiness
+        u8            m_out_congested;  // Above the high watermark, cleared at the low watermark
+        us_shm_link*  m_shm;            // Non-null for connections of a shared memory server
+        u64           m_last_active;    // Loop time (ms) of the last received data
+        timer_node_t  m_idle_timer;     // Armed when the server has an idle timeout
     };
 
     struct us_server
     {
-        i32          m_kind;
-        i32          m_server_id;
-        i32          m_listen_fd;
-        u32          m_ip;
-        u16          m_port;
-        u8           m_type;
-        i32          m_active;
-        u32          m_recv_buf_size;
-        us_msg_cb    m_on_msg;
-        us_client_cb m_on_connect;
-        us_client_cb m_on_disconnect;
-        void*        m_user;
-        us_conn*     m_conns;
-        u32          m_conns_count;
-        u32          m_conns_cap;
+        i32             m_kind;
+        i32             m_server_id;
+        us_loop*        m_loop;
+        i32             m_listen_fd;
+        u32             m_ip;
+        u16             m_port;
+        u8              m_type;
+        i32             m_active;
+        u32             m_recv_buf_size;
+        us_msg_cb       m_on_msg;
+        us_client_cb    m_on_connect;
+        us_client_cb    m_on_disconnect;
+        us_pressure_cb  m_on_pressure;
+        u32             m_low_watermark;
+        u32             m_high_watermark;
+        void*           m_user;
+        u32             m_conns_count;
+        u32             m_index;    // Slot in the server array of the loop
+        packet_pool_t*  m_packets;  // UDP, pool that owns the receive buffers of the batch
+        us_dgram_batch* m_batch;    // UDP, receive batch
+        char*           m_path;     // Shared memory, path of the Unix socket, removed on close
+        u32             m_idle_timeout_ms;  // Close connections that received nothing for this long, 0 = never
+    };
+
+    struct us_dgram_batch
+    {
+        packet_t*   m_packets[US_UDP_BATCH];
+        sockaddr_in m_addrs[US_UDP_BATCH];
+        iovec       m_iovs[US_UDP_BATCH];
+#if defined(TARGET_LINUX)
+        mmsghdr m_msgs[US_UDP_BATCH];
+#endif
+        i32 m_truncated[US_UDP_BATCH];  // Datagram did not fit the buffer, it is dropped
+    };
+
+    // The token of a registration is (generation << 32 | slot) for a connection and the server id for
+    // a listener, connection generations are never 0 so the two can not be confused. Client handles
+    // are connection tokens, events or handles of a connection that has been closed no longer match
+    // the generation of the slot and are dropped.
+    struct us_event
+    {
+        u64 m_token;
+        u32 m_flags;
+    };
+
+    struct us_uring;
+
+    // Cell of the bounded multi-producer queue of posts, the sequence tells producers and the consumer
+    // whose turn it is (free for position p when m_seq == p, filled when m_seq == p + 1)
+    struct us_post_cell
+    {
+        u64        m_seq;
+        us_post_fn m_fn;
+        void*      m_data;
     };
 
     struct us_loop
     {
-        i32        m_kq;
-        i32        m_stop;
-        i32        m_next_server_id;
-        us_server* m_servers;
-        u32        m_servers_count;
-        u32        m_servers_cap;
-        alloc_t*   m_allocator;
+        i32             m_poll_fd;
+        i32             m_stop;
+        i32             m_next_server_id;
+        us_server*      m_servers;        // Slots are stable, a closed server leaves an inactive slot behind
+        u32             m_servers_count;  // Number of slots in use, active or not
+        u32             m_servers_cap;
+        us_conn**       m_conn_pages;  // Connection slab, pages of US_CONN_PAGE_SIZE connections
+        u32             m_conn_pages_count;
+        u32             m_conn_pages_cap;
+        u32             m_conn_free;  // Head of the free slot list
+        us_out_chunk*   m_free_chunks;  // Pool of outbound chunks shared by all connections
+        u32             m_free_chunks_count;
+        alloc_t*        m_allocator;
+        nengine::enum_t m_engine;
+        us_uring*       m_uring;  // Non-null when the io_uring engine is active
+        u32             m_flags;
+        i32             m_index;           // Index of this loop in its group, 0 for a standalone loop
+        i32             m_run_timeout_ms;  // Poll timeout used when the loop runs on a group thread
+        us_post_cell*   m_posts;         // US_POST_CAPACITY cells
+        u64             m_post_head;     // Only touched by the thread running the loop
+        u64             m_post_tail;     // Claimed by posting threads with a CAS
+        u32             m_wake_pending;  // Set by the first post after a drain, only that post signals
+        i32             m_wake_fd;       // eventfd (Linux)
+        timer_wheel_t*  m_timers;
+        u64             m_now;   // Monotonic time in ms, sampled once per loop iteration
+        u64             m_time;  // Wall clock time in ms, sampled together with m_now
+        us_loop_stats_t m_stats;  // Only written by the thread running the loop
+    };
+
+    struct us_timer
+    {
+        timer_node_t m_node;
+        us_loop*     m_loop;
+        us_timer_cb  m_cb;
+        void*        m_user;
+        u32          m_interval_ms;
     };
 
+    static us_conn*   add_client(us_loop* L, us_server* server, i32 cfd);
+    static i32        consume_from_client(us_loop* L, us_conn* connection, const byte* data, u32 len);
+    static i32        read_datagrams(us_loop* L, us_server* server);
+    static i32        flush_conn(us_loop* L, us_conn* connection);
+    static i32        service_shm_conn(us_loop* L, us_conn* connection);
+    static int_t      dispatch_messages(us_conn* connection, const byte* data, u32 len, u32& out_need);
+    static void       loop_drain_posts(us_loop* L);
+    static void       close_conn(us_loop* L, us_conn* connection);
+    static us_conn*   conn_lookup(us_loop* L, u64 token);
+    static us_server* find_server_by_id(us_loop* L, i32 server_id, uint_t* out_idx);
+
+    static inline u64         conn_token(const us_conn* connection) { return ((u64)connection->m_gen << 32) | (u64)connection->m_slot; }
+    static inline client_id_t to_client_handle(const us_conn* connection) { return (client_id_t)(uintptr_t)conn_token(connection); }
+    static inline u64         from_client_handle(client_id_t handle) { return (u64)(uintptr_t)handle; }
+
+    // The loop samples the clocks once per iteration, callbacks and decoders use the cached values
+    // instead of asking the kernel (or time()) for every message.
+    static void loop_update_time(us_loop* L)
+    {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        L->m_now = (u64)ts.tv_sec * 1000 + (u64)ts.tv_nsec / 1000000;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        L->m_time = (u64)ts.tv_sec * 1000 + (u64)ts.tv_nsec / 1000000;
+    }
+
+    // Shorten the poll timeout so that the loop wakes up for the first timer that is due
+    static i32 loop_wait_timeout(us_loop* L, i32 timeout_ms)
+    {
+        const u64 next = timer_wheel_next(L->m_timers);
+        if (next == 0xFFFFFFFFFFFFFFFFull)
+            return timeout_ms;
+        const u64 delta = next > L->m_now ? next - L->m_now : 0;
+        if (timeout_ms < 0 || delta < (u64)timeout_ms)
+            return (i32)delta;
+        return timeout_ms;
+    }
+
+    static void loop_run_timers(us_loop* L)
+    {
+        loop_update_time(L);
+        timer_wheel_advance(L->m_timers, L->m_now);
+    }
+
     static i32 set_fd_nonblock(i32 fd)
     {
         i32 flags = fcntl(fd, F_GETFL, 0);
@@ -98,366 +318,2222 @@ namespace ncore
 
     static i32 set_fd_nosigpipe(i32 fd)
     {
+#if defined(TARGET_LINUX)
+        // Linux has no SO_NOSIGPIPE, every send() passes MSG_NOSIGNAL instead
+        CC_UNUSED(fd);
+        return 0;
+#else
         i32 one = 1;
         return setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
     }
 
-    static i32 kq_add_read(i32 kq, i32 fd, void* udata)
+#if defined(TARGET_LINUX)
+
+    // ----------------------------------------------------------------------------------------------
+    // epoll backend, edge-triggered, so every read/accept path must drain until EAGAIN
+    // ----------------------------------------------------------------------------------------------
+
+    static i32 poll_create() { return epoll_create1(EPOLL_CLOEXEC); }
+
+    static i32 poll_add_read(i32 pfd, i32 fd, u64 token)
     {
-        struct kevent kev;
-        EV_SET(&kev, (uintptr_t)fd, EVFILT_READ, EV_ADD, 0, 0, udata);
-        return kevent(kq, &kev, 1, NULL, 0, NULL);
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events   = EPOLLIN | EPOLLRDHUP | EPOLLET;
+        ev.data.u64 = token;
+        return epoll_ctl(pfd, EPOLL_CTL_ADD, fd, &ev);
     }
 
-    static i32 kq_del_read(i32 kq, i32 fd)
+    // Write interest is only added while a connection has queued data, an edge-triggered EPOLLOUT
+    // that stays registered would wake the loop every time the peer acknowledges data.
+    static i32 poll_set_write(i32 pfd, i32 fd, u64 token, bool enable)
     {
-        struct kevent kev;
-        EV_SET(&kev, (uintptr_t)fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
-        return kevent(kq, &kev, 1, NULL, 0, NULL);
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events   = EPOLLIN | EPOLLRDHUP | EPOLLET | (enable ? (u32)EPOLLOUT : 0);
+        ev.data.u64 = token;
+        return epoll_ctl(pfd, EPOLL_CTL_MOD, fd, &ev);
     }
 
-    static void close_conn(us_loop* L, us_server* server, uint_t idx)
+    static i32 poll_del_read(i32 pfd, i32 fd)
     {
-        us_conn* connection = &server->m_conns[idx];
-        if (connection->m_fd >= 0)
+        struct epoll_event ev;  // Kernels before 2.6.9 require a non-null event for EPOLL_CTL_DEL
+        memset(&ev, 0, sizeof(ev));
+        return epoll_ctl(pfd, EPOLL_CTL_DEL, fd, &ev);
+    }
+
+    static i32 poll_wait(i32 pfd, us_event* events, i32 max_events, i32 timeout_ms)
+    {
+        struct epoll_event evlist[US_MAX_EVENT_BATCH];
+        if (max_events > US_MAX_EVENT_BATCH)
+            max_events = US_MAX_EVENT_BATCH;
+
+        i32 nev = epoll_wait(pfd, evlist, max_events, timeout_ms);
+        for (i32 i = 0; i < nev; ++i)
         {
-            kq_del_read(L->m_kq, connection->m_fd);
-            close(connection->m_fd);
+            const u32 e       = evlist[i].events;
+            events[i].m_token = evlist[i].data.u64;
+            events[i].m_flags = 0;
+            if (e & EPOLLIN)
+                events[i].m_flags |= US_EV_READ;
+            if (e & EPOLLOUT)
+                events[i].m_flags |= US_EV_WRITE;
+            if (e & (EPOLLRDHUP | EPOLLHUP))
+                events[i].m_flags |= US_EV_EOF;
+            if (e & EPOLLERR)
+                events[i].m_flags |= US_EV_ERROR;
         }
-        if (server->m_on_disconnect)
+        return nev;
+    }
+
+
+    // ----------------------------------------------------------------------------------------------
+    // io_uring engine (Linux)
+    //
+    // Listeners use a multishot accept, connections a multishot recv that picks its buffer from a
+    // provided buffer ring. All SQEs queued while processing completions are submitted together with
+    // the wait for the next completions, so a single io_uring_enter() services every connection.
+    // The user_data of a request carries (op, connection slot or server id, generation) so completions
+    // that arrive after a connection was closed (and its slot possibly reused) are recognized and dropped.
+    // ----------------------------------------------------------------------------------------------
+
+#define US_URING_SQ_ENTRIES 256
+#define US_URING_CQ_ENTRIES 4096
+#define US_URING_BUF_GROUP  0
+#define US_URING_BUF_COUNT  512   // Must be a power of 2
+#define US_URING_BUF_SIZE   4096  // Size of each provided receive buffer
+
+#define US_URING_OP_ACCEPT 1
+#define US_URING_OP_RECV   2
+#define US_URING_OP_CANCEL 3
+#define US_URING_OP_POLL   4  // Readiness of a UDP socket, drained with recvmmsg()
+#define US_URING_OP_WRITE  5  // Write readiness of a connection with queued outbound data
+#define US_URING_OP_SHM    6  // Readiness of the Unix socket of a shared memory link
+#define US_URING_OP_BELL   7  // Doorbell of a shared memory link
+#define US_URING_OP_WAKE   8  // Wakeup eventfd of the loop (us_loop_post)
+
+    struct us_uring
+    {
+        i32                m_ring_fd;
+        u32                m_features;
+        u32*               m_sq_head;
+        u32*               m_sq_tail;
+        u32*               m_sq_array;
+        u32                m_sq_mask;
+        u32                m_sq_entries;
+        u32                m_sq_local_tail;  // Tail including SQEs that are not yet published
+        u32                m_sq_submitted;   // Number of SQEs handed to the kernel so far
+        io_uring_sqe*      m_sqes;
+        u32*               m_cq_head;
+        u32*               m_cq_tail;
+        u32                m_cq_mask;
+        io_uring_cqe*      m_cqes;
+        void*              m_sq_map;
+        size_t             m_sq_map_size;
+        void*              m_cq_map;
+        size_t             m_cq_map_size;
+        size_t             m_sqes_map_size;
+        io_uring_buf_ring* m_buf_ring;
+        size_t             m_buf_ring_size;
+        byte*              m_buf_base;
+        u16                m_buf_tail;
+    };
+
+    static inline u64 uring_udata(u32 op, u32 id, u32 gen) { return ((u64)gen << 32) | ((u64)(id & 0xFFFFFF) << 8) | (u64)op; }
+    static inline u32 uring_udata_op(u64 udata) { return (u32)(udata & 0xFF); }
+    static inline u32 uring_udata_id(u64 udata) { return (u32)((udata >> 8) & 0xFFFFFF); }
+    static inline u32 uring_udata_gen(u64 udata) { return (u32)(udata >> 32); }
+
+    static i32 uring_setup(u32 entries, io_uring_params* p) { return (i32)syscall(__NR_io_uring_setup, entries, p); }
+    static i32 uring_register(i32 fd, u32 opcode, void* arg, u32 nr_args) { return (i32)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args); }
+    static i32 uring_enter(i32 fd, u32 to_submit, u32 min_complete, u32 flags, void* arg, size_t argsz) { return (i32)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz); }
+
+    static void uring_destroy(us_loop* L, us_uring* U)
+    {
+        if (U->m_buf_ring)
         {
-            server->m_on_disconnect((client_id_t)connection, server->m_user);
+            io_uring_buf_reg reg;
+            memset(&reg, 0, sizeof(reg));
+            reg.bgid = US_URING_BUF_GROUP;
+            uring_register(U->m_ring_fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+            munmap(U->m_buf_ring, U->m_buf_ring_size);
         }
-        if (connection->m_buf)
+        if (U->m_buf_base)
+            g_deallocate_array(L->m_allocator, U->m_buf_base);
+        if (U->m_sqes)
+            munmap(U->m_sqes, U->m_sqes_map_size);
+        if (U->m_cq_map && U->m_cq_map != U->m_sq_map)
+            munmap(U->m_cq_map, U->m_cq_map_size);
+        if (U->m_sq_map)
+            munmap(U->m_sq_map, U->m_sq_map_size);
+        if (U->m_ring_fd >= 0)
+            close(U->m_ring_fd);
+        g_deallocate(L->m_allocator, U);
+    }
+
+    static void uring_recycle_buffer(us_uring* U, u16 bid)
+    {
+        // Not &bufs[i], in C++ the kernel header's flex array member starts at offset 8 instead of 0
+        io_uring_buf* buf = (io_uring_buf*)U->m_buf_ring + (U->m_buf_tail & (US_URING_BUF_COUNT - 1));
+        buf->addr         = (u64)(uintptr_t)(U->m_buf_base + (uint_t)bid * US_URING_BUF_SIZE);
+        buf->len          = US_URING_BUF_SIZE;
+        buf->bid          = bid;
+        U->m_buf_tail++;
+        __atomic_store_n(&U->m_buf_ring->tail, U->m_buf_tail, __ATOMIC_RELEASE);
+    }
+
+    // Returns NULL when the kernel lacks any of the features we depend on (multishot recv needs 6.0+),
+    // the caller then falls back to the epoll backend.
+    static us_uring* uring_create(us_loop* L)
+    {
+        us_uring* U = g_allocate_and_clear<us_uring>(L->m_allocator);
+        if (!U)
+            return NULL;
+        U->m_ring_fd = -1;
+
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        params.flags      = IORING_SETUP_CQSIZE;  // Not SINGLE_ISSUER, a group creates the ring on another thread than the one running it
+        params.cq_entries = US_URING_CQ_ENTRIES;
+        U->m_ring_fd      = uring_setup(US_URING_SQ_ENTRIES, &params);
+        if (U->m_ring_fd < 0)
         {
-            g_deallocate_array(L->m_allocator, connection->m_buf);
+            uring_destroy(L, U);
+            return NULL;
+        }
+        U->m_features = params.features;
+        if ((U->m_features & (IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG)) != (IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG))
+        {
+            uring_destroy(L, U);
+            return NULL;
+        }
+
+        // Submission and completion rings share a single mapping (IORING_FEAT_SINGLE_MMAP)
+        U->m_sq_map_size = params.sq_off.array + params.sq_entries * sizeof(u32);
+        U->m_cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        if (U->m_cq_map_size > U->m_sq_map_size)
+            U->m_sq_map_size = U->m_cq_map_size;
+        U->m_cq_map_size = U->m_sq_map_size;
+        U->m_sq_map      = mmap(NULL, U->m_sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, U->m_ring_fd, IORING_OFF_SQ_RING);
+        if (U->m_sq_map == MAP_FAILED)
+        {
+            U->m_sq_map = NULL;
+            uring_destroy(L, U);
+            return NULL;
+        }
+        U->m_cq_map        = U->m_sq_map;
+        U->m_sqes_map_size = params.sq_entries * sizeof(io_uring_sqe);
+        U->m_sqes          = (io_uring_sqe*)mmap(NULL, U->m_sqes_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, U->m_ring_fd, IORING_OFF_SQES);
+        if ((void*)U->m_sqes == MAP_FAILED)
+        {
+            U->m_sqes = NULL;
+            uring_destroy(L, U);
+            return NULL;
         }
 
-        uint_t last = server->m_conns_count - 1;
-        if (idx != last)
+        byte* sq           = (byte*)U->m_sq_map;
+        U->m_sq_head       = (u32*)(sq + params.sq_off.head);
+        U->m_sq_tail       = (u32*)(sq + params.sq_off.tail);
+        U->m_sq_mask       = *(u32*)(sq + params.sq_off.ring_mask);
+        U->m_sq_entries    = *(u32*)(sq + params.sq_off.ring_entries);
+        U->m_sq_array      = (u32*)(sq + params.sq_off.array);
+        U->m_sq_local_tail = *U->m_sq_tail;
+        U->m_sq_submitted  = U->m_sq_local_tail;
+
+        byte* cq     = (byte*)U->m_cq_map;
+        U->m_cq_head = (u32*)(cq + params.cq_off.head);
+        U->m_cq_tail = (u32*)(cq + params.cq_off.tail);
+        U->m_cq_mask = *(u32*)(cq + params.cq_off.ring_mask);
+        U->m_cqes    = (io_uring_cqe*)(cq + params.cq_off.cqes);
+
+        // Provided buffer ring, the ring memory must be page aligned so it comes from mmap
+        U->m_buf_ring_size = US_URING_BUF_COUNT * sizeof(io_uring_buf);
+        U->m_buf_ring      = (io_uring_buf_ring*)mmap(NULL, U->m_buf_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if ((void*)U->m_buf_ring == MAP_FAILED)
+        {
+            U->m_buf_ring = NULL;
+            uring_destroy(L, U);
+            return NULL;
+        }
+        io_uring_buf_reg reg;
+        memset(&reg, 0, sizeof(reg));
+        reg.ring_addr    = (u64)(uintptr_t)U->m_buf_ring;
+        reg.ring_entries = US_URING_BUF_COUNT;
+        reg.bgid         = US_URING_BUF_GROUP;
+        if (uring_register(U->m_ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+        {
+            munmap(U->m_buf_ring, U->m_buf_ring_size);
+            U->m_buf_ring = NULL;
+            uring_destroy(L, U);
+            return NULL;
+        }
+        U->m_buf_base = g_allocate_array<byte>(L->m_allocator, (uint_t)US_URING_BUF_COUNT * US_URING_BUF_SIZE);
+        if (!U->m_buf_base)
         {
-            server->m_conns[idx] = server->m_conns[last];
-            us_conn* moved       = &server->m_conns[idx];
-            kq_del_read(L->m_kq, moved->m_fd);
-            kq_add_read(L->m_kq, moved->m_fd, (void*)moved);
+            uring_destroy(L, U);
+            return NULL;
         }
-        memset(&server->m_conns[last], 0, sizeof(us_conn));
-        server->m_conns_count--;
+        for (u32 i = 0; i < US_URING_BUF_COUNT; ++i)
+            uring_recycle_buffer(U, (u16)i);
+        return U;
     }
 
-    static i32 accept_new_clients(us_loop* L, us_server* server)
+    // Hand all queued SQEs to the kernel and optionally wait for at least one completion
+    static i32 uring_submit(us_uring* U, u32 min_complete, i32 timeout_ms)
     {
-        for (;;)
+        __atomic_store_n(U->m_sq_tail, U->m_sq_local_tail, __ATOMIC_RELEASE);
+        const u32 to_submit = U->m_sq_local_tail - U->m_sq_submitted;
+        if (to_submit == 0 && min_complete == 0)
+            return 0;
+
+        u32                      flags = 0;
+        io_uring_getevents_arg   arg;
+        struct __kernel_timespec ts;
+        void*                    argp  = NULL;
+        size_t                   argsz = 0;
+        if (min_complete > 0)
         {
-            i32 cfd = accept(server->m_listen_fd, NULL, NULL);
-            if (cfd < 0)
+            flags |= IORING_ENTER_GETEVENTS;
+            if (timeout_ms >= 0)
             {
-                if (errno == EAGAIN || errno == EWOULDBLOCK)
-                    return 0;
-                if (errno == EINTR)
-                    continue;
-                return -1;
+                ts.tv_sec  = timeout_ms / 1000;
+                ts.tv_nsec = (long long)(timeout_ms % 1000) * 1000000LL;
+                memset(&arg, 0, sizeof(arg));
+                arg.ts = (u64)(uintptr_t)&ts;
+                flags |= IORING_ENTER_EXT_ARG;
+                argp  = &arg;
+                argsz = sizeof(arg);
             }
-            if (set_fd_nonblock(cfd) < 0 || set_fd_cloexec(cfd) < 0 || set_fd_nosigpipe(cfd) < 0)
+        }
+
+        i32 n = uring_enter(U->m_ring_fd, to_submit, min_complete, flags, argp, argsz);
+        if (n < 0)
+        {
+            // ETIME is the normal outcome of a wait with a timeout
+            if (errno == ETIME || errno == EINTR || errno == EAGAIN || errno == EBUSY)
+                return 0;
+            return -1;
+        }
+        U->m_sq_submitted += (u32)n;
+        return n;
+    }
+
+    static io_uring_sqe* uring_get_sqe(us_uring* U)
+    {
+        const u32 head = __atomic_load_n(U->m_sq_head, __ATOMIC_ACQUIRE);
+        if (U->m_sq_local_tail - head >= U->m_sq_entries)
+        {
+            // Submission queue is full, flush it without waiting for completions
+            uring_submit(U, 0, 0);
+            if (U->m_sq_local_tail - __atomic_load_n(U->m_sq_head, __ATOMIC_ACQUIRE) >= U->m_sq_entries)
+                return NULL;
+        }
+        const u32     idx = U->m_sq_local_tail & U->m_sq_mask;
+        io_uring_sqe* sqe = &U->m_sqes[idx];
+        memset(sqe, 0, sizeof(*sqe));
+        U->m_sq_array[idx] = idx;
+        U->m_sq_local_tail++;
+        return sqe;
+    }
+
+    static i32 uring_arm_accept(us_uring* U, us_server* server)
+    {
+        io_uring_sqe* sqe = uring_get_sqe(U);
+        if (!sqe)
+            return -1;
+        sqe->opcode       = IORING_OP_ACCEPT;
+        sqe->fd           = server->m_listen_fd;
+        sqe->ioprio       = IORING_ACCEPT_MULTISHOT;
+        sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+        sqe->user_data    = uring_udata(US_URING_OP_ACCEPT, (u32)server->m_server_id, 0);
+        return 0;
+    }
+
+    static i32 uring_arm_recv(us_uring* U, us_conn* connection)
+    {
+        io_uring_sqe* sqe = uring_get_sqe(U);
+        if (!sqe)
+            return -1;
+        sqe->opcode    = IORING_OP_RECV;
+        sqe->fd        = connection->m_fd;
+        sqe->ioprio    = IORING_RECV_MULTISHOT;
+        sqe->flags     = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = US_URING_BUF_GROUP;
+        sqe->user_data = uring_udata(US_URING_OP_RECV, connection->m_slot, connection->m_gen);
+        return 0;
+    }
+
+    static i32 uring_arm_poll(us_uring* U, us_server* server)
+    {
+        io_uring_sqe* sqe = uring_get_sqe(U);
+        if (!sqe)
+            return -1;
+        sqe->opcode        = IORING_OP_POLL_ADD;
+        sqe->fd            = server->m_listen_fd;
+        sqe->poll32_events = POLLIN;
+        sqe->len           = IORING_POLL_ADD_MULTI;
+        sqe->user_data     = uring_udata(US_URING_OP_POLL, (u32)server->m_server_id, 0);
+        return 0;
+    }
+
+    static void uring_cancel(us_uring* U, u64 target_udata)
+    {
+        io_uring_sqe* sqe = uring_get_sqe(U);
+        if (!sqe)
+            return;
+        sqe->opcode    = IORING_OP_ASYNC_CANCEL;
+        sqe->fd        = -1;
+        sqe->addr      = target_udata;
+        sqe->user_data = uring_udata(US_URING_OP_CANCEL, 0, 0);
+    }
+
+    // One-shot, re-armed for as long as the connection has data queued
+    static i32 uring_arm_write(us_uring* U, us_conn* connection)
+    {
+        io_uring_sqe* sqe = uring_get_sqe(U);
+        if (!sqe)
+            return -1;
+        sqe->opcode        = IORING_OP_POLL_ADD;
+        sqe->fd            = connection->m_fd;
+        sqe->poll32_events = POLLOUT;
+        sqe->user_data     = uring_udata(US_URING_OP_WRITE, connection->m_slot, connection->m_gen);
+        return 0;
+    }
+
+    static i32 uring_arm_shm(us_uring* U, us_conn* connection, u32 op)
+    {
+        io_uring_sqe* sqe = uring_get_sqe(U);
+        if (!sqe)
+            return -1;
+        sqe->opcode        = IORING_OP_POLL_ADD;
+        sqe->fd            = op == US_URING_OP_BELL ? connection->m_shm->m_bell_fd : connection->m_fd;
+        sqe->poll32_events = POLLIN;
+        sqe->len           = IORING_POLL_ADD_MULTI;
+        sqe->user_data     = uring_udata(op, connection->m_slot, connection->m_gen);
+        return 0;
+    }
+
+    static i32 uring_arm_wake(us_uring* U, i32 fd)
+    {
+        io_uring_sqe* sqe = uring_get_sqe(U);
+        if (!sqe)
+            return -1;
+        sqe->opcode        = IORING_OP_POLL_ADD;
+        sqe->fd            = fd;
+        sqe->poll32_events = POLLIN;
+        sqe->len           = IORING_POLL_ADD_MULTI;
+        sqe->user_data     = uring_udata(US_URING_OP_WAKE, 0, 0);
+        return 0;
+    }
+
+    // Must be called before the generation of the slot is bumped
+    static void uring_unwatch_conn(us_uring* U, us_conn* connection)
+    {
+        if (connection->m_shm)
+        {
+            uring_cancel(U, uring_udata(US_URING_OP_SHM, connection->m_slot, connection->m_gen));
+            uring_cancel(U, uring_udata(US_URING_OP_BELL, connection->m_slot, connection->m_gen));
+            return;
+        }
+        uring_cancel(U, uring_udata(US_URING_OP_RECV, connection->m_slot, connection->m_gen));
+        if (connection->m_out_armed)
+            uring_cancel(U, uring_udata(US_URING_OP_WRITE, connection->m_slot, connection->m_gen));
+    }
+
+    static void uring_process_cqe(us_loop* L, us_uring* U, const io_uring_cqe* cqe)
+    {
+        const u64 udata = cqe->user_data;
+        const i32 res   = cqe->res;
+        const u32 more  = cqe->flags & IORING_CQE_F_MORE;
+
+        switch (uring_udata_op(udata))
+        {
+            case US_URING_OP_ACCEPT:
             {
-                close(cfd);
-                continue;
+                us_server* server = find_server_by_id(L, (i32)uring_udata_id(udata), NULL);
+                if (res >= 0)
+                {
+                    if (server)
+                        add_client(L, server, res);
+                    else
+                        close(res);  // Server was closed while this accept was in flight
+                }
+                // Only re-arm after transient failures, a hard error (e.g. EMFILE) would spin otherwise
+                if (server && !more && (res >= 0 || res == -ECONNABORTED || res == -EINTR))
+                    uring_arm_accept(U, server);
+                break;
             }
-            if (server->m_conns_count >= server->m_conns_cap)
+            case US_URING_OP_POLL:
             {
-                errno = 12;  // ENOMEM
-                close(cfd);
-                continue;
+                const i32  server_id = (i32)uring_udata_id(udata);
+                us_server* server    = find_server_by_id(L, server_id, NULL);
+                if (server && res > 0)
+                    read_datagrams(L, server);
+                server = find_server_by_id(L, server_id, NULL);  // A callback may have closed it
+                if (server && !more && (res >= 0 || res == -EINTR))
+                    uring_arm_poll(U, server);
+                break;
             }
-            us_conn* connection = &server->m_conns[server->m_conns_count++];
-            memset(connection, 0, sizeof(*connection));
-            connection->m_kind   = US_KIND_CONN;
-            connection->m_server = server;
-            connection->m_fd     = cfd;
-            connection->m_cap    = server->m_recv_buf_size;
-            connection->m_buf    = g_allocate_array<byte>(L->m_allocator, connection->m_cap);
-            connection->m_used   = 0;
-            if (!connection->m_buf)
-            {
-                close_conn(L, server, server->m_conns_count - 1);
-                continue;
+            case US_URING_OP_WRITE:
+            {
+                const u64 token      = ((u64)uring_udata_gen(udata) << 32) | uring_udata_id(udata);
+                us_conn*  connection = conn_lookup(L, token);
+                if (connection)
+                {
+                    connection->m_out_armed = 0;
+                    if (res < 0 || flush_conn(L, connection) < 0)
+                    {
+                        if (conn_lookup(L, token) == connection)
+                            close_conn(L, connection);
+                    }
+                }
+                break;
             }
-            if (kq_add_read(L->m_kq, cfd, (void*)connection) < 0)
+            case US_URING_OP_WAKE:
             {
-                close_conn(L, server, server->m_conns_count - 1);
-                continue;
+                if (!more)
+                    uring_arm_wake(U, L->m_wake_fd);
+                loop_drain_posts(L);
+                break;
             }
-            if (server->m_on_connect)
-                server->m_on_connect(server->m_server_id, cfd, server->m_user);
-        }
-    }
-
-    static u32 read_u32_be(const byte* p) { return ((u32)p[0] << 24) | ((u32)p[1] << 16) | ((u32)p[2] << 8) | ((u32)p[3]); }
-
-    static i32 read_from_client(us_loop* L, us_conn* connection)
-    {
-        CC_UNUSED(L);
-        for (;;)
-        {
-            // Header
-            u32 hn = 0;
-            while (hn < US_MESSAGE_HEADER_SIZE)
+            case US_URING_OP_SHM:
+            case US_URING_OP_BELL:
             {
-                ssize_t n = read(connection->m_fd, connection->m_buf + hn, US_MESSAGE_HEADER_SIZE - hn);
-                if (n > 0)
+                const u64 token      = ((u64)uring_udata_gen(udata) << 32) | uring_udata_id(udata);
+                us_conn*  connection = conn_lookup(L, token);
+                if (connection)
                 {
-                    hn += (u32)n;
-                    continue;
+                    if ((res < 0 && res != -EINTR) || service_shm_conn(L, connection) < 0)
+                    {
+                        if (conn_lookup(L, token) == connection)
+                            close_conn(L, connection);
+                    }
+                    else if (!more && conn_lookup(L, token) == connection)
+                    {
+                        uring_arm_shm(U, connection, uring_udata_op(udata));
+                    }
                 }
-                if (n == 0)
-                    return -1;  // EOF
-                if (errno == EAGAIN || errno == EWOULDBLOCK)
-                    return 0;  // No more data for now
-                if (errno == EINTR)
-                    continue;
-                return -1;
+                break;
             }
+            case US_URING_OP_RECV:
+            {
+                const u64 token      = ((u64)uring_udata_gen(udata) << 32) | uring_udata_id(udata);
+                const u32 has_buf    = cqe->flags & IORING_CQE_F_BUFFER;
+                const u16 bid        = (u16)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+                us_conn*  connection = conn_lookup(L, token);
 
-            const u32 magic = read_u32_be(connection->m_buf + US_MESSAGE_OFFSET_MAGIC);
-            if (magic != US_MESSAGE_MAGIC)
-                return -1;
-
-            const u32 payload_len = read_u32_be(connection->m_buf + US_MESSAGE_OFFSET_LEN);
-            if (payload_len > connection->m_cap - US_MESSAGE_HEADER_SIZE)
-                return -1;
+                i32 need_close = 0;
+                if (connection)
+                {
+                    if (res > 0)
+                    {
+                        const byte* data = U->m_buf_base + (uint_t)bid * US_URING_BUF_SIZE;
+                        if (consume_from_client(L, connection, data, (u32)res) < 0)
+                            need_close = 1;
+                    }
+                    else if (res != -ENOBUFS)
+                    {
+                        need_close = 1;  // EOF or error
+                    }
+                }
+                if (has_buf)
+                    uring_recycle_buffer(U, bid);
 
-            // Now read the payload of the message
-            u32 bn = 0;
-            while (bn < payload_len)
-            {
-                ssize_t n = read(connection->m_fd, connection->m_buf + US_MESSAGE_HEADER_SIZE + bn, payload_len - bn);
-                if (n > 0)
+                // The message callbacks may have closed the connection already
+                connection = conn_lookup(L, token);
+                if (connection)
                 {
-                    bn += (u32)n;
-                    continue;
+                    if (need_close)
+                        close_conn(L, connection);
+                    else if (!more)
+                        uring_arm_recv(U, connection);  // Multishot ended (e.g. out of buffers), re-arm
                 }
-                if (n == 0)
-                    return -1;  // EOF
-                if (errno == EAGAIN || errno == EWOULDBLOCK)
-                    return 0;  // No more data for now
-                if (errno == EINTR)
-                    continue;
-                return -1;
+                break;
             }
-
-            // Full message read, now dispatch
-            connection->m_used = US_MESSAGE_HEADER_SIZE + payload_len;
-            connection->m_server->m_on_msg(connection->m_server->m_server_id, connection->m_fd, (const u8*)connection->m_buf, connection->m_used, connection->m_server->m_user);
-            connection->m_used = 0;
+            default: break;  // Cancel completions
         }
     }
 
-    us_loop* us_loop_create(alloc_t* mi)
+    static i32 uring_loop_run(us_loop* L, us_uring* U, i32 timeout_ms)
     {
-        if (!mi)
-        {
-            errno = 22;
-            return NULL;
-        }
-        i32 kq = kqueue();
-        if (kq < 0)
-            return NULL;
-        us_loop* loop = g_allocate<us_loop>(mi);
-        if (!loop)
-        {
-            close(kq);
-            return NULL;
-        }
-        memset(loop, 0, sizeof(*loop));
-        loop->m_kq             = kq;
-        loop->m_stop           = 0;
-        loop->m_next_server_id = 1;
-        loop->m_servers        = g_allocate_array_and_clear<us_server>(mi, US_LOOP_SERVER_CAP);
-        loop->m_servers_count  = 0;
-        loop->m_servers_cap    = US_LOOP_SERVER_CAP;
-        loop->m_allocator      = mi;
-        return loop;
-    }
+        if (uring_submit(U, 1, timeout_ms) < 0)
+            return -1;
 
-    static us_server* find_server_by_id(us_loop* L, i32 server_id, uint_t* out_idx)
-    {
-        for (uint_t i = 0; i < L->m_servers_count; ++i)
+        loop_update_time(L);
+        u32 head = *U->m_cq_head;
+        if (head != __atomic_load_n(U->m_cq_tail, __ATOMIC_ACQUIRE))
+            L->m_stats.m_wakeups += 1;
+        for (;;)
         {
-            if (L->m_servers[i].m_active && L->m_servers[i].m_server_id == server_id)
+            const u32 tail = __atomic_load_n(U->m_cq_tail, __ATOMIC_ACQUIRE);
+            if (head == tail)
+                break;
+            while (head != tail)
             {
-                if (out_idx)
-                    *out_idx = i;
-                return &L->m_servers[i];
+                uring_process_cqe(L, U, &U->m_cqes[head & U->m_cq_mask]);
+                head++;
             }
+            __atomic_store_n(U->m_cq_head, head, __ATOMIC_RELEASE);
         }
-        return NULL;
+
+        loop_run_timers(L);
+
+        // Push out the re-arms, cancels and buffer returns queued while processing
+        return uring_submit(U, 0, 0) < 0 ? -1 : 0;
     }
 
-    i32 us_server_create(us_loop* loop, u8 type, u32 ip, u16 port, uint_t recv_buf_size, us_msg_cb on_msg, us_client_cb on_connect, us_client_cb on_disconnect, void* user)
+#else
+
+    // ----------------------------------------------------------------------------------------------
+    // kqueue backend (macOS, BSD)
+    // ----------------------------------------------------------------------------------------------
+
+    static i32 poll_create() { return kqueue(); }
+
+    static i32 poll_add_read(i32 kq, i32 fd, u64 token)
     {
-        if (!loop || !on_msg || recv_buf_size == 0)
+        struct kevent kev;
+        EV_SET(&kev, (uintptr_t)fd, EVFILT_READ, EV_ADD, 0, 0, (void*)(uintptr_t)token);
+        return kevent(kq, &kev, 1, NULL, 0, NULL);
+    }
+
+    static i32 poll_set_write(i32 kq, i32 fd, u64 token, bool enable)
+    {
+        struct kevent kev;
+        EV_SET(&kev, (uintptr_t)fd, EVFILT_WRITE, enable ? (EV_ADD | EV_CLEAR) : EV_DELETE, 0, 0, (void*)(uintptr_t)token);
+        return kevent(kq, &kev, 1, NULL, 0, NULL);
+    }
+
+    static i32 poll_del_read(i32 kq, i32 fd)
+    {
+        struct kevent kev;
+        EV_SET(&kev, (uintptr_t)fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+        return kevent(kq, &kev, 1, NULL, 0, NULL);
+    }
+
+    static i32 poll_wait(i32 kq, us_event* events, i32 max_events, i32 timeout_ms)
+    {
+        struct kevent   evlist[US_MAX_EVENT_BATCH];
+        struct timespec ts, *tsp = NULL;
+        if (timeout_ms >= 0)
+        {
+            ts.tv_sec  = timeout_ms / 1000;
+            ts.tv_nsec = (long)(timeout_ms % 1000) * 1000000L;
+            tsp        = &ts;
+        }
+        if (max_events > US_MAX_EVENT_BATCH)
+            max_events = US_MAX_EVENT_BATCH;
+
+        i32 nev = kevent(kq, NULL, 0, evlist, max_events, tsp);
+        for (i32 i = 0; i < nev; ++i)
+        {
+            const struct kevent* ev = &evlist[i];
+            events[i].m_token       = (u64)(uintptr_t)ev->udata;
+            events[i].m_flags       = 0;
+            if (ev->filter == EVFILT_READ)
+                events[i].m_flags |= US_EV_READ;
+            if (ev->filter == EVFILT_WRITE)
+                events[i].m_flags |= US_EV_WRITE;
+            if ((ev->flags & EV_EOF) != 0)
+                events[i].m_flags |= US_EV_EOF;
+            if ((ev->flags & EV_ERROR) != 0)
+                events[i].m_flags |= US_EV_ERROR;
+        }
+        return nev;
+    }
+
+#endif
+
+    // ----------------------------------------------------------------------------------------------
+    // Wakeup of a loop from another thread, an eventfd on Linux (watched by epoll or io_uring) and a
+    // EVFILT_USER event on kqueue.
+    // ----------------------------------------------------------------------------------------------
+
+#if defined(TARGET_LINUX)
+
+    static i32 wake_open(us_loop* L)
+    {
+        L->m_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (L->m_wake_fd < 0)
+            return -1;
+        if (L->m_uring)
+            return uring_arm_wake(L->m_uring, L->m_wake_fd);
+        return poll_add_read(L->m_poll_fd, L->m_wake_fd, US_WAKE_TOKEN);
+    }
+
+    static void wake_close(us_loop* L)
+    {
+        if (L->m_wake_fd >= 0)
+            close(L->m_wake_fd);
+        L->m_wake_fd = -1;
+    }
+
+    static void wake_signal(us_loop* L)
+    {
+        const u64 one = 1;
+        ssize_t   n;
+        do
+        {
+            n = write(L->m_wake_fd, &one, sizeof(one));
+        } while (n < 0 && errno == EINTR);
+    }
+
+    static void wake_ack(us_loop* L)
+    {
+        u64 value;
+        while (read(L->m_wake_fd, &value, sizeof(value)) < 0 && errno == EINTR)
+        {
+        }
+    }
+
+#else
+
+    static i32 wake_open(us_loop* L)
+    {
+        struct kevent kev;
+        EV_SET(&kev, US_WAKE_IDENT, EVFILT_USER, EV_ADD | EV_CLEAR, 0, 0, (void*)(uintptr_t)US_WAKE_TOKEN);
+        return kevent(L->m_poll_fd, &kev, 1, NULL, 0, NULL);
+    }
+
+    static void wake_close(us_loop* L) { CC_UNUSED(L); }
+
+    static void wake_signal(us_loop* L)
+    {
+        struct kevent kev;
+        EV_SET(&kev, US_WAKE_IDENT, EVFILT_USER, 0, NOTE_TRIGGER, 0, NULL);
+        kevent(L->m_poll_fd, &kev, 1, NULL, 0, NULL);
+    }
+
+    static void wake_ack(us_loop* L) { CC_UNUSED(L); }  // EV_CLEAR resets the event
+
+#endif
+
+    // Consumer side of the post queue, runs on the loop thread when the wakeup fires
+    static void loop_drain_posts(us_loop* L)
+    {
+        wake_ack(L);
+        // Posts made from here on signal again, the fence orders the store before the loads of the
+        // cells (a poster pushes, then exchanges the flag)
+        __atomic_store_n(&L->m_wake_pending, 0, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        for (u32 n = 0; n < US_POST_CAPACITY; ++n)
+        {
+            us_post_cell* cell = &L->m_posts[L->m_post_head & (US_POST_CAPACITY - 1)];
+            if (__atomic_load_n(&cell->m_seq, __ATOMIC_ACQUIRE) != L->m_post_head + 1)
+                break;
+            us_post_fn fn   = cell->m_fn;
+            void*      data = cell->m_data;
+            __atomic_store_n(&cell->m_seq, L->m_post_head + US_POST_CAPACITY, __ATOMIC_RELEASE);
+            L->m_post_head += 1;
+            fn(L, data);
+        }
+    }
+
+    // Accept one pending connection as a non-blocking, close-on-exec socket.
+    // On Linux this is a single accept4() call, elsewhere it needs the fcntl/setsockopt dance.
+    static i32 accept_nonblock(i32 listen_fd)
+    {
+#if defined(TARGET_LINUX)
+        return accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+        i32 cfd = accept(listen_fd, NULL, NULL);
+        if (cfd < 0)
+            return cfd;
+        if (set_fd_nonblock(cfd) < 0 || set_fd_cloexec(cfd) < 0 || set_fd_nosigpipe(cfd) < 0)
+        {
+            close(cfd);
+            errno = ECONNABORTED;
+            return -1;
+        }
+        return cfd;
+#endif
+    }
+
+    // Engine neutral registration of listeners and connections
+
+    static i32 loop_watch_server(us_loop* L, us_server* server)
+    {
+#if defined(TARGET_LINUX)
+        if (L->m_uring)
+            return server->m_type == US_SERVER_UDP ? uring_arm_poll(L->m_uring, server) : uring_arm_accept(L->m_uring, server);
+#endif
+        return poll_add_read(L->m_poll_fd, server->m_listen_fd, (u64)(u32)server->m_server_id);
+    }
+
+    static void loop_unwatch_server(us_loop* L, us_server* server)
+    {
+#if defined(TARGET_LINUX)
+        if (L->m_uring)
+        {
+            uring_cancel(L->m_uring, uring_udata(server->m_type == US_SERVER_UDP ? US_URING_OP_POLL : US_URING_OP_ACCEPT, (u32)server->m_server_id, 0));
+            return;
+        }
+#endif
+        poll_del_read(L->m_poll_fd, server->m_listen_fd);
+    }
+
+    static i32 loop_watch_conn(us_loop* L, us_conn* connection)
+    {
+#if defined(TARGET_LINUX)
+        if (L->m_uring && connection->m_shm)
+        {
+            if (uring_arm_shm(L->m_uring, connection, US_URING_OP_SHM) < 0)
+                return -1;
+            return uring_arm_shm(L->m_uring, connection, US_URING_OP_BELL);
+        }
+        if (L->m_uring)
+            return uring_arm_recv(L->m_uring, connection);
+#endif
+        // Both descriptors of a shared memory link report to the same connection
+        if (connection->m_shm && poll_add_read(L->m_poll_fd, connection->m_shm->m_bell_fd, conn_token(connection)) < 0)
+            return -1;
+        return poll_add_read(L->m_poll_fd, connection->m_fd, conn_token(connection));
+    }
+
+    static void loop_unwatch_conn(us_loop* L, us_conn* connection)
+    {
+#if defined(TARGET_LINUX)
+        if (L->m_uring)
+        {
+            uring_unwatch_conn(L->m_uring, connection);
+            return;
+        }
+#else
+        if (connection->m_out_armed)
+            poll_set_write(L->m_poll_fd, connection->m_fd, 0, false);
+#endif
+        if (connection->m_shm)
+            poll_del_read(L->m_poll_fd, connection->m_shm->m_bell_fd);
+        poll_del_read(L->m_poll_fd, connection->m_fd);
+    }
+
+    static i32 loop_watch_write(us_loop* L, us_conn* connection, bool enable)
+    {
+        if ((connection->m_out_armed != 0) == enable)
+            return 0;
+#if defined(TARGET_LINUX)
+        if (L->m_uring)
+        {
+            // A one-shot poll that is no longer needed just completes once and is ignored
+            if (enable && uring_arm_write(L->m_uring, connection) < 0)
+                return -1;
+            connection->m_out_armed = enable ? 1 : 0;
+            return 0;
+        }
+#endif
+        if (poll_set_write(L->m_poll_fd, connection->m_fd, conn_token(connection), enable) < 0)
+            return -1;
+        connection->m_out_armed = enable ? 1 : 0;
+        return 0;
+    }
+
+    // Take a slot from the free list, a new page is added to the slab when the free list is empty
+    static us_conn* conn_alloc(us_loop* L)
+    {
+        if (L->m_conn_free == US_CONN_SLOT_NONE)
+        {
+            if (((L->m_conn_pages_count + 1) << US_CONN_PAGE_SHIFT) > US_CONN_SLOT_LIMIT)
+            {
+                errno = 12;  // ENOMEM
+                return NULL;
+            }
+            if (L->m_conn_pages_count == L->m_conn_pages_cap)
+            {
+                const u32 new_cap   = L->m_conn_pages_cap == 0 ? 16 : L->m_conn_pages_cap * 2;
+                us_conn** new_pages = g_allocate_array_and_clear<us_conn*>(L->m_allocator, new_cap);
+                if (!new_pages)
+                    return NULL;
+                if (L->m_conn_pages)
+                {
+                    memcpy(new_pages, L->m_conn_pages, L->m_conn_pages_count * sizeof(us_conn*));
+                    g_deallocate_array(L->m_allocator, L->m_conn_pages);
+                }
+                L->m_conn_pages     = new_pages;
+                L->m_conn_pages_cap = new_cap;
+            }
+            us_conn* page = g_allocate_array_and_clear<us_conn>(L->m_allocator, US_CONN_PAGE_SIZE);
+            if (!page)
+                return NULL;
+            const u32 base = L->m_conn_pages_count << US_CONN_PAGE_SHIFT;
+            for (u32 i = 0; i < US_CONN_PAGE_SIZE; ++i)
+            {
+                page[i].m_fd        = -1;
+                page[i].m_slot      = base + i;
+                page[i].m_gen       = 1;
+                page[i].m_next_free = (i + 1 < US_CONN_PAGE_SIZE) ? (base + i + 1) : US_CONN_SLOT_NONE;
+            }
+            L->m_conn_pages[L->m_conn_pages_count++] = page;
+            L->m_conn_free                           = base;
+        }
+        us_conn* connection = &L->m_conn_pages[L->m_conn_free >> US_CONN_PAGE_SHIFT][L->m_conn_free & US_CONN_PAGE_MASK];
+        L->m_conn_free      = connection->m_next_free;
+        return connection;
+    }
+
+    // Return a slot to the free list, bumping the generation invalidates every outstanding handle
+    static void conn_release(us_loop* L, us_conn* connection)
+    {
+        const u32 slot = connection->m_slot;
+        u32       gen  = connection->m_gen + 1;
+        if (gen == 0)
+            gen = 1;
+        memset(connection, 0, sizeof(*connection));
+        connection->m_fd        = -1;
+        connection->m_slot      = slot;
+        connection->m_gen       = gen;
+        connection->m_next_free = L->m_conn_free;
+        L->m_conn_free          = slot;
+    }
+
+    static us_conn* conn_lookup(us_loop* L, u64 token)
+    {
+        const u32 slot = (u32)token;
+        const u32 gen  = (u32)(token >> 32);
+        if (gen == 0 || (slot >> US_CONN_PAGE_SHIFT) >= L->m_conn_pages_count)
+            return NULL;
+        us_conn* connection = &L->m_conn_pages[slot >> US_CONN_PAGE_SHIFT][slot & US_CONN_PAGE_MASK];
+        if (connection->m_kind != US_KIND_CONN || connection->m_gen != gen)
+            return NULL;
+        return connection;
+    }
+
+    static us_out_chunk* chunk_alloc(us_loop* L)
+    {
+        us_out_chunk* chunk = L->m_free_chunks;
+        if (chunk)
+        {
+            L->m_free_chunks = chunk->m_next;
+            L->m_free_chunks_count -= 1;
+        }
+        else
+        {
+            chunk = g_allocate<us_out_chunk>(L->m_allocator);
+            if (!chunk)
+                return NULL;
+        }
+        chunk->m_next = NULL;
+        chunk->m_head = 0;
+        chunk->m_tail = 0;
+        return chunk;
+    }
+
+    static void chunk_free(us_loop* L, us_out_chunk* chunk)
+    {
+        if (L->m_free_chunks_count >= US_OUT_CHUNK_POOL_MAX)
+        {
+            g_deallocate(L->m_allocator, chunk);
+            return;
+        }
+        chunk->m_next    = L->m_free_chunks;
+        L->m_free_chunks = chunk;
+        L->m_free_chunks_count += 1;
+    }
+
+    // Append to the outbound queue, filling up the last chunk first so that a burst of small
+    // messages ends up in a few contiguous buffers.
+    static i32 out_append(us_loop* L, us_conn* connection, const u8* data, u32 len)
+    {
+        while (len > 0)
+        {
+            us_out_chunk* chunk = connection->m_out_tail;
+            if (!chunk || chunk->m_tail == US_OUT_CHUNK_DATA)
+            {
+                chunk = chunk_alloc(L);
+                if (!chunk)
+                {
+                    errno = 12;  // ENOMEM
+                    return -1;
+                }
+                if (connection->m_out_tail)
+                    connection->m_out_tail->m_next = chunk;
+                else
+                    connection->m_out_head = chunk;
+                connection->m_out_tail = chunk;
+            }
+            const u32 room = US_OUT_CHUNK_DATA - chunk->m_tail;
+            const u32 n    = len < room ? len : room;
+            memcpy(chunk->m_data + chunk->m_tail, data, n);
+            chunk->m_tail += n;
+            connection->m_out_bytes += n;
+            data += n;
+            len -= n;
+        }
+        return 0;
+    }
+
+    static void out_clear(us_loop* L, us_conn* connection)
+    {
+        us_out_chunk* chunk = connection->m_out_head;
+        while (chunk)
+        {
+            us_out_chunk* next = chunk->m_next;
+            chunk_free(L, chunk);
+            chunk = next;
+        }
+        connection->m_out_head  = NULL;
+        connection->m_out_tail  = NULL;
+        connection->m_out_bytes = 0;
+    }
+
+    // Tell the server when a connection crosses its watermarks, returns false when the callback closed it
+    static bool out_check_pressure(us_conn* connection)
+    {
+        us_server* server = connection->m_server;
+        if (!server->m_on_pressure)
+            return true;
+        const u32 gen = connection->m_gen;
+        if (!connection->m_out_congested && connection->m_out_bytes >= server->m_high_watermark)
+        {
+            connection->m_out_congested = 1;
+            server->m_on_pressure(to_client_handle(connection), true, server->m_user);
+        }
+        else if (connection->m_out_congested && connection->m_out_bytes <= server->m_low_watermark)
+        {
+            connection->m_out_congested = 0;
+            server->m_on_pressure(to_client_handle(connection), false, server->m_user);
+        }
+        return connection->m_gen == gen;
+    }
+
+    // Send as much of the outbound queue as the socket takes, all chunks go out with one sendmsg()
+    // per US_OUT_WRITEV_MAX chunks. Returns -1 when the connection should be closed.
+    static i32 flush_conn(us_loop* L, us_conn* connection)
+    {
+        while (connection->m_out_head)
+        {
+            iovec iov[US_OUT_WRITEV_MAX];
+            i32   iov_count = 0;
+            for (us_out_chunk* chunk = connection->m_out_head; chunk && iov_count < US_OUT_WRITEV_MAX; chunk = chunk->m_next)
+            {
+                iov[iov_count].iov_base = chunk->m_data + chunk->m_head;
+                iov[iov_count].iov_len  = chunk->m_tail - chunk->m_head;
+                iov_count++;
+            }
+            msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov    = iov;
+            msg.msg_iovlen = iov_count;
+
+            ssize_t n = sendmsg(connection->m_fd, &msg, US_SEND_FLAGS);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    return loop_watch_write(L, connection, true);
+                return -1;
+            }
+            L->m_stats.m_bytes_sent += (u64)n;
+            connection->m_out_bytes -= (u32)n;
+            while (n > 0)
+            {
+                us_out_chunk* chunk = connection->m_out_head;
+                const u32     avail = chunk->m_tail - chunk->m_head;
+                if ((u32)n < avail)
+                {
+                    chunk->m_head += (u32)n;
+                    break;
+                }
+                n -= avail;
+                connection->m_out_head = chunk->m_next;
+                if (!connection->m_out_head)
+                    connection->m_out_tail = NULL;
+                chunk_free(L, chunk);
+            }
+            if (!out_check_pressure(connection))
+                return 0;  // Closed by the callback
+        }
+        return loop_watch_write(L, connection, false);
+    }
+
+#if defined(TARGET_LINUX)
+
+    static void shm_link_destroy(us_loop* L, us_conn* connection)
+    {
+        us_shm_link* link = connection->m_shm;
+        if (!link)
+            return;
+        if (link->m_map)
+            munmap(link->m_map, link->m_map_size);
+        if (link->m_bell_fd >= 0)
+            close(link->m_bell_fd);
+        g_deallocate(L->m_allocator, link);
+        connection->m_shm = NULL;
+    }
+
+    // Create the ring and the doorbell of a new producer and hand both descriptors over the socket
+    static i32 shm_link_create(us_loop* L, us_conn* connection)
+    {
+        const u32    capacity = connection->m_server->m_recv_buf_size;
+        us_shm_link* link     = g_allocate_and_clear<us_shm_link>(L->m_allocator);
+        if (!link)
+        {
+            errno = 12;  // ENOMEM
+            return -1;
+        }
+        link->m_bell_fd   = -1;
+        connection->m_shm = link;
+
+        const i32 memfd = (i32)syscall(SYS_memfd_create, "cconartist_shm", MFD_CLOEXEC);
+        if (memfd < 0)
+            return -1;
+        link->m_map_size = US_SHM_DATA_OFFSET + (size_t)capacity;
+        if (ftruncate(memfd, (off_t)link->m_map_size) < 0)
+        {
+            close(memfd);
+            return -1;
+        }
+        link->m_map = mmap(NULL, link->m_map_size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+        if (link->m_map == MAP_FAILED)
+        {
+            link->m_map = NULL;
+            close(memfd);
+            return -1;
+        }
+        shm_ring_init(link->m_map, capacity);
+        shm_ring_attach(link->m_ring, link->m_map, capacity);
+
+        link->m_bell_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (link->m_bell_fd < 0)
+        {
+            close(memfd);
+            return -1;
+        }
+
+        u32   map_size = (u32)link->m_map_size;
+        iovec iov;
+        iov.iov_base = &map_size;
+        iov.iov_len  = sizeof(map_size);
+        union
+        {
+            cmsghdr m_align;
+            byte    m_buf[CMSG_SPACE(2 * sizeof(i32))];
+        } control;
+        memset(&control, 0, sizeof(control));
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov        = &iov;
+        msg.msg_iovlen     = 1;
+        msg.msg_control    = control.m_buf;
+        msg.msg_controllen = sizeof(control.m_buf);
+        cmsghdr* cmsg      = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level   = SOL_SOCKET;
+        cmsg->cmsg_type    = SCM_RIGHTS;
+        cmsg->cmsg_len     = CMSG_LEN(2 * sizeof(i32));
+        const i32 fds[2]   = {memfd, link->m_bell_fd};
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+        // A few bytes on a fresh socket, this does not block
+        ssize_t n;
+        do
+        {
+            n = sendmsg(connection->m_fd, &msg, US_SEND_FLAGS);
+        } while (n < 0 && errno == EINTR);
+        close(memfd);  // The producer has its own reference now, the mapping keeps ours alive
+        return n == (ssize_t)sizeof(map_size) ? 0 : -1;
+    }
+
+    // Deliver every record in the ring, the messages are dispatched straight from shared memory.
+    // Returns -1 when the link should be closed (producer left, corrupt ring or closed by a callback).
+    static i32 service_shm_conn(us_loop* L, us_conn* connection)
+    {
+        us_shm_link* link = connection->m_shm;
+
+        u64 bell;
+        while (read(link->m_bell_fd, &bell, sizeof(bell)) < 0 && errno == EINTR)
+        {
+        }
+
+        // Producers never send anything on the socket, readability means that the producer is gone
+        byte    scratch[64];
+        ssize_t n    = recv(connection->m_fd, scratch, sizeof(scratch), MSG_DONTWAIT);
+        const bool gone = n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR);
+
+        // Whatever the producer committed before it left is still delivered
+        for (u32 budget = US_SHM_DRAIN_BUDGET;; --budget)
+        {
+            if (budget == 0)
+            {
+                // Come back on the next loop iteration, after the other connections had their turn
+                const u64 one = 1;
+                if (write(link->m_bell_fd, &one, sizeof(one)) < 0)
+                    return -1;
+                break;
+            }
+            const byte* data;
+            u32         size;
+            const i32   r = shm_ring_peek(link->m_ring, data, size);
+            if (r < 0)
+                return -1;
+            if (r == 0)
+            {
+                if (shm_ring_wait(link->m_ring))
+                    break;
+                continue;
+            }
+            u32         need;
+            connection->m_last_active = L->m_now;
+            const int_t consumed      = dispatch_messages(connection, data, size, need);
+            if (consumed != (int_t)size)
+                return -1;  // Not a whole number of valid messages, or the connection was closed
+            shm_ring_pop(link->m_ring);
+        }
+        return gone ? -1 : 0;
+    }
+
+#else
+
+    static void shm_link_destroy(us_loop* L, us_conn* connection) { CC_UNUSED(L); CC_UNUSED(connection); }
+    static i32  shm_link_create(us_loop* L, us_conn* connection)
+    {
+        CC_UNUSED(L);
+        CC_UNUSED(connection);
+        errno = ENOSYS;
+        return -1;
+    }
+    static i32 service_shm_conn(us_loop* L, us_conn* connection)
+    {
+        CC_UNUSED(L);
+        CC_UNUSED(connection);
+        return -1;
+    }
+
+#endif
+
+    static void close_conn(us_loop* L, us_conn* connection)
+    {
+        us_server* server = connection->m_server;
+        if (connection->m_fd >= 0)
+        {
+            loop_unwatch_conn(L, connection);
+            close(connection->m_fd);
+        }
+        L->m_stats.m_closed += 1;
+        server->m_conns_count -= 1;
+        timer_cancel(L->m_timers, &connection->m_idle_timer);
+        if (connection->m_buf)
+        {
+            g_deallocate_array(L->m_allocator, connection->m_buf);
+        }
+        out_clear(L, connection);
+        shm_link_destroy(L, connection);
+        const client_id_t client_id = to_client_handle(connection);
+        conn_release(L, connection);
+        if (server->m_on_disconnect)
+        {
+            server->m_on_disconnect(client_id, server->m_user);
+        }
+    }
+
+    // Activity does not touch the timer, it only moves m_last_active. When the timer fires on a
+    // connection that was active meanwhile it is pushed out to the real deadline.
+    static void conn_idle_expired(timer_node_t* timer, void* user)
+    {
+        us_conn*   connection = (us_conn*)user;
+        us_server* server     = connection->m_server;
+        us_loop*   L          = server->m_loop;
+        if (server->m_idle_timeout_ms == 0)
+            return;
+        const u64 deadline = connection->m_last_active + server->m_idle_timeout_ms;
+        if (deadline > L->m_now)
+        {
+            timer_schedule(L->m_timers, timer, deadline);
+            return;
+        }
+        L->m_stats.m_timeouts += 1;
+        close_conn(L, connection);
+    }
+
+    static us_conn* add_client(us_loop* L, us_server* server, i32 cfd)
+    {
+        us_conn* connection = conn_alloc(L);
+        if (!connection)
+        {
+            close(cfd);
+            return NULL;
+        }
+        connection->m_kind   = US_KIND_CONN;
+        connection->m_server = server;
+        connection->m_fd     = cfd;
+        connection->m_head   = 0;
+        connection->m_tail   = 0;
+        connection->m_need   = US_MESSAGE_HEADER_SIZE;
+        connection->m_last_active = L->m_now;
+        timer_init(&connection->m_idle_timer, conn_idle_expired, connection);
+        i32 result;
+        if (server->m_type == US_SERVER_SHM)
+        {
+            // Messages are dispatched from the ring, a record can be half of the ring at most
+            connection->m_cap = server->m_recv_buf_size >> 1;
+            result            = shm_link_create(L, connection);
+        }
+        else
+        {
+            connection->m_cap = server->m_recv_buf_size;
+            connection->m_buf = g_allocate_array<byte>(L->m_allocator, connection->m_cap);
+            result            = connection->m_buf ? 0 : -1;
+        }
+        if (result < 0 || loop_watch_conn(L, connection) < 0)
+        {
+            close(cfd);
+            if (connection->m_buf)
+                g_deallocate_array(L->m_allocator, connection->m_buf);
+            shm_link_destroy(L, connection);
+            conn_release(L, connection);
+            return NULL;
+        }
+        server->m_conns_count += 1;
+        L->m_stats.m_accepted += 1;
+        if (server->m_idle_timeout_ms > 0)
+            timer_schedule(L->m_timers, &connection->m_idle_timer, L->m_now + server->m_idle_timeout_ms);
+        if (server->m_on_connect)
+            server->m_on_connect(to_client_handle(connection), server->m_user);
+        return connection;
+    }
+
+    static i32 accept_new_clients(us_loop* L, us_server* server)
+    {
+        for (;;)
+        {
+            i32 cfd = accept_nonblock(server->m_listen_fd);
+            if (cfd < 0)
+            {
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    return 0;
+                if (errno == EINTR || errno == ECONNABORTED)
+                    continue;
+                return -1;
+            }
+            add_client(L, server, cfd);
+        }
+    }
+
+    static inline client_id_t to_peer_handle(const us_server* server, const sockaddr_in& addr)
+    {
+        const u64 id = (u64)((u32)server->m_server_id & US_PEER_ID_MASK) << US_PEER_ID_SHIFT;
+        return (client_id_t)(uintptr_t)(((u64)ntohl(addr.sin_addr.s_addr) << 32) | US_PEER_TAG | id | ((u64)ntohs(addr.sin_port) << 8) | server->m_index);
+    }
+    static inline bool is_peer_handle(client_id_t handle) { return ((u64)(uintptr_t)handle & US_PEER_TAG) != 0; }
+
+    // The UDP server a peer handle was received on, NULL when that server has been closed
+    static us_server* peer_server(us_loop* L, client_id_t handle)
+    {
+        const u64 h   = (u64)(uintptr_t)handle;
+        const u32 idx = (u32)(h & 0xFF);
+        if (idx >= L->m_servers_count || !L->m_servers[idx].m_active || L->m_servers[idx].m_type != US_SERVER_UDP)
+            return NULL;
+        if (((u32)(h >> US_PEER_ID_SHIFT) & US_PEER_ID_MASK) != ((u32)L->m_servers[idx].m_server_id & US_PEER_ID_MASK))
+            return NULL;  // The slot was reused by another server
+        return &L->m_servers[idx];
+    }
+
+    static void peer_address(client_id_t handle, sockaddr_in& addr)
+    {
+        const u64 h = (u64)(uintptr_t)handle;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family      = AF_INET;
+        addr.sin_addr.s_addr = htonl((u32)(h >> 32));
+        addr.sin_port        = htons((u16)(h >> 8));
+    }
+
+    static void destroy_dgram_batch(us_loop* L, us_server* server)
+    {
+        if (server->m_batch)
+        {
+            for (i32 i = 0; i < US_UDP_BATCH; ++i)
+                packet_release(server->m_packets, server->m_batch->m_packets[i]);  // Ignores NULL
+            g_deallocate(L->m_allocator, server->m_batch);
+            server->m_batch = NULL;
+        }
+        if (server->m_packets)
+        {
+            packet_pool_destroy(server->m_packets);
+            server->m_packets = NULL;
+        }
+    }
+
+    // The buffers of a batch are taken from the packet pool once and reused by every receive
+    static i32 create_dgram_batch(us_loop* L, us_server* server)
+    {
+        const u32 size    = server->m_recv_buf_size < US_UDP_MAX_DATAGRAM ? server->m_recv_buf_size : US_UDP_MAX_DATAGRAM;
+        server->m_packets = packet_pool_create(L->m_allocator, US_UDP_BATCH, US_UDP_BATCH, (u16)size);
+        server->m_batch   = g_allocate_and_clear<us_dgram_batch>(L->m_allocator);
+        if (!server->m_packets || !server->m_batch)
+        {
+            destroy_dgram_batch(L, server);
+            errno = 12;  // ENOMEM
+            return -1;
+        }
+        us_dgram_batch* batch = server->m_batch;
+        for (i32 i = 0; i < US_UDP_BATCH; ++i)
+        {
+            packet_t* pkt = packet_acquire(server->m_packets);
+            if (!pkt)
+            {
+                destroy_dgram_batch(L, server);
+                errno = 12;  // ENOMEM
+                return -1;
+            }
+            batch->m_packets[i]       = pkt;
+            batch->m_iovs[i].iov_base = pkt->m_data;
+            batch->m_iovs[i].iov_len  = pkt->m_data_capacity;
+#if defined(TARGET_LINUX)
+            batch->m_msgs[i].msg_hdr.msg_name   = &batch->m_addrs[i];
+            batch->m_msgs[i].msg_hdr.msg_iov    = &batch->m_iovs[i];
+            batch->m_msgs[i].msg_hdr.msg_iovlen = 1;
+#endif
+        }
+        return 0;
+    }
+
+    // Receive up to US_UDP_BATCH datagrams, returns the number received, 0 when the socket is drained
+    static i32 receive_datagrams(us_server* server)
+    {
+        us_dgram_batch* batch = server->m_batch;
+#if defined(TARGET_LINUX)
+        for (i32 i = 0; i < US_UDP_BATCH; ++i)
+        {
+            batch->m_msgs[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);  // Both are updated by the kernel
+            batch->m_msgs[i].msg_hdr.msg_flags   = 0;
+        }
+        for (;;)
+        {
+            const i32 n = recvmmsg(server->m_listen_fd, batch->m_msgs, US_UDP_BATCH, MSG_DONTWAIT, NULL);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0)
+                return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+            for (i32 i = 0; i < n; ++i)
+            {
+                batch->m_packets[i]->m_data_size = batch->m_msgs[i].msg_len;
+                batch->m_truncated[i]            = (batch->m_msgs[i].msg_hdr.msg_flags & MSG_TRUNC) != 0;
+            }
+            return n;
+        }
+#else
+        // No recvmmsg() on macOS/BSD, fill the batch with one recvfrom() per datagram
+        i32 n = 0;
+        while (n < US_UDP_BATCH)
+        {
+            socklen_t     alen = sizeof(sockaddr_in);
+            const ssize_t r    = recvfrom(server->m_listen_fd, batch->m_iovs[n].iov_base, batch->m_iovs[n].iov_len, MSG_DONTWAIT, (sockaddr*)&batch->m_addrs[n], &alen);
+            if (r < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                if (n == 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+                    return -1;
+                break;
+            }
+            // recvfrom() silently cuts off what does not fit, a full buffer is treated as truncated
+            batch->m_packets[n]->m_data_size = (u32)r;
+            batch->m_truncated[n]            = (size_t)r == batch->m_iovs[n].iov_len;
+            n++;
+        }
+        return n;
+#endif
+    }
+
+    // Drain the socket of a UDP server, every datagram is handed to on_msg with its sender as the client.
+    // Returns -1 on a socket error, stops early when a callback closes the server.
+    static i32 read_datagrams(us_loop* L, us_server* server)
+    {
+        const i32 server_id = server->m_server_id;
+        for (;;)
+        {
+            const i32 n = receive_datagrams(server);
+            if (n <= 0)
+                return n;
+            us_dgram_batch* batch = server->m_batch;
+            for (i32 i = 0; i < n; ++i)
+            {
+                if (batch->m_truncated[i])
+                    continue;
+                const packet_t* pkt = batch->m_packets[i];
+                server->m_on_msg(to_peer_handle(server, batch->m_addrs[i]), pkt->m_data, pkt->m_data_size, server->m_user);
+                L->m_stats.m_messages += 1;
+                L->m_stats.m_bytes += pkt->m_data_size;
+                if (!server->m_active || server->m_server_id != server_id)
+                    return 0;
+            }
+            if (n < US_UDP_BATCH)
+                return 0;
+        }
+    }
+
+    static u32 read_u32_be(const byte* p) { return ((u32)p[0] << 24) | ((u32)p[1] << 16) | ((u32)p[2] << 8) | ((u32)p[3]); }
+
+    // Dispatch every complete message in [data, data + len), returns the number of bytes consumed
+    // or -1 when the stream is corrupt, a message can never fit the connection buffer or a callback
+    // closed the connection.
+    // 'out_need' receives the full size of the incomplete message that follows, as far as known.
+    static int_t dispatch_messages(us_conn* connection, const byte* data, u32 len, u32& out_need)
+    {
+        us_server* server = connection->m_server;
+        const u32  gen    = connection->m_gen;
+        u32        pos    = 0;
+        out_need          = US_MESSAGE_HEADER_SIZE;
+        while (len - pos >= US_MESSAGE_HEADER_SIZE)
+        {
+            const byte* msg   = data + pos;
+            const u32   magic = read_u32_be(msg + US_MESSAGE_OFFSET_MAGIC);
+            if (magic != US_MESSAGE_MAGIC)
+                return -1;
+            const u32 payload_len = read_u32_be(msg + US_MESSAGE_OFFSET_LEN);
+            if (payload_len > connection->m_cap - US_MESSAGE_HEADER_SIZE)
+                return -1;
+            const u32 msg_len = US_MESSAGE_HEADER_SIZE + payload_len;
+            if (len - pos < msg_len)
+            {
+                out_need = msg_len;
+                break;
+            }
+            server->m_on_msg(to_client_handle(connection), (const u8*)msg, msg_len, server->m_user);
+            server->m_loop->m_stats.m_messages += 1;
+            server->m_loop->m_stats.m_bytes += msg_len;
+            if (connection->m_gen != gen)
+                return -1;  // The callback closed the connection
+            pos += msg_len;
+        }
+        return pos;
+    }
+
+    // Dispatch the complete messages that are buffered in the connection and make sure the message
+    // in progress has room to complete. The partial message is only moved to the front of the buffer
+    // when it would otherwise run off the end or when the free space at the end gets too small to
+    // read efficiently.
+    static i32 dispatch_buffered(us_conn* connection)
+    {
+        const int_t n = dispatch_messages(connection, connection->m_buf + connection->m_head, connection->m_tail - connection->m_head, connection->m_need);
+        if (n < 0)
+            return -1;
+        connection->m_head += (u32)n;
+        if (connection->m_head == connection->m_tail)
+        {
+            connection->m_head = 0;
+            connection->m_tail = 0;
+        }
+        else if ((connection->m_cap - connection->m_head) < connection->m_need || (connection->m_cap - connection->m_tail) < (connection->m_cap >> 2))
+        {
+            const u32 partial = connection->m_tail - connection->m_head;
+            memmove(connection->m_buf, connection->m_buf + connection->m_head, partial);
+            connection->m_head = 0;
+            connection->m_tail = partial;
+        }
+        return 0;
+    }
+
+    // Read as much as fits in the connection buffer with one read() and dispatch all complete
+    // messages in it, returns -1 when the connection should be closed.
+    static i32 read_from_client(us_loop* L, us_conn* connection)
+    {
+        for (;;)
+        {
+            const u32 room = connection->m_cap - connection->m_tail;
+            ssize_t   n    = read(connection->m_fd, connection->m_buf + connection->m_tail, room);
+            if (n > 0)
+            {
+                connection->m_last_active = L->m_now;
+                connection->m_tail += (u32)n;
+                if (dispatch_buffered(connection) < 0)
+                    return -1;
+                // A short read on a stream socket means the receive queue is empty, new data
+                // will raise a new (edge-triggered) readiness event.
+                if ((u32)n < room)
+                    return 0;
+                continue;
+            }
+            if (n == 0)
+                return -1;  // EOF
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;  // No more data for now
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+    }
+
+    // Feed bytes that were received outside of the connection buffer (io_uring provided buffers).
+    // Complete messages are dispatched straight from the given memory, only a trailing partial
+    // message is copied into the connection buffer.
+    static i32 consume_from_client(us_loop* L, us_conn* connection, const byte* data, u32 len)
+    {
+        connection->m_last_active = L->m_now;
+        if (connection->m_head == connection->m_tail)
+        {
+            const int_t n = dispatch_messages(connection, data, len, connection->m_need);
+            if (n < 0)
+                return -1;
+            data += n;
+            len -= (u32)n;
+        }
+        while (len > 0)
+        {
+            const u32 room = connection->m_cap - connection->m_tail;
+            const u32 n    = len < room ? len : room;
+            memcpy(connection->m_buf + connection->m_tail, data, n);
+            connection->m_tail += n;
+            data += n;
+            len -= n;
+            if (dispatch_buffered(connection) < 0)
+                return -1;
+        }
+        return 0;
+    }
+
+    us_loop* us_loop_create(alloc_t* mi, nengine::enum_t engine)
+    {
+        if (!mi)
+        {
+            errno = 22;
+            return NULL;
+        }
+        i32 pfd = poll_create();
+        if (pfd < 0)
+            return NULL;
+        us_loop* loop = g_allocate<us_loop>(mi);
+        if (!loop)
+        {
+            close(pfd);
+            return NULL;
+        }
+        memset(loop, 0, sizeof(*loop));
+        loop->m_poll_fd        = pfd;
+        loop->m_stop           = 0;
+        loop->m_next_server_id = 1;
+        loop->m_servers        = g_allocate_array_and_clear<us_server>(mi, US_LOOP_SERVER_CAP);
+        loop->m_servers_count  = 0;
+        loop->m_servers_cap    = US_LOOP_SERVER_CAP;
+        loop->m_conn_free      = US_CONN_SLOT_NONE;
+        loop->m_allocator      = mi;
+        loop->m_engine         = nengine::Poll;
+        loop->m_uring          = NULL;
+        loop_update_time(loop);
+        loop->m_timers  = timer_wheel_create(mi, loop->m_now);
+        loop->m_posts   = g_allocate_array<us_post_cell>(mi, US_POST_CAPACITY);
+        loop->m_wake_fd = -1;
+        if (!loop->m_servers || !loop->m_timers || !loop->m_posts)
+        {
+            us_loop_destroy(loop);
+            errno = 12;  // ENOMEM
+            return NULL;
+        }
+        for (u32 i = 0; i < US_POST_CAPACITY; ++i)
+            loop->m_posts[i].m_seq = i;
+#if defined(TARGET_LINUX)
+        if (engine == nengine::IoUring)
+        {
+            loop->m_uring = uring_create(loop);
+            if (loop->m_uring)
+                loop->m_engine = nengine::IoUring;
+        }
+#else
+        CC_UNUSED(engine);
+#endif
+        // After the engine is known, io_uring watches the wakeup itself instead of through epoll
+        if (wake_open(loop) < 0)
+        {
+            i32 e = errno;
+            us_loop_destroy(loop);
+            errno = e;
+            return NULL;
+        }
+        return loop;
+    }
+
+    static us_server* find_server_by_id(us_loop* L, i32 server_id, uint_t* out_idx)
+    {
+        for (uint_t i = 0; i < L->m_servers_count; ++i)
+        {
+            if (L->m_servers[i].m_active && L->m_servers[i].m_server_id == server_id)
+            {
+                if (out_idx)
+                    *out_idx = i;
+                return &L->m_servers[i];
+            }
+        }
+        return NULL;
+    }
+
+    // Server ids are handed out as opaque handles, 0 (NULL) is never a valid server id
+    static inline server_id_t to_server_handle(i32 server_id) { return (server_id_t)(uintptr_t)server_id; }
+    static inline i32         from_server_handle(server_id_t handle) { return (i32)(uintptr_t)handle; }
+
+    // Server slots are never moved, reuse the slot of a closed server before taking a new one
+    static us_server* alloc_server_slot(us_loop* L)
+    {
+        for (u32 i = 0; i < L->m_servers_count; ++i)
+        {
+            if (!L->m_servers[i].m_active)
+                return &L->m_servers[i];
+        }
+        if (L->m_servers_count >= L->m_servers_cap)
+        {
+            errno = 12;  // ENOMEM
+            return NULL;
+        }
+        return &L->m_servers[L->m_servers_count++];
+    }
+
+    server_id_t us_server_create(us_loop* loop, u8 type, u32 ip, u16 port, uint_t recv_buf_size, us_msg_cb on_msg, us_client_cb on_connect, us_client_cb on_disconnect, void* user)
+    {
+        if (!loop || !on_msg || recv_buf_size == 0)
+        {
+            errno = 22;  // EINVAL
+            return NULL;
+        }
+
+        if (type != 0 && type != 1)  // Only support UDP and TCP for now, where 0 = UDP, 1 = TCP
+        {
+            errno = 22;  // EINVAL
+            return NULL;
+        }
+
+        us_server* server = alloc_server_slot(loop);
+        if (!server)
+            return NULL;
+
+#if defined(TARGET_LINUX)
+        i32 fd = socket(AF_INET, ((type == 0) ? SOCK_DGRAM : SOCK_STREAM) | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0)
+            return NULL;
+#else
+        i32 fd = socket(AF_INET, (type == 0) ? SOCK_DGRAM : SOCK_STREAM, 0);
+        if (fd < 0)
+            return NULL;
+        if (set_fd_nonblock(fd) < 0 || set_fd_cloexec(fd) < 0)
+        {
+            i32 e = errno;
+            close(fd);
+            errno = e;
+            return NULL;
+        }
+#endif
+
+        if (loop->m_flags & US_LOOP_FLAG_REUSEPORT)
+        {
+            // Every loop of a group binds its own listener to the same port, the kernel spreads the
+            // incoming connections (Linux) or datagrams over them.
+            i32 one = 1;
+            if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0)
+            {
+                i32 e = errno;
+                close(fd);
+                errno = e;
+                return NULL;
+            }
+        }
+
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(ip);
+        addr.sin_port = htons(port);
+
+        if (bind(fd, (sockaddr*)&addr, (socklen_t)sizeof(addr)) < 0)
+        {
+            i32 e = errno;
+            close(fd);
+            errno = e;
+            return NULL;
+        }
+
+        if (type == 0)
+        {
+            // Best effort, the kernel caps it at net.core.rmem_max
+            i32 rcvbuf = US_UDP_RCVBUF;
+            setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+        }
+        else if (listen(fd, SOMAXCONN) < 0)
+        {
+            i32 e = errno;
+            close(fd);
+            errno = e;
+            return NULL;
+        }
+
+        memset(server, 0, sizeof(*server));
+        server->m_kind          = US_KIND_SERVER;
+        server->m_server_id     = loop->m_next_server_id++;
+        server->m_loop          = loop;
+        server->m_listen_fd     = fd;
+        server->m_recv_buf_size = recv_buf_size;
+        server->m_on_msg        = on_msg;
+        server->m_on_connect    = on_connect;
+        server->m_on_disconnect  = on_disconnect;
+        server->m_low_watermark  = US_OUT_LOW_WATERMARK;
+        server->m_high_watermark = US_OUT_HIGH_WATERMARK;
+        server->m_user           = user;
+        server->m_conns_count   = 0;
+        server->m_active        = 1;
+
+        server->m_index         = (u32)(server - loop->m_servers);
+
+        server->m_ip   = ip;
+        server->m_port = port;
+        server->m_type = type;
+
+        if ((type == 0 && create_dgram_batch(loop, server) < 0) || loop_watch_server(loop, server) < 0)
+        {
+            i32 e = errno;
+            close(fd);
+            destroy_dgram_batch(loop, server);
+            memset(server, 0, sizeof(*server));
+            errno = e;
+            return NULL;
+        }
+
+        return to_server_handle(server->m_server_id);
+    }
+
+#if defined(TARGET_LINUX)
+
+    server_id_t us_shm_server_create(us_loop* loop, const char* socket_path, uint_t ring_size, us_msg_cb on_msg, us_client_cb on_connect, us_client_cb on_disconnect, void* user)
+    {
+        if (!loop || !on_msg || !socket_path || strlen(socket_path) >= sizeof(((sockaddr_un*)0)->sun_path) || ring_size > US_SHM_MAX_CAPACITY)
+        {
+            errno = 22;  // EINVAL
+            return NULL;
+        }
+
+        // The ring positions are masked, so the capacity is a power of 2
+        u32 capacity = US_SHM_MIN_CAPACITY;
+        while (capacity < ring_size)
+            capacity <<= 1;
+
+        us_server* server = alloc_server_slot(loop);
+        if (!server)
+            return NULL;
+
+        i32 fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0)
+            return NULL;
+
+        sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strcpy(addr.sun_path, socket_path);
+
+        // A socket file left behind by a previous run would fail the bind
+        unlink(socket_path);
+        if (bind(fd, (sockaddr*)&addr, (socklen_t)sizeof(addr)) < 0 || listen(fd, SOMAXCONN) < 0)
+        {
+            i32 e = errno;
+            close(fd);
+            errno = e;
+            return NULL;
+        }
+
+        memset(server, 0, sizeof(*server));
+        server->m_kind           = US_KIND_SERVER;
+        server->m_server_id      = loop->m_next_server_id++;
+        server->m_loop           = loop;
+        server->m_listen_fd      = fd;
+        server->m_recv_buf_size  = capacity;
+        server->m_on_msg         = on_msg;
+        server->m_on_connect     = on_connect;
+        server->m_on_disconnect  = on_disconnect;
+        server->m_low_watermark  = US_OUT_LOW_WATERMARK;
+        server->m_high_watermark = US_OUT_HIGH_WATERMARK;
+        server->m_user           = user;
+        server->m_active         = 1;
+        server->m_index          = (u32)(server - loop->m_servers);
+        server->m_type           = US_SERVER_SHM;
+        server->m_path           = g_duplicate_string(loop->m_allocator, socket_path);
+
+        if (!server->m_path || loop_watch_server(loop, server) < 0)
+        {
+            i32 e = server->m_path ? errno : 12;
+            close(fd);
+            unlink(socket_path);
+            if (server->m_path)
+                g_deallocate_string(loop->m_allocator, server->m_path);
+            memset(server, 0, sizeof(*server));
+            errno = e;
+            return NULL;
+        }
+
+        return to_server_handle(server->m_server_id);
+    }
+
+#else
+
+    // memfd and eventfd are Linux only
+    server_id_t us_shm_server_create(us_loop* loop, const char* socket_path, uint_t ring_size, us_msg_cb on_msg, us_client_cb on_connect, us_client_cb on_disconnect, void* user)
+    {
+        CC_UNUSED(loop);
+        CC_UNUSED(socket_path);
+        CC_UNUSED(ring_size);
+        CC_UNUSED(on_msg);
+        CC_UNUSED(on_connect);
+        CC_UNUSED(on_disconnect);
+        CC_UNUSED(user);
+        errno = ENOSYS;
+        return NULL;
+    }
+
+#endif
+
+    i32 us_server_close(us_loop* loop, server_id_t server_id)
+    {
+        if (!loop)
+        {
+            errno = 22;
+            return -1;
+        }
+        us_server* server = find_server_by_id(loop, from_server_handle(server_id), NULL);
+        if (!server)
+        {
+            errno = 2;
+            return -1;
+        }
+
+        for (u32 p = 0; p < loop->m_conn_pages_count && server->m_conns_count > 0; ++p)
+        {
+            us_conn* page = loop->m_conn_pages[p];
+            for (u32 i = 0; i < US_CONN_PAGE_SIZE; ++i)
+            {
+                if (page[i].m_kind == US_KIND_CONN && page[i].m_server == server)
+                    close_conn(loop, &page[i]);
+            }
+        }
+
+        if (server->m_listen_fd >= 0)
+        {
+            loop_unwatch_server(loop, server);
+            close(server->m_listen_fd);
+        }
+        destroy_dgram_batch(loop, server);
+        if (server->m_path)
+        {
+            unlink(server->m_path);
+            g_deallocate_string(loop->m_allocator, server->m_path);
+        }
+
+        // The slot stays where it is (inactive) so nothing that points at other servers has to move
+        memset(server, 0, sizeof(*server));
+        return 0;
+    }
+
+    void us_loop_destroy(struct us_loop* loop)
+    {
+        if (!loop)
+            return;
+
+        for (u32 i = 0; i < loop->m_servers_count; ++i)
+        {
+            struct us_server* server = &loop->m_servers[i];
+            if (server->m_active)
+            {
+                us_server_close(loop, to_server_handle(server->m_server_id));
+            }
+        }
+        loop->m_servers_count = 0;
+
+        if (loop->m_servers)
+        {
+            g_deallocate_array(loop->m_allocator, loop->m_servers);
+        }
+
+        // Timers that were not destroyed by their owner are detached, not freed
+        timer_wheel_destroy(loop->m_timers);
+
+        // Posts that did not run yet are dropped
+        wake_close(loop);
+        if (loop->m_posts)
+            g_deallocate_array(loop->m_allocator, loop->m_posts);
+
+        for (u32 p = 0; p < loop->m_conn_pages_count; ++p)
+        {
+            g_deallocate_array(loop->m_allocator, loop->m_conn_pages[p]);
+        }
+        if (loop->m_conn_pages)
         {
-            errno = 22;  // EINVAL
-            return -1;
+            g_deallocate_array(loop->m_allocator, loop->m_conn_pages);
         }
 
-        if (type != 0 && type != 1)  // Only support UDP and TCP for now, where 0 = UDP, 1 = TCP
+        while (loop->m_free_chunks)
         {
-            errno = 22;  // EINVAL
-            return -1;
+            us_out_chunk* chunk = loop->m_free_chunks;
+            loop->m_free_chunks = chunk->m_next;
+            g_deallocate(loop->m_allocator, chunk);
         }
 
-        if (loop->m_servers_count >= loop->m_servers_cap)
+#if defined(TARGET_LINUX)
+        if (loop->m_uring)
         {
-            errno = 12;  // ENOMEM
-            return -1;
+            uring_destroy(loop, loop->m_uring);
+            loop->m_uring = NULL;
         }
+#endif
 
-        i32 fd = socket(AF_INET, (type == 0) ? SOCK_DGRAM : SOCK_STREAM, 0);
-        if (fd < 0)
-            return -1;
-        if (set_fd_nonblock(fd) < 0 || set_fd_cloexec(fd) < 0)
+        if (loop->m_poll_fd >= 0)
         {
-            i32 e = errno;
-            close(fd);
-            errno = e;
-            return -1;
+            close(loop->m_poll_fd);
         }
 
-        sockaddr_in addr;
-        memset(&addr, 0, sizeof(addr));
-        addr.sin_family = AF_INET;
-        addr.sin_addr.s_addr = htonl(ip);
-        addr.sin_port = htons(port);
+        g_deallocate(loop->m_allocator, loop);
+    }
 
-        if (bind(fd, (sockaddr*)&addr, (socklen_t)sizeof(addr)) < 0)
+    nengine::enum_t us_loop_engine(us_loop* loop)
+    {
+        if (loop != nullptr && loop->m_engine == nengine::IoUring)
+            return nengine::IoUring;
+        return nengine::Poll;
+    }
+
+    i32 us_loop_index(us_loop* loop) { return loop ? loop->m_index : -1; }
+
+    void us_loop_stats(us_loop* loop, us_loop_stats_t& out_stats)
+    {
+        // Racy read from another thread, good enough for monitoring the balance between loops
+        memcpy(&out_stats, &loop->m_stats, sizeof(us_loop_stats_t));
+    }
+
+    // Set by us_loop_run, a thread only ever runs one loop
+    static __thread us_loop* s_current_loop = NULL;
+
+    us_loop* us_loop_current() { return s_current_loop; }
+
+    i32 us_loop_post(us_loop* loop, us_post_fn fn, void* data)
+    {
+        if (!loop || !fn)
         {
-            i32 e = errno;
-            close(fd);
-            errno = e;
+            errno = 22;
             return -1;
         }
-
-        if (listen(fd, SOMAXCONN) < 0)
+        u64           pos = __atomic_load_n(&loop->m_post_tail, __ATOMIC_RELAXED);
+        us_post_cell* cell;
+        for (;;)
         {
-            i32 e = errno;
-            close(fd);
-            errno = e;
-            return -1;
+            cell           = &loop->m_posts[pos & (US_POST_CAPACITY - 1)];
+            const u64 seq  = __atomic_load_n(&cell->m_seq, __ATOMIC_ACQUIRE);
+            const i64 diff = (i64)(seq - pos);
+            if (diff == 0)
+            {
+                if (__atomic_compare_exchange_n(&loop->m_post_tail, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                    break;
+            }
+            else if (diff < 0)
+            {
+                errno = EAGAIN;  // The loop is US_POST_CAPACITY posts behind
+                return -1;
+            }
+            else
+            {
+                pos = __atomic_load_n(&loop->m_post_tail, __ATOMIC_RELAXED);
+            }
         }
+        cell->m_fn   = fn;
+        cell->m_data = data;
+        __atomic_store_n(&cell->m_seq, pos + 1, __ATOMIC_RELEASE);
+        us_loop_wake(loop);
+        return 0;
+    }
 
-        us_server* server = &loop->m_servers[loop->m_servers_count++];
-        memset(server, 0, sizeof(*server));
-        server->m_kind          = US_KIND_SERVER;
-        server->m_server_id     = loop->m_next_server_id++;
-        server->m_listen_fd     = fd;
-        server->m_recv_buf_size = recv_buf_size;
-        server->m_on_msg        = on_msg;
-        server->m_on_connect    = on_connect;
-        server->m_on_disconnect = on_disconnect;
-        server->m_user          = user;
-        server->m_conns         = g_allocate_array_and_clear<us_conn>(loop->m_allocator, US_SERVER_CONN_CAP);
-        server->m_conns_count   = 0;
-        server->m_conns_cap     = US_SERVER_CONN_CAP;
-        server->m_active        = 1;
+    void us_loop_wake(us_loop* loop)
+    {
+        // Only the first wake after a drain costs a syscall
+        if (__atomic_exchange_n(&loop->m_wake_pending, 1, __ATOMIC_SEQ_CST) == 0)
+            wake_signal(loop);
+    }
 
-        server->m_ip   = ip;
-        server->m_port = port;
-        server->m_type = type;
+    u64 us_loop_now(us_loop* loop) { return loop->m_now; }
+    u64 us_loop_time(us_loop* loop) { return loop->m_time; }
 
-        if (kq_add_read(loop->m_kq, fd, (void*)server) < 0)
-        {
-            i32 e = errno;
-            close(fd);
-            memset(server, 0, sizeof(*server));
-            loop->m_servers_count--;
-            errno = e;
-            return -1;
-        }
+    // ----------------------------------------------------------------------------------------------
+    // Timers, the loop owns the wheel, the caller owns the timer
+    // ----------------------------------------------------------------------------------------------
 
-        return server->m_server_id;
+    static void us_timer_fired(timer_node_t* node, void* user)
+    {
+        us_timer* timer = (us_timer*)user;
+        // Re-arm before the callback, so the callback can still stop (or restart) the timer
+        if (timer->m_interval_ms > 0)
+            timer_schedule(timer->m_loop->m_timers, node, node->m_expires + timer->m_interval_ms);
+        timer->m_cb(timer->m_loop, timer, timer->m_user);
     }
 
-    i32 us_server_close(us_loop* loop, i32 server_id)
+    us_timer* us_timer_create(us_loop* loop, us_timer_cb cb, void* user)
     {
-        if (!loop)
+        if (!loop || !cb)
         {
             errno = 22;
-            return -1;
+            return NULL;
         }
-        uint_t     idx    = 0;
-        us_server* server = find_server_by_id(loop, server_id, &idx);
-        if (!server)
+        us_timer* timer = g_allocate_and_clear<us_timer>(loop->m_allocator);
+        if (!timer)
+            return NULL;
+        timer_init(&timer->m_node, us_timer_fired, timer);
+        timer->m_loop = loop;
+        timer->m_cb   = cb;
+        timer->m_user = user;
+        return timer;
+    }
+
+    i32 us_timer_start(us_loop* loop, us_timer* timer, u32 delay_ms, u32 interval_ms)
+    {
+        if (!loop || !timer || timer->m_loop != loop)
         {
-            errno = 2;
+            errno = 22;
             return -1;
         }
+        timer->m_interval_ms = interval_ms;
+        timer_schedule(loop->m_timers, &timer->m_node, loop->m_now + delay_ms);
+        return 0;
+    }
+
+    void us_timer_stop(us_loop* loop, us_timer* timer)
+    {
+        if (loop && timer)
+            timer_cancel(loop->m_timers, &timer->m_node);
+    }
+
+    void us_timer_destroy(us_loop* loop, us_timer* timer)
+    {
+        if (!loop || !timer)
+            return;
+        timer_cancel(loop->m_timers, &timer->m_node);
+        g_deallocate(loop->m_allocator, timer);
+    }
+
+    // ----------------------------------------------------------------------------------------------
+    // Loop group, N loops that each run on their own thread. Every server created through the group
+    // gets a SO_REUSEPORT listener on every loop, so a connection lives (and is decoded) entirely on
+    // the thread of the loop that accepted it.
+    // Note: Only Linux balances SO_REUSEPORT TCP listeners, on macOS all connections end up on one loop.
+    // ----------------------------------------------------------------------------------------------
 
-        while (server->m_conns_count > 0)
+    struct us_loop_group
+    {
+        alloc_t*  m_allocator;
+        us_loop** m_loops;
+        pthread_t m_threads[US_GROUP_LOOP_CAP];
+        i32       m_count;
+        i32       m_running;  // Number of loop threads started
+    };
+
+    us_loop_group* us_loop_group_create(alloc_t* allocator, i32 n_loops, nengine::enum_t engine)
+    {
+        if (!allocator || n_loops <= 0 || n_loops > US_GROUP_LOOP_CAP)
         {
-            close_conn(loop, server, server->m_conns_count - 1);
+            errno = 22;
+            return NULL;
         }
-        if (server->m_conns)
+        us_loop_group* group = g_allocate_and_clear<us_loop_group>(allocator);
+        if (!group)
+            return NULL;
+        group->m_allocator = allocator;
+        group->m_loops     = g_allocate_array_and_clear<us_loop*>(allocator, n_loops);
+        for (i32 i = 0; i < n_loops; ++i)
         {
-            // us_dealloc(loop, server->m_conns);
-            g_deallocate_array(loop->m_allocator, server->m_conns);
-            server->m_conns = NULL;
+            us_loop* loop = us_loop_create(allocator, engine);
+            if (!loop)
+            {
+                us_loop_group_destroy(group);
+                return NULL;
+            }
+            loop->m_flags |= US_LOOP_FLAG_REUSEPORT;
+            loop->m_index = i;
+            group->m_loops[group->m_count++] = loop;
         }
+        return group;
+    }
 
-        if (server->m_listen_fd >= 0)
+    i32      us_loop_group_size(us_loop_group* group) { return group ? group->m_count : 0; }
+    us_loop* us_loop_group_get(us_loop_group* group, i32 index) { return (group && index >= 0 && index < group->m_count) ? group->m_loops[index] : NULL; }
+
+    i32 us_loop_group_server_create(us_loop_group* group, u8 type, u32 ip, u16 port, uint_t recv_buf_size, us_msg_cb on_msg, us_client_cb on_connect, us_client_cb on_disconnect, void* user)
+    {
+        if (!group || group->m_running)
         {
-            kq_del_read(loop->m_kq, server->m_listen_fd);
-            close(server->m_listen_fd);
+            errno = 22;
+            return -1;
         }
-
-        if (server->m_type == 0)  // UDP
+        server_id_t* servers = g_allocate_array_and_clear<server_id_t>(group->m_allocator, group->m_count);
+        if (!servers)
         {
-            // No additional cleanup needed for UDP
+            errno = 12;  // ENOMEM
+            return -1;
         }
-
-        uint_t last = loop->m_servers_count - 1;
-        memset(server, 0, sizeof(*server));
-        if (idx != last)
+        i32 result = 0;
+        for (i32 i = 0; i < group->m_count; ++i)
         {
-            loop->m_servers[idx] = loop->m_servers[last];
-            struct us_server* M  = &loop->m_servers[idx];
-            kq_del_read(loop->m_kq, M->m_listen_fd);
-            kq_add_read(loop->m_kq, M->m_listen_fd, (void*)M);
+            servers[i] = us_server_create(group->m_loops[i], type, ip, port, recv_buf_size, on_msg, on_connect, on_disconnect, user);
+            if (servers[i] == NULL)
+            {
+                // Close the listeners of the loops before this one, the group either listens on all loops or on none
+                const int err = errno;
+                while (--i >= 0)
+                    us_server_close(group->m_loops[i], servers[i]);
+                errno  = err;
+                result = -1;
+                break;
+            }
         }
-        memset(&loop->m_servers[last], 0, sizeof(struct us_server));
-        loop->m_servers_count--;
-        return 0;
+        g_deallocate_array(group->m_allocator, servers);
+        return result;
     }
 
-    void us_loop_destroy(struct us_loop* loop)
+    static void* loop_group_thread(void* arg)
     {
-        if (!loop)
-            return;
-
-        while (loop->m_servers_count > 0)
+        us_loop* loop = (us_loop*)arg;
+        while (__atomic_load_n(&loop->m_stop, __ATOMIC_ACQUIRE) == 0)
         {
-            struct us_server* server = &loop->m_servers[loop->m_servers_count - 1];
-            if (server->m_active)
-            {
-                us_server_close(loop, server->m_server_id);
-            }
-            else
-            {
-                loop->m_servers_count--;
-            }
+            if (us_loop_run(loop, loop->m_run_timeout_ms) < 0 && errno != EINTR)
+                break;
         }
+        return NULL;
+    }
 
-        if (loop->m_servers)
+    i32 us_loop_group_start(us_loop_group* group, i32 timeout_ms)
+    {
+        if (!group || group->m_running)
         {
-            g_deallocate_array(loop->m_allocator, loop->m_servers);
+            errno = 22;
+            return -1;
+        }
+        for (i32 i = 0; i < group->m_count; ++i)
+        {
+            us_loop* loop = group->m_loops[i];
+            __atomic_store_n(&loop->m_stop, 0, __ATOMIC_RELEASE);
+            loop->m_run_timeout_ms = timeout_ms;
+            if (pthread_create(&group->m_threads[i], NULL, loop_group_thread, loop) != 0)
+            {
+                group->m_running = i;
+                us_loop_group_stop(group);
+                return -1;
+            }
         }
+        group->m_running = group->m_count;
+        return 0;
+    }
 
-        if (loop->m_kq >= 0)
+    // The loops are woken up, a loop stops once it finished its current iteration
+    void us_loop_group_stop(us_loop_group* group)
+    {
+        if (!group)
+            return;
+        for (i32 i = 0; i < group->m_running; ++i)
         {
-            close(loop->m_kq);
+            __atomic_store_n(&group->m_loops[i]->m_stop, 1, __ATOMIC_RELEASE);
+            us_loop_wake(group->m_loops[i]);
         }
+        for (i32 i = 0; i < group->m_running; ++i)
+            pthread_join(group->m_threads[i], NULL);
+        group->m_running = 0;
+    }
 
-        g_deallocate(loop->m_allocator, loop);
+    void us_loop_group_destroy(us_loop_group* group)
+    {
+        if (!group)
+            return;
+        us_loop_group_stop(group);
+        for (i32 i = 0; i < group->m_count; ++i)
+            us_loop_destroy(group->m_loops[i]);
+        g_deallocate_array(group->m_allocator, group->m_loops);
+        g_deallocate(group->m_allocator, group);
     }
 
     i32 us_loop_run(struct us_loop* loop, i32 timeout_ms)
@@ -467,106 +2543,204 @@ namespace ncore
             errno = 22;
             return -1;
         }
+        s_current_loop = loop;
+        timeout_ms     = loop_wait_timeout(loop, timeout_ms);
 
-        struct kevent   evlist[US_MAX_KEVENT_BATCH];
-        struct timespec ts, *tsp = NULL;
-        if (timeout_ms >= 0)
-        {
-            ts.tv_sec  = timeout_ms / 1000;
-            ts.tv_nsec = (long)(timeout_ms % 1000) * 1000000L;
-            tsp        = &ts;
-        }
+#if defined(TARGET_LINUX)
+        if (loop->m_uring)
+            return uring_loop_run(loop, loop->m_uring, timeout_ms);
+#endif
 
-        i32 nev = kevent(loop->m_kq, NULL, 0, evlist, US_MAX_KEVENT_BATCH, tsp);
+        us_event evlist[US_MAX_EVENT_BATCH];
+        i32      nev = poll_wait(loop->m_poll_fd, evlist, US_MAX_EVENT_BATCH, timeout_ms);
         if (nev < 0)
         {
-            if (errno == 4)
+            if (errno == EINTR)
                 return 0;
             return -1;
         }
+        loop_update_time(loop);
+        if (nev > 0)
+            loop->m_stats.m_wakeups += 1;
 
         for (i32 i = 0; i < nev; ++i)
         {
-            struct kevent* ev    = &evlist[i];
-            void*          udata = ev->udata;
-            if (!udata)
-                continue;
-            i32* kindp = (i32*)udata;
-            i32  kind  = *kindp;
-            if (kind == US_KIND_SERVER)
+            us_event* ev    = &evlist[i];
+            const u64 token = ev->m_token;
+            if (token == US_WAKE_TOKEN)
+            {
+                loop_drain_posts(loop);
+            }
+            else if ((token >> 32) == 0)
             {
-                us_server* server = (us_server*)udata;
-                if (ev->filter == EVFILT_READ)
+                us_server* server = find_server_by_id(loop, (i32)token, NULL);
+                if (server && (ev->m_flags & US_EV_READ))
                 {
-                    accept_new_clients(loop, server);
+                    if (server->m_type == US_SERVER_UDP)
+                        read_datagrams(loop, server);
+                    else
+                        accept_new_clients(loop, server);
                 }
             }
-            else if (kind == US_KIND_CONN)
+            else
             {
-                us_conn*   connection = (us_conn*)udata;
-                us_server* server     = connection->m_server;
-                i32        need_close = 0;
-                if ((ev->flags & EV_EOF) != 0)
+                // A connection closed earlier in this batch (its slot possibly reused) no longer resolves
+                us_conn* connection = conn_lookup(loop, token);
+                if (!connection)
+                    continue;
+                i32 need_close = 0;
+
+                if (connection->m_shm)
                 {
-                    need_close = 1;
+                    // The ring is drained before a hang up of the producer is acted upon
+                    if (service_shm_conn(loop, connection) < 0 || (ev->m_flags & (US_EV_EOF | US_EV_ERROR)))
+                    {
+                        if (conn_lookup(loop, token) == connection)
+                            close_conn(loop, connection);
+                    }
+                    continue;
                 }
-                else if (ev->filter == EVFILT_READ)
+
+                // Drain whatever is readable first, a peer may send its last message together with the FIN
+                if (ev->m_flags & US_EV_READ)
                 {
                     if (read_from_client(loop, connection) < 0)
                         need_close = 1;
                 }
-                if (need_close)
+                if ((ev->m_flags & US_EV_WRITE) && !need_close && conn_lookup(loop, token) == connection)
                 {
-                    uint_t connection_idx = (uint_t)-1;
-                    for (uint_t k = 0; k < server->m_conns_count; ++k)
-                    {
-                        if (&server->m_conns[k] == connection)
-                        {
-                            connection_idx = k;
-                            break;
-                        }
-                    }
-                    if (connection_idx != (uint_t)-1)
-                    {
-                        close_conn(loop, server, connection_idx);
-                    }
-                    else
-                    {
-                        kq_del_read(loop->m_kq, connection->m_fd);
-                        close(connection->m_fd);
-                        if (connection->m_buf)
-                        {
-                            g_deallocate_array(loop->m_allocator, connection->m_buf);
-                        }
-                    }
+                    if (flush_conn(loop, connection) < 0)
+                        need_close = 1;
+                }
+                if (ev->m_flags & (US_EV_EOF | US_EV_ERROR))
+                {
+                    need_close = 1;
+                }
+                if (need_close && conn_lookup(loop, token) == connection)
+                {
+                    close_conn(loop, connection);
                 }
-            }
-            else
-            {
-                // ignore
             }
         }
+
+        loop_run_timers(loop);
         return 0;
     }
 
-    ssize_t us_client_send(i32 client_fd, const void* data, uint_t len)
+    // A datagram to a UDP peer is sent from the socket of the server it was received on, so it
+    // arrives from the address the peer sent to.
+    static int_t send_to_peer(us_loop* loop, client_id_t client_id, const u8* data, uint_t len)
     {
-        if (client_fd < 0 || !data)
+        us_server* server = peer_server(loop, client_id);
+        if (!server || !data)
         {
             errno = 22;
             return -1;
         }
+        sockaddr_in addr;
+        peer_address(client_id, addr);
         for (;;)
         {
-            ssize_t n = send(client_fd, data, len, 0);
+            ssize_t n = sendto(server->m_listen_fd, data, len, US_SEND_FLAGS, (sockaddr*)&addr, sizeof(addr));
             if (n >= 0)
                 return n;
-            if (errno == 4)
-                continue; /* EINTR */
-            if (errno == 35 /* EAGAIN */ || errno == 35 /* EWOULDBLOCK alias */)
-                return 0;
+            if (errno == EINTR)
+                continue;
+            if (errno == EWOULDBLOCK)
+                errno = EAGAIN;  // The send buffer is full, the datagram is not sent
+            return -1;
+        }
+    }
+
+    int_t us_client_send(us_loop* loop, client_id_t client_id, const u8* data, uint_t len)
+    {
+        if (loop && is_peer_handle(client_id))
+            return send_to_peer(loop, client_id, data, len);
+        us_conn* connection = loop ? conn_lookup(loop, from_client_handle(client_id)) : NULL;
+        if (!connection || connection->m_fd < 0 || !data)
+        {
+            errno = 22;
+            return -1;
+        }
+        if (connection->m_shm)
+        {
+            errno = 95;  // EOPNOTSUPP, a shared memory link only carries data from the producer to the server
+            return -1;
+        }
+
+        // Only send directly when nothing is queued, otherwise the data would overtake the queue
+        uint_t sent = 0;
+        while (connection->m_out_bytes == 0 && sent < len)
+        {
+            ssize_t n = send(connection->m_fd, data + sent, len - sent, US_SEND_FLAGS);
+            if (n >= 0)
+            {
+                loop->m_stats.m_bytes_sent += (u64)n;
+                sent += (uint_t)n;
+                continue;
+            }
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            return -1;  // The read side will notice the broken connection and close it
+        }
+        if (sent == len)
+            return (int_t)len;
+
+        if (out_append(loop, connection, data + sent, (u32)(len - sent)) < 0)
+            return -1;
+        if (loop_watch_write(loop, connection, true) < 0)
+            return -1;
+        out_check_pressure(connection);
+        return (int_t)len;
+    }
+
+    i32 us_server_set_pressure(us_loop* loop, server_id_t server_id, uint_t low_watermark, uint_t high_watermark, us_pressure_cb on_pressure)
+    {
+        us_server* server = loop ? find_server_by_id(loop, from_server_handle(server_id), NULL) : NULL;
+        if (!server || low_watermark >= high_watermark)
+        {
+            errno = 22;
+            return -1;
+        }
+        server->m_low_watermark  = (u32)low_watermark;
+        server->m_high_watermark = (u32)high_watermark;
+        server->m_on_pressure    = on_pressure;
+        return 0;
+    }
+
+    i32 us_server_set_idle_timeout(us_loop* loop, server_id_t server_id, u32 timeout_ms)
+    {
+        us_server* server = loop ? find_server_by_id(loop, from_server_handle(server_id), NULL) : NULL;
+        if (!server || server->m_type == US_SERVER_UDP)
+        {
+            errno = 22;
             return -1;
         }
+        server->m_idle_timeout_ms = timeout_ms;
+
+        // Connections that are already open get the new timeout as well, counted from now
+        for (u32 p = 0; p < loop->m_conn_pages_count; ++p)
+        {
+            us_conn* page = loop->m_conn_pages[p];
+            for (u32 i = 0; i < US_CONN_PAGE_SIZE; ++i)
+            {
+                us_conn* connection = &page[i];
+                if (connection->m_kind != US_KIND_CONN || connection->m_server != server)
+                    continue;
+                if (timeout_ms == 0)
+                {
+                    timer_cancel(loop->m_timers, &connection->m_idle_timer);
+                }
+                else
+                {
+                    connection->m_last_active = loop->m_now;
+                    timer_schedule(loop->m_timers, &connection->m_idle_timer, loop->m_now + timeout_ms);
+                }
+            }
+        }
+        return 0;
     }
 
     // This is a UDP broadcast, it sends the given data on the network.
@@ -575,7 +2749,7 @@ namespace ncore
     //          address would be 192.168.1.255.
     //          us_broadcast(loop, inet_addr("192.168.1.255"), port, data, len);
     // port is the UDP port to send the broadcast to, e.g. 31337
-    i32 us_broadcast(struct us_loop* loop, u32 ip, u16 port, const void* data, uint_t len)
+    i32 us_broadcast(struct us_loop* loop, u32 ip, u16 port, const u8* data, uint_t len)
     {
         if (!loop || !data)
         {
@@ -600,7 +2774,7 @@ namespace ncore
         addr.sin_family = AF_INET;
         addr.sin_addr.s_addr = htonl(ip);
         addr.sin_port = htons(port);
-        ssize_t n = sendto(fd, data, len, 0, (sockaddr*)&addr, sizeof(addr));
+        ssize_t n = sendto(fd, data, len, US_SEND_FLAGS, (sockaddr*)&addr, sizeof(addr));
         i32     e = errno;
         close(fd);
         if (n < 0)        {
@@ -611,29 +2785,59 @@ namespace ncore
         return n >= 0 ? 0 : -1;
     }
 
-    i32 us_client_close(us_loop* loop, i32 server_id, i32 client_fd)
+    i32 us_client_close(us_loop* loop, client_id_t client_id)
     {
         if (!loop)
         {
             errno = 22;
             return -1;
         }
-        us_server* server = find_server_by_id(loop, server_id, NULL);
-        if (!server)
+        if (is_peer_handle(client_id))
+            return 0;  // UDP peers have nothing to close
+        us_conn* connection = conn_lookup(loop, from_client_handle(client_id));
+        if (!connection)
         {
-            errno = 2;
+            errno = 2;  // Already closed
+            return -1;
+        }
+        close_conn(loop, connection);
+        return 0;
+    }
+
+    i32 us_client_address(us_loop* loop, client_id_t client_id, u32& out_ip, u16& out_port)
+    {
+        if (!loop)
+        {
+            errno = 22;
             return -1;
         }
-        for (uint_t i = 0; i < server->m_conns_count; ++i)
+        sockaddr_in addr;
+        if (is_peer_handle(client_id))
+        {
+            peer_address(client_id, addr);
+        }
+        else
         {
-            if (server->m_conns[i].m_fd == client_fd)
+            us_conn* connection = conn_lookup(loop, from_client_handle(client_id));
+            if (!connection)
+            {
+                errno = 2;
+                return -1;
+            }
+            if (connection->m_shm)
             {
-                close_conn(loop, server, i);
+                // A local producer process, it has no address of its own
+                out_ip   = 0x7F000001;
+                out_port = 0;
                 return 0;
             }
+            socklen_t alen = sizeof(addr);
+            if (getpeername(connection->m_fd, (sockaddr*)&addr, &alen) < 0)
+                return -1;
         }
-        errno = 2;
-        return -1;
+        out_ip   = ntohl(addr.sin_addr.s_addr);
+        out_port = ntohs(addr.sin_port);
+        return 0;
     }
 
 }  // namespace ncore
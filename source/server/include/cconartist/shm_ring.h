@@ -0,0 +1,72 @@
+#ifndef __CCONARTIST_SHM_RING_H__
+#define __CCONARTIST_SHM_RING_H__
+#include "ccore/c_target.h"
+#ifdef USE_PRAGMA_ONCE
+#    pragma once
+#endif
+
+namespace ncore
+{
+    class alloc_t;
+
+    // Shared memory ring between one local producer process and a us_loop (single producer, single
+    // consumer). The producer connects to the Unix socket of a shm server (us_shm_server_create) and
+    // receives a memfd with the ring and an eventfd doorbell through SCM_RIGHTS.
+    //
+    // Ring memory: [shm_ring_header_t][pad to US_SHM_DATA_OFFSET][data, m_capacity bytes]
+    // A record is [u32 size][size bytes], records start on an 8 byte boundary. A record never wraps,
+    // when it does not fit before the end of the data the producer writes US_SHM_WRAP and continues at
+    // the start. A record holds one or more framed messages, exactly as they are sent over TCP.
+    //
+    // The doorbell is only rung when the consumer has announced (m_consumer_waiting) that it ran out of
+    // records, so a busy ring costs no syscalls at all.
+
+#define US_SHM_MAGIC       0x5553484D  // "USHM"
+#define US_SHM_VERSION     1
+#define US_SHM_DATA_OFFSET 4096
+#define US_SHM_WRAP        0xFFFFFFFF
+
+    struct shm_ring_header_t
+    {
+        u32 m_magic;
+        u32 m_version;
+        u32 m_capacity;  // Size of the data area in bytes, power of 2
+        u32 m_reserved;
+        u8  m_pad0[48];
+        u64 m_head;  // Consumer position, only written by the consumer
+        u8  m_pad1[56];
+        u64 m_tail;  // Producer position, only written by the producer
+        u8  m_pad2[56];
+        u32 m_consumer_waiting;  // Non-zero when the consumer waits for the doorbell
+        u8  m_pad3[60];
+    };
+
+    // Process local view of a ring, the positions are kept here so the other side can not corrupt them
+    struct shm_ring_t
+    {
+        shm_ring_header_t* m_header;
+        byte*              m_data;
+        u32                m_capacity;
+        u32                m_size;  // Size of the record returned by the last peek or reserve
+        u64                m_pos;   // Consumer: head, producer: tail
+    };
+
+    void shm_ring_init(void* memory, u32 capacity);  // Format a fresh ring, memory is US_SHM_DATA_OFFSET + capacity bytes
+    bool shm_ring_attach(shm_ring_t& ring, void* memory, u32 capacity);
+
+    // Consumer side (server)
+    i32  shm_ring_peek(shm_ring_t& ring, const byte*& out_data, u32& out_size);  // 1 = record, 0 = empty, -1 = corrupt
+    void shm_ring_pop(shm_ring_t& ring);                                         // Release the record returned by shm_ring_peek
+    bool shm_ring_wait(shm_ring_t& ring);                                        // Announce that the consumer sleeps, false when records arrived meanwhile
+
+    // Producer side (local helper process)
+    struct us_shm_producer;
+    us_shm_producer* us_shm_connect(alloc_t* allocator, const char* socket_path);
+    void             us_shm_disconnect(us_shm_producer* producer);
+    u8*              us_shm_reserve(us_shm_producer* producer, u32 size);  // Room for a record of 'size' bytes, NULL when the ring is full
+    void             us_shm_commit(us_shm_producer* producer);             // Publish the reserved record
+    bool             us_shm_write(us_shm_producer* producer, const u8* data, u32 size);
+
+}  // namespace ncore
+
+#endif  // __CCONARTIST_SHM_RING_H__
@@ -11,26 +11,115 @@ namespace ncore
 
     struct us_loop;
     struct us_server;
+    struct us_loop_group;
 
     typedef void* server_id_t;
-    typedef void* client_id_t;
+    typedef void* client_id_t;  // Generation tagged handle, stays invalid once the client is closed (never reused)
 
-    // Message callback: data is ephemeral, not owned by the callback
+    // Message callback: data is ephemeral, not owned by the callback.
+    // TCP: data is one framed message of a connection.
+    // UDP: data is one datagram, the client id identifies the sender (address and port) and can be
+    //      used to reply with us_client_send as long as the server is open.
     typedef void (*us_msg_cb)(client_id_t client_id, const u8* data, uint_t len, void* user);
     typedef void (*us_client_cb)(client_id_t client_id, void* user);
 
+    // Outbound queue of a client crossed the high watermark (congested = true) or drained back to the
+    // low watermark (congested = false)
+    typedef void (*us_pressure_cb)(client_id_t client_id, bool congested, void* user);
+
+    struct us_timer;
+    typedef void (*us_timer_cb)(us_loop* loop, us_timer* timer, void* user);
+    typedef void (*us_post_fn)(us_loop* loop, void* data);
+
+    // Event engine used by a loop
+    namespace nengine
+    {
+        typedef u8 enum_t;
+        enum
+        {
+            Poll    = 0,  // Readiness based, epoll on Linux and kqueue on macOS/BSD
+            IoUring = 1,  // Linux io_uring (multishot accept/recv), falls back to Poll when the kernel lacks support
+        };
+    }  // namespace nengine
+
+    // Per loop counters, these are only written by the thread that runs the loop
+    struct us_loop_stats_t
+    {
+        u64 m_accepted;    // Connections accepted
+        u64 m_closed;      // Connections closed
+        u64 m_messages;    // Messages dispatched to us_msg_cb
+        u64 m_bytes;       // Bytes dispatched to us_msg_cb
+        u64 m_bytes_sent;  // Bytes written to client sockets
+        u64 m_wakeups;     // Number of times the loop woke up with work to do
+        u64 m_timeouts;    // Connections closed by their idle timeout
+    };
+
     // Loop creation, run & destroy
-    us_loop* us_loop_create(alloc_t* allocator);
-    i32      us_loop_run(us_loop* loop, i32 timeout_ms);
-    void     us_loop_destroy(us_loop* loop);
+    us_loop*        us_loop_create(alloc_t* allocator, nengine::enum_t engine = nengine::Poll);
+    i32             us_loop_run(us_loop* loop, i32 timeout_ms);
+    void            us_loop_destroy(us_loop* loop);
+    nengine::enum_t us_loop_engine(us_loop* loop);  // The engine that is actually in use
+    i32             us_loop_index(us_loop* loop);   // Index of the loop in its group
+    void            us_loop_stats(us_loop* loop, us_loop_stats_t& out_stats);
+    us_loop*        us_loop_current();              // The loop running on the calling thread, use this in callbacks
+
+    // Cross-thread, callable from any thread. fn(loop, data) runs on the thread of the loop, posts from
+    // one thread run in the order they were made. Returns -1 (EAGAIN) when the loop is 4096 posts behind.
+    // Example: finish the work of a job_manager_t worker on the loop
+    //          push_job(jm, channel, create_stream_file, request);
+    //          set_channel_notify(jm, channel, on_job_done, loop);  // on_job_done posts a function that calls pop_job
+    i32  us_loop_post(us_loop* loop, us_post_fn fn, void* data);
+    void us_loop_wake(us_loop* loop);  // Interrupt the poll of the loop, e.g. after setting a flag it checks
 
-    // Create & manage server (UDP or TCP)
+    // Time as sampled by the loop once per iteration, use these instead of time() in callbacks
+    u64 us_loop_now(us_loop* loop);   // Monotonic, in ms
+    u64 us_loop_time(us_loop* loop);  // Wall clock (Unix epoch), in ms
+
+    // Timers with a resolution of 1 ms, driven by us_loop_run (a timer shortens the poll timeout).
+    // interval_ms = 0 is a one-shot timer. A timer belongs to one loop and is destroyed by the caller,
+    // before the loop is destroyed.
+    // Example: drive the stream manager once per second
+    //          us_timer* t = us_timer_create(loop, on_update, manager);
+    //          us_timer_start(loop, t, 1000, 1000);
+    //          static void on_update(us_loop* loop, us_timer* t, void* user) { stream_manager_update((stream_manager_t*)user, (f64)us_loop_time(loop) / 1000.0); }
+    us_timer* us_timer_create(us_loop* loop, us_timer_cb cb, void* user);
+    i32       us_timer_start(us_loop* loop, us_timer* timer, u32 delay_ms, u32 interval_ms);
+    void      us_timer_stop(us_loop* loop, us_timer* timer);
+    void      us_timer_destroy(us_loop* loop, us_timer* timer);
+
+    // Loop group, 'n_loops' loops that each run on their own thread with SO_REUSEPORT listeners.
+    // Callbacks for a client are always invoked on the thread of the loop that owns it, the allocator
+    // must be thread-safe since every loop allocates from it.
+    // us_loop_group_server_create listens on every loop of the group, on failure it closes the listeners it already
+    // created and returns -1.
+    us_loop_group* us_loop_group_create(alloc_t* allocator, i32 n_loops, nengine::enum_t engine = nengine::Poll);
+    i32            us_loop_group_server_create(us_loop_group* group, u8 type, u32 ip, u16 port, uint_t recv_buf_size, us_msg_cb on_msg, us_client_cb on_connect, us_client_cb on_disconnect, void* user);
+    i32            us_loop_group_start(us_loop_group* group, i32 timeout_ms);
+    void           us_loop_group_stop(us_loop_group* group);
+    void           us_loop_group_destroy(us_loop_group* group);
+    i32            us_loop_group_size(us_loop_group* group);
+    us_loop*       us_loop_group_get(us_loop_group* group, i32 index);
+
+    // Create & manage server (type 0 = UDP, 1 = TCP), for UDP recv_buf_size is the largest datagram (<= 65535)
     server_id_t us_server_create(us_loop* loop, u8 type, u32 ip, u16 port, uint_t recv_buf_size, us_msg_cb on_msg, us_client_cb on_connect, us_client_cb on_disconnect, void* user);
     i32         us_server_close(us_loop* loop, server_id_t server_id);
+    i32         us_server_set_pressure(us_loop* loop, server_id_t server_id, uint_t low_watermark, uint_t high_watermark, us_pressure_cb on_pressure);  // Defaults: 64 KiB / 256 KiB
+    i32         us_server_set_idle_timeout(us_loop* loop, server_id_t server_id, u32 timeout_ms);  // Close clients that sent nothing for timeout_ms, 0 = never (default)
+
+    // Shared memory server for local producer processes (Linux), see shm_ring.h. Every producer that
+    // connects to the Unix socket at socket_path gets its own ring of ring_size bytes (rounded up to a
+    // power of 2, at least 64 KiB), its messages are dispatched straight from the ring to on_msg.
+    server_id_t us_shm_server_create(us_loop* loop, const char* socket_path, uint_t ring_size, us_msg_cb on_msg, us_client_cb on_connect, us_client_cb on_disconnect, void* user);
 
-    // Create & manage clients
-    int_t us_client_send(client_id_t client_id, const u8* data, uint_t len);
+    // Create & manage clients, a client handle is only valid on the loop that owns the client.
+    // The handle passed to on_disconnect is already closed, it can be used to find user state only.
+    // us_client_send never drops TCP data, whatever the socket does not take right away is queued and
+    // sent when the socket becomes writable. Returns len, or -1 on error. Stop sending to a client
+    // that is reported as congested, the queue is not bounded. Queued data is discarded on close.
+    // A UDP datagram is sent right away or not at all, -1 (EAGAIN) when the send buffer of the server is full.
+    int_t us_client_send(us_loop* loop, client_id_t client_id, const u8* data, uint_t len);
     i32   us_client_close(us_loop* loop, client_id_t client_id);
+    i32   us_client_address(us_loop* loop, client_id_t client_id, u32& out_ip, u16& out_port);  // Host byte order
 
     // UDP broadcast, returns 0 on success, -1 on failure (if no clients or error)
     i32 us_broadcast(us_loop* loop, u32 ip, u16 port, const u8* data, uint_t len);
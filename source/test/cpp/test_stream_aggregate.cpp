@@ -0,0 +1,139 @@
+#include "ccore/c_target.h"
+#include "ccore/c_allocator.h"
+
+#include "cconartist/stream_aggregate.h"
+#include "cconartist/user_types.h"
+
+#include "cunittest/cunittest.h"
+
+#include <string.h>
+
+using namespace ncore;
+
+static u32 s_random = 4321;
+static u32 next_random()
+{
+    s_random = s_random * 1103515245 + 12345;
+    return s_random >> 8;
+}
+
+// The vector kernels against the scalar strided path on the same values, for every length up to a
+// few vectors (all the tails) and at an unaligned start
+template <typename T>
+static bool same_as_strided(u8 value_type, const T *values, u32 count)
+{
+    for (u32 n = 0; n <= count; n += (n < 80) ? 1 : 97)
+    {
+        for (u32 skip = 0; skip < 2 && skip < n; ++skip)
+        {
+            stream_stats_t simd, scalar;
+            stream_stats_init(simd);
+            stream_stats_init(scalar);
+            if (!stream_aggregate_values(value_type, values + skip, n - skip, simd))
+                return false;
+            if (!stream_aggregate_strided(value_type, (const u8 *)(values + skip), sizeof(T), n - skip, scalar))
+                return false;
+            if (simd.m_count != scalar.m_count || simd.m_min != scalar.m_min || simd.m_max != scalar.m_max)
+                return false;
+            const f64 diff = simd.m_sum - scalar.m_sum;
+            const f64 size = scalar.m_sum < 0 ? -scalar.m_sum : scalar.m_sum;
+            if (diff > size * 1e-9 || -diff > size * 1e-9)
+                return false;
+        }
+    }
+    return true;
+}
+
+static const u32 c_count = 3000;
+
+UNITTEST_SUITE_BEGIN(stream_aggregate)
+{
+    UNITTEST_FIXTURE(kernels)
+    {
+        UNITTEST_FIXTURE_SETUP() {}
+        UNITTEST_FIXTURE_TEARDOWN() {}
+
+        UNITTEST_TEST(integers)
+        {
+            u8  v8[c_count];
+            u16 v16[c_count];
+            s16 vs16[c_count];
+            u32 v32[c_count];
+            s32 vs32[c_count];
+            for (u32 i = 0; i < c_count; ++i)
+            {
+                v8[i]   = (u8)next_random();
+                v16[i]  = (u16)next_random();
+                vs16[i] = (s16)next_random();
+                v32[i]  = (u32)next_random() << 8 | (next_random() & 0xFF);
+                vs32[i] = (s32)v32[i];
+            }
+            CHECK_TRUE(same_as_strided(nvalue::TypeU8, v8, c_count));
+            CHECK_TRUE(same_as_strided(nvalue::TypeU16, v16, c_count));
+            CHECK_TRUE(same_as_strided(nvalue::TypeS16, vs16, c_count));
+            CHECK_TRUE(same_as_strided(nvalue::TypeU32, v32, c_count));
+            CHECK_TRUE(same_as_strided(nvalue::TypeS32, vs32, c_count));
+        }
+
+        UNITTEST_TEST(floats)
+        {
+            f32 v32[c_count];
+            f64 v64[c_count];
+            for (u32 i = 0; i < c_count; ++i)
+            {
+                v32[i] = (float)((i32)(next_random() % 20000) - 10000) * 0.01f;
+                v64[i] = (double)next_random() * -0.125;
+            }
+            CHECK_TRUE(same_as_strided(nvalue::TypeF32, v32, c_count));
+            CHECK_TRUE(same_as_strided(nvalue::TypeF64, v64, c_count));
+        }
+
+        UNITTEST_TEST(extremes)
+        {
+            // Values at the ends of their range, the sums must not wrap
+            static u8  v8[70000];
+            static u16 v16[70000];
+            static s16 vs16[70000];
+            for (u32 i = 0; i < 70000; ++i)
+            {
+                v8[i]   = 0xFF;
+                v16[i]  = 0xFFFF;
+                vs16[i] = (i & 1) ? 32767 : -32768;
+            }
+            stream_stats_t stats;
+            stream_stats_init(stats);
+            CHECK_TRUE(stream_aggregate_values(nvalue::TypeU8, v8, 70000, stats));
+            CHECK_EQUAL(70000 * 255.0, stats.m_sum);
+            stream_stats_init(stats);
+            CHECK_TRUE(stream_aggregate_values(nvalue::TypeU16, v16, 70000, stats));
+            CHECK_EQUAL(70000 * 65535.0, stats.m_sum);
+            stream_stats_init(stats);
+            CHECK_TRUE(stream_aggregate_values(nvalue::TypeS16, vs16, 70000, stats));
+            CHECK_EQUAL(-35000.0, stats.m_sum);
+            CHECK_EQUAL(-32768.0, stats.m_min);
+            CHECK_EQUAL(32767.0, stats.m_max);
+        }
+
+        UNITTEST_TEST(accumulate)
+        {
+            // Pieces give the same result as the whole, the mean is filled in by finish
+            u16 values[100];
+            for (u32 i = 0; i < 100; ++i)
+                values[i] = (u16)(i + 1);
+            stream_stats_t stats;
+            stream_stats_init(stats);
+            CHECK_TRUE(stream_aggregate_values(nvalue::TypeU16, values + 40, 60, stats));
+            CHECK_TRUE(stream_aggregate_values(nvalue::TypeU16, values, 40, stats));
+            CHECK_TRUE(stream_aggregate_values(nvalue::TypeU16, values, 0, stats));
+            stream_stats_finish(stats);
+            CHECK_EQUAL(100, (u32)stats.m_count);
+            CHECK_EQUAL(1.0, stats.m_min);
+            CHECK_EQUAL(100.0, stats.m_max);
+            CHECK_EQUAL(5050.0, stats.m_sum);
+            CHECK_EQUAL(50.5, stats.m_mean);
+
+            CHECK_FALSE(stream_aggregate_values(nvalue::TypeString, values, 10, stats));
+        }
+    }
+}
+UNITTEST_SUITE_END
@@ -0,0 +1,94 @@
+#include "ccore/c_target.h"
+#include "ccore/c_allocator.h"
+
+#include "cconartist/stream_codec.h"
+
+#include "cunittest/cunittest.h"
+
+#include <string.h>
+
+using namespace ncore;
+
+static u32 s_random = 12345;
+static u32 next_random()
+{
+    s_random = s_random * 1103515245 + 12345;
+    return s_random >> 8;
+}
+
+static bool round_trip(const u64 *times, const u8 *values, u32 count, u32 value_size, bool is_float, u32 &out_size)
+{
+    static u8  encoded[32 * 1024];
+    static u64 decoded_times[c_stream_codec_block_items];
+    static u8  decoded_values[c_stream_codec_block_items * 8];
+
+    if (stream_codec_bound(count, value_size) > sizeof(encoded))
+        return false;
+    out_size = stream_codec_encode(encoded, times, values, count, value_size, is_float);
+    if (!stream_codec_decode(encoded, out_size, decoded_times, decoded_values, count, value_size, is_float))
+        return false;
+    return memcmp(times, decoded_times, count * sizeof(u64)) == 0 && memcmp(values, decoded_values, count * value_size) == 0;
+}
+
+UNITTEST_SUITE_BEGIN(stream_codec)
+{
+    UNITTEST_FIXTURE(basic)
+    {
+        UNITTEST_FIXTURE_SETUP() {}
+        UNITTEST_FIXTURE_TEARDOWN() {}
+
+        UNITTEST_TEST(temperature)
+        {
+            // A reading every second with a few ms of jitter, a slowly changing value
+            u64 times[c_stream_codec_block_items];
+            f32 values[c_stream_codec_block_items];
+            f32 value = 21.5f;
+            for (u32 i = 0; i < c_stream_codec_block_items; ++i)
+            {
+                times[i] = (u64)i * 1000 + (next_random() % 5);
+                if ((next_random() % 16) == 0)
+                    value += ((next_random() & 1) != 0) ? 0.1f : -0.1f;
+                values[i] = value;
+            }
+            u32 size = 0;
+            CHECK_TRUE(round_trip(times, (const u8 *)values, c_stream_codec_block_items, sizeof(f32), true, size));
+            CHECK_TRUE(size * 5 <= c_stream_codec_block_items * (5 + sizeof(f32)));
+        }
+
+        UNITTEST_TEST(switch_u8)
+        {
+            u64 times[c_stream_codec_block_items];
+            u8  values[c_stream_codec_block_items];
+            for (u32 i = 0; i < c_stream_codec_block_items; ++i)
+            {
+                times[i]  = 5000 + (u64)i * 250;
+                values[i] = (u8)((i / 100) & 1);
+            }
+            u32 size = 0;
+            CHECK_TRUE(round_trip(times, values, c_stream_codec_block_items, sizeof(u8), false, size));
+            CHECK_TRUE(size * 5 <= c_stream_codec_block_items * (5 + sizeof(u8)));
+        }
+
+        UNITTEST_TEST(random_values)
+        {
+            // Nothing to gain, but every value and time must survive
+            u64 times[c_stream_codec_block_items];
+            u64 values[c_stream_codec_block_items];
+            u64 time = 0;
+            for (u32 i = 0; i < c_stream_codec_block_items; ++i)
+            {
+                time += next_random() % 100000;
+                times[i]  = time;
+                values[i] = ((u64)next_random() << 40) ^ ((u64)next_random() << 20) ^ next_random();
+            }
+            u32 size = 0;
+            for (u32 value_size = 1; value_size <= 8; value_size <<= 1)
+            {
+                CHECK_TRUE(round_trip(times, (const u8 *)values, c_stream_codec_block_items, value_size, false, size));
+                CHECK_TRUE(round_trip(times, (const u8 *)values, c_stream_codec_block_items, value_size, true, size));
+            }
+            CHECK_TRUE(round_trip(times, (const u8 *)values, 1, 8, true, size));
+        }
+    }
+}
+UNITTEST_SUITE_END
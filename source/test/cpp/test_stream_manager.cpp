@@ -0,0 +1,353 @@
+#include "ccore/c_target.h"
+#include "ccore/c_allocator.h"
+
+#include "cconartist/job_manager.h"
+#include "cconartist/stream_manager.h"
+#include "cconartist/stream_request.h"
+#include "cconartist/user_types.h"
+
+#include "cunittest/cunittest.h"
+#include "test_temp_dir.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+using namespace ncore;
+
+// Keeps the only worker of the job manager busy, the jobs that are pushed after it stay in flight
+static s32  s_hold_worker = 0;
+static void hold_worker_fn(void *job_data0, void *job_data1)
+{
+    CC_UNUSED(job_data1);
+    s32 *hold = (s32 *)job_data0;
+    while (__atomic_load_n(hold, __ATOMIC_ACQUIRE) != 0)
+        usleep(1000);
+}
+
+// Counts the jobs that completed on any channel of a job manager, the tests wait on it for the flush, archive and
+// mappings jobs instead of sleeping
+struct jobs_done_t
+{
+    pthread_mutex_t m_mutex;
+    pthread_cond_t  m_cond;
+    u32             m_count;
+};
+static jobs_done_t s_jobs_done = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0};
+
+static void jobs_done_fn(job_channel_t channel, void *user)
+{
+    CC_UNUSED(channel);
+    jobs_done_t *done = (jobs_done_t *)user;
+    pthread_mutex_lock(&done->m_mutex);
+    done->m_count += 1;
+    pthread_cond_broadcast(&done->m_cond);
+    pthread_mutex_unlock(&done->m_mutex);
+}
+
+// The hook goes on every channel, also the ones the stream and request managers have yet to create
+static void jobs_done_hook(job_manager_t *jobs, i32 max_channels)
+{
+    for (job_channel_t channel = 0; channel < max_channels; channel++)
+        set_channel_notify(jobs, channel, jobs_done_fn, &s_jobs_done);
+}
+
+static u32 jobs_done_count()
+{
+    pthread_mutex_lock(&s_jobs_done.m_mutex);
+    const u32 count = s_jobs_done.m_count;
+    pthread_mutex_unlock(&s_jobs_done.m_mutex);
+    return count;
+}
+
+// Waits until a job completed after 'seen' was read, false after 'timeout_ms' without one
+static bool jobs_done_wait(u32 seen, u32 timeout_ms)
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000)
+    {
+        deadline.tv_sec += 1;
+        deadline.tv_nsec -= 1000000000;
+    }
+    pthread_mutex_lock(&s_jobs_done.m_mutex);
+    i32 result = 0;
+    while (s_jobs_done.m_count == seen && result == 0)
+        result = pthread_cond_timedwait(&s_jobs_done.m_cond, &s_jobs_done.m_mutex, &deadline);
+    const bool completed = s_jobs_done.m_count != seen;
+    pthread_mutex_unlock(&s_jobs_done.m_mutex);
+    return completed;
+}
+
+// Updates until 'done' holds, between updates it waits for the next job to complete, false if no job completed
+// for a few seconds while 'done' did not hold yet
+template <typename T>
+static bool update_until(stream_manager_t *m, f64 now, T done)
+{
+    for (;;)
+    {
+        const u32 seen = jobs_done_count();
+        stream_manager_update(m, now);
+        if (done())
+            return true;
+        if (!jobs_done_wait(seen, 5000))
+            return done();
+    }
+}
+
+// The archive of the first file of a stream, in the directory of the month (UTC) of its first item
+static void archive_path(char *path, u32 path_size, const char *base_path, const char *name, u64 time_begin)
+{
+    const time_t begin = (time_t)(time_begin / 1000);
+    struct tm    date;
+    gmtime_r(&begin, &date);
+    snprintf(path, path_size, "%s/%04d%02d/%s_0000.rostream", base_path, date.tm_year + 1900, date.tm_mon + 1, name);
+}
+
+static u32 write_items(stream_manager_t *m, stream_id_t id, u64 t0, u32 first, u32 count)
+{
+    u32 written = 0;
+    for (u32 i = first; i < first + count; i++)
+        written += stream_write_u32(m, id, t0 + i, i) ? 1 : 0;
+    return written;
+}
+
+// Every item reads back in order, item i has time t0 + i and value i
+static bool check_items(stream_manager_t *m, stream_id_t id, u64 t0, u32 count)
+{
+    stream_iterator_t it;
+    if (!stream_iterator_begin(m, id, it))
+        return false;
+    u64       time;
+    u8 const *data;
+    u32       size;
+    u32       n = 0;
+    while (stream_iterator_next(m, it, time, data, size))
+    {
+        u32 value;
+        memcpy(&value, data, sizeof(value));
+        if (value != n || time != t0 + n)
+            break;
+        n++;
+    }
+    stream_iterator_end(m, it);
+    return n == count;
+}
+
+// stream_aggregate on the items with a time in [time_begin, time_end] against count, min, max and sum computed
+// from the values that the iterator returns
+static bool aggregate_matches_iterator(stream_manager_t *m, stream_id_t id, u64 time_begin, u64 time_end)
+{
+    stream_stats_t stats;
+    if (!stream_aggregate(m, id, time_begin, time_end, stats))
+        return false;
+
+    stream_iterator_t it;
+    if (!stream_iterator_begin(m, id, it))
+        return false;
+    u64       time;
+    u8 const *data;
+    u32       size;
+    u64       n   = 0;
+    f64       lo  = 0.0;
+    f64       hi  = 0.0;
+    f64       sum = 0.0;
+    while (stream_iterator_next(m, it, time, data, size) && time <= time_end)
+    {
+        if (time < time_begin)
+            continue;
+        u32 value;
+        memcpy(&value, data, sizeof(value));
+        lo = (n == 0 || value < lo) ? value : lo;
+        hi = (n == 0 || value > hi) ? value : hi;
+        sum += (f64)value;
+        n += 1;
+    }
+    stream_iterator_end(m, it);
+    return n > 0 && stats.m_count == n && stats.m_min == lo && stats.m_max == hi && stats.m_sum == sum;
+}
+
+UNITTEST_SUITE_BEGIN(stream_manager)
+{
+    UNITTEST_FIXTURE(rotation)
+    {
+        UNITTEST_ALLOCATOR;
+
+        static char s_base_path[64];
+
+        UNITTEST_FIXTURE_SETUP() { test_temp_dir_create(s_base_path, sizeof(s_base_path), "stream_manager"); }
+        UNITTEST_FIXTURE_TEARDOWN() { test_temp_dir_remove(s_base_path); }
+
+        UNITTEST_TEST(swap_and_prepare_while_flush_in_flight)
+        {
+            // The mappings name the file of the stream that is registered below (hid 0)
+            const u16 lid     = 0x0102;
+            const u64 user_id = ((u64)lid << 16) | ((u64)nvalue::TypeU32 << 8);
+            char      mappings_path[96];
+            snprintf(mappings_path, sizeof(mappings_path), "%s/mappings.txt", s_base_path);
+            FILE *file = fopen(mappings_path, "wb");
+            fprintf(file, "%012llx=sensor\n", (unsigned long long)user_id);
+            fclose(file);
+
+            job_manager_t *jobs = create_job_manager(Allocator, 8, 1, 64);
+            jobs_done_hook(jobs, 8);
+            stream_manager_t         *m        = stream_manager_create(Allocator, 8, s_base_path);
+            stream_request_manager_t *requests = create_stream_request_manager(Allocator, jobs, 0.0, s_base_path, mappings_path);
+            stream_flush_config_t     config   = {0.0, 0};  // A flush on every update
+            stream_manager_set_request_manager(m, requests);
+            stream_manager_set_job_manager(m, jobs, config);
+
+            // The request manager reads the mappings after 10 seconds, then the file of the stream is created
+            const stream_id_t      id  = stream_manager_register_stream(m, 0, lid, nvalue::TypeU32, 0);
+            f64                    now = 11.0;
+            stream_manager_stats_t stats;
+            CHECK_TRUE(update_until(m, now, [&]() {
+                stream_manager_stats(m, stats);
+                return stats.m_staged_streams == 0;
+            }));
+
+            // Items a ms apart, an update prepares the successor (the stream has less than a day to go)
+            const u64 t0      = 1760000000000ull;
+            u32       written = write_items(m, id, t0, 0, 100000);
+            now += 11.0;
+            CHECK_TRUE(update_until(m, now, [&]() {
+                stream_manager_stats(m, stats);
+                return stats.m_flushes >= 1;
+            }));
+
+            // Setting the job manager again waits for the flush that may be in flight, the flush of the next update
+            // then waits behind the held worker
+            stream_manager_set_job_manager(m, jobs, config);
+            const job_channel_t hold_channel = init_channel(jobs, 2);
+            __atomic_store_n(&s_hold_worker, 1, __ATOMIC_RELEASE);
+            CHECK_EQUAL(0, push_job(jobs, hold_channel, hold_worker_fn, &s_hold_worker));
+            written += write_items(m, id, t0, written, 10);
+            stream_manager_update(m, now);
+
+            // Fill the stream, the writer swaps to the successor
+            while (stats.m_ro_mappings == 0 && written < 2000000)
+            {
+                written += write_items(m, id, t0, written, 1000);
+                stream_manager_stats(m, stats);
+            }
+            CHECK_EQUAL(1, (s32)stats.m_ro_mappings);
+            written += write_items(m, id, t0, written, 1000);
+
+            // The retired stream can not be archived yet, and the successor that is now written to must stay as it is
+            now += 11.0;
+            stream_manager_update(m, now);
+            written += write_items(m, id, t0, written, 1000);
+            CHECK_TRUE(check_items(m, id, t0, written));
+
+            // Once the flush is done the retired stream is archived
+            __atomic_store_n(&s_hold_worker, 0, __ATOMIC_RELEASE);
+            void *job_data0;
+            void *job_data1;
+            pop_job_wait(jobs, hold_channel, job_data0, job_data1);
+            char archived[128];
+            archive_path(archived, sizeof(archived), s_base_path, "sensor", t0);
+            CHECK_TRUE(update_until(m, now, [&]() { return access(archived, F_OK) == 0; }));
+
+            // Setting the job manager again waits for the archive job, the archived file was compressed
+            stream_manager_set_job_manager(m, jobs, config);
+            struct stat st;
+            CHECK_EQUAL(0, stat(archived, &st));
+            CHECK_TRUE(st.st_size < 4 * 1024 * 1024);
+            CHECK_TRUE(check_items(m, id, t0, written));
+
+            stream_manager_destroy(Allocator, m);
+            destroy_stream_request_manager(requests);
+            destroy_job_manager(jobs);
+
+            // A restart registers the archived file from the catalog that the archive job wrote
+            m = stream_manager_create(Allocator, 8, s_base_path);
+            CHECK_TRUE(check_items(m, stream_manager_register_stream(m, 0, lid, nvalue::TypeU32, 0), t0, written));
+            stream_manager_destroy(Allocator, m);
+        }
+    }
+
+    UNITTEST_FIXTURE(aggregate)
+    {
+        UNITTEST_ALLOCATOR;
+
+        static char s_base_path[64];
+
+        UNITTEST_FIXTURE_SETUP() { test_temp_dir_create(s_base_path, sizeof(s_base_path), "stream_manager"); }
+        UNITTEST_FIXTURE_TEARDOWN() { test_temp_dir_remove(s_base_path); }
+
+        // Row layout files, column pages and compressed blocks all go through the kernels, the result must be the
+        // same as for the values read one by one
+        UNITTEST_TEST(matches_iterator)
+        {
+            const u16   lid       = 0x0304;
+            const char *names[3]  = {"row", "column", "archived"};
+            const u16   layout[3] = {c_stream_layout_row, c_stream_layout_column, c_stream_layout_row};
+            char        mappings_path[96];
+            snprintf(mappings_path, sizeof(mappings_path), "%s/mappings.txt", s_base_path);
+            FILE *file = fopen(mappings_path, "wb");
+            for (u8 s = 0; s < 3; s++)
+                fprintf(file, "%012llx=%s\n", (unsigned long long)(((u64)lid << 16) | ((u64)nvalue::TypeU32 << 8) | s), names[s]);
+            fclose(file);
+
+            job_manager_t *jobs = create_job_manager(Allocator, 8, 1, 64);
+            jobs_done_hook(jobs, 8);
+            stream_manager_t         *m        = stream_manager_create(Allocator, 8, s_base_path);
+            stream_request_manager_t *requests = create_stream_request_manager(Allocator, jobs, 0.0, s_base_path, mappings_path);
+            stream_flush_config_t     config   = {5.0, 0};
+            stream_manager_set_request_manager(m, requests);
+            stream_manager_set_job_manager(m, jobs, config);
+
+            stream_id_t ids[3];
+            for (u8 s = 0; s < 3; s++)
+                ids[s] = stream_manager_register_stream(m, 0, lid, nvalue::TypeU32, s, layout[s]);
+            f64                    now = 11.0;
+            stream_manager_stats_t stats;
+            CHECK_TRUE(update_until(m, now, [&]() {
+                stream_manager_stats(m, stats);
+                return stats.m_staged_streams == 0;
+            }));
+
+            // The third stream swaps to its successor once its file is full, its full file is archived compressed
+            const u64 t0         = 1760000000000ull;
+            const u32 count      = 300000;
+            u32       written[3] = {0, 0, 0};
+            for (u8 s = 0; s < 3; s++)
+                written[s] = write_items(m, ids[s], t0, 0, 100000);
+            now += 11.0;
+            stream_manager_update(m, now);
+            for (u8 s = 0; s < 2; s++)
+                written[s] += write_items(m, ids[s], t0, written[s], count - written[s]);
+            while (stats.m_ro_mappings == 0 && written[2] < 1000000)
+            {
+                written[2] += write_items(m, ids[2], t0, written[2], 1000);
+                stream_manager_stats(m, stats);
+            }
+            CHECK_EQUAL(count, written[0]);
+            CHECK_EQUAL(count, written[1]);
+            CHECK_TRUE(written[2] > count);
+
+            char archived[128];
+            archive_path(archived, sizeof(archived), s_base_path, "archived", t0);
+            CHECK_TRUE(update_until(m, now, [&]() { return access(archived, F_OK) == 0; }));
+            stream_manager_set_job_manager(m, jobs, config);  // Waits for the archive job
+
+            // All items, and a range that starts and ends in the middle of a page and of a compressed block
+            for (u8 s = 0; s < 3; s++)
+            {
+                CHECK_TRUE(aggregate_matches_iterator(m, ids[s], t0, t0 + count - 1));
+                CHECK_TRUE(aggregate_matches_iterator(m, ids[s], t0 + 1234, t0 + count - 4321));
+            }
+
+            stream_manager_destroy(Allocator, m);
+            destroy_stream_request_manager(requests);
+            destroy_job_manager(jobs);
+        }
+    }
+}
+UNITTEST_SUITE_END
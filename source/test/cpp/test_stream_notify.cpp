@@ -0,0 +1,94 @@
+#include "ccore/c_target.h"
+#include "ccore/c_allocator.h"
+
+#include "cconartist/stream_notify.h"
+
+#include "cunittest/cunittest.h"
+#include "test_temp_dir.h"
+
+using namespace ncore;
+
+UNITTEST_SUITE_BEGIN(stream_notify)
+{
+    UNITTEST_FIXTURE(basic)
+    {
+        UNITTEST_ALLOCATOR;
+
+        static char s_base_path[64];
+
+        UNITTEST_FIXTURE_SETUP() { test_temp_dir_create(s_base_path, sizeof(s_base_path), "stream_notify"); }
+        UNITTEST_FIXTURE_TEARDOWN() { test_temp_dir_remove(s_base_path); }
+
+        UNITTEST_TEST(publish_and_wait)
+        {
+            CHECK_NULL(stream_notify_open(Allocator, s_base_path));
+
+            stream_notify_t *writer = stream_notify_create(Allocator, s_base_path);
+            CHECK_NOT_NULL(writer);
+            stream_notify_t *reader = stream_notify_open(Allocator, s_base_path);
+            CHECK_NOT_NULL(reader);
+
+            u64 item_count = 0, time_end = 0;
+            CHECK_FALSE(stream_notify_state(reader, 0xA1, item_count, time_end));
+
+            // Nothing published, the doorbell does not ring and a wait times out
+            const u32 generation = stream_notify_generation(reader);
+            stream_notify_ring(writer);
+            CHECK_EQUAL(generation, stream_notify_generation(reader));
+            CHECK_FALSE(stream_notify_wait(reader, generation, 10));
+
+            const u64 user_ids[2] = {0xA1, 0xB2};
+            u64       cursors[2]  = {0, 0};
+            CHECK_EQUAL(-1, stream_notify_wait_any(reader, user_ids, cursors, 2, 10));
+
+            // Several publishes, a single ring
+            stream_notify_publish(writer, 0, 0xA1, 10, 1000);
+            stream_notify_publish(writer, 1, 0xB2, 3, 2000);
+            stream_notify_publish(writer, 0, 0xA1, 12, 1200);
+            stream_notify_ring(writer);
+            CHECK_EQUAL(generation + 1, stream_notify_generation(reader));
+            CHECK_TRUE(stream_notify_wait(reader, generation, 10));
+
+            CHECK_TRUE(stream_notify_state(reader, 0xA1, item_count, time_end));
+            CHECK_EQUAL(12, (u32)item_count);
+            CHECK_EQUAL(1200, (u32)time_end);
+            CHECK_EQUAL(0, stream_notify_wait_any(reader, user_ids, cursors, 2, 10));
+            cursors[0] = 12;
+            CHECK_EQUAL(1, stream_notify_wait_any(reader, user_ids, cursors, 2, 10));
+            cursors[1] = 3;
+            CHECK_EQUAL(-1, stream_notify_wait_any(reader, user_ids, cursors, 2, 10));
+
+            // Publishing an unchanged count does not ring
+            stream_notify_publish(writer, 1, 0xB2, 3, 2000);
+            stream_notify_ring(writer);
+            CHECK_EQUAL(generation + 1, stream_notify_generation(reader));
+
+            // A new writer keeps the file, the reader stays connected
+            stream_notify_close(Allocator, writer);
+            writer = stream_notify_create(Allocator, s_base_path);
+            stream_notify_publish(writer, 0, 0xB2, 4, 2100);
+            stream_notify_ring(writer);
+            CHECK_EQUAL(1, stream_notify_wait_any(reader, user_ids, cursors, 2, 10));
+            CHECK_FALSE(stream_notify_state(reader, 0xA1, item_count, time_end));
+
+            // 0xB2 moves from slot 0 to slot 2, it is only found there
+            stream_notify_publish(writer, 1, 0xA1, 13, 1300);
+            stream_notify_publish(writer, 2, 0xB2, 5, 2200);
+            stream_notify_publish(writer, 0, 0xC3, 1, 3000);
+            stream_notify_ring(writer);
+            CHECK_TRUE(stream_notify_state(reader, 0xA1, item_count, time_end));
+            CHECK_EQUAL(13, (u32)item_count);
+            CHECK_TRUE(stream_notify_state(reader, 0xB2, item_count, time_end));
+            CHECK_EQUAL(5, (u32)item_count);
+            CHECK_EQUAL(2200, (u32)time_end);
+            stream_notify_publish(writer, 2, 0xB2, 6, 2300);
+            CHECK_TRUE(stream_notify_state(reader, 0xB2, item_count, time_end));
+            CHECK_EQUAL(6, (u32)item_count);
+
+            stream_notify_close(Allocator, reader);
+            stream_notify_close(Allocator, writer);
+            CHECK_NULL(writer);
+        }
+    }
+}
+UNITTEST_SUITE_END
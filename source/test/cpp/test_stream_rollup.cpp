@@ -0,0 +1,98 @@
+#include "ccore/c_target.h"
+#include "ccore/c_allocator.h"
+
+#include "cconartist/stream_rollup.h"
+
+#include "cunittest/cunittest.h"
+
+using namespace ncore;
+
+static const u64 c_minute = 60 * 1000;
+static const u64 c_hour   = 60 * c_minute;
+static const u64 c_day    = 24 * c_hour;
+
+UNITTEST_SUITE_BEGIN(stream_rollup)
+{
+    UNITTEST_FIXTURE(basic)
+    {
+        UNITTEST_ALLOCATOR;
+
+        UNITTEST_FIXTURE_SETUP() {}
+        UNITTEST_FIXTURE_TEARDOWN() {}
+
+        UNITTEST_TEST(tiers)
+        {
+            u8 *rollup = g_allocate_array<u8>(Allocator, (u32)stream_rollup_size());
+            stream_rollup_init(rollup);
+            CHECK_TRUE(stream_rollup_valid(rollup, stream_rollup_size()));
+            CHECK_FALSE(stream_rollup_valid(rollup, stream_rollup_size() - 1));
+
+            // A value every 10 seconds for two days, the value is the minute of the day
+            const u64 t0 = 20000 * c_day;
+            for (u64 t = t0; t < t0 + 2 * c_day; t += 10000)
+                stream_rollup_add(rollup, t, (f64)(((t - t0) % c_day) / c_minute));
+            CHECK_EQUAL(2 * 8640, (u32)stream_rollup_items(rollup));
+            CHECK_EQUAL(16384 * c_day, stream_rollup_span());
+            stream_rollup_skip(rollup, 5);  // Counted, the buckets below do not change
+            CHECK_EQUAL(2 * 8640 + 5, (u32)stream_rollup_items(rollup));
+
+            u64 width = 0;
+            CHECK_EQUAL(2, stream_rollup_tier(rollup, t0, c_day, width));
+            CHECK_EQUAL(c_day, width);
+            CHECK_EQUAL(1, stream_rollup_tier(rollup, t0, 6 * c_hour, width));
+            CHECK_EQUAL(c_hour, width);
+            CHECK_EQUAL(0, stream_rollup_tier(rollup, t0, 5 * c_minute, width));
+            CHECK_EQUAL(-1, stream_rollup_tier(rollup, t0, 10000, width));
+
+            stream_bucket_t buckets[64];
+            CHECK_EQUAL(2, stream_rollup_read(rollup, 2, t0, t0 + 2 * c_day - 1, buckets, 64));
+            CHECK_EQUAL(t0, buckets[0].m_time);
+            CHECK_EQUAL(8640, (u32)buckets[0].m_count);
+            CHECK_EQUAL(0.0, buckets[0].m_min);
+            CHECK_EQUAL(1439.0, buckets[0].m_max);
+            CHECK_EQUAL(719.5, buckets[0].m_mean);
+
+            // Whole buckets that overlap the range, at most the number asked for
+            CHECK_EQUAL(3, stream_rollup_read(rollup, 1, t0 + c_hour + 1, t0 + 3 * c_hour + 1, buckets, 64));
+            CHECK_EQUAL(t0 + c_hour, buckets[0].m_time);
+            CHECK_EQUAL(360, (u32)buckets[0].m_count);
+            CHECK_EQUAL(60.0, buckets[0].m_min);
+            CHECK_EQUAL(119.0, buckets[0].m_max);
+            CHECK_EQUAL(2, stream_rollup_read(rollup, 0, t0, t0 + c_hour, buckets, 2));
+            CHECK_EQUAL(t0 + c_minute, buckets[1].m_time);
+            CHECK_EQUAL(6, (u32)buckets[1].m_count);
+
+            g_deallocate_array<u8>(Allocator, rollup);
+        }
+
+        UNITTEST_TEST(ring)
+        {
+            u8 *rollup = g_allocate_array<u8>(Allocator, (u32)stream_rollup_size());
+            stream_rollup_init(rollup);
+
+            // A value every hour for 60 days, the minute tier only holds the most recent weeks
+            const u64 t0 = 20000 * c_day;
+            for (u64 t = t0; t < t0 + 60 * c_day; t += c_hour)
+                stream_rollup_add(rollup, t, 1.0);
+
+            u64 width = 0;
+            CHECK_EQUAL(-1, stream_rollup_tier(rollup, t0, c_minute, width));
+            CHECK_EQUAL(1, stream_rollup_tier(rollup, t0, c_hour, width));
+            CHECK_EQUAL(0, stream_rollup_tier(rollup, t0 + 59 * c_day, c_minute, width));
+
+            stream_bucket_t buckets[64];
+            CHECK_EQUAL(0, stream_rollup_read(rollup, 0, t0, t0 + c_day - 1, buckets, 64));
+            CHECK_EQUAL(24, stream_rollup_read(rollup, 0, t0 + 59 * c_day, t0 + 60 * c_day, buckets, 64));
+
+            // A value older than the ring is not counted in the minute tier, but in the others
+            stream_rollup_add(rollup, t0 + 30, 5.0);
+            CHECK_EQUAL(0, stream_rollup_read(rollup, 0, t0, t0 + c_day - 1, buckets, 64));
+            CHECK_EQUAL(1, stream_rollup_read(rollup, 2, t0, t0 + c_day - 1, buckets, 64));
+            CHECK_EQUAL(25, (u32)buckets[0].m_count);
+            CHECK_EQUAL(5.0, buckets[0].m_max);
+
+            g_deallocate_array<u8>(Allocator, rollup);
+        }
+    }
+}
+UNITTEST_SUITE_END
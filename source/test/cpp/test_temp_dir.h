@@ -0,0 +1,26 @@
+#ifndef __CCONARTIST_TEST_TEMP_DIR_H__
+#define __CCONARTIST_TEST_TEMP_DIR_H__
+
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// A fresh directory under /tmp for the files of a test fixture, 'prefix' starts its name
+inline bool test_temp_dir_create(char *path, int path_size, const char *prefix)
+{
+    snprintf(path, path_size, "/tmp/%s_XXXXXX", prefix);
+    return mkdtemp(path) != nullptr;
+}
+
+inline int test_temp_dir_remove_entry(const char *path, const struct stat *st, int type, struct FTW *ftw)
+{
+    (void)st;
+    (void)type;
+    (void)ftw;
+    return remove(path);
+}
+
+// Removes the directory and everything in it, children before their directory, without following links
+inline bool test_temp_dir_remove(const char *path) { return nftw(path, test_temp_dir_remove_entry, 16, FTW_DEPTH | FTW_PHYS) == 0; }
+
+#endif
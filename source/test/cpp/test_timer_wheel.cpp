@@ -0,0 +1,189 @@
+#include "ccore/c_target.h"
+#include "ccore/c_allocator.h"
+
+#include "cconartist/timer_wheel.h"
+
+#include "cunittest/cunittest.h"
+
+using namespace ncore;
+
+struct fired_t
+{
+    u64 m_ticks[8];
+    u32 m_count;
+};
+
+struct test_timer_t
+{
+    timer_node_t   m_node;
+    timer_wheel_t *m_wheel;
+    fired_t       *m_fired;
+    u64            m_now;
+    u64            m_interval;
+};
+
+static void on_timer(timer_node_t *timer, void *user)
+{
+    test_timer_t *t = (test_timer_t *)user;
+    if (t->m_fired->m_count < 8)
+        t->m_fired->m_ticks[t->m_fired->m_count] = t->m_now;
+    t->m_fired->m_count += 1;
+    if (t->m_interval > 0)
+        timer_schedule(t->m_wheel, timer, timer->m_expires + t->m_interval);
+}
+
+static void init_test_timer(test_timer_t &t, timer_wheel_t *wheel, fired_t *fired, u64 interval)
+{
+    timer_init(&t.m_node, on_timer, &t);
+    t.m_wheel    = wheel;
+    t.m_fired    = fired;
+    t.m_now      = 0;
+    t.m_interval = interval;
+}
+
+// Advance one ms at a time so that the tick a timer fired on is known exactly
+static void advance_to(timer_wheel_t *wheel, test_timer_t &t, u64 from, u64 to)
+{
+    for (u64 now = from; now <= to; ++now)
+    {
+        t.m_now = now;
+        timer_wheel_advance(wheel, now);
+    }
+}
+
+UNITTEST_SUITE_BEGIN(timer_wheel)
+{
+    UNITTEST_FIXTURE(basic)
+    {
+        UNITTEST_ALLOCATOR;
+
+        UNITTEST_FIXTURE_SETUP() {}
+        UNITTEST_FIXTURE_TEARDOWN() {}
+
+        UNITTEST_TEST(create_destroy)
+        {
+            timer_wheel_t *wheel = timer_wheel_create(Allocator, 1000);
+            CHECK_NOT_NULL(wheel);
+            CHECK_EQUAL(0xFFFFFFFFFFFFFFFFull, timer_wheel_next(wheel));
+            timer_wheel_destroy(wheel);
+            CHECK_NULL(wheel);
+        }
+
+        UNITTEST_TEST(fire_once)
+        {
+            timer_wheel_t *wheel = timer_wheel_create(Allocator, 1000);
+            fired_t        fired = {};
+            test_timer_t   t;
+            init_test_timer(t, wheel, &fired, 0);
+
+            timer_schedule(wheel, &t.m_node, 1000 + 5000);  // Crosses a level 1 block
+            CHECK_TRUE(timer_pending(&t.m_node));
+            advance_to(wheel, t, 1000, 7000);
+            CHECK_EQUAL((u32)1, fired.m_count);
+            CHECK_EQUAL((u64)6000, fired.m_ticks[0]);
+            CHECK_FALSE(timer_pending(&t.m_node));
+
+            timer_wheel_destroy(wheel);
+        }
+
+        UNITTEST_TEST(cancel)
+        {
+            timer_wheel_t *wheel = timer_wheel_create(Allocator, 0);
+            fired_t        fired = {};
+            test_timer_t   t;
+            init_test_timer(t, wheel, &fired, 0);
+
+            timer_schedule(wheel, &t.m_node, 100);
+            timer_cancel(wheel, &t.m_node);
+            CHECK_FALSE(timer_pending(&t.m_node));
+            timer_wheel_advance(wheel, 1000);
+            CHECK_EQUAL((u32)0, fired.m_count);
+
+            timer_wheel_destroy(wheel);
+        }
+
+        UNITTEST_TEST(periodic)
+        {
+            timer_wheel_t *wheel = timer_wheel_create(Allocator, 0);
+            fired_t        fired = {};
+            test_timer_t   t;
+            init_test_timer(t, wheel, &fired, 250);
+
+            timer_schedule(wheel, &t.m_node, 250);
+            advance_to(wheel, t, 0, 1000);
+            CHECK_EQUAL((u32)4, fired.m_count);
+            CHECK_EQUAL((u64)250, fired.m_ticks[0]);
+            CHECK_EQUAL((u64)500, fired.m_ticks[1]);
+            CHECK_EQUAL((u64)750, fired.m_ticks[2]);
+            CHECK_EQUAL((u64)1000, fired.m_ticks[3]);
+
+            timer_cancel(wheel, &t.m_node);
+            timer_wheel_destroy(wheel);
+        }
+
+        UNITTEST_TEST(large_step)
+        {
+            // The loop may sleep far longer than a tick, every timer that is due fires in one advance
+            timer_wheel_t *wheel = timer_wheel_create(Allocator, 0);
+            fired_t        fired = {};
+            test_timer_t   a, b;
+            init_test_timer(a, wheel, &fired, 0);
+            init_test_timer(b, wheel, &fired, 0);
+
+            timer_schedule(wheel, &a.m_node, 70);
+            timer_schedule(wheel, &b.m_node, 300000);
+            CHECK_EQUAL((u32)1, timer_wheel_advance(wheel, 200000));
+            CHECK_TRUE(timer_wheel_next(wheel) <= 300000);
+            CHECK_EQUAL((u32)1, timer_wheel_advance(wheel, 300000));
+            CHECK_EQUAL((u32)2, fired.m_count);
+
+            timer_wheel_destroy(wheel);
+        }
+
+        UNITTEST_TEST(next_wakeups)
+        {
+            // A loop that sleeps until timer_wheel_next wakes a few times for a timer an hour out, not every block
+            timer_wheel_t *wheel = timer_wheel_create(Allocator, 5);
+            fired_t        fired = {};
+            test_timer_t   t;
+            init_test_timer(t, wheel, &fired, 0);
+
+            u64 const expires = 3600ull * 1000 + 123;
+            timer_schedule(wheel, &t.m_node, expires);
+            u32 wakeups = 0;
+            while (fired.m_count == 0 && wakeups < 16)
+            {
+                u64 const next = timer_wheel_next(wheel);
+                CHECK_TRUE(next <= expires);
+                t.m_now = next;
+                timer_wheel_advance(wheel, next);
+                wakeups += 1;
+            }
+            CHECK_EQUAL((u32)1, fired.m_count);
+            CHECK_EQUAL(expires, fired.m_ticks[0]);
+            CHECK_TRUE(wakeups <= 4);
+
+            // Exact within the current block
+            timer_schedule(wheel, &t.m_node, expires + 3);
+            CHECK_EQUAL(expires + 3, timer_wheel_next(wheel));
+            timer_wheel_destroy(wheel);
+        }
+
+        UNITTEST_TEST(overflow)
+        {
+            // Beyond the reach of level 3 (about 4.6 hours)
+            timer_wheel_t *wheel = timer_wheel_create(Allocator, 0);
+            fired_t        fired = {};
+            test_timer_t   t;
+            init_test_timer(t, wheel, &fired, 0);
+
+            u64 const expires = 10ull * 3600 * 1000;
+            timer_schedule(wheel, &t.m_node, expires);
+            CHECK_EQUAL((u32)0, timer_wheel_advance(wheel, expires - 1));
+            CHECK_EQUAL((u32)1, timer_wheel_advance(wheel, expires));
+
+            timer_wheel_destroy(wheel);
+        }
+    }
+}
+UNITTEST_SUITE_END